@@ -50,6 +50,7 @@ static inline u32 apb_readl(unsigned long offset)
 		return readl(IO_TO_VIRT(offset));
 
 	mutex_lock(&tegra_apb_dma_lock);
+	memset(&req, 0, sizeof(req));
 	req.complete = apb_dma_complete;
 	req.to_memory = 1;
 	req.dest_addr = tegra_apb_bb_phys;
@@ -87,6 +88,7 @@ static inline void apb_writel(u32 value, unsigned long offset)
 
 	mutex_lock(&tegra_apb_dma_lock);
 	*((u32 *)tegra_apb_bb) = value;
+	memset(&req, 0, sizeof(req));
 	req.complete = apb_dma_complete;
 	req.to_memory = 0;
 	req.dest_addr = offset;
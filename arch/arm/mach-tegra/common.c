@@ -36,6 +36,7 @@
 #include "apbio.h"
 #include "board.h"
 #include "clock.h"
+#include "devices.h"
 #include "fuse.h"
 #include "power.h"
 
@@ -165,6 +166,10 @@ int __init tegra_init_postcore(void)
 {
 	tegra_dma_init();
 	tegra_init_apb_dma();
+#ifdef CONFIG_TEGRA_SYSTEM_DMA
+	/* for the dmaengine driver, on every board */
+	platform_device_register(&tegra_apb_dma_device);
+#endif
 
 	return 0;
 }
@@ -835,6 +835,12 @@ static struct resource tegra_avp_resources[] = {
 		.flags	= IORESOURCE_IRQ,
 		.name	= "mbox_from_avp_pending",
 	},
+	[1] = {
+		.start	= INT_SHR_SEM_OUTBOX_IBE,
+		.end	= INT_SHR_SEM_OUTBOX_IBE,
+		.flags	= IORESOURCE_IRQ,
+		.name	= "mbox_to_avp_read",
+	},
 };
 
 struct platform_device tegra_avp_device = {
@@ -868,6 +874,11 @@ struct platform_device tegra_aes_device = {
 	},
 };
 
+struct platform_device tegra_apb_dma_device = {
+	.name		= "tegra-apbdma",
+	.id		= -1,
+};
+
 struct platform_device tegra_pcm_device = {
         .name = "tegra-pcm-audio",
         .id = -1,
@@ -28,6 +28,8 @@
 #include <linux/irq.h>
 #include <linux/delay.h>
 #include <linux/clk.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
 #include <mach/dma.h>
 #include <mach/irqs.h>
 #include <mach/iomap.h>
@@ -110,6 +112,13 @@ const unsigned int apb_addr_wrap_table[8] = {0, 1, 2, 4, 8, 16, 32, 64};
 
 const unsigned int bus_width_table[5] = {8, 16, 32, 64, 128};
 
+/* one hardware program of a scatterlist request */
+struct tegra_dma_seg {
+	u32			ahb_ptr;
+	u32			wcount;
+	unsigned int		size;
+};
+
 #define TEGRA_DMA_NAME_SIZE 16
 struct tegra_dma_channel {
 	struct list_head	list;
@@ -136,6 +145,15 @@ static void tegra_dma_update_hw(struct tegra_dma_channel *ch,
 static void tegra_dma_update_hw_partial(struct tegra_dma_channel *ch,
 	struct tegra_dma_req *req);
 static void tegra_dma_stop(struct tegra_dma_channel *ch);
+static void tegra_dma_cyclic_queue_next(struct tegra_dma_channel *ch,
+	struct tegra_dma_req *req);
+
+static void tegra_dma_free_chain(struct tegra_dma_req *req)
+{
+	kfree(req->segs);
+	req->segs = NULL;
+	req->num_segs = 0;
+}
 
 void tegra_dma_flush(struct tegra_dma_channel *ch)
 {
@@ -182,8 +200,12 @@ int tegra_dma_cancel(struct tegra_dma_channel *ch)
 	unsigned long irq_flags;
 
 	spin_lock_irqsave(&ch->lock, irq_flags);
-	while (!list_empty(&ch->list))
-		list_del(ch->list.next);
+	while (!list_empty(&ch->list)) {
+		struct tegra_dma_req *req = list_first_entry(&ch->list,
+			typeof(*req), node);
+		list_del(&req->node);
+		tegra_dma_free_chain(req);
+	}
 
 	tegra_dma_stop(ch);
 
@@ -191,6 +213,18 @@ int tegra_dma_cancel(struct tegra_dma_channel *ch)
 	return 0;
 }
 
+/* Waits for the channel's interrupt handler, and so for a complete or
+ * threshold callback it has already taken a request off the queue for, to
+ * finish. tegra_dma_cancel() doesn't, so requests it took away may still
+ * be in use until this returns. Sleeps, and must not be called from the
+ * callbacks.
+ */
+void tegra_dma_sync(struct tegra_dma_channel *ch)
+{
+	synchronize_irq(ch->irq);
+}
+EXPORT_SYMBOL(tegra_dma_sync);
+
 /* should be called with the channel lock held */
 static unsigned int dma_active_count(struct tegra_dma_channel *ch,
 	struct tegra_dma_req *req, unsigned int status)
@@ -272,7 +306,8 @@ int tegra_dma_dequeue_req(struct tegra_dma_channel *ch,
 	writel(GEN_ENABLE, addr + APB_DMA_GEN);
 	spin_unlock(&enable_lock);
 
-	req->bytes_transferred = dma_active_count(ch, req, status);
+	req->bytes_transferred = req->seg_bytes_done +
+		dma_active_count(ch, req, status);
 
 	if (!list_empty(&ch->list)) {
 		/* if the list is not empty, queue the next request */
@@ -283,6 +318,7 @@ int tegra_dma_dequeue_req(struct tegra_dma_channel *ch,
 	}
 skip_status:
 	req->status = -TEGRA_DMA_REQ_ERROR_ABORTED;
+	tegra_dma_free_chain(req);
 
 	spin_unlock_irqrestore(&ch->lock, irq_flags);
 
@@ -292,6 +328,31 @@ skip_status:
 }
 EXPORT_SYMBOL(tegra_dma_dequeue_req);
 
+/* Bytes done so far by req, which must be the request in flight, or
+ * -ENOENT if it isn't. In cyclic mode this counts from the start of the
+ * current round, and runs past req->size for as long as the hardware has
+ * gone round (or on to the next request) without the interrupt having
+ * been handled yet, so the position in the buffer is the count modulo the
+ * size.
+ */
+int tegra_dma_get_transfer_count(struct tegra_dma_channel *ch,
+	struct tegra_dma_req *req)
+{
+	unsigned long irq_flags;
+	unsigned int status;
+	int bytes = -ENOENT;
+
+	spin_lock_irqsave(&ch->lock, irq_flags);
+	if (!list_empty(&ch->list) &&
+		list_first_entry(&ch->list, typeof(*req), node) == req) {
+		status = readl(ch->addr + APB_DMA_CHAN_STA);
+		bytes = req->seg_bytes_done + dma_active_count(ch, req, status);
+	}
+	spin_unlock_irqrestore(&ch->lock, irq_flags);
+	return bytes;
+}
+EXPORT_SYMBOL(tegra_dma_get_transfer_count);
+
 bool tegra_dma_is_empty(struct tegra_dma_channel *ch)
 {
 	unsigned long irq_flags;
@@ -325,6 +386,59 @@ bool tegra_dma_is_req_inflight(struct tegra_dma_channel *ch,
 }
 EXPORT_SYMBOL(tegra_dma_is_req_inflight);
 
+/* Turns the scatterlist of req into hardware programs up front, so the
+ * ISR only has to write them out. should be called with the channel lock
+ * held */
+static int tegra_dma_build_chain(struct tegra_dma_channel *ch,
+	struct tegra_dma_req *req)
+{
+	struct scatterlist *sg;
+	struct tegra_dma_seg *seg;
+	unsigned int num_segs = 0;
+	unsigned int total = 0;
+	int i;
+
+	if (!(ch->mode & TEGRA_DMA_MODE_ONESHOT))
+		return -EINVAL;
+
+	for_each_sg(req->sg, sg, req->sg_len, i) {
+		if (!sg_dma_len(sg) || sg_dma_len(sg) & 0x3 ||
+		    sg_dma_address(sg) & 0x3)
+			return -EINVAL;
+		num_segs += DIV_ROUND_UP(sg_dma_len(sg),
+			TEGRA_DMA_MAX_TRANSFER_SIZE);
+	}
+	if (!num_segs)
+		return -EINVAL;
+
+	seg = kmalloc(num_segs * sizeof(*seg), GFP_ATOMIC);
+	if (!seg)
+		return -ENOMEM;
+	req->segs = seg;
+	req->num_segs = num_segs;
+
+	for_each_sg(req->sg, sg, req->sg_len, i) {
+		dma_addr_t addr = sg_dma_address(sg);
+		unsigned int len = sg_dma_len(sg);
+
+		while (len) {
+			unsigned int n = min_t(unsigned int, len,
+				TEGRA_DMA_MAX_TRANSFER_SIZE);
+
+			seg->ahb_ptr = addr;
+			seg->wcount = (n >> 2) - 1;
+			seg->size = n;
+			seg++;
+
+			addr += n;
+			len -= n;
+			total += n;
+		}
+	}
+	req->size = total;
+	return 0;
+}
+
 int tegra_dma_enqueue_req(struct tegra_dma_channel *ch,
 	struct tegra_dma_req *req)
 {
@@ -332,7 +446,7 @@ int tegra_dma_enqueue_req(struct tegra_dma_channel *ch,
 	struct tegra_dma_req *_req;
 	int start_dma = 0;
 
-	if (req->size > TEGRA_DMA_MAX_TRANSFER_SIZE ||
+	if ((!req->sg && req->size > TEGRA_DMA_MAX_TRANSFER_SIZE) ||
 		req->source_addr & 0x3 || req->dest_addr & 0x3) {
 		pr_err("Invalid DMA request for channel %d\n", ch->id);
 		return -EINVAL;
@@ -347,6 +461,19 @@ int tegra_dma_enqueue_req(struct tegra_dma_channel *ch,
 		}
 	}
 
+	req->segs = NULL;
+	req->cur_seg = 0;
+	req->seg_bytes_done = 0;
+	if (req->sg) {
+		int ret = tegra_dma_build_chain(ch, req);
+		if (ret) {
+			spin_unlock_irqrestore(&ch->lock, irq_flags);
+			pr_err("Invalid DMA scatterlist for channel %d\n",
+				ch->id);
+			return ret;
+		}
+	}
+
 	req->bytes_transferred = 0;
 	req->status = 0;
 	/* STATUS_EMPTY just means the DMA hasn't processed the buf yet. */
@@ -386,6 +513,18 @@ int tegra_dma_enqueue_req(struct tegra_dma_channel *ch,
 			}
 		}
 	}
+	/* In cyclic mode the hardware latches the next buffer when it goes
+	 * round, so the one after the buffer in flight can be written out
+	 * right away, unless the interrupt is about to take care of it.
+	 */
+	else if (ch->mode & TEGRA_DMA_MODE_CYCLIC) {
+		struct tegra_dma_req *first_req;
+		first_req = list_entry(ch->list.next,
+					typeof(*first_req), node);
+		if (first_req->node.next == &req->node &&
+			!(readl(ch->addr + APB_DMA_CHAN_STA) & STA_ISE_EOC))
+			tegra_dma_cyclic_queue_next(ch, req);
+	}
 
 	spin_unlock_irqrestore(&ch->lock, irq_flags);
 
@@ -414,6 +553,9 @@ struct tegra_dma_channel *tegra_dma_allocate_channel(int mode)
 	}
 	__set_bit(channel, channel_usage);
 	ch = &dma_channels[channel];
+	/* cyclic transfers interrupt at each half of the buffer */
+	if (mode & TEGRA_DMA_MODE_CYCLIC)
+		mode |= TEGRA_DMA_MODE_CONTINUOUS_DOUBLE;
 	ch->mode = mode;
 
 out:
@@ -463,6 +605,18 @@ static void tegra_dma_update_hw_partial(struct tegra_dma_channel *ch,
 	return;
 }
 
+/* APB address the current segment of a scatterlist request starts at: a
+ * FIFO (wrapping) APB side stays put, a linear one moves along with the
+ * memory side.
+ */
+static u32 tegra_dma_seg_apb_ptr(struct tegra_dma_req *req)
+{
+	if (req->to_memory)
+		return req->source_addr +
+			(req->source_wrap ? 0 : req->seg_bytes_done);
+	return req->dest_addr + (req->dest_wrap ? 0 : req->seg_bytes_done);
+}
+
 static void tegra_dma_update_hw(struct tegra_dma_channel *ch,
 	struct tegra_dma_req *req)
 {
@@ -484,7 +638,10 @@ static void tegra_dma_update_hw(struct tegra_dma_channel *ch,
 
 	csr |= req->req_sel << CSR_REQ_SEL_SHIFT;
 
-	ch->req_transfer_count = (req->size >> 2) - 1;
+	if (req->segs)
+		ch->req_transfer_count = req->segs[req->cur_seg].wcount;
+	else
+		ch->req_transfer_count = (req->size >> 2) - 1;
 
 	/* One shot mode is always single buffered.  Continuous mode could
 	 * support either.
@@ -521,6 +678,11 @@ static void tegra_dma_update_hw(struct tegra_dma_channel *ch,
 		ahb_bus_width = req->source_bus_width;
 	}
 
+	if (req->segs) {
+		apb_ptr = tegra_dma_seg_apb_ptr(req);
+		ahb_ptr = req->segs[req->cur_seg].ahb_ptr;
+	}
+
 	apb_addr_wrap >>= 2;
 	ahb_addr_wrap >>= 2;
 
@@ -570,6 +732,29 @@ static void tegra_dma_update_hw(struct tegra_dma_channel *ch,
 	req->status = TEGRA_DMA_REQ_INFLIGHT;
 }
 
+/* Starts the next segment of a scatterlist request from the interrupt of
+ * the one before. Everything but the addresses and the word count stays
+ * as tegra_dma_update_hw() left it.
+ */
+static void tegra_dma_update_hw_seg(struct tegra_dma_channel *ch,
+	struct tegra_dma_req *req)
+{
+	struct tegra_dma_seg *seg = &req->segs[req->cur_seg];
+	u32 csr;
+
+	ch->req_transfer_count = seg->wcount;
+
+	csr = readl(ch->addr + APB_DMA_CHAN_CSR);
+	csr &= ~(CSR_WCOUNT_MASK | CSR_ENB);
+	csr |= seg->wcount << CSR_WCOUNT_SHIFT;
+	writel(csr, ch->addr + APB_DMA_CHAN_CSR);
+	writel(tegra_dma_seg_apb_ptr(req), ch->addr + APB_DMA_CHAN_APB_PTR);
+	writel(seg->ahb_ptr, ch->addr + APB_DMA_CHAN_AHB_PTR);
+
+	csr |= CSR_ENB;
+	writel(csr, ch->addr + APB_DMA_CHAN_CSR);
+}
+
 static void handle_oneshot_dma(struct tegra_dma_channel *ch)
 {
 	struct tegra_dma_req *req;
@@ -582,8 +767,18 @@ static void handle_oneshot_dma(struct tegra_dma_channel *ch)
 	}
 
 	req = list_entry(ch->list.next, typeof(*req), node);
+	if (req && req->segs && req->cur_seg + 1 < req->num_segs) {
+		/* the client only hears about the whole list */
+		req->seg_bytes_done += req->segs[req->cur_seg].size;
+		req->cur_seg++;
+		tegra_dma_update_hw_seg(ch, req);
+		spin_unlock_irqrestore(&ch->lock, irq_flags);
+		return;
+	}
+
 	if (req) {
 		list_del(&req->node);
+		tegra_dma_free_chain(req);
 		req->bytes_transferred = req->size;
 		req->status = TEGRA_DMA_REQ_SUCCESS;
 
@@ -697,6 +892,82 @@ static void handle_continuous_dbl_dma(struct tegra_dma_channel *ch)
 	spin_unlock_irqrestore(&ch->lock, irq_flags);
 }
 
+/* Writes out the buffer to go to once the one in flight is done, keeping
+ * the word count of the one in flight for its transfer count.
+ */
+static void tegra_dma_cyclic_queue_next(struct tegra_dma_channel *ch,
+	struct tegra_dma_req *req)
+{
+	int req_transfer_count = ch->req_transfer_count;
+
+	tegra_dma_update_hw_partial(ch, req);
+	ch->req_transfer_count = req_transfer_count;
+}
+
+/* The buffer in flight is gone round again by the hardware until another
+ * request is queued behind it, so nothing needs to be done for it here
+ * but to keep track of which half it is in.
+ */
+static void handle_cyclic_dma(struct tegra_dma_channel *ch)
+{
+	struct tegra_dma_req *req;
+	struct tegra_dma_req *next_req = NULL;
+	unsigned long irq_flags;
+	bool is_dma_ping_complete;
+
+	spin_lock_irqsave(&ch->lock, irq_flags);
+	if (list_empty(&ch->list)) {
+		spin_unlock_irqrestore(&ch->lock, irq_flags);
+		return;
+	}
+
+	req = list_entry(ch->list.next, typeof(*req), node);
+	if (!list_is_last(&req->node, &ch->list))
+		next_req = list_entry(req->node.next, typeof(*next_req), node);
+
+	is_dma_ping_complete = (readl(ch->addr + APB_DMA_CHAN_STA)
+				& STA_PING_PONG) ? true : false;
+	if (req->to_memory)
+		is_dma_ping_complete = !is_dma_ping_complete;
+
+	if (is_dma_ping_complete) {
+		req->buffer_status = TEGRA_DMA_REQ_BUF_STATUS_HALF_FULL;
+		if (next_req && next_req->status != TEGRA_DMA_REQ_INFLIGHT)
+			tegra_dma_cyclic_queue_next(ch, next_req);
+		/* DMA lock is NOT held when callback is called */
+		spin_unlock_irqrestore(&ch->lock, irq_flags);
+		if (req->threshold)
+			req->threshold(req);
+		return;
+	}
+
+	if (!next_req) {
+		req->buffer_status = TEGRA_DMA_REQ_BUF_STATUS_EMPTY;
+		spin_unlock_irqrestore(&ch->lock, irq_flags);
+		if (req->threshold)
+			req->threshold(req);
+		return;
+	}
+
+	if (next_req->status != TEGRA_DMA_REQ_INFLIGHT) {
+		/* the half way interrupt was missed, and the hardware has
+		 * started over on req */
+		tegra_dma_stop(ch);
+		tegra_dma_update_hw(ch, next_req);
+	} else {
+		ch->req_transfer_count = (next_req->size >> 3) - 1;
+	}
+
+	req->buffer_status = TEGRA_DMA_REQ_BUF_STATUS_FULL;
+	req->bytes_transferred = req->size;
+	req->status = TEGRA_DMA_REQ_SUCCESS;
+	list_del(&req->node);
+
+	/* DMA lock is NOT held when callback is called */
+	spin_unlock_irqrestore(&ch->lock, irq_flags);
+	req->complete(req);
+}
+
 static void handle_continuous_sngl_dma(struct tegra_dma_channel *ch)
 {
 	struct tegra_dma_req *req;
@@ -763,6 +1034,8 @@ static irqreturn_t dma_isr(int irq, void *data)
 
 	if (ch->mode & TEGRA_DMA_MODE_ONESHOT)
 		handle_oneshot_dma(ch);
+	else if (ch->mode & TEGRA_DMA_MODE_CYCLIC)
+		handle_cyclic_dma(ch);
 	else if (ch->mode & TEGRA_DMA_MODE_CONTINUOUS_DOUBLE)
 		handle_continuous_dbl_dma(ch);
 	else if (ch->mode & TEGRA_DMA_MODE_CONTINUOUS_SINGLE)
@@ -27,6 +27,8 @@
 
 struct tegra_dma_req;
 struct tegra_dma_channel;
+struct tegra_dma_seg;
+struct scatterlist;
 
 #define TEGRA_DMA_REQ_SEL_CNTR			0
 #define TEGRA_DMA_REQ_SEL_I2S_2			1
@@ -64,6 +66,13 @@ enum tegra_dma_mode {
 	TEGRA_DMA_MODE_CONTINUOUS_DOUBLE = TEGRA_DMA_MODE_CONTINUOUS,
 	TEGRA_DMA_MODE_CONTINUOUS_SINGLE = 4,
 	TEGRA_DMA_MODE_ONESHOT = 8,
+	/* Continuous double buffered, where the last request queued is
+	 * gone round again by the hardware until it is dequeued or another
+	 * one is queued behind it. threshold is called on every half of the
+	 * buffer and complete only once the next request has taken over.
+	 * Buffers must be a multiple of 8 bytes.
+	 */
+	TEGRA_DMA_MODE_CYCLIC = 16,
 };
 
 enum tegra_dma_req_error {
@@ -127,6 +136,18 @@ struct tegra_dma_req {
 	unsigned long req_sel;
 	unsigned int size;
 
+	/* Memory side of the transfer as a scatterlist already mapped with
+	 * dma_map_sg(), in place of dest_addr (to_memory) or source_addr and
+	 * size. Segments must be word aligned, and are split at
+	 * TEGRA_DMA_MAX_TRANSFER_SIZE. The DMA ISR moves on to the next
+	 * segment by itself, and complete is called once, after the last one.
+	 * size is set to the total length. The APB side is a FIFO when its
+	 * wrap is set, and otherwise advances with the segments. Only for
+	 * TEGRA_DMA_MODE_ONESHOT channels.
+	 */
+	struct scatterlist *sg;
+	unsigned int sg_len;
+
 	/* Updated by the DMA driver on the conpletion of the request. */
 	int bytes_transferred;
 	int status;
@@ -136,6 +157,22 @@ struct tegra_dma_req {
 
 	/* Client specific data */
 	void *dev;
+
+	/* Private to the DMA driver: the hardware programs built from sg */
+	struct tegra_dma_seg *segs;
+	unsigned int num_segs;
+	unsigned int cur_seg;
+	unsigned int seg_bytes_done;
+};
+
+/* Passed as dma_chan->private by the filter function of dmaengine
+ * clients. mode is the mode of the APB DMA channel claimed for the
+ * dmaengine channel: TEGRA_DMA_MODE_ONESHOT (or 0) for slave_sg
+ * transfers, TEGRA_DMA_MODE_CONTINUOUS_SINGLE for cyclic ones.
+ */
+struct tegra_dma_slave {
+	unsigned long req_sel;
+	int mode;
 };
 
 int tegra_dma_enqueue_req(struct tegra_dma_channel *ch,
@@ -147,12 +184,15 @@ void tegra_dma_flush(struct tegra_dma_channel *ch);
 
 bool tegra_dma_is_req_inflight(struct tegra_dma_channel *ch,
 	struct tegra_dma_req *req);
+int tegra_dma_get_transfer_count(struct tegra_dma_channel *ch,
+	struct tegra_dma_req *req);
 bool tegra_dma_is_empty(struct tegra_dma_channel *ch);
 bool tegra_dma_is_stopped(struct tegra_dma_channel *ch);
 
 struct tegra_dma_channel *tegra_dma_allocate_channel(int mode);
 void tegra_dma_free_channel(struct tegra_dma_channel *ch);
 int tegra_dma_cancel(struct tegra_dma_channel *ch);
+void tegra_dma_sync(struct tegra_dma_channel *ch);
 
 int __init tegra_dma_init(void);
 
@@ -34,8 +34,18 @@ typedef u32 tegra_iovmm_addr_t;
 #error "Unsupported tegra architecture family"
 #endif
 
+struct page;
 struct tegra_iovmm_device_ops;
 
+/* accumulated latency of a device's map or unmap operations, reported in
+ * /proc/iovmminfo */
+struct tegra_iovmm_stat {
+	unsigned long			count;
+	unsigned long			pages;
+	u64				total_ns;
+	u64				max_ns;
+};
+
 /* each I/O virtual memory manager unit should register a device with
  * the iovmm system
  */
@@ -44,12 +54,17 @@ struct tegra_iovmm_device {
 	const char			*name;
 	struct list_head		list;
 	int				pgsize_bits;
+	spinlock_t			stat_lock;
+	struct tegra_iovmm_stat		map_stat;
+	struct tegra_iovmm_stat		unmap_stat;
 };
 
 /* tegra_iovmm_domain serves a purpose analagous to mm_struct as defined in
  * <linux/mm_types.h> - it defines a virtual address space within which
  * tegra_iovmm_areas can be created.
  */
+#define TEGRA_IOVMM_ALLOC_HIST	12 /* bucket i counts allocations < 2^i us */
+
 struct tegra_iovmm_domain {
 	atomic_t		clients;
 	atomic_t		locks;
@@ -60,6 +75,8 @@ struct tegra_iovmm_domain {
 	struct rb_root		all_blocks;  /* ordered by address */
 	struct rb_root		free_blocks; /* ordered by size */
 	struct tegra_iovmm_device *dev;
+	/* block allocation latency, protected by block_lock */
+	unsigned long		alloc_hist[TEGRA_IOVMM_ALLOC_HIST];
 };
 
 /* tegra_iovmm_client is analagous to an individual task in the task group
@@ -99,6 +116,11 @@ struct tegra_iovmm_device_ops {
 	void (*map_pfn)(struct tegra_iovmm_device *dev,
 		struct tegra_iovmm_area *io_vma,
 		tegra_iovmm_addr_t offs, unsigned long pfn);
+	/* maps count consecutive pages starting at offs; optional, devices
+	 * which don't provide it are programmed one map_pfn at a time */
+	void (*map_pages)(struct tegra_iovmm_device *dev,
+		struct tegra_iovmm_area *io_vma, tegra_iovmm_addr_t offs,
+		struct page **pages, unsigned long count);
 	/* ensures that a domain is resident in the hardware's mapping region
 	 * so that it may be used by a client */
 	int (*lock_domain)(struct tegra_iovmm_device *dev,
@@ -172,6 +194,11 @@ void tegra_iovmm_free_vm(struct tegra_iovmm_area *vm);
 void tegra_iovmm_vm_insert_pfn(struct tegra_iovmm_area *area,
 	tegra_iovmm_addr_t vaddr, unsigned long pfn);
 
+/* like tegra_iovmm_vm_insert_pfn, but maps count pages to consecutive
+ * I/O addresses starting at vaddr in a single device operation */
+void tegra_iovmm_vm_insert_pages(struct tegra_iovmm_area *area,
+	tegra_iovmm_addr_t vaddr, struct page **pages, unsigned long count);
+
 /* called by clients to return the iovmm_area containing addr, or NULL if
  * addr has not been allocated. caller should call tegra_iovmm_put_area when
  * finished using the returned pointer */
@@ -243,6 +270,9 @@ static inline void tegra_iovmm_free_vm(struct tegra_iovmm_area *vm) { }
 static inline void tegra_iovmm_vm_insert_pfn(struct tegra_iovmm_area *area,
 	tegra_iovmm_addr_t vaddr, unsigned long pfn) { }
 
+static inline void tegra_iovmm_vm_insert_pages(struct tegra_iovmm_area *area,
+	tegra_iovmm_addr_t vaddr, struct page **pages, unsigned long count) { }
+
 static inline struct tegra_iovmm_area *tegra_iovmm_find_area_get(
 	struct tegra_iovmm_client *client, tegra_iovmm_addr_t addr)
 {
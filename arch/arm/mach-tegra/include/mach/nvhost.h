@@ -96,6 +96,33 @@ struct nvhost_reloc {
 	__u32 target_offset;
 };
 
+struct nvhost_waitchk {
+	__u32 syncpt_id;
+	__u32 thresh;
+};
+
+/* one job of a multi-job submit; its cmdbufs, relocs and wait checks are
+ * taken in order from the flat arrays in nvhost_submit_args */
+struct nvhost_submit_job {
+	__u32 syncpt_id;
+	__u32 syncpt_incrs;
+	__u32 num_cmdbufs;
+	__u32 num_relocs;
+	__u32 num_waitchks;
+};
+
+#define NVHOST_SUBMIT_FLAG_NULL_KICKOFF	(1 << 0)
+
+struct nvhost_submit_args {
+	__u32 num_jobs;
+	__u32 flags;
+	struct nvhost_submit_job *jobs;
+	struct nvhost_cmdbuf *cmdbufs;
+	struct nvhost_reloc *relocs;
+	struct nvhost_waitchk *waitchks;
+	__u32 *fences;
+};
+
 struct nvhost_get_param_args {
 	__u32 value;
 };
@@ -104,6 +131,16 @@ struct nvhost_set_nvmap_fd_args {
 	__u32 fd;
 };
 
+/* submits of higher priority clients get the channel first; clients
+ * start out at NVHOST_PRIORITY_MEDIUM */
+#define NVHOST_PRIORITY_LOW	0
+#define NVHOST_PRIORITY_MEDIUM	1
+#define NVHOST_PRIORITY_HIGH	2	/* needs CAP_SYS_NICE */
+
+struct nvhost_set_priority_args {
+	__u32 priority;
+};
+
 #define NVHOST_IOCTL_CHANNEL_FLUSH		\
 	_IOR(NVHOST_IOCTL_MAGIC, 1, struct nvhost_get_param_args)
 #define NVHOST_IOCTL_CHANNEL_GET_SYNCPOINTS	\
@@ -116,9 +153,13 @@ struct nvhost_set_nvmap_fd_args {
 	_IOW(NVHOST_IOCTL_MAGIC, 5, struct nvhost_set_nvmap_fd_args)
 #define NVHOST_IOCTL_CHANNEL_NULL_KICKOFF	\
 	_IOR(NVHOST_IOCTL_MAGIC, 6, struct nvhost_get_param_args)
+#define NVHOST_IOCTL_CHANNEL_SUBMIT		\
+	_IOW(NVHOST_IOCTL_MAGIC, 7, struct nvhost_submit_args)
+#define NVHOST_IOCTL_CHANNEL_SET_PRIORITY	\
+	_IOW(NVHOST_IOCTL_MAGIC, 8, struct nvhost_set_priority_args)
 #define NVHOST_IOCTL_CHANNEL_LAST		\
-	_IOC_NR(NVHOST_IOCTL_CHANNEL_NULL_KICKOFF)
-#define NVHOST_IOCTL_CHANNEL_MAX_ARG_SIZE sizeof(struct nvhost_get_param_args)
+	_IOC_NR(NVHOST_IOCTL_CHANNEL_SET_PRIORITY)
+#define NVHOST_IOCTL_CHANNEL_MAX_ARG_SIZE sizeof(struct nvhost_submit_args)
 
 struct nvhost_ctrl_syncpt_read_args {
 	__u32 id;
@@ -135,6 +176,18 @@ struct nvhost_ctrl_syncpt_wait_args {
 	__s32 timeout;
 };
 
+struct nvhost_ctrl_syncpt_fence_args {
+	__u32 id;
+	__u32 thresh;
+	__s32 fd;
+};
+
+struct nvhost_ctrl_fence_merge_args {
+	__s32 fd1;
+	__s32 fd2;
+	__s32 fd;
+};
+
 struct nvhost_ctrl_module_mutex_args {
 	__u32 id;
 	__u32 lock;
@@ -161,8 +214,13 @@ struct nvhost_ctrl_module_regrdwr_args {
 #define NVHOST_IOCTL_CTRL_MODULE_REGRDWR	\
 	_IOWR(NVHOST_IOCTL_MAGIC, 5, struct nvhost_ctrl_module_regrdwr_args)
 
+#define NVHOST_IOCTL_CTRL_SYNCPT_FENCE		\
+	_IOWR(NVHOST_IOCTL_MAGIC, 6, struct nvhost_ctrl_syncpt_fence_args)
+#define NVHOST_IOCTL_CTRL_FENCE_MERGE		\
+	_IOWR(NVHOST_IOCTL_MAGIC, 7, struct nvhost_ctrl_fence_merge_args)
+
 #define NVHOST_IOCTL_CTRL_LAST			\
-	_IOC_NR(NVHOST_IOCTL_CTRL_MODULE_REGRDWR)
+	_IOC_NR(NVHOST_IOCTL_CTRL_FENCE_MERGE)
 #define NVHOST_IOCTL_CTRL_MAX_ARG_SIZE sizeof(struct nvhost_ctrl_module_regrdwr_args)
 
 #endif
@@ -48,6 +48,7 @@
 #define NVMAP_HANDLE_CACHE_FLAG      (0x3ul << 0)
 
 #define NVMAP_HANDLE_SECURE          (0x1ul << 2)
+#define NVMAP_HANDLE_STICKY          (0x1ul << 3)
 
 
 #if defined(__KERNEL__)
@@ -36,6 +36,7 @@ void tegra_dc_ext_enable(struct tegra_dc_ext *dc_ext);
 void tegra_dc_ext_disable(struct tegra_dc_ext *dc_ext);
 
 int tegra_dc_ext_process_hotplug(int output);
+int tegra_dc_ext_process_vblank(int output, u32 count, u64 timestamp_ns);
 
 #else /* CONFIG_TEGRA_DC_EXTENSIONS */
 
@@ -72,6 +73,11 @@ int tegra_dc_ext_process_hotplug(int output)
 {
 	return 0;
 }
+static inline
+int tegra_dc_ext_process_vblank(int output, u32 count, u64 timestamp_ns)
+{
+	return 0;
+}
 #endif /* CONFIG_TEGRA_DC_EXTENSIONS */
 
 #endif /* __MACH_TEGRA_DC_EXT_H */
@@ -44,9 +44,12 @@
 #define GART_PAGE_SHIFT (12)
 #define GART_PAGE_MASK (~((1<<GART_PAGE_SHIFT)-1))
 
+/* maximum number of entries programmed per hold of pte_lock */
+#define GART_BATCH (64)
+
 struct gart_device {
 	void __iomem		*regs;
-	u32			*savedata;
+	u32			*savedata; /* shadow copy of all GART entries */
 	u32			page_count; /* total remappable size */
 	tegra_iovmm_addr_t	iovmm_base; /* offset to apply to vmm_area */
 	spinlock_t		pte_lock;
@@ -61,6 +64,9 @@ static void gart_unmap(struct tegra_iovmm_device *,
 	struct tegra_iovmm_area *, bool);
 static void gart_map_pfn(struct tegra_iovmm_device *,
 	struct tegra_iovmm_area *, tegra_iovmm_addr_t, unsigned long);
+static void gart_map_pages(struct tegra_iovmm_device *,
+	struct tegra_iovmm_area *, tegra_iovmm_addr_t, struct page **,
+	unsigned long);
 static struct tegra_iovmm_domain *gart_alloc_domain(
 	struct tegra_iovmm_device *, struct tegra_iovmm_client *);
 
@@ -74,6 +80,7 @@ static struct tegra_iovmm_device_ops tegra_iovmm_gart_ops = {
 	.map		= gart_map,
 	.unmap		= gart_unmap,
 	.map_pfn	= gart_map_pfn,
+	.map_pages	= gart_map_pages,
 	.alloc_domain	= gart_alloc_domain,
 	.suspend	= gart_suspend,
 	.resume		= gart_resume,
@@ -87,30 +94,42 @@ static struct platform_driver tegra_iovmm_gart_drv = {
 	},
 };
 
+/* every entry written to the GART is also recorded in the shadow table,
+ * so that the hardware never needs to be read back to save its state.
+ * must be called with pte_lock held. */
+static inline void gart_set_pte(struct gart_device *gart,
+	tegra_iovmm_addr_t offs, u32 pte)
+{
+	writel(offs, gart->regs + GART_ENTRY_ADDR);
+	writel(pte, gart->regs + GART_ENTRY_DATA);
+	gart->savedata[(offs - gart->iovmm_base) >> GART_PAGE_SHIFT] = pte;
+}
+
+/* entry writes are posted; rather than a barrier per entry, a single
+ * barrier and a read back after a run of writes ensures that the whole
+ * run has reached the GART before any client can use the mapping */
+static inline void gart_flush_ptes(struct gart_device *gart)
+{
+	wmb();
+	readl(gart->regs + GART_ENTRY_DATA);
+}
+
 static int gart_suspend(struct tegra_iovmm_device *dev)
 {
 	struct gart_device *gart = container_of(dev, struct gart_device, iovmm);
-	unsigned int i;
-	unsigned long reg;
 
 	if (!gart)
 		return -ENODEV;
 
-	if (!gart->enable)
-		return 0;
-
-	spin_lock(&gart->pte_lock);
-	reg = gart->iovmm_base;
-	for (i=0; i<gart->page_count; i++) {
-		writel(reg, gart->regs + GART_ENTRY_ADDR);
-		gart->savedata[i] = readl(gart->regs + GART_ENTRY_DATA);
-		dmb();
-		reg += 1 << GART_PAGE_SHIFT;
-	}
-	spin_unlock(&gart->pte_lock);
+	/* the shadow table already holds the state of every entry */
 	return 0;
 }
 
+/* enables the GART and loads its entries. if data is NULL every entry is
+ * invalidated; otherwise only the runs of valid entries in data are
+ * replayed, since the remaining entries are already invalid (either
+ * because they were cleared at probe time, or because the memory
+ * controller was reset across suspend). */
 static void do_gart_setup(struct gart_device *gart, const u32 *data)
 {
 	unsigned long reg;
@@ -120,12 +139,14 @@ static void do_gart_setup(struct gart_device *gart, const u32 *data)
 
 	reg = gart->iovmm_base;
 	for (i=0; i<gart->page_count; i++) {
-		writel(reg, gart->regs + GART_ENTRY_ADDR);
-		writel((data) ? data[i] : 0, gart->regs + GART_ENTRY_DATA);
-		wmb();
+		if (!data || data[i]) {
+			writel(reg, gart->regs + GART_ENTRY_ADDR);
+			writel((data) ? data[i] : 0,
+				gart->regs + GART_ENTRY_DATA);
+		}
 		reg += 1 << GART_PAGE_SHIFT;
 	}
-	wmb();
+	gart_flush_ptes(gart);
 }
 
 static void gart_resume(struct tegra_iovmm_device *dev)
@@ -227,6 +248,8 @@ static int gart_probe(struct platform_device *pdev)
 		goto fail;
 	}
 
+	memset(gart->savedata, 0, sizeof(u32)*gart->page_count);
+
 	spin_lock(&gart->pte_lock);
 
 	do_gart_setup(gart, NULL);
@@ -262,42 +285,46 @@ static int gart_map(struct tegra_iovmm_device *dev,
 	struct tegra_iovmm_area *iovma)
 {
 	struct gart_device *gart = container_of(dev, struct gart_device, iovmm);
+	unsigned long pfn[GART_BATCH];
 	unsigned long gart_page, count;
-	unsigned int i;
+	unsigned int i, j, n;
 
 	gart_page = iovma->iovm_start;
 	count = iovma->iovm_length >> GART_PAGE_SHIFT;
 
-	for (i=0; i<count; i++) {
-		unsigned long pfn;
+	/* make a batch of pages resident outside of the lock, then program
+	 * the whole run of entries with a single hold of pte_lock */
+	for (i=0; i<count; i+=n) {
+		n = min_t(unsigned long, count - i, GART_BATCH);
 
-		pfn = iovma->ops->lock_makeresident(iovma, i<<PAGE_SHIFT);
-		if (!pfn_valid(pfn))
-			goto fail;
+		for (j=0; j<n; j++) {
+			pfn[j] = iovma->ops->lock_makeresident(iovma,
+				(i+j)<<PAGE_SHIFT);
+			if (!pfn_valid(pfn[j]))
+				goto fail;
+		}
 
 		spin_lock(&gart->pte_lock);
-
-		writel(gart_page, gart->regs + GART_ENTRY_ADDR);
-		writel(GART_PTE(pfn), gart->regs + GART_ENTRY_DATA);
-		wmb();
-		gart_page += 1 << GART_PAGE_SHIFT;
-
+		for (j=0; j<n; j++) {
+			gart_set_pte(gart, gart_page, GART_PTE(pfn[j]));
+			gart_page += 1 << GART_PAGE_SHIFT;
+		}
 		spin_unlock(&gart->pte_lock);
 	}
-	wmb();
+	gart_flush_ptes(gart);
 	return 0;
 
 fail:
+	i += j;
+	gart_page = iovma->iovm_start;
 	spin_lock(&gart->pte_lock);
-	while (i--) {
-		iovma->ops->release(iovma, i<<PAGE_SHIFT);
-		gart_page -= 1 << GART_PAGE_SHIFT;
-		writel(gart_page, gart->regs + GART_ENTRY_ADDR);
-		writel(0, gart->regs + GART_ENTRY_DATA);
-		wmb();
+	for (j=0; j<i; j++) {
+		iovma->ops->release(iovma, j<<PAGE_SHIFT);
+		gart_set_pte(gart, gart_page, 0);
+		gart_page += 1 << GART_PAGE_SHIFT;
 	}
 	spin_unlock(&gart->pte_lock);
-	wmb();
+	gart_flush_ptes(gart);
 	return -ENOMEM;
 }
 
@@ -316,13 +343,11 @@ static void gart_unmap(struct tegra_iovmm_device *dev,
 		if (iovma->ops && iovma->ops->release)
 			iovma->ops->release(iovma, i<<PAGE_SHIFT);
 
-		writel(gart_page, gart->regs + GART_ENTRY_ADDR);
-		writel(0, gart->regs + GART_ENTRY_DATA);
-		wmb();
+		gart_set_pte(gart, gart_page, 0);
 		gart_page += 1 << GART_PAGE_SHIFT;
 	}
 	spin_unlock(&gart->pte_lock);
-	wmb();
+	gart_flush_ptes(gart);
 }
 
 static void gart_map_pfn(struct tegra_iovmm_device *dev,
@@ -333,11 +358,35 @@ static void gart_map_pfn(struct tegra_iovmm_device *dev,
 
 	BUG_ON(!pfn_valid(pfn));
 	spin_lock(&gart->pte_lock);
-	writel(offs, gart->regs + GART_ENTRY_ADDR);
-	writel(GART_PTE(pfn), gart->regs + GART_ENTRY_DATA);
-	wmb();
+	gart_set_pte(gart, offs, GART_PTE(pfn));
 	spin_unlock(&gart->pte_lock);
-	wmb();
+	gart_flush_ptes(gart);
+}
+
+static void gart_map_pages(struct tegra_iovmm_device *dev,
+	struct tegra_iovmm_area *iovma, tegra_iovmm_addr_t offs,
+	struct page **pages, unsigned long count)
+{
+	struct gart_device *gart = container_of(dev, struct gart_device, iovmm);
+	unsigned long i, n;
+
+	while (count) {
+		n = min_t(unsigned long, count, GART_BATCH);
+
+		spin_lock(&gart->pte_lock);
+		for (i=0; i<n; i++) {
+			unsigned long pfn = page_to_pfn(pages[i]);
+
+			BUG_ON(!pfn_valid(pfn));
+			gart_set_pte(gart, offs, GART_PTE(pfn));
+			offs += 1 << GART_PAGE_SHIFT;
+		}
+		spin_unlock(&gart->pte_lock);
+
+		pages += n;
+		count -= n;
+	}
+	gart_flush_ptes(gart);
 }
 
 static struct tegra_iovmm_domain *gart_alloc_domain(
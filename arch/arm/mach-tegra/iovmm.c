@@ -21,6 +21,9 @@
  */
 
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
 #include <linux/spinlock.h>
 #include <linux/proc_fs.h>
 #include <linux/sched.h>
@@ -121,16 +124,97 @@ static void tegra_iovmm_block_stats(struct tegra_iovmm_domain *domain,
 	spin_unlock(&domain->block_lock);
 }
 
+static void iovmm_stat_account(struct tegra_iovmm_device *dev,
+	struct tegra_iovmm_stat *stat, ktime_t start, unsigned long pages)
+{
+	u64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	unsigned long flags;
+
+	spin_lock_irqsave(&dev->stat_lock, flags);
+	stat->count++;
+	stat->pages += pages;
+	stat->total_ns += ns;
+	stat->max_ns = max(stat->max_ns, ns);
+	spin_unlock_irqrestore(&dev->stat_lock, flags);
+}
+
+static int iovmm_dev_map(struct tegra_iovmm_device *dev,
+	struct tegra_iovmm_area *area)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = dev->ops->map(dev, area);
+	iovmm_stat_account(dev, &dev->map_stat, start,
+		area->iovm_length >> dev->pgsize_bits);
+	return ret;
+}
+
+static void iovmm_dev_unmap(struct tegra_iovmm_device *dev,
+	struct tegra_iovmm_area *area, bool decommit)
+{
+	ktime_t start = ktime_get();
+
+	dev->ops->unmap(dev, area, decommit);
+	iovmm_stat_account(dev, &dev->unmap_stat, start,
+		area->iovm_length >> dev->pgsize_bits);
+}
+
+static int iovmm_stat_print(char *page, int len, int count, const char *op,
+	const struct tegra_iovmm_stat *stat)
+{
+	u64 avg = (stat->count) ? div_u64(stat->total_ns, stat->count) : 0;
+
+	return iovmprint("\t\t%s: %lu calls, %lu pages, avg %lluns, "
+		"max %lluns\n", op, stat->count, stat->pages,
+		(unsigned long long)avg, (unsigned long long)stat->max_ns);
+}
+
+static int tegra_iovmm_alloc_hist_print(struct tegra_iovmm_domain *domain,
+	char *page, int len, int count)
+{
+	unsigned long hist[TEGRA_IOVMM_ALLOC_HIST];
+	int start = len;
+	int i;
+
+	spin_lock(&domain->block_lock);
+	memcpy(hist, domain->alloc_hist, sizeof(hist));
+	spin_unlock(&domain->block_lock);
+
+	len += iovmprint("\t\talloc latency:");
+	for (i=0; i<TEGRA_IOVMM_ALLOC_HIST-1; i++)
+		len += iovmprint(" <%uus:%lu", 1u<<i, hist[i]);
+	len += iovmprint(" >=%uus:%lu\n", 1u<<(i-1), hist[i]);
+
+	return len - start;
+}
+
 static int tegra_iovmm_read_proc(char *page, char **start, off_t off,
 	int count, int *eof, void *data)
 {
 	struct iovmm_share_group *grp;
+	struct tegra_iovmm_device *dev;
 	tegra_iovmm_addr_t max_free, total_free, total;
 	unsigned int num, num_free;
 
 	int len = 0;
 
 	mutex_lock(&iovmm_list_lock);
+	len += iovmprint("\ndevices\n");
+	list_for_each_entry(dev, &iovmm_devices, list) {
+		struct tegra_iovmm_stat map_stat, unmap_stat;
+		unsigned long flags;
+
+		spin_lock_irqsave(&dev->stat_lock, flags);
+		map_stat = dev->map_stat;
+		unmap_stat = dev->unmap_stat;
+		spin_unlock_irqrestore(&dev->stat_lock, flags);
+
+		len += iovmprint("\t%s\n", dev->name);
+		len += iovmm_stat_print(page, len, count, "map", &map_stat);
+		len += iovmm_stat_print(page, len, count, "unmap", &unmap_stat);
+	}
+
 	len += iovmprint("\ngroups\n");
 	if (list_empty(&iovmm_groups))
 		len += iovmprint("\t<empty>\n");
@@ -147,6 +231,8 @@ static int tegra_iovmm_read_proc(char *page, char **start, off_t off,
 			len += iovmprint("\t\tsize: %uKiB free: %uKiB "
 				"largest: %uKiB (%u free / %u total blocks)\n",
 				total, total_free, max_free, num_free, num);
+			len += tegra_iovmm_alloc_hist_print(grp->domain,
+				page, len, count);
 		}
 	}
 	mutex_unlock(&iovmm_list_lock);
@@ -226,22 +312,18 @@ static void iovmm_free_block(struct tegra_iovmm_domain *domain,
 	spin_unlock(&domain->block_lock);
 }
 
-/* if the best-fit block is larger than the requested size, a remainder
- * block will be created and inserted into the free list in its place.
- * since all free blocks are stored in two trees the new block needs to be
- * linked into both. */
+/* if the best-fit block is larger than the requested size, the remainder
+ * block rem will be inserted into the free list in its place. since all
+ * free blocks are stored in two trees the new block needs to be linked
+ * into both. must be called with block_lock held. */
 static void iovmm_split_free_block(struct tegra_iovmm_domain *domain,
-	struct tegra_iovmm_block *block, unsigned long size)
+	struct tegra_iovmm_block *block, struct tegra_iovmm_block *rem,
+	unsigned long size)
 {
 	struct rb_node **p;
 	struct rb_node *parent = NULL;
-	struct tegra_iovmm_block *rem;
 	struct tegra_iovmm_block *b;
 
-	rem = kmem_cache_zalloc(iovmm_cache, GFP_KERNEL);
-	if (!rem) return;
-
-	spin_lock(&domain->block_lock);
 	p = &domain->free_blocks.rb_node;
 
 	iovmm_start(rem) = iovmm_start(block) + size;
@@ -275,22 +357,35 @@ static void iovmm_split_free_block(struct tegra_iovmm_domain *domain,
 	rb_insert_color(&rem->all_node, &domain->all_blocks);
 }
 
+/* must be called with block_lock held */
+static void iovmm_alloc_account(struct tegra_iovmm_domain *domain,
+	ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	unsigned int bucket = fls((us > 0) ? (unsigned long)us : 0);
+
+	bucket = min_t(unsigned int, bucket, TEGRA_IOVMM_ALLOC_HIST-1);
+	domain->alloc_hist[bucket]++;
+}
+
 static struct tegra_iovmm_block *iovmm_alloc_block(
 	struct tegra_iovmm_domain *domain, unsigned long size)
 {
 	struct rb_node *n;
-	struct tegra_iovmm_block *b, *best;
-        static int splitting = 0;
+	struct tegra_iovmm_block *b, *best, *rem;
+	ktime_t start = ktime_get();
 
 	BUG_ON(!size);
 	size = iovmm_align_up(domain->dev, size);
-        for (;;) {
-		spin_lock(&domain->block_lock);
-		if (!splitting)
-			break;
-		spin_unlock(&domain->block_lock);
-		schedule();
-	}
+
+	/* the remainder block for a split is allocated before the search,
+	 * so that the search and the split are both performed under
+	 * block_lock and concurrent allocators never wait on each other
+	 * for anything longer than the tree operations. if it can't be
+	 * allocated, the best-fit block is simply not split. */
+	rem = kmem_cache_zalloc(iovmm_cache, GFP_KERNEL);
+
+	spin_lock(&domain->block_lock);
 	n = domain->free_blocks.rb_node;
 	best = NULL;
 	while (n) {
@@ -305,21 +400,26 @@ static struct tegra_iovmm_block *iovmm_alloc_block(
 		}
 	}
 	if (!best) {
+		iovmm_alloc_account(domain, start);
 		spin_unlock(&domain->block_lock);
+		if (rem)
+			kmem_cache_free(iovmm_cache, rem);
 		return NULL;
 	}
 	rb_erase(&best->free_node, &domain->free_blocks);
 	clear_bit(BK_free, &best->flags);
 	atomic_inc(&best->ref);
-	if (iovmm_length(best) >= size+MIN_SPLIT_BYTES(domain)) {
-		splitting = 1;
-		spin_unlock(&domain->block_lock);
-		iovmm_split_free_block(domain, best, size);
-		splitting = 0;
+	if (rem && iovmm_length(best) >= size+MIN_SPLIT_BYTES(domain)) {
+		iovmm_split_free_block(domain, best, rem, size);
+		rem = NULL;
 	}
 
+	iovmm_alloc_account(domain, start);
 	spin_unlock(&domain->block_lock);
 
+	if (rem)
+		kmem_cache_free(iovmm_cache, rem);
+
 	return best;
 }
 
@@ -333,6 +433,7 @@ int tegra_iovmm_domain_init(struct tegra_iovmm_domain *domain,
 	if (!b) return -ENOMEM;
 
 	domain->dev = dev;
+	memset(domain->alloc_hist, 0, sizeof(domain->alloc_hist));
 	atomic_set(&domain->clients, 0);
 	atomic_set(&domain->locks, 0);
 	atomic_set(&b->ref, 1);
@@ -372,7 +473,7 @@ struct tegra_iovmm_area *tegra_iovmm_create_vm(
 		set_bit(BK_map_dirty, &b->flags);
 		set_bit(DM_map_dirty, &client->domain->flags);
 	} else if (ops) {
-		if (dev->ops->map(dev, &b->vm_area))
+		if (iovmm_dev_map(dev, &b->vm_area))
 			pr_err("%s failed to map locked domain\n", __func__);
 	}
 	up_read(&b->vm_area.domain->map_lock);
@@ -384,12 +485,42 @@ void tegra_iovmm_vm_insert_pfn(struct tegra_iovmm_area *area,
 	tegra_iovmm_addr_t vaddr, unsigned long pfn)
 {
 	struct tegra_iovmm_device *dev = area->domain->dev;
+	ktime_t start;
+
 	BUG_ON(vaddr & ((1<<dev->pgsize_bits)-1));
 	BUG_ON(vaddr >= area->iovm_start + area->iovm_length);
 	BUG_ON(vaddr < area->iovm_start);
 	BUG_ON(area->ops);
 
+	start = ktime_get();
 	dev->ops->map_pfn(dev, area, vaddr, pfn);
+	iovmm_stat_account(dev, &dev->map_stat, start, 1);
+}
+
+void tegra_iovmm_vm_insert_pages(struct tegra_iovmm_area *area,
+	tegra_iovmm_addr_t vaddr, struct page **pages, unsigned long count)
+{
+	struct tegra_iovmm_device *dev = area->domain->dev;
+	ktime_t start;
+	unsigned long i;
+
+	BUG_ON(vaddr & ((1<<dev->pgsize_bits)-1));
+	BUG_ON(vaddr < area->iovm_start);
+	BUG_ON(vaddr + (count << dev->pgsize_bits) >
+		area->iovm_start + area->iovm_length);
+	BUG_ON(area->ops);
+
+	start = ktime_get();
+	if (dev->ops->map_pages) {
+		dev->ops->map_pages(dev, area, vaddr, pages, count);
+	} else {
+		for (i=0; i<count; i++) {
+			dev->ops->map_pfn(dev, area, vaddr,
+				page_to_pfn(pages[i]));
+			vaddr += 1 << dev->pgsize_bits;
+		}
+	}
+	iovmm_stat_account(dev, &dev->map_stat, start, count);
 }
 
 void tegra_iovmm_zap_vm(struct tegra_iovmm_area *vm)
@@ -403,7 +534,7 @@ void tegra_iovmm_zap_vm(struct tegra_iovmm_area *vm)
 	 * the memory for the page tables it uses may not be allocated */
 	down_read(&vm->domain->map_lock);
 	if (!test_and_clear_bit(BK_map_dirty, &b->flags))
-		dev->ops->unmap(dev, vm, false);
+		iovmm_dev_unmap(dev, vm, false);
 	up_read(&vm->domain->map_lock);
 }
 
@@ -419,7 +550,7 @@ void tegra_iovmm_unzap_vm(struct tegra_iovmm_area *vm)
 	down_read(&vm->domain->map_lock);
 	if (vm->ops) {
 		if (atomic_read(&vm->domain->locks))
-			dev->ops->map(dev, vm);
+			iovmm_dev_map(dev, vm);
 		else {
 			set_bit(BK_map_dirty, &b->flags);
 			set_bit(DM_map_dirty, &vm->domain->flags);
@@ -441,7 +572,7 @@ void tegra_iovmm_free_vm(struct tegra_iovmm_area *vm)
 	dev = vm->domain->dev;
 	down_read(&domain->map_lock);
 	if (!test_and_clear_bit(BK_map_dirty, &b->flags))
-		dev->ops->unmap(dev, vm, true);
+		iovmm_dev_unmap(dev, vm, true);
 	iovmm_free_block(domain, b);
 	up_read(&domain->map_lock);
 }
@@ -536,7 +667,7 @@ static int _iovmm_client_lock(struct tegra_iovmm_client *client)
 					pr_err("%s: vm_area ops must exist for lazy maps\n", __func__);
 					continue;
 				}
-				dev->ops->map(dev, &b->vm_area);
+				iovmm_dev_map(dev, &b->vm_area);
 			}
 		}
 	}
@@ -712,6 +843,9 @@ fail:
 int tegra_iovmm_register(struct tegra_iovmm_device *dev)
 {
 	BUG_ON(!dev);
+	spin_lock_init(&dev->stat_lock);
+	memset(&dev->map_stat, 0, sizeof(dev->map_stat));
+	memset(&dev->unmap_stat, 0, sizeof(dev->unmap_stat));
 	mutex_lock(&iovmm_list_lock);
 	if (list_empty(&iovmm_devices)) {
 		iovmm_cache = KMEM_CACHE(tegra_iovmm_block, 0);
@@ -37,13 +37,14 @@
 #include <mach/arb_sema.h>
 #include <mach/clk.h>
 
+#include <crypto/algapi.h>
 #include <crypto/scatterwalk.h>
 #include <crypto/aes.h>
 #include <crypto/internal/rng.h>
 
 #include "tegra-aes.h"
 
-#define FLAGS_MODE_MASK		0x000f
+#define FLAGS_MODE_MASK		0x060f
 #define FLAGS_ENCRYPT		BIT(0)
 #define FLAGS_CBC		BIT(1)
 #define FLAGS_GIV		BIT(2)
@@ -53,6 +54,8 @@
 #define FLAGS_INIT		BIT(6)
 #define FLAGS_FAST		BIT(7)
 #define FLAGS_BUSY		8
+#define FLAGS_XTS		BIT(9)
+#define FLAGS_CTR		BIT(10)
 
 /*
  * Defines AES engine Max process bytes size in one go, which takes 1 msec.
@@ -63,6 +66,13 @@
  */
 #define AES_HW_DMA_BUFFER_SIZE_BYTES 0x4000
 
+/*
+ * Number of queued requests run in one go while holding the hardware.
+ * With dm-crypt sized requests of 4KB or less, this keeps the BSE within
+ * the 1 msec above before it is handed back to the AVP.
+ */
+#define AES_HW_MAX_BATCH 4
+
 /*
  * The key table length is 64 bytes
  * (This includes first upto 32 bytes key + 16 bytes original initial vector
@@ -142,6 +152,7 @@ static struct tegra_aes_slot ssk = {
 
 struct tegra_aes_reqctx {
 	unsigned long mode;
+	int err;
 };
 
 #define TEGRA_AES_QUEUE_LENGTH 50
@@ -169,12 +180,8 @@ struct tegra_aes_dev {
 	spinlock_t lock;
 	struct crypto_queue queue;
 	struct tegra_aes_slot *slots;
+	unsigned long keys_loaded;	/* slots whose key is in the engine */
 	struct ablkcipher_request *req;
-	size_t total;
-	struct scatterlist *in_sg;
-	size_t in_offset;
-	struct scatterlist *out_sg;
-	size_t out_offset;
 };
 
 static struct tegra_aes_dev *aes_dev;
@@ -183,7 +190,9 @@ struct tegra_aes_ctx {
 	struct tegra_aes_dev *dd;
 	unsigned long flags;
 	struct tegra_aes_slot *slot;
+	u8 key[AES_MAX_KEY_SIZE];
 	int keylen;
+	struct crypto_cipher *tweak_tfm;	/* xts only */
 };
 
 static struct tegra_aes_ctx rng_ctx = {
@@ -340,11 +349,11 @@ static int aes_start_crypt(struct tegra_aes_dev *dd, u32 in_addr, u32 out_addr,
 	return 0;
 }
 
-static void aes_release_key_slot(struct tegra_aes_dev *dd)
+static void aes_release_key_slot(struct tegra_aes_ctx *ctx)
 {
 	spin_lock(&list_lock);
-	dd->ctx->slot->available = true;
-	dd->ctx->slot = NULL;
+	ctx->slot->available = true;
+	ctx->slot = NULL;
 	spin_unlock(&list_lock);
 }
 
@@ -405,6 +414,14 @@ static int aes_set_key(struct tegra_aes_dev *dd)
 	if (use_ssk)
 		goto out;
 
+	/* the key is still in the slot from an earlier request */
+	if (!(ctx->flags & FLAGS_NEW_KEY) &&
+	    test_bit(ctx->slot->slot_num, &dd->keys_loaded))
+		goto out;
+
+	memset(dd->ivkey_base, 0, AES_HW_KEY_TABLE_LENGTH_BYTES);
+	memcpy(dd->ivkey_base, ctx->key, ctx->keylen);
+
 	/* copy the key table from sdram to vram */
 	cmdq[0] = 0;
 	cmdq[0] = UCQOPCODE_MEMDMAVD << ICQBITSHIFT_OPCODE |
@@ -437,175 +454,284 @@ static int aes_set_key(struct tegra_aes_dev *dd)
 		icq_empty = value & (0x1<<3);
 	} while (eng_busy & (!icq_empty));
 
+	ctx->flags &= ~FLAGS_NEW_KEY;
+	set_bit(ctx->slot->slot_num, &dd->keys_loaded);
+
 out:
 	return 0;
 }
 
-static int tegra_aes_handle_req(struct tegra_aes_dev *dd)
+/* true if the request can be run straight from and to its scatterlists:
+ * the engine needs word aligned buffers and whole blocks per segment */
+static bool aes_sg_direct(struct scatterlist *sg, size_t nbytes, int *nents)
 {
-	struct crypto_async_request *async_req, *backlog;
-	struct tegra_aes_ctx *ctx;
-	struct tegra_aes_reqctx *rctx;
-	struct ablkcipher_request *req;
-	unsigned long flags;
-	int dma_max = AES_HW_DMA_BUFFER_SIZE_BYTES;
-	int ret = 0, nblocks, total;
-	int count = 0;
+	size_t len;
+
+	*nents = 0;
+	while (nbytes && sg) {
+		len = min(nbytes, (size_t)sg->length);
+		if (!IS_ALIGNED(sg->offset, sizeof(u32)) ||
+		    !IS_ALIGNED(len, AES_BLOCK_SIZE))
+			return false;
+		nbytes -= len;
+		(*nents)++;
+		sg = sg_next(sg);
+	}
+	return !nbytes;
+}
+
+static int aes_crypt_direct(struct tegra_aes_dev *dd,
+	struct ablkcipher_request *req, int in_nents, int out_nents)
+{
+	struct scatterlist *in_sg = req->src, *out_sg = req->dst;
+	size_t in_off = 0, out_off = 0, total = req->nbytes, count;
+	bool inplace = req->src == req->dst;
 	dma_addr_t addr_in, addr_out;
-	struct scatterlist *in_sg, *out_sg;
+	int ret = 0;
 
-	if (!dd)
-		return -EINVAL;
+	if (inplace) {
+		if (!dma_map_sg(dd->dev, in_sg, in_nents, DMA_BIDIRECTIONAL))
+			return -ENOMEM;
+	} else {
+		if (!dma_map_sg(dd->dev, in_sg, in_nents, DMA_TO_DEVICE))
+			return -ENOMEM;
+		if (!dma_map_sg(dd->dev, out_sg, out_nents, DMA_FROM_DEVICE)) {
+			dma_unmap_sg(dd->dev, in_sg, in_nents, DMA_TO_DEVICE);
+			return -ENOMEM;
+		}
+	}
 
-	spin_lock_irqsave(&dd->lock, flags);
-	backlog = crypto_get_backlog(&dd->queue);
-	async_req = crypto_dequeue_request(&dd->queue);
-	if (!async_req)
-		clear_bit(FLAGS_BUSY, &dd->flags);
-	spin_unlock_irqrestore(&dd->lock, flags);
+	/* the source and destination segments need not line up, so each
+	 * run goes as far as the shorter of the two */
+	while (total) {
+		count = min(sg_dma_len(in_sg) - in_off,
+			sg_dma_len(out_sg) - out_off);
+		count = min3(count, total, (size_t)AES_HW_DMA_BUFFER_SIZE_BYTES);
+		addr_in = sg_dma_address(in_sg) + in_off;
+		addr_out = sg_dma_address(out_sg) + out_off;
+
+		ret = aes_start_crypt(dd, addr_in, addr_out,
+			count / AES_BLOCK_SIZE, dd->flags, true);
+		if (ret < 0) {
+			dev_err(dd->dev, "aes_start_crypt fail(%d)\n", ret);
+			break;
+		}
 
-	if (!async_req)
-		return -ENODATA;
+		total -= count;
+		in_off += count;
+		out_off += count;
+		if (total && in_off == sg_dma_len(in_sg)) {
+			in_sg = sg_next(in_sg);
+			in_off = 0;
+		}
+		if (total && out_off == sg_dma_len(out_sg)) {
+			out_sg = sg_next(out_sg);
+			out_off = 0;
+		}
+	}
 
-	if (backlog)
-		backlog->complete(backlog, -EINPROGRESS);
+	if (inplace) {
+		dma_unmap_sg(dd->dev, req->src, in_nents, DMA_BIDIRECTIONAL);
+	} else {
+		dma_unmap_sg(dd->dev, req->dst, out_nents, DMA_FROM_DEVICE);
+		dma_unmap_sg(dd->dev, req->src, in_nents, DMA_TO_DEVICE);
+	}
+	return ret;
+}
 
-	req = ablkcipher_request_cast(async_req);
+static int aes_crypt_bounce(struct tegra_aes_dev *dd,
+	struct ablkcipher_request *req)
+{
+	size_t done = 0, count;
+	int ret;
 
-	dev_dbg(dd->dev, "%s: get new req\n", __func__);
+	while (done < req->nbytes) {
+		count = min(req->nbytes - done,
+			(size_t)AES_HW_DMA_BUFFER_SIZE_BYTES);
+		scatterwalk_map_and_copy(dd->buf_in, req->src, done, count, 0);
 
-	/* take mutex to access the aes hw */
-	mutex_lock(&aes_lock);
+		ret = aes_start_crypt(dd, (u32)dd->dma_buf_in,
+			(u32)dd->dma_buf_out, count / AES_BLOCK_SIZE,
+			dd->flags, true);
+		if (ret < 0) {
+			dev_err(dd->dev, "aes_start_crypt fail(%d)\n", ret);
+			return ret;
+		}
 
-	/* assign new request to device */
-	dd->req = req;
-	dd->total = req->nbytes;
-	dd->in_offset = 0;
-	dd->in_sg = req->src;
-	dd->out_offset = 0;
-	dd->out_sg = req->dst;
+		scatterwalk_map_and_copy(dd->buf_out, req->dst, done, count, 1);
+		done += count;
+	}
+	return 0;
+}
 
-	in_sg = dd->in_sg;
-	out_sg = dd->out_sg;
+/* multiplies the tweak by x in GF(2^128), as in IEEE P1619 */
+static void aes_xts_mult_x(u8 *t)
+{
+	int i;
+	u8 carry = t[AES_BLOCK_SIZE - 1] >> 7;
 
-	if (!in_sg || !out_sg) {
-		mutex_unlock(&aes_lock);
-		return -EINVAL;
+	for (i = AES_BLOCK_SIZE - 1; i > 0; i--)
+		t[i] = (t[i] << 1) | (t[i - 1] >> 7);
+	t[0] = (t[0] << 1) ^ (carry ? 0x87 : 0);
+}
+
+/* xors count bytes of buf with the tweaks starting at t, which is left at
+ * the tweak of the block after them */
+static void aes_xts_xor_tweaks(u8 *buf, u8 *t, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i += AES_BLOCK_SIZE) {
+		crypto_xor(buf + i, t, AES_BLOCK_SIZE);
+		aes_xts_mult_x(t);
 	}
+}
 
-	total = dd->total;
-	rctx = ablkcipher_request_ctx(req);
-	ctx = crypto_ablkcipher_ctx(crypto_ablkcipher_reqtfm(req));
-	rctx->mode &= FLAGS_MODE_MASK;
-	dd->flags = (dd->flags & ~FLAGS_MODE_MASK) | rctx->mode;
+/*
+ * The engine has no XTS mode, so the tweaks are applied around its ECB
+ * mode, a whole chunk of up to AES_HW_DMA_BUFFER_SIZE_BYTES at a time so
+ * that multi-sector requests keep the DMA busy.  The initial tweak is the
+ * encrypted sector number, done with the second half of the key in
+ * software since it is a single block.
+ */
+static int aes_crypt_xts(struct tegra_aes_dev *dd,
+	struct ablkcipher_request *req)
+{
+	struct tegra_aes_ctx *ctx = dd->ctx;
+	u8 t[AES_BLOCK_SIZE], t_chunk[AES_BLOCK_SIZE];
+	size_t done = 0, count;
+	int ret;
 
-	dd->iv = (u8 *)req->info;
-	dd->ivlen = AES_BLOCK_SIZE;
+	crypto_cipher_encrypt_one(ctx->tweak_tfm, t, req->info);
 
-	if ((dd->flags & FLAGS_CBC) && dd->iv)
-		dd->flags |= FLAGS_NEW_IV;
-	else
-		dd->flags &= ~FLAGS_NEW_IV;
+	while (done < req->nbytes) {
+		count = min(req->nbytes - done,
+			(size_t)AES_HW_DMA_BUFFER_SIZE_BYTES);
+		scatterwalk_map_and_copy(dd->buf_in, req->src, done, count, 0);
+		memcpy(t_chunk, t, AES_BLOCK_SIZE);
+		aes_xts_xor_tweaks((u8 *)dd->buf_in, t, count);
 
-	ctx->dd = dd;
-	if (dd->ctx != ctx) {
-		/* assign new context to device */
-		dd->ctx = ctx;
-		ctx->flags |= FLAGS_NEW_KEY;
-	}
+		ret = aes_start_crypt(dd, (u32)dd->dma_buf_in,
+			(u32)dd->dma_buf_out, count / AES_BLOCK_SIZE,
+			dd->flags & FLAGS_ENCRYPT, true);
+		if (ret < 0) {
+			dev_err(dd->dev, "aes_start_crypt fail(%d)\n", ret);
+			return ret;
+		}
 
-	/* take the hardware semaphore */
-	if (tegra_arb_mutex_lock_timeout(dd->res_id, ARB_SEMA_TIMEOUT) < 0) {
-		dev_err(dd->dev, "aes hardware not available\n");
-		mutex_unlock(&aes_lock);
-		return -EBUSY;
+		aes_xts_xor_tweaks((u8 *)dd->buf_out, t_chunk, count);
+		scatterwalk_map_and_copy(dd->buf_out, req->dst, done, count, 1);
+		done += count;
 	}
+	return 0;
+}
 
-	ret = aes_hw_init(dd);
-	if (ret < 0) {
-		dev_err(dd->dev, "%s: hw init fail(%d)\n", __func__, ret);
-		goto fail;
-	}
+/*
+ * CTR is run as ECB encryption of the counter blocks, which are then
+ * xored with the data.  The counter in req->info is left at the block
+ * after the last one used, for the next request to go on from.
+ */
+static int aes_crypt_ctr(struct tegra_aes_dev *dd,
+	struct ablkcipher_request *req)
+{
+	u8 *ctr = req->info;
+	u8 *in = (u8 *)dd->buf_in;
+	size_t done = 0, count, i;
+	int ret;
 
-	aes_set_key(dd);
+	while (done < req->nbytes) {
+		count = min(req->nbytes - done,
+			(size_t)AES_HW_DMA_BUFFER_SIZE_BYTES);
+		for (i = 0; i < count; i += AES_BLOCK_SIZE) {
+			memcpy(in + i, ctr, AES_BLOCK_SIZE);
+			crypto_inc(ctr, AES_BLOCK_SIZE);
+		}
 
-	/* set iv to the aes hw slot */
-	memset(dd->buf_in, 0 , AES_BLOCK_SIZE);
-	memcpy(dd->buf_in, dd->iv, dd->ivlen);
+		ret = aes_start_crypt(dd, (u32)dd->dma_buf_in,
+			(u32)dd->dma_buf_out,
+			DIV_ROUND_UP(count, AES_BLOCK_SIZE), FLAGS_ENCRYPT,
+			true);
+		if (ret < 0) {
+			dev_err(dd->dev, "aes_start_crypt fail(%d)\n", ret);
+			return ret;
+		}
 
-	ret = aes_start_crypt(dd, (u32)dd->dma_buf_in,
-	  (u32)dd->dma_buf_out, 1, FLAGS_CBC, false);
-	if (ret < 0) {
-		dev_err(dd->dev, "aes_start_crypt fail(%d)\n", ret);
-		goto out;
+		/* the counters are used up, so buf_in takes the data */
+		scatterwalk_map_and_copy(in, req->src, done, count, 0);
+		crypto_xor(in, (u8 *)dd->buf_out, count);
+		scatterwalk_map_and_copy(in, req->dst, done, count, 1);
+		done += count;
 	}
+	return 0;
+}
 
-	while (total) {
-		dev_dbg(dd->dev, "remain: 0x%x\n", total);
+/* runs one request, with the hardware already taken by the caller */
+static int tegra_aes_handle_req(struct tegra_aes_dev *dd,
+	struct ablkcipher_request *req)
+{
+	struct tegra_aes_ctx *ctx;
+	struct tegra_aes_reqctx *rctx;
+	int in_nents, out_nents;
+	int ret;
 
-		ret = dma_map_sg(dd->dev, in_sg, 1, DMA_TO_DEVICE);
-		if (!ret) {
-			dev_err(dd->dev, "dma_map_sg() error\n");
-			goto out;
-		}
+	if (!req->src || !req->dst)
+		return -EINVAL;
+	/* no ciphertext stealing for xts */
+	rctx = ablkcipher_request_ctx(req);
+	if (!(rctx->mode & FLAGS_CTR) &&
+	    !IS_ALIGNED(req->nbytes, AES_BLOCK_SIZE))
+		return -EINVAL;
 
-		ret = dma_map_sg(dd->dev, out_sg, 1, DMA_FROM_DEVICE);
-		if (!ret) {
-				dev_err(dd->dev, "dma_map_sg() error\n");
-				dma_unmap_sg(dd->dev, dd->in_sg,
-					1, DMA_TO_DEVICE);
-				goto out;
-			}
+	/* assign new request to device */
+	dd->req = req;
+
+	ctx = crypto_ablkcipher_ctx(crypto_ablkcipher_reqtfm(req));
+	rctx->mode &= FLAGS_MODE_MASK;
+	dd->flags = (dd->flags & ~FLAGS_MODE_MASK) | rctx->mode;
 
-		addr_in = sg_dma_address(in_sg);
-		addr_out = sg_dma_address(out_sg);
-		dd->flags |= FLAGS_FAST;
-		count = min((int)sg_dma_len(in_sg), (int)dma_max);
-		WARN_ON(sg_dma_len(in_sg) != sg_dma_len(out_sg));
-		nblocks = DIV_ROUND_UP(count, AES_BLOCK_SIZE);
+	dd->iv = (u8 *)req->info;
+	dd->ivlen = AES_BLOCK_SIZE;
 
-		ret = aes_start_crypt(dd, addr_in, addr_out, nblocks,
-			dd->flags, true);
+	if ((dd->flags & FLAGS_CBC) && dd->iv)
+		dd->flags |= FLAGS_NEW_IV;
+	else
+		dd->flags &= ~FLAGS_NEW_IV;
+
+	ctx->dd = dd;
+	dd->ctx = ctx;
+	aes_set_key(dd);
 
-		dma_unmap_sg(dd->dev, out_sg, 1, DMA_FROM_DEVICE);
-		dma_unmap_sg(dd->dev, in_sg, 1, DMA_TO_DEVICE);
+	if (dd->flags & FLAGS_NEW_IV) {
+		/* set iv to the aes hw slot */
+		memset(dd->buf_in, 0 , AES_BLOCK_SIZE);
+		memcpy(dd->buf_in, dd->iv, dd->ivlen);
 
+		ret = aes_start_crypt(dd, (u32)dd->dma_buf_in,
+		  (u32)dd->dma_buf_out, 1, FLAGS_CBC, false);
 		if (ret < 0) {
 			dev_err(dd->dev, "aes_start_crypt fail(%d)\n", ret);
-			goto out;
+			return ret;
 		}
-		dd->flags &= ~FLAGS_FAST;
-
-		dev_dbg(dd->dev, "out: copied 0x%x\n", count);
-		total -= count;
-		in_sg = sg_next(in_sg);
-		out_sg = sg_next(out_sg);
-		WARN_ON(((total != 0) && (!in_sg || !out_sg)));
 	}
 
-out:
-	aes_hw_deinit(dd);
-
-fail:
-	/* release the hardware semaphore */
-	tegra_arb_mutex_unlock(dd->res_id);
+	if (!req->nbytes)
+		return 0;
 
-	dd->total = total;
-
-	/* release the mutex */
-	mutex_unlock(&aes_lock);
+	if (dd->flags & FLAGS_XTS)
+		return aes_crypt_xts(dd, req);
+	if (dd->flags & FLAGS_CTR)
+		return aes_crypt_ctr(dd, req);
 
-	if (dd->req->base.complete)
-		dd->req->base.complete(&dd->req->base, ret);
+	if (aes_sg_direct(req->src, req->nbytes, &in_nents) &&
+	    aes_sg_direct(req->dst, req->nbytes, &out_nents))
+		return aes_crypt_direct(dd, req, in_nents, out_nents);
 
-	dev_dbg(dd->dev, "%s: exit\n", __func__);
-	return ret;
+	return aes_crypt_bounce(dd, req);
 }
 
-static int tegra_aes_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
+static int aes_set_ctx_key(struct tegra_aes_ctx *ctx, const u8 *key,
 	unsigned int keylen)
 {
-	struct tegra_aes_ctx *ctx = crypto_ablkcipher_ctx(tfm);
 	struct tegra_aes_dev *dd = aes_dev;
 	struct tegra_aes_slot *key_slot;
 
@@ -624,10 +750,9 @@ static int tegra_aes_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
 	dev_dbg(dd->dev, "keylen: %d\n", keylen);
 
 	ctx->dd = dd;
-	dd->ctx = ctx;
 
 	if (ctx->slot)
-		aes_release_key_slot(dd);
+		aes_release_key_slot(ctx);
 
 	key_slot = aes_find_key_slot(dd);
 	if (!key_slot) {
@@ -639,24 +764,139 @@ static int tegra_aes_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
 	ctx->keylen = keylen;
 	ctx->flags |= FLAGS_NEW_KEY;
 
-	/* copy the key */
-	memset(dd->ivkey_base, 0, AES_HW_KEY_TABLE_LENGTH_BYTES);
-	memcpy(dd->ivkey_base, key, keylen);
+	/* the key is copied to the key table when it is loaded, so that
+	 * this doesn't race with requests of other contexts */
+	memcpy(ctx->key, key, keylen);
 
 	dev_dbg(dd->dev, "done\n");
 	return 0;
 }
 
+static int tegra_aes_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
+	unsigned int keylen)
+{
+	return aes_set_ctx_key(crypto_ablkcipher_ctx(tfm), key, keylen);
+}
+
+/* the first half of the key is for the data, the second for the tweak */
+static int tegra_aes_xts_setkey(struct crypto_ablkcipher *tfm, const u8 *key,
+	unsigned int keylen)
+{
+	struct tegra_aes_ctx *ctx = crypto_ablkcipher_ctx(tfm);
+	int ret;
+
+	if (keylen % 2) {
+		crypto_ablkcipher_set_flags(tfm, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
+	}
+
+	ret = aes_set_ctx_key(ctx, key, keylen / 2);
+	if (ret)
+		return ret;
+
+	return crypto_cipher_setkey(ctx->tweak_tfm, key + keylen / 2,
+		keylen / 2);
+}
+
+static struct ablkcipher_request *aes_dequeue_req(struct tegra_aes_dev *dd)
+{
+	struct crypto_async_request *async_req, *backlog;
+	unsigned long flags;
+
+	spin_lock_irqsave(&dd->lock, flags);
+	backlog = crypto_get_backlog(&dd->queue);
+	async_req = crypto_dequeue_request(&dd->queue);
+	if (!async_req)
+		clear_bit(FLAGS_BUSY, &dd->flags);
+	spin_unlock_irqrestore(&dd->lock, flags);
+
+	if (!async_req)
+		return NULL;
+
+	if (backlog)
+		backlog->complete(backlog, -EINPROGRESS);
+
+	return ablkcipher_request_cast(async_req);
+}
+
+/*
+ * The queued requests are run in batches of up to AES_HW_MAX_BATCH, for
+ * which the hardware, its clocks and the loaded keys are kept, instead of
+ * taking and setting them up again for every request.  The batches are
+ * bounded since the AVP shares the engine through the arbitration
+ * semaphore.  The requests are completed once the hardware is released.
+ */
 static void aes_workqueue_handler(struct work_struct *work)
 {
 	struct tegra_aes_dev *dd = aes_dev;
-	int ret;
+	struct ablkcipher_request *req;
+	struct tegra_aes_reqctx *rctx;
+	LIST_HEAD(done);
+	int count, ret;
 
 	set_bit(FLAGS_BUSY, &dd->flags);
 
 	do {
-		ret = tegra_aes_handle_req(dd);
-	} while (!ret);
+		req = aes_dequeue_req(dd);
+		if (!req)
+			return;
+
+		dev_dbg(dd->dev, "%s: get new req\n", __func__);
+
+		/* take mutex to access the aes hw */
+		mutex_lock(&aes_lock);
+
+		/* take the hardware semaphore */
+		ret = tegra_arb_mutex_lock_timeout(dd->res_id,
+			ARB_SEMA_TIMEOUT);
+		if (ret < 0) {
+			dev_err(dd->dev, "aes hardware not available\n");
+			ret = -EBUSY;
+		} else {
+			ret = aes_hw_init(dd);
+			if (ret < 0) {
+				dev_err(dd->dev, "%s: hw init fail(%d)\n",
+					__func__, ret);
+				tegra_arb_mutex_unlock(dd->res_id);
+			}
+		}
+
+		count = 0;
+		if (ret < 0) {
+			/* fail just this request, the next batch may have
+			 * better luck */
+			rctx = ablkcipher_request_ctx(req);
+			rctx->err = ret;
+			list_add_tail(&req->base.list, &done);
+		} else {
+			/* the AVP may have used the key slots meanwhile */
+			dd->keys_loaded = 0;
+			do {
+				rctx = ablkcipher_request_ctx(req);
+				rctx->err = tegra_aes_handle_req(dd, req);
+				list_add_tail(&req->base.list, &done);
+			} while (++count < AES_HW_MAX_BATCH &&
+				 (req = aes_dequeue_req(dd)));
+
+			aes_hw_deinit(dd);
+			/* release the hardware semaphore */
+			tegra_arb_mutex_unlock(dd->res_id);
+		}
+
+		/* release the mutex */
+		mutex_unlock(&aes_lock);
+
+		while (!list_empty(&done)) {
+			req = ablkcipher_request_cast(list_first_entry(&done,
+				struct crypto_async_request, list));
+			list_del(&req->base.list);
+			rctx = ablkcipher_request_ctx(req);
+			if (req->base.complete)
+				req->base.complete(&req->base, rctx->err);
+		}
+
+		dev_dbg(dd->dev, "%s: exit\n", __func__);
+	} while (!count || count == AES_HW_MAX_BATCH);
 }
 
 static irqreturn_t aes_irq(int irq, void *dev_id)
@@ -716,6 +956,22 @@ static int tegra_aes_cbc_decrypt(struct ablkcipher_request *req)
 	return tegra_aes_crypt(req, FLAGS_CBC);
 }
 
+static int tegra_aes_xts_encrypt(struct ablkcipher_request *req)
+{
+	return tegra_aes_crypt(req, FLAGS_ENCRYPT | FLAGS_XTS);
+}
+
+static int tegra_aes_xts_decrypt(struct ablkcipher_request *req)
+{
+	return tegra_aes_crypt(req, FLAGS_XTS);
+}
+
+/* encryption and decryption are the same for ctr */
+static int tegra_aes_ctr_crypt(struct ablkcipher_request *req)
+{
+	return tegra_aes_crypt(req, FLAGS_ENCRYPT | FLAGS_CTR);
+}
+
 static int tegra_aes_get_random(struct crypto_rng *tfm, u8 *rdata,
 	unsigned int dlen)
 {
@@ -817,9 +1073,8 @@ static int tegra_aes_rng_reset(struct crypto_rng *tfm, u8 *seed,
 	ctx->keylen = AES_KEYSIZE_128;
 	ctx->flags |= FLAGS_NEW_KEY;
 
-	/* copy the key to the key slot */
-	memset(dd->ivkey_base, 0, AES_HW_KEY_TABLE_LENGTH_BYTES);
-	memcpy(dd->ivkey_base, seed + DEFAULT_RNG_BLK_SZ, AES_KEYSIZE_128);
+	/* the key is copied to the key slot by aes_set_key() */
+	memcpy(ctx->key, seed + DEFAULT_RNG_BLK_SZ, AES_KEYSIZE_128);
 
 	dd->iv = seed;
 	dd->ivlen = slen;
@@ -884,6 +1139,37 @@ static int tegra_aes_cra_init(struct crypto_tfm *tfm)
 	return 0;
 }
 
+static void tegra_aes_cra_exit(struct crypto_tfm *tfm)
+{
+	struct tegra_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	if (ctx->slot)
+		aes_release_key_slot(ctx);
+}
+
+static int tegra_aes_xts_cra_init(struct crypto_tfm *tfm)
+{
+	struct tegra_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	ctx->tweak_tfm = crypto_alloc_cipher("aes", 0, 0);
+	if (IS_ERR(ctx->tweak_tfm)) {
+		int ret = PTR_ERR(ctx->tweak_tfm);
+
+		ctx->tweak_tfm = NULL;
+		return ret;
+	}
+
+	return tegra_aes_cra_init(tfm);
+}
+
+static void tegra_aes_xts_cra_exit(struct crypto_tfm *tfm)
+{
+	struct tegra_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	crypto_free_cipher(ctx->tweak_tfm);
+	tegra_aes_cra_exit(tfm);
+}
+
 static struct crypto_alg algs[] = {
 	{
 		.cra_name = "disabled_ecb(aes)",
@@ -896,6 +1182,7 @@ static struct crypto_alg algs[] = {
 		.cra_type = &crypto_ablkcipher_type,
 		.cra_module = THIS_MODULE,
 		.cra_init = tegra_aes_cra_init,
+		.cra_exit = tegra_aes_cra_exit,
 		.cra_u.ablkcipher = {
 			.min_keysize = AES_MIN_KEY_SIZE,
 			.max_keysize = AES_MAX_KEY_SIZE,
@@ -914,6 +1201,7 @@ static struct crypto_alg algs[] = {
 		.cra_type = &crypto_ablkcipher_type,
 		.cra_module = THIS_MODULE,
 		.cra_init = tegra_aes_cra_init,
+		.cra_exit = tegra_aes_cra_exit,
 		.cra_u.ablkcipher = {
 			.min_keysize = AES_MIN_KEY_SIZE,
 			.max_keysize = AES_MAX_KEY_SIZE,
@@ -922,6 +1210,50 @@ static struct crypto_alg algs[] = {
 			.encrypt = tegra_aes_cbc_encrypt,
 			.decrypt = tegra_aes_cbc_decrypt,
 		}
+	}, {
+		/*
+		 * xts and ctr go around the engine's ecb mode and are
+		 * preferred over the generic templates on top of aes_generic
+		 */
+		.cra_name = "xts(aes)",
+		.cra_driver_name = "xts-aes-tegra",
+		.cra_priority = 300,
+		.cra_flags = CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC,
+		.cra_blocksize = AES_BLOCK_SIZE,
+		.cra_ctxsize  = sizeof(struct tegra_aes_ctx),
+		.cra_alignmask = 3,
+		.cra_type = &crypto_ablkcipher_type,
+		.cra_module = THIS_MODULE,
+		.cra_init = tegra_aes_xts_cra_init,
+		.cra_exit = tegra_aes_xts_cra_exit,
+		.cra_u.ablkcipher = {
+			.min_keysize = 2 * AES_MIN_KEY_SIZE,
+			.max_keysize = 2 * AES_MAX_KEY_SIZE,
+			.ivsize = AES_BLOCK_SIZE,
+			.setkey = tegra_aes_xts_setkey,
+			.encrypt = tegra_aes_xts_encrypt,
+			.decrypt = tegra_aes_xts_decrypt,
+		}
+	}, {
+		.cra_name = "ctr(aes)",
+		.cra_driver_name = "ctr-aes-tegra",
+		.cra_priority = 300,
+		.cra_flags = CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC,
+		.cra_blocksize = 1,
+		.cra_ctxsize  = sizeof(struct tegra_aes_ctx),
+		.cra_alignmask = 3,
+		.cra_type = &crypto_ablkcipher_type,
+		.cra_module = THIS_MODULE,
+		.cra_init = tegra_aes_cra_init,
+		.cra_exit = tegra_aes_cra_exit,
+		.cra_u.ablkcipher = {
+			.min_keysize = AES_MIN_KEY_SIZE,
+			.max_keysize = AES_MAX_KEY_SIZE,
+			.ivsize = AES_BLOCK_SIZE,
+			.setkey = tegra_aes_setkey,
+			.encrypt = tegra_aes_ctr_crypt,
+			.decrypt = tegra_aes_ctr_crypt,
+		}
 	}, {
 		.cra_name = "disabled_ansi_cprng",
 		.cra_driver_name = "rng-aes-tegra",
@@ -0,0 +1,639 @@
+/*
+ * drivers/dma/tegra_apb_dma.c
+ *
+ * dmaengine driver for the NVIDIA Tegra APB DMA controller, on top of the
+ * channel API of arch/arm/mach-tegra/dma.c
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/scatterlist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+#include <mach/dma.h>
+
+/* The APB DMA channels are shared with the drivers using the mach API
+ * directly, so a dmaengine channel only claims one of them while a client
+ * holds it. */
+#define TEGRA_APB_DMA_CHANNELS		8
+
+struct tegra_apb_dma_stats {
+	u32				xfers;
+	u64				bytes;
+	u64				total_us;
+	u32				max_us;
+	u64				busy_us;
+};
+
+struct tegra_apb_dma_chan {
+	struct dma_chan			chan;
+	struct tegra_dma_channel	*hw;
+	int				mode;
+	unsigned long			req_sel;
+
+	/* from DMA_SLAVE_CONFIG */
+	dma_addr_t			per_addr;
+	unsigned long			per_bus_width;
+
+	/* protects the lists, last_completed and the stats */
+	spinlock_t			lock;
+	struct list_head		queued;
+	struct list_head		active;
+	/* taken away by DMA_TERMINATE_ALL, but maybe still in the hands of
+	 * the DMA ISR on another CPU until free_work has synced with it */
+	struct list_head		terminated;
+	struct work_struct		free_work;
+	dma_cookie_t			last_completed;
+	/* the last one which could not be queued to the hardware */
+	dma_cookie_t			last_error;
+	ktime_t				last_done;
+	struct tegra_apb_dma_stats	stats;
+};
+
+struct tegra_apb_dma {
+	struct dma_device		dma_device;
+	struct dentry			*debugfs_root;
+	struct tegra_apb_dma_chan	channels[TEGRA_APB_DMA_CHANNELS];
+};
+
+/* A slave_sg transfer is a single request with the scatterlist attached.
+ * A cyclic transfer has one request per period, which are kept queued on
+ * the channel in a ring: each one is put back at the tail as it completes. */
+struct tegra_apb_dma_desc {
+	struct dma_async_tx_descriptor	txd;
+	struct list_head		node;
+	bool				cyclic;
+	ktime_t				stamp;
+	unsigned int			num_reqs;
+	struct tegra_dma_req		reqs[0];
+};
+
+static inline struct tegra_apb_dma_chan *to_tegra_chan(struct dma_chan *chan)
+{
+	return container_of(chan, struct tegra_apb_dma_chan, chan);
+}
+
+static inline struct tegra_apb_dma_desc *to_tegra_desc(
+	struct dma_async_tx_descriptor *txd)
+{
+	return container_of(txd, struct tegra_apb_dma_desc, txd);
+}
+
+/* Looks the request up among the descriptors still in flight. A request
+ * of a descriptor which DMA_TERMINATE_ALL took away while its completion
+ * was on the way from the DMA ISR isn't found; its memory is only freed
+ * once the ISR is done with it, see tegra_apb_dma_free_work(). */
+static struct tegra_apb_dma_desc *find_desc_locked(
+	struct tegra_apb_dma_chan *tchan, struct tegra_dma_req *req)
+{
+	struct tegra_apb_dma_desc *desc;
+
+	list_for_each_entry(desc, &tchan->active, node)
+		if (req >= desc->reqs && req < desc->reqs + desc->num_reqs)
+			return desc;
+	return NULL;
+}
+
+/* latency is from issue_pending to completion, or for cyclic transfers
+ * from one period to the next; busy time leaves out the gaps in which
+ * the channel had nothing to do, for the throughput */
+static void account_xfer_locked(struct tegra_apb_dma_chan *tchan,
+				struct tegra_apb_dma_desc *desc,
+				unsigned int bytes)
+{
+	struct tegra_apb_dma_stats *stats = &tchan->stats;
+	ktime_t now = ktime_get();
+	ktime_t start = desc->stamp;
+	u32 us = ktime_us_delta(now, desc->stamp);
+
+	if (ktime_to_ns(ktime_sub(tchan->last_done, start)) > 0)
+		start = tchan->last_done;
+
+	stats->xfers++;
+	stats->bytes += bytes;
+	stats->total_us += us;
+	if (us > stats->max_us)
+		stats->max_us = us;
+	stats->busy_us += ktime_us_delta(now, start);
+
+	tchan->last_done = now;
+	desc->stamp = now;
+}
+
+static void tegra_apb_dma_complete(struct tegra_dma_req *req)
+{
+	struct tegra_apb_dma_chan *tchan = req->dev;
+	struct tegra_apb_dma_desc *desc;
+	dma_async_tx_callback callback;
+	void *param;
+	unsigned long flags;
+	bool done;
+
+	spin_lock_irqsave(&tchan->lock, flags);
+	desc = find_desc_locked(tchan, req);
+	if (!desc || req->status != TEGRA_DMA_REQ_SUCCESS) {
+		spin_unlock_irqrestore(&tchan->lock, flags);
+		return;
+	}
+
+	account_xfer_locked(tchan, desc, req->bytes_transferred);
+	callback = desc->txd.callback;
+	param = desc->txd.callback_param;
+	done = !desc->cyclic;
+	if (done) {
+		list_del(&desc->node);
+		tchan->last_completed = desc->txd.cookie;
+	} else {
+		tegra_dma_enqueue_req(tchan->hw, req);
+	}
+	spin_unlock_irqrestore(&tchan->lock, flags);
+
+	if (callback)
+		callback(param);
+	if (done)
+		kfree(desc);
+}
+
+static dma_cookie_t tegra_apb_dma_tx_submit(struct dma_async_tx_descriptor *txd)
+{
+	struct tegra_apb_dma_chan *tchan = to_tegra_chan(txd->chan);
+	struct tegra_apb_dma_desc *desc = to_tegra_desc(txd);
+	dma_cookie_t cookie;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tchan->lock, flags);
+	cookie = tchan->chan.cookie;
+	if (++cookie < 0)
+		cookie = 1;
+	tchan->chan.cookie = cookie;
+	txd->cookie = cookie;
+	list_add_tail(&desc->node, &tchan->queued);
+	spin_unlock_irqrestore(&tchan->lock, flags);
+
+	return cookie;
+}
+
+/* A descriptor which can't be queued to the hardware reports DMA_ERROR
+ * from tx_status, and still gets its callback so that a client waiting
+ * for it finds out. */
+static void tegra_apb_dma_issue_pending(struct dma_chan *chan)
+{
+	struct tegra_apb_dma_chan *tchan = to_tegra_chan(chan);
+	struct tegra_apb_dma_desc *desc, *tmp;
+	unsigned long flags;
+	unsigned int i;
+	LIST_HEAD(failed);
+	int ret;
+
+	spin_lock_irqsave(&tchan->lock, flags);
+	list_for_each_entry_safe(desc, tmp, &tchan->queued, node) {
+		desc->stamp = ktime_get();
+		/* the periods of cyclic transfers are checked when they are
+		 * prepared, only building the segments of a scatterlist can
+		 * fail here, and a scatterlist is a single request */
+		ret = 0;
+		for (i = 0; i < desc->num_reqs && !ret; i++)
+			ret = tegra_dma_enqueue_req(tchan->hw, &desc->reqs[i]);
+		if (ret) {
+			dev_err(chan->device->dev,
+				"%s: cannot queue cookie %d (%d)\n",
+				dma_chan_name(chan), desc->txd.cookie, ret);
+			tchan->last_error = desc->txd.cookie;
+			list_move_tail(&desc->node, &failed);
+		} else {
+			list_move_tail(&desc->node, &tchan->active);
+		}
+	}
+	spin_unlock_irqrestore(&tchan->lock, flags);
+
+	list_for_each_entry_safe(desc, tmp, &failed, node) {
+		if (desc->txd.callback)
+			desc->txd.callback(desc->txd.callback_param);
+		kfree(desc);
+	}
+}
+
+static enum dma_status tegra_apb_dma_tx_status(struct dma_chan *chan,
+	dma_cookie_t cookie, struct dma_tx_state *txstate)
+{
+	struct tegra_apb_dma_chan *tchan = to_tegra_chan(chan);
+	dma_cookie_t last_completed, last_used;
+	unsigned long flags;
+	bool error;
+
+	spin_lock_irqsave(&tchan->lock, flags);
+	last_completed = tchan->last_completed;
+	last_used = chan->cookie;
+	error = cookie == tchan->last_error;
+	spin_unlock_irqrestore(&tchan->lock, flags);
+
+	dma_set_tx_state(txstate, last_completed, last_used, 0);
+	if (error)
+		return DMA_ERROR;
+	return dma_async_is_complete(cookie, last_completed, last_used);
+}
+
+/* tegra_dma_cancel() doesn't wait for an ISR on another CPU which has
+ * already taken a request off the hardware queue, so the descriptors are
+ * freed from here, after syncing with the ISR. This can't be done in
+ * terminate_all itself, which may be called from a completion callback. */
+static void tegra_apb_dma_free_work(struct work_struct *work)
+{
+	struct tegra_apb_dma_chan *tchan =
+		container_of(work, struct tegra_apb_dma_chan, free_work);
+	struct tegra_apb_dma_desc *desc, *tmp;
+	unsigned long flags;
+	LIST_HEAD(list);
+
+	spin_lock_irqsave(&tchan->lock, flags);
+	list_splice_init(&tchan->terminated, &list);
+	spin_unlock_irqrestore(&tchan->lock, flags);
+
+	if (list_empty(&list))
+		return;
+
+	tegra_dma_sync(tchan->hw);
+	list_for_each_entry_safe(desc, tmp, &list, node)
+		kfree(desc);
+}
+
+static void tegra_apb_dma_terminate_all(struct tegra_apb_dma_chan *tchan)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tchan->lock, flags);
+	tegra_dma_cancel(tchan->hw);
+	list_splice_tail_init(&tchan->active, &tchan->terminated);
+	list_splice_tail_init(&tchan->queued, &tchan->terminated);
+	spin_unlock_irqrestore(&tchan->lock, flags);
+
+	schedule_work(&tchan->free_work);
+}
+
+static int tegra_apb_dma_control(struct dma_chan *chan, enum dma_ctrl_cmd cmd,
+				 unsigned long arg)
+{
+	struct tegra_apb_dma_chan *tchan = to_tegra_chan(chan);
+	struct dma_slave_config *cfg = (void *)arg;
+	enum dma_slave_buswidth width;
+
+	switch (cmd) {
+	case DMA_TERMINATE_ALL:
+		tegra_apb_dma_terminate_all(tchan);
+		return 0;
+	case DMA_SLAVE_CONFIG:
+		if (cfg->direction == DMA_FROM_DEVICE) {
+			tchan->per_addr = cfg->src_addr;
+			width = cfg->src_addr_width;
+		} else {
+			tchan->per_addr = cfg->dst_addr;
+			width = cfg->dst_addr_width;
+		}
+		if (tchan->per_addr & 0x3)
+			return -EINVAL;
+
+		switch (width) {
+		case DMA_SLAVE_BUSWIDTH_1_BYTE:
+			tchan->per_bus_width = 8;
+			break;
+		case DMA_SLAVE_BUSWIDTH_2_BYTES:
+			tchan->per_bus_width = 16;
+			break;
+		case DMA_SLAVE_BUSWIDTH_4_BYTES:
+			tchan->per_bus_width = 32;
+			break;
+		default:
+			return -EINVAL;
+		}
+		return 0;
+	default:
+		return -ENXIO;
+	}
+}
+
+static struct tegra_apb_dma_desc *tegra_apb_dma_alloc_desc(
+	struct tegra_apb_dma_chan *tchan, unsigned int num_reqs)
+{
+	struct tegra_apb_dma_desc *desc;
+
+	desc = kzalloc(sizeof(*desc) + num_reqs * sizeof(desc->reqs[0]),
+		       GFP_ATOMIC);
+	if (!desc)
+		return NULL;
+
+	dma_async_tx_descriptor_init(&desc->txd, &tchan->chan);
+	desc->txd.tx_submit = tegra_apb_dma_tx_submit;
+	desc->num_reqs = num_reqs;
+	INIT_LIST_HEAD(&desc->node);
+	return desc;
+}
+
+/* the peripheral side is a FIFO register, the memory side is linear */
+static void tegra_apb_dma_init_req(struct tegra_apb_dma_chan *tchan,
+				   struct tegra_dma_req *req,
+				   enum dma_data_direction direction,
+				   dma_addr_t mem_addr, unsigned int len)
+{
+	req->complete = tegra_apb_dma_complete;
+	req->dev = tchan;
+	req->req_sel = tchan->req_sel;
+	req->size = len;
+
+	if (direction == DMA_FROM_DEVICE) {
+		req->to_memory = 1;
+		req->source_addr = tchan->per_addr;
+		req->source_bus_width = tchan->per_bus_width;
+		req->source_wrap = 4;
+		req->dest_addr = mem_addr;
+		req->dest_bus_width = 32;
+		req->dest_wrap = 0;
+	} else {
+		req->to_memory = 0;
+		req->dest_addr = tchan->per_addr;
+		req->dest_bus_width = tchan->per_bus_width;
+		req->dest_wrap = 4;
+		req->source_addr = mem_addr;
+		req->source_bus_width = 32;
+		req->source_wrap = 0;
+	}
+}
+
+static struct dma_async_tx_descriptor *tegra_apb_dma_prep_slave_sg(
+	struct dma_chan *chan, struct scatterlist *sgl, unsigned int sg_len,
+	enum dma_data_direction direction, unsigned long flags)
+{
+	struct tegra_apb_dma_chan *tchan = to_tegra_chan(chan);
+	struct tegra_apb_dma_desc *desc;
+	struct tegra_dma_req *req;
+	struct scatterlist *sg;
+	int i;
+
+	if (!(tchan->mode & TEGRA_DMA_MODE_ONESHOT) || !sg_len ||
+	    !tchan->per_bus_width)
+		return NULL;
+
+	/* the same checks as the scatterlist requests of the mach API, so
+	 * that queueing the request can only fail on memory */
+	for_each_sg(sgl, sg, sg_len, i)
+		if (!sg_dma_len(sg) || (sg_dma_address(sg) & 0x3) ||
+		    (sg_dma_len(sg) & 0x3))
+			return NULL;
+
+	desc = tegra_apb_dma_alloc_desc(tchan, 1);
+	if (!desc)
+		return NULL;
+
+	req = &desc->reqs[0];
+	tegra_apb_dma_init_req(tchan, req, direction, 0, 0);
+	req->sg = sgl;
+	req->sg_len = sg_len;
+	desc->txd.flags = flags;
+
+	return &desc->txd;
+}
+
+static struct dma_async_tx_descriptor *tegra_apb_dma_prep_dma_cyclic(
+	struct dma_chan *chan, dma_addr_t buf_addr, size_t buf_len,
+	size_t period_len, enum dma_data_direction direction)
+{
+	struct tegra_apb_dma_chan *tchan = to_tegra_chan(chan);
+	struct tegra_apb_dma_desc *desc;
+	unsigned int periods;
+	unsigned int i;
+
+	if (!(tchan->mode & TEGRA_DMA_MODE_CONTINUOUS_SINGLE) ||
+	    !tchan->per_bus_width)
+		return NULL;
+
+	/* the hardware keeps at most one period queued behind the one in
+	 * flight, so the ring needs two of them to run without gaps */
+	if (!period_len || buf_len % period_len ||
+	    period_len > TEGRA_DMA_MAX_TRANSFER_SIZE ||
+	    (period_len & 0x3) || (buf_addr & 0x3))
+		return NULL;
+	periods = buf_len / period_len;
+	if (periods < 2)
+		return NULL;
+
+	desc = tegra_apb_dma_alloc_desc(tchan, periods);
+	if (!desc)
+		return NULL;
+
+	desc->cyclic = true;
+	for (i = 0; i < periods; i++)
+		tegra_apb_dma_init_req(tchan, &desc->reqs[i], direction,
+				       buf_addr + i * period_len, period_len);
+
+	return &desc->txd;
+}
+
+static int tegra_apb_dma_alloc_chan_resources(struct dma_chan *chan)
+{
+	struct tegra_apb_dma_chan *tchan = to_tegra_chan(chan);
+	struct tegra_dma_slave *slave = chan->private;
+	int mode;
+
+	if (!slave)
+		return -EINVAL;
+
+	mode = slave->mode ? slave->mode : TEGRA_DMA_MODE_ONESHOT;
+	if (mode != TEGRA_DMA_MODE_ONESHOT &&
+	    mode != TEGRA_DMA_MODE_CONTINUOUS_SINGLE)
+		return -EINVAL;
+
+	tchan->hw = tegra_dma_allocate_channel(mode);
+	if (!tchan->hw)
+		return -EBUSY;
+
+	tchan->mode = mode;
+	tchan->req_sel = slave->req_sel;
+	tchan->per_addr = 0;
+	tchan->per_bus_width = 0;
+	tchan->last_completed = chan->cookie = 1;
+	tchan->last_error = 0;
+	tchan->last_done = ktime_set(0, 0);
+	memset(&tchan->stats, 0, sizeof(tchan->stats));
+
+	return 0;
+}
+
+static void tegra_apb_dma_free_chan_resources(struct dma_chan *chan)
+{
+	struct tegra_apb_dma_chan *tchan = to_tegra_chan(chan);
+
+	tegra_apb_dma_terminate_all(tchan);
+	flush_work(&tchan->free_work);
+	tegra_dma_free_channel(tchan->hw);
+	tchan->hw = NULL;
+}
+
+#ifdef CONFIG_DEBUG_FS
+/* per channel: transfers (or periods), bytes, average and max latency,
+ * and the throughput over the time the channel was busy */
+static int tegra_apb_dma_stats_show(struct seq_file *s, void *data)
+{
+	struct tegra_apb_dma *tdma = s->private;
+	struct tegra_apb_dma_stats stats;
+	unsigned long flags;
+	bool cyclic;
+	int i;
+
+	seq_printf(s, "%-12s %-7s %10s %12s %8s %8s %8s\n", "channel", "mode",
+		   "xfers", "bytes", "avg_us", "max_us", "KB/s");
+	for (i = 0; i < TEGRA_APB_DMA_CHANNELS; i++) {
+		struct tegra_apb_dma_chan *tchan = &tdma->channels[i];
+
+		spin_lock_irqsave(&tchan->lock, flags);
+		stats = tchan->stats;
+		cyclic = tchan->mode & TEGRA_DMA_MODE_CONTINUOUS_SINGLE;
+		spin_unlock_irqrestore(&tchan->lock, flags);
+
+		if (!stats.xfers)
+			continue;
+		seq_printf(s, "%-12s %-7s %10u %12llu %8llu %8u %8llu\n",
+			   dma_chan_name(&tchan->chan),
+			   cyclic ? "cyclic" : "sg", stats.xfers, stats.bytes,
+			   div_u64(stats.total_us, stats.xfers), stats.max_us,
+			   stats.busy_us ?
+				div64_u64(stats.bytes * USEC_PER_SEC,
+					  stats.busy_us * 1024) : 0);
+	}
+	return 0;
+}
+
+static int tegra_apb_dma_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tegra_apb_dma_stats_show, inode->i_private);
+}
+
+static const struct file_operations tegra_apb_dma_stats_fops = {
+	.open		= tegra_apb_dma_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static void tegra_apb_dma_debugfs_init(struct tegra_apb_dma *tdma)
+{
+	tdma->debugfs_root = debugfs_create_dir("tegra_apb_dma", NULL);
+	if (IS_ERR_OR_NULL(tdma->debugfs_root)) {
+		tdma->debugfs_root = NULL;
+		return;
+	}
+	debugfs_create_file("stats", S_IRUGO, tdma->debugfs_root, tdma,
+			    &tegra_apb_dma_stats_fops);
+}
+#else
+static inline void tegra_apb_dma_debugfs_init(struct tegra_apb_dma *tdma)
+{
+}
+#endif
+
+static int __init tegra_apb_dma_probe(struct platform_device *pdev)
+{
+	struct tegra_apb_dma *tdma;
+	struct dma_device *dd;
+	int i;
+	int ret;
+
+	tdma = kzalloc(sizeof(*tdma), GFP_KERNEL);
+	if (!tdma)
+		return -ENOMEM;
+
+	dd = &tdma->dma_device;
+	INIT_LIST_HEAD(&dd->channels);
+	dma_cap_set(DMA_SLAVE, dd->cap_mask);
+	dma_cap_set(DMA_CYCLIC, dd->cap_mask);
+
+	for (i = 0; i < TEGRA_APB_DMA_CHANNELS; i++) {
+		struct tegra_apb_dma_chan *tchan = &tdma->channels[i];
+
+		spin_lock_init(&tchan->lock);
+		INIT_LIST_HEAD(&tchan->queued);
+		INIT_LIST_HEAD(&tchan->active);
+		INIT_LIST_HEAD(&tchan->terminated);
+		INIT_WORK(&tchan->free_work, tegra_apb_dma_free_work);
+		tchan->chan.device = dd;
+		list_add_tail(&tchan->chan.device_node, &dd->channels);
+	}
+
+	dd->dev = &pdev->dev;
+	dd->device_alloc_chan_resources = tegra_apb_dma_alloc_chan_resources;
+	dd->device_free_chan_resources = tegra_apb_dma_free_chan_resources;
+	dd->device_tx_status = tegra_apb_dma_tx_status;
+	dd->device_prep_slave_sg = tegra_apb_dma_prep_slave_sg;
+	dd->device_prep_dma_cyclic = tegra_apb_dma_prep_dma_cyclic;
+	dd->device_control = tegra_apb_dma_control;
+	dd->device_issue_pending = tegra_apb_dma_issue_pending;
+
+	ret = dma_async_device_register(dd);
+	if (ret) {
+		dev_err(&pdev->dev, "unable to register\n");
+		kfree(tdma);
+		return ret;
+	}
+
+	platform_set_drvdata(pdev, tdma);
+	tegra_apb_dma_debugfs_init(tdma);
+
+	dev_info(&pdev->dev, "%d dmaengine channels\n", TEGRA_APB_DMA_CHANNELS);
+	return 0;
+}
+
+static int __exit tegra_apb_dma_remove(struct platform_device *pdev)
+{
+	struct tegra_apb_dma *tdma = platform_get_drvdata(pdev);
+
+	debugfs_remove_recursive(tdma->debugfs_root);
+	dma_async_device_unregister(&tdma->dma_device);
+	kfree(tdma);
+	return 0;
+}
+
+static struct platform_driver tegra_apb_dma_driver = {
+	.driver		= {
+		.name	= "tegra-apbdma",
+		.owner	= THIS_MODULE,
+	},
+	.remove		= __exit_p(tegra_apb_dma_remove),
+};
+
+static int __init tegra_apb_dma_module_init(void)
+{
+	return platform_driver_probe(&tegra_apb_dma_driver, tegra_apb_dma_probe);
+}
+subsys_initcall(tegra_apb_dma_module_init);
+
+static void __exit tegra_apb_dma_module_exit(void)
+{
+	platform_driver_unregister(&tegra_apb_dma_driver);
+}
+module_exit(tegra_apb_dma_module_exit);
+
+MODULE_DESCRIPTION("NVIDIA Tegra APB DMA dmaengine driver");
+MODULE_LICENSE("GPL");
@@ -15,6 +15,7 @@
 
 #include <linux/clk.h>
 #include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/dma-mapping.h>
 #include <linux/err.h>
@@ -25,6 +26,7 @@
 #include <linux/ioctl.h>
 #include <linux/irq.h>
 #include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mutex.h>
@@ -35,6 +37,7 @@
 #include <linux/tegra_rpc.h>
 #include <linux/types.h>
 #include <linux/uaccess.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 
 #include <mach/clk.h>
@@ -93,10 +96,33 @@ module_param_named(debug_mask, avp_debug_mask, uint, S_IWUSR | S_IRUGO);
 #define AVP_MSG_MAX_CMD_LEN		16
 #define AVP_MSG_AREA_SIZE	(AVP_MSG_MAX_CMD_LEN + TEGRA_RPC_MAX_MSG_LEN)
 
+/* The AVP firmware takes one message at a time from the shared area and
+ * acks it by clearing its first word.  Messages are queued up to
+ * AVP_SEND_QUEUE_LEN deep on our side, and each is copied into the
+ * shared area as soon as the one before it is acked, which is noticed
+ * through the mailbox read interrupt instead of by polling. */
+#define AVP_SEND_QUEUE_LEN		16
+
+/* round-trip latency histogram buckets: below 64us, then doubling */
+#define AVP_LAT_BUCKETS			12
+#define AVP_LAT_MIN_SHIFT		6
+
+struct avp_queued_msg {
+	ktime_t				stamp;
+	size_t				len;
+	u8				data[AVP_MSG_AREA_SIZE];
+};
+
+struct avp_lat_hist {
+	u32				count[AVP_LAT_BUCKETS];
+	u32				max_us;
+};
+
 struct avp_info {
 	struct clk			*cop_clk;
 
 	int				mbox_from_avp_pend_irq;
+	int				mbox_to_avp_read_irq;
 
 	dma_addr_t			msg_area_addr;
 	u32				msg;
@@ -108,6 +134,20 @@ struct avp_info {
 	struct work_struct		recv_work;
 	struct workqueue_struct		*recv_wq;
 
+	/* protects the send queue, the slot state and the histograms */
+	spinlock_t			send_lock;
+	struct avp_queued_msg		*send_queue;
+	unsigned int			send_head;
+	unsigned int			send_count;
+	bool				slot_busy;	/* not acked yet */
+	bool				slot_sync;	/* answered in place */
+	ktime_t				slot_stamp;
+	wait_queue_head_t		send_wq;
+	struct work_struct		send_work;
+	struct avp_lat_hist		msg_lat;
+	struct avp_lat_hist		conn_lat;
+	struct dentry			*debugfs_root;
+
 	struct trpc_node		*rpc_node;
 	struct miscdevice		misc_dev;
 	int				refcount;
@@ -310,33 +350,176 @@ static inline u32 msg_recv_get_cmd(struct avp_info *avp)
 	return *cmd;
 }
 
-static inline int __msg_write(struct avp_info *avp, void *hdr, size_t hdr_len,
-			      void *buf, size_t len)
+static inline bool slot_acked(struct avp_info *avp)
 {
-	memcpy(avp->msg_to_avp, hdr, hdr_len);
+	/* rem_ack is a pointer into shared memory that the AVP modifies */
+	volatile u32 *rem_ack = avp->msg_to_avp;
+
+	rmb();
+	return *rem_ack == 0;
+}
+
+static void lat_record(struct avp_lat_hist *hist, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int i = 0;
+
+	while (i < AVP_LAT_BUCKETS - 1 &&
+	       us >= (1LL << (AVP_LAT_MIN_SHIFT + i)))
+		i++;
+	hist->count[i]++;
+	if (us > hist->max_us)
+		hist->max_us = us;
+}
+
+/* retires the message in the shared area if the AVP has acked it, and
+ * then copies the next queued message in. called with send_lock held;
+ * returns true if a message was retired. */
+static bool avp_send_kick(struct avp_info *avp)
+{
+	struct avp_queued_msg *qmsg;
+	bool retired = false;
+
+	if (avp->slot_busy && !avp->slot_sync && slot_acked(avp)) {
+		/* the stamp is 0 for the marker set up by avp_halt() */
+		if (avp->slot_stamp.tv64)
+			lat_record(&avp->msg_lat, avp->slot_stamp);
+		avp->slot_busy = false;
+		retired = true;
+	}
+
+	if (!avp->slot_busy && avp->send_count) {
+		qmsg = &avp->send_queue[avp->send_head];
+		memcpy(avp->msg_to_avp, qmsg->data, qmsg->len);
+		wmb();
+		mbox_writel(avp->msg, MBOX_TO_AVP);
+		avp->slot_busy = true;
+		avp->slot_stamp = qmsg->stamp;
+		avp->send_head = (avp->send_head + 1) % AVP_SEND_QUEUE_LEN;
+		avp->send_count--;
+		wake_up(&avp->send_wq);
+
+		/* without the read interrupt, the ack has to be polled for */
+		if (avp->mbox_to_avp_read_irq < 0)
+			schedule_work(&avp->send_work);
+	} else if (retired) {
+		wake_up(&avp->send_wq);
+	}
+
+	return retired;
+}
+
+/* polls for the ack of the message in the shared area, for when the
+ * mailbox was read before the AVP got around to acking the message */
+static void avp_send_work(struct work_struct *work)
+{
+	struct avp_info *avp = container_of(work, struct avp_info, send_work);
+	unsigned long endtime = jiffies + HZ;
+	unsigned long flags;
+	bool waiting;
+
+	for (;;) {
+		spin_lock_irqsave(&avp->send_lock, flags);
+		if (avp_send_kick(avp))
+			endtime = jiffies + HZ;
+		waiting = avp->slot_busy && !avp->slot_sync;
+		spin_unlock_irqrestore(&avp->send_lock, flags);
+
+		if (!waiting)
+			return;
+		if (!time_before(jiffies, endtime))
+			break;
+		usleep_range(50, 100);
+	}
+	pr_err("%s: remote has not acked last message\n", __func__);
+}
+
+static irqreturn_t avp_mbox_read_isr(int irq, void *data)
+{
+	struct avp_info *avp = data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&avp->send_lock, flags);
+	/* the AVP has taken the message out of the mailbox; the interrupt
+	 * stays asserted until the mailbox is written again */
+	if (!(mbox_readl(MBOX_TO_AVP) & MBOX_MSG_VALID))
+		mbox_writel(0, MBOX_TO_AVP);
+	if (!avp_send_kick(avp) && avp->slot_busy && !avp->slot_sync)
+		schedule_work(&avp->send_work);
+	else if (avp->slot_sync)
+		wake_up(&avp->send_wq);
+	spin_unlock_irqrestore(&avp->send_lock, flags);
+
+	return IRQ_HANDLED;
+}
+
+static bool send_queue_has_room(struct avp_info *avp)
+{
+	return ACCESS_ONCE(avp->send_count) < AVP_SEND_QUEUE_LEN;
+}
+
+/* queues a message for the AVP without waiting for it to be taken,
+ * unless the queue is full. called with to_avp_lock held, which keeps
+ * the room from being taken by anyone else. */
+static int msg_queue(struct avp_info *avp, void *hdr, size_t hdr_len,
+		     void *buf, size_t len)
+{
+	struct avp_queued_msg *qmsg;
+	unsigned long flags;
+
+	if (!wait_event_timeout(avp->send_wq, send_queue_has_room(avp), HZ))
+		return -ETIMEDOUT;
+
+	spin_lock_irqsave(&avp->send_lock, flags);
+	qmsg = &avp->send_queue[(avp->send_head + avp->send_count) %
+				AVP_SEND_QUEUE_LEN];
+	memcpy(qmsg->data, hdr, hdr_len);
 	if (buf && len)
-		memcpy(avp->msg_to_avp + hdr_len, buf, len);
-	mbox_writel(avp->msg, MBOX_TO_AVP);
+		memcpy(qmsg->data + hdr_len, buf, len);
+	qmsg->len = hdr_len + len;
+	qmsg->stamp = ktime_get();
+	avp->send_count++;
+	avp_send_kick(avp);
+	spin_unlock_irqrestore(&avp->send_lock, flags);
+
 	return 0;
 }
 
-static inline int msg_write(struct avp_info *avp, void *hdr, size_t hdr_len,
-			    void *buf, size_t len)
+/* takes the shared area for a message which the AVP answers in place,
+ * once all queued messages have been acked */
+static bool slot_claim(struct avp_info *avp)
 {
-	/* rem_ack is a pointer into shared memory that the AVP modifies */
-	volatile u32 *rem_ack = avp->msg_to_avp;
-	unsigned long endtime = jiffies + HZ;
+	unsigned long flags;
+	bool claimed = false;
 
-	/* the other side ack's the message by clearing the first word,
-	 * wait for it to do so */
-	rmb();
-	while (*rem_ack != 0 && time_before(jiffies, endtime)) {
-		usleep_range(100, 2000);
-		rmb();
+	spin_lock_irqsave(&avp->send_lock, flags);
+	avp_send_kick(avp);
+	if (!avp->slot_busy && !avp->send_count) {
+		avp->slot_busy = true;
+		avp->slot_sync = true;
+		claimed = true;
 	}
-	if (*rem_ack != 0)
+	spin_unlock_irqrestore(&avp->send_lock, flags);
+
+	return claimed;
+}
+
+/* writes a message that is answered in place, to be followed by
+ * msg_wait_ack_locked(). called with to_avp_lock held. */
+static int msg_write_sync(struct avp_info *avp, void *hdr, size_t hdr_len)
+{
+	unsigned long flags;
+
+	if (!wait_event_timeout(avp->send_wq, slot_claim(avp), HZ))
 		return -ETIMEDOUT;
-	__msg_write(avp, hdr, hdr_len, buf, len);
+
+	spin_lock_irqsave(&avp->send_lock, flags);
+	memcpy(avp->msg_to_avp, hdr, hdr_len);
+	wmb();
+	avp->slot_stamp = ktime_get();
+	mbox_writel(avp->msg, MBOX_TO_AVP);
+	spin_unlock_irqrestore(&avp->send_lock, flags);
+
 	return 0;
 }
 
@@ -353,18 +536,26 @@ static inline int msg_check_ack(struct avp_info *avp, u32 cmd, u32 *arg)
 	return 0;
 }
 
-/* XXX: add timeout */
+/* waits for the answer to a message written with msg_write_sync(), and
+ * hands the shared area back to the send queue. The answer is written
+ * in place without an interrupt, so it is polled for, but only after
+ * the mailbox read interrupt says the AVP has picked the message up. */
 static int msg_wait_ack_locked(struct avp_info *avp, u32 cmd, u32 *arg)
 {
 	/* rem_ack is a pointer into shared memory that the AVP modifies */
 	volatile u32 *rem_ack = avp->msg_to_avp;
 	unsigned long endtime = jiffies + HZ / 5;
+	unsigned long flags;
 	int ret;
 
-	do {
-		ret = msg_check_ack(avp, cmd, arg);
-		usleep_range(1000, 5000);
-	} while (ret && time_before(jiffies, endtime));
+	if (avp->mbox_to_avp_read_irq >= 0)
+		wait_event_timeout(avp->send_wq,
+				   !(mbox_readl(MBOX_TO_AVP) & MBOX_MSG_VALID),
+				   HZ / 5);
+
+	while ((ret = msg_check_ack(avp, cmd, arg)) &&
+	       time_before(jiffies, endtime))
+		usleep_range(50, 100);
 
 	/* if we timed out, try one more time */
 	if (ret)
@@ -373,9 +564,65 @@ static int msg_wait_ack_locked(struct avp_info *avp, u32 cmd, u32 *arg)
 	/* clear out the ack */
 	*rem_ack = 0;
 	wmb();
+
+	spin_lock_irqsave(&avp->send_lock, flags);
+	if (!ret)
+		lat_record(&avp->conn_lat, avp->slot_stamp);
+	avp->slot_busy = false;
+	avp->slot_sync = false;
+	avp_send_kick(avp);
+	wake_up(&avp->send_wq);
+	spin_unlock_irqrestore(&avp->send_lock, flags);
 	return ret;
 }
 
+static const char *lat_bucket_names[AVP_LAT_BUCKETS] = {
+	"<64us", "<128us", "<256us", "<512us", "<1ms", "<2ms", "<4ms",
+	"<8ms", "<16ms", "<32ms", "<64ms", ">=64ms",
+};
+
+static void lat_show(struct seq_file *s, const char *name,
+		     struct avp_lat_hist *hist)
+{
+	int i;
+
+	seq_printf(s, "%s (max %uus):\n", name, hist->max_us);
+	for (i = 0; i < AVP_LAT_BUCKETS; i++)
+		seq_printf(s, "  %-7s %u\n", lat_bucket_names[i],
+			   hist->count[i]);
+}
+
+static int avp_latency_show(struct seq_file *s, void *data)
+{
+	struct avp_info *avp = s->private;
+	struct avp_lat_hist msg_lat, conn_lat;
+	unsigned int queued;
+	unsigned long flags;
+
+	spin_lock_irqsave(&avp->send_lock, flags);
+	msg_lat = avp->msg_lat;
+	conn_lat = avp->conn_lat;
+	queued = avp->send_count;
+	spin_unlock_irqrestore(&avp->send_lock, flags);
+
+	seq_printf(s, "queued: %u\n", queued);
+	lat_show(s, "messages, queued to acked", &msg_lat);
+	lat_show(s, "connects/disconnects, sent to answered", &conn_lat);
+	return 0;
+}
+
+static int avp_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, avp_latency_show, inode->i_private);
+}
+
+static const struct file_operations avp_latency_fops = {
+	.open		= avp_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int avp_trpc_send(struct trpc_endpoint *ep, void *buf, size_t len)
 {
 	struct avp_info *avp = tegra_avp;
@@ -408,10 +655,10 @@ static int avp_trpc_send(struct trpc_endpoint *ep, void *buf, size_t len)
 	msg.msg_len = len;
 
 	mutex_lock(&avp->to_avp_lock);
-	ret = msg_write(avp, &msg, sizeof(msg), buf, len);
+	ret = msg_queue(avp, &msg, sizeof(msg), buf, len);
 	mutex_unlock(&avp->to_avp_lock);
 
-	DBG(AVP_DBG_TRACE_TRPC_MSG, "%s: msg sent for %s (%x->%x) (%d)\n",
+	DBG(AVP_DBG_TRACE_TRPC_MSG, "%s: msg queued for %s (%x->%x) (%d)\n",
 	    __func__, trpc_name(ep), rinfo->loc_id, rinfo->rem_id, ret);
 	rinfo_put(rinfo);
 	return ret;
@@ -430,7 +677,7 @@ static int _send_disconnect(struct avp_info *avp, u32 port_id)
 	msg.port_id = port_id;
 
 	mutex_lock(&avp->to_avp_lock);
-	ret = msg_write(avp, &msg, sizeof(msg), NULL, 0);
+	ret = msg_write_sync(avp, &msg, sizeof(msg));
 	if (ret) {
 		pr_err("%s: remote has not acked last message (%x)\n", __func__,
 		       port_id);
@@ -591,7 +838,7 @@ static int avp_node_try_connect(struct trpc_node *node,
 	 */
 	recv_msg_lock(avp);
 	mutex_lock(&avp->to_avp_lock);
-	ret = msg_write(avp, &msg, sizeof(msg), NULL, 0);
+	ret = msg_write_sync(avp, &msg, sizeof(msg));
 	if (ret) {
 		pr_err("%s: remote has not acked last message (%s)\n", __func__,
 		       port_name);
@@ -769,7 +1016,9 @@ static int process_message(struct avp_info *avp, struct msg_data *raw_msg,
 
 	ret = trpc_send_msg(avp->rpc_node, rinfo->trpc_ep, port_msg->data,
 				 len, gfp_flags);
-	if (ret == -ENOMEM) {
+	/* a full ring holds the message back, unacked, until its reader
+	 * catches up, rather than losing it */
+	if (ret == -ENOMEM || ret == -EAGAIN) {
 		trpc_put(rinfo->trpc_ep);
 		rinfo_put(rinfo);
 		goto no_ack;
@@ -793,6 +1042,8 @@ static void process_avp_message(struct work_struct *work)
 {
 	struct avp_info *avp = container_of(work, struct avp_info, recv_work);
 	struct msg_data *msg = avp->msg_from_avp;
+	unsigned long flags;
+	bool shutdown;
 
 	mutex_lock(&avp->from_avp_lock);
 	rmb();
@@ -804,7 +1055,13 @@ static void process_avp_message(struct work_struct *work)
 		process_disconnect_locked(avp, msg);
 		break;
 	case CMD_MESSAGE:
-		process_message(avp, msg, GFP_KERNEL);
+		while (process_message(avp, msg, GFP_KERNEL) == -EAGAIN) {
+			spin_lock_irqsave(&avp->state_lock, flags);
+			shutdown = avp->shutdown;
+			spin_unlock_irqrestore(&avp->state_lock, flags);
+			if (shutdown)
+				break;
+		}
 		break;
 	default:
 		pr_err("%s: unknown cmd (%x) received\n", __func__, msg->cmd);
@@ -904,15 +1161,26 @@ static int avp_reset(struct avp_info *avp, unsigned long reset_addr)
 
 static void avp_halt(struct avp_info *avp)
 {
+	unsigned long flags;
+
 	/* ensure the AVP is halted */
 	writel(FLOW_MODE_STOP, FLOW_CTRL_HALT_COP_EVENTS);
 	tegra_periph_reset_assert(avp->cop_clk);
 
-	/* set up the initial memory areas and mailbox contents */
+	/* set up the initial memory areas and mailbox contents; the AVP
+	 * kernel acks the marker in the message area when it boots, and
+	 * nothing can be sent to it before that */
+	spin_lock_irqsave(&avp->send_lock, flags);
 	*((u32 *)avp->msg_from_avp) = 0;
 	*((u32 *)avp->msg_to_avp) = 0xfeedf00d;
 	mbox_writel(0, MBOX_FROM_AVP);
 	mbox_writel(0, MBOX_TO_AVP);
+	avp->send_count = 0;
+	avp->slot_busy = true;
+	avp->slot_sync = false;
+	avp->slot_stamp = ktime_set(0, 0);
+	spin_unlock_irqrestore(&avp->send_lock, flags);
+	wake_up(&avp->send_wq);
 }
 
 /* Note: CPU_PORT server and AVP_PORT client are registered with the avp
@@ -957,6 +1225,12 @@ static int avp_init(struct avp_info *avp, const char *fw_file)
 	}
 
 	enable_irq(avp->mbox_from_avp_pend_irq);
+	if (avp->mbox_to_avp_read_irq >= 0)
+		enable_irq(avp->mbox_to_avp_read_irq);
+	/* the boot marker is acked in the message area, and the mailbox may
+	 * well have been read before its interrupt was enabled, so poll for
+	 * it either way */
+	schedule_work(&avp->send_work);
 	/* Initialize the avp_svc *first*. This creates RPC_CPU_PORT to be
 	 * ready for remote commands. Then, connect to the
 	 * remote RPC_AVP_PORT to be able to send library load/unload and
@@ -983,6 +1257,9 @@ err_rpc_avp_port:
 	avp_svc_stop(avp->avp_svc);
 err_avp_svc_start:
 	disable_irq(avp->mbox_from_avp_pend_irq);
+	if (avp->mbox_to_avp_read_irq >= 0)
+		disable_irq(avp->mbox_to_avp_read_irq);
+	cancel_work_sync(&avp->send_work);
 err_reset:
 	avp_halt(avp);
 err_req_fw:
@@ -1005,6 +1282,9 @@ static void avp_uninit(struct avp_info *avp)
 
 	disable_irq(avp->mbox_from_avp_pend_irq);
 	cancel_work_sync(&avp->recv_work);
+	if (avp->mbox_to_avp_read_irq >= 0)
+		disable_irq(avp->mbox_to_avp_read_irq);
+	cancel_work_sync(&avp->send_work);
 
 	avp_halt(avp);
 
@@ -1425,6 +1705,9 @@ static int tegra_avp_suspend(struct platform_device *pdev, pm_message_t state)
 	}
 
 	disable_irq(avp->mbox_from_avp_pend_irq);
+	if (avp->mbox_to_avp_read_irq >= 0)
+		disable_irq(avp->mbox_to_avp_read_irq);
+	cancel_work_sync(&avp->send_work);
 
 	pr_info("avp_suspend: resume_addr=%lx\n", avp->resume_addr);
 	avp->resume_addr &= 0xfffffffeUL;
@@ -1457,6 +1740,11 @@ static int tegra_avp_resume(struct platform_device *pdev)
 	avp->suspending = false;
 	smp_wmb();
 	enable_irq(avp->mbox_from_avp_pend_irq);
+	if (avp->mbox_to_avp_read_irq >= 0)
+		enable_irq(avp->mbox_to_avp_read_irq);
+	/* the mailbox was drained before suspending, so no read interrupt
+	 * comes to push out what was queued in the meantime */
+	schedule_work(&avp->send_work);
 
 	pr_info("%s()-\n", __func__);
 
@@ -1496,6 +1784,18 @@ static int tegra_avp_probe(struct platform_device *pdev)
 		return -ENOMEM;
 	}
 
+	/* without the read interrupt, acks are polled for */
+	avp->mbox_to_avp_read_irq = platform_get_irq_byname(pdev,
+							"mbox_to_avp_read");
+
+	avp->send_queue = kcalloc(AVP_SEND_QUEUE_LEN,
+				  sizeof(struct avp_queued_msg), GFP_KERNEL);
+	if (!avp->send_queue) {
+		pr_err("%s: cannot allocate send queue\n", __func__);
+		ret = -ENOMEM;
+		goto err_alloc_send_queue;
+	}
+
 	avp->nvmap_drv = nvmap_create_client(nvmap_dev, "avp_core");
 	if (IS_ERR(avp->nvmap_drv)) {
 		pr_err("%s: cannot create drv nvmap client\n", __func__);
@@ -1557,6 +1857,9 @@ static int tegra_avp_probe(struct platform_device *pdev)
 	mutex_init(&avp->to_avp_lock);
 	mutex_init(&avp->from_avp_lock);
 	INIT_WORK(&avp->recv_work, process_avp_message);
+	spin_lock_init(&avp->send_lock);
+	init_waitqueue_head(&avp->send_wq);
+	INIT_WORK(&avp->send_work, avp_send_work);
 
 	mutex_init(&avp->libs_lock);
 	INIT_LIST_HEAD(&avp->libs);
@@ -1586,6 +1889,8 @@ static int tegra_avp_probe(struct platform_device *pdev)
 	memset(msg_area, 0, AVP_MSG_AREA_SIZE * 2);
 	avp->msg = ((avp->msg_area_addr >> 4) |
 			MBOX_MSG_VALID | MBOX_MSG_PENDING_INT_EN);
+	if (avp->mbox_to_avp_read_irq >= 0)
+		avp->msg |= MBOX_MSG_READ_INT_EN;
 	avp->msg_to_avp = msg_area;
 	avp->msg_from_avp = msg_area + AVP_MSG_AREA_SIZE;
 
@@ -1623,6 +1928,22 @@ static int tegra_avp_probe(struct platform_device *pdev)
 	}
 	disable_irq(avp->mbox_from_avp_pend_irq);
 
+	if (avp->mbox_to_avp_read_irq >= 0) {
+		ret = request_irq(avp->mbox_to_avp_read_irq,
+				  avp_mbox_read_isr, 0, TEGRA_AVP_NAME, avp);
+		if (ret) {
+			pr_err("%s: cannot register read irq handler\n",
+			       __func__);
+			goto err_req_irq_read;
+		}
+		disable_irq(avp->mbox_to_avp_read_irq);
+	}
+
+	avp->debugfs_root = debugfs_create_dir("tegra_avp", NULL);
+	if (!IS_ERR_OR_NULL(avp->debugfs_root))
+		debugfs_create_file("latency", 0444, avp->debugfs_root, avp,
+				    &avp_latency_fops);
+
 	tegra_avp = avp;
 
 	pr_info("%s: driver registered, kernel %lx(%p), msg area %lx/%lx\n",
@@ -1632,6 +1953,8 @@ static int tegra_avp_probe(struct platform_device *pdev)
 
 	return 0;
 
+err_req_irq_read:
+	free_irq(irq, avp);
 err_req_irq_pend:
 	misc_deregister(&avp->misc_dev);
 err_misc_reg:
@@ -1660,6 +1983,8 @@ err_nvmap_mmap:
 err_nvmap_alloc:
 	nvmap_client_put(avp->nvmap_drv);
 err_nvmap_create_drv_client:
+	kfree(avp->send_queue);
+err_alloc_send_queue:
 	kfree(avp);
 	tegra_avp = NULL;
 	return ret;
@@ -1680,8 +2005,13 @@ static int tegra_avp_remove(struct platform_device *pdev)
 	/* ensure that noone can open while we tear down */
 	mutex_unlock(&avp->open_lock);
 
+	debugfs_remove_recursive(avp->debugfs_root);
 	misc_deregister(&avp->misc_dev);
 
+	if (avp->mbox_to_avp_read_irq >= 0)
+		free_irq(avp->mbox_to_avp_read_irq, avp);
+	free_irq(avp->mbox_from_avp_pend_irq, avp);
+
 	avp_halt(avp);
 
 	avp_svc_destroy(avp->avp_svc);
@@ -1697,6 +2027,7 @@ static int tegra_avp_remove(struct platform_device *pdev)
 	nvmap_munmap(avp->kernel_handle, avp->kernel_data);
 	nvmap_free(avp->nvmap_drv, avp->kernel_handle);
 	nvmap_client_put(avp->nvmap_drv);
+	kfree(avp->send_queue);
 	kfree(avp);
 	tegra_avp = NULL;
 	return 0;
@@ -14,16 +14,21 @@
  */
 
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/dma-mapping.h>
 #include <linux/err.h>
 #include <linux/io.h>
 #include <linux/kthread.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/tegra_rpc.h>
 #include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <mach/clk.h>
 #include <mach/nvmap.h>
@@ -78,6 +83,54 @@ struct avp_clk {
 	struct avp_module	*mod;
 };
 
+/* Requests which can take long, i.e. nvmap allocation and pinning, are
+ * run on a pool of AVP_SVC_WORKERS workers so that they don't hold up the
+ * clock, reset and power requests behind them.  The AVP matches answers
+ * to requests by their order only, so the answers are still sent in the
+ * order the requests came in. */
+#define AVP_SVC_WORKERS		4
+
+struct svc_stat {
+	u32			count;
+	u32			max_us;
+	u64			total_us;
+};
+
+static const char *svc_names[] = {
+	[SVC_NVMAP_CREATE]		= "nvmap_create",
+	[SVC_NVMAP_FREE]		= "nvmap_free",
+	[SVC_NVMAP_ALLOC]		= "nvmap_alloc",
+	[SVC_NVMAP_PIN]			= "nvmap_pin",
+	[SVC_NVMAP_UNPIN]		= "nvmap_unpin",
+	[SVC_NVMAP_GET_ADDRESS]		= "nvmap_get_addr",
+	[SVC_NVMAP_FROM_ID]		= "nvmap_from_id",
+	[SVC_MODULE_CLOCK]		= "module_clock",
+	[SVC_MODULE_RESET]		= "module_reset",
+	[SVC_POWER_REGISTER]		= "power_register",
+	[SVC_POWER_UNREGISTER]		= "power_unregister",
+	[SVC_POWER_STARVATION]		= "power_starvation",
+	[SVC_POWER_BUSY_HINT]		= "power_busy_hint",
+	[SVC_POWER_BUSY_HINT_MULTI]	= "power_busy_hint_multi",
+	[SVC_DFS_GETSTATE]		= "dfs_get_state",
+	[SVC_POWER_MAXFREQ]		= "power_max_freq",
+	[SVC_PRINTF]			= "printf",
+	[SVC_AVP_WDT_RESET]		= "wdt_reset",
+	[SVC_DFS_GET_CLK_UTIL]		= "dfs_get_clk_util",
+};
+#define NUM_SVC_IDS		ARRAY_SIZE(svc_names)
+
+struct svc_req {
+	struct list_head		list;
+	struct work_struct		work;
+	struct avp_svc_info		*avp_svc;
+	ktime_t				stamp;
+	bool				done;
+
+	u8				buf[TEGRA_RPC_MAX_MSG_LEN];
+	size_t				resp_len;
+	u8				resp[TEGRA_RPC_MAX_MSG_LEN];
+};
+
 struct avp_svc_info {
 	struct avp_clk			clks[NUM_CLK_REQUESTS];
 	/* used for dvfs */
@@ -89,14 +142,31 @@ struct avp_svc_info {
 	struct trpc_endpoint		*cpu_ep;
 	struct task_struct		*svc_thread;
 
+	struct workqueue_struct		*svc_wq;
+	/* requests waiting to be answered, in the order they came in */
+	struct list_head		reply_list;
+	/* serializes the answers, protects the list and the stats */
+	struct mutex			reply_lock;
+	atomic_t			slow_pending;
+	wait_queue_head_t		slow_wq;
+	struct svc_stat			stats[NUM_SVC_IDS];
+	struct dentry			*debugfs_root;
+
 	/* client for remote allocations, for easy tear down */
 	struct nvmap_client		*nvmap_remote;
 	struct trpc_node		*rpc_node;
 };
 
+static void svc_set_resp(struct svc_req *req, void *resp, size_t len)
+{
+	BUG_ON(len > TEGRA_RPC_MAX_MSG_LEN);
+	memcpy(req->resp, resp, len);
+	req->resp_len = len;
+}
+
 static void do_svc_nvmap_create(struct avp_svc_info *avp_svc,
 				struct svc_msg *_msg,
-				size_t len)
+				struct svc_req *req)
 {
 	struct svc_nvmap_create *msg = (struct svc_nvmap_create *)_msg;
 	struct svc_nvmap_create_resp resp;
@@ -115,14 +185,13 @@ static void do_svc_nvmap_create(struct avp_svc_info *avp_svc,
 	resp.svc_id = SVC_NVMAP_CREATE_RESPONSE;
 	resp.err = err;
 	resp.handle_id = handle_id;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
-	/* TODO: do we need to put the handle if send_msg failed? */
+	svc_set_resp(req, &resp, sizeof(resp));
+	/* TODO: do we need to put the handle if sending the answer fails? */
 }
 
 static void do_svc_nvmap_alloc(struct avp_svc_info *avp_svc,
 			       struct svc_msg *_msg,
-			       size_t len)
+			       struct svc_req *req)
 {
 	struct svc_nvmap_alloc *msg = (struct svc_nvmap_alloc *)_msg;
 	struct svc_common_resp resp;
@@ -180,13 +249,12 @@ static void do_svc_nvmap_alloc(struct avp_svc_info *avp_svc,
 out:
 	resp.svc_id = SVC_NVMAP_ALLOC_RESPONSE;
 	resp.err = err;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_nvmap_free(struct avp_svc_info *avp_svc,
 			      struct svc_msg *_msg,
-			      size_t len)
+			      struct svc_req *req)
 {
 	struct svc_nvmap_free *msg = (struct svc_nvmap_free *)_msg;
 
@@ -195,7 +263,7 @@ static void do_svc_nvmap_free(struct avp_svc_info *avp_svc,
 
 static void do_svc_nvmap_pin(struct avp_svc_info *avp_svc,
 			     struct svc_msg *_msg,
-			     size_t len)
+			     struct svc_req *req)
 {
 	struct svc_nvmap_pin *msg = (struct svc_nvmap_pin *)_msg;
 	struct svc_nvmap_pin_resp resp;
@@ -219,13 +287,12 @@ static void do_svc_nvmap_pin(struct avp_svc_info *avp_svc,
 out:
 	resp.svc_id = SVC_NVMAP_PIN_RESPONSE;
 	resp.addr = addr;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_nvmap_unpin(struct avp_svc_info *avp_svc,
 			       struct svc_msg *_msg,
-			       size_t len)
+			       struct svc_req *req)
 {
 	struct svc_nvmap_unpin *msg = (struct svc_nvmap_unpin *)_msg;
 	struct svc_common_resp resp;
@@ -236,13 +303,12 @@ static void do_svc_nvmap_unpin(struct avp_svc_info *avp_svc,
 
 	resp.svc_id = SVC_NVMAP_UNPIN_RESPONSE;
 	resp.err = 0;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_nvmap_from_id(struct avp_svc_info *avp_svc,
 				 struct svc_msg *_msg,
-				 size_t len)
+				 struct svc_req *req)
 {
 	struct svc_nvmap_from_id *msg = (struct svc_nvmap_from_id *)_msg;
 	struct svc_common_resp resp;
@@ -259,13 +325,12 @@ static void do_svc_nvmap_from_id(struct avp_svc_info *avp_svc,
 
 	resp.svc_id = SVC_NVMAP_FROM_ID_RESPONSE;
 	resp.err = err;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_nvmap_get_addr(struct avp_svc_info *avp_svc,
 				  struct svc_msg *_msg,
-				  size_t len)
+				  struct svc_req *req)
 {
 	struct svc_nvmap_get_addr *msg = (struct svc_nvmap_get_addr *)_msg;
 	struct svc_nvmap_get_addr_resp resp;
@@ -273,13 +338,12 @@ static void do_svc_nvmap_get_addr(struct avp_svc_info *avp_svc,
 	resp.svc_id = SVC_NVMAP_GET_ADDRESS_RESPONSE;
 	resp.addr = nvmap_handle_address(avp_svc->nvmap_remote, msg->handle_id);
 	resp.addr += msg->offs;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_pwr_register(struct avp_svc_info *avp_svc,
 				struct svc_msg *_msg,
-				size_t len)
+				struct svc_req *req)
 {
 	struct svc_pwr_register *msg = (struct svc_pwr_register *)_msg;
 	struct svc_pwr_register_resp resp;
@@ -288,8 +352,7 @@ static void do_svc_pwr_register(struct avp_svc_info *avp_svc,
 	resp.err = 0;
 	resp.client_id = msg->client_id;
 
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static struct avp_module *find_avp_module(struct avp_svc_info *avp_svc, u32 id)
@@ -301,7 +364,7 @@ static struct avp_module *find_avp_module(struct avp_svc_info *avp_svc, u32 id)
 
 static void do_svc_module_reset(struct avp_svc_info *avp_svc,
 				struct svc_msg *_msg,
-				size_t len)
+				struct svc_req *req)
 {
 	struct svc_module_ctrl *msg = (struct svc_module_ctrl *)_msg;
 	struct svc_common_resp resp;
@@ -328,13 +391,12 @@ static void do_svc_module_reset(struct avp_svc_info *avp_svc,
 
 send_response:
 	resp.svc_id = SVC_MODULE_RESET_RESPONSE;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_module_clock(struct avp_svc_info *avp_svc,
 				struct svc_msg *_msg,
-				size_t len)
+				struct svc_req *req)
 {
 	struct svc_module_ctrl *msg = (struct svc_module_ctrl *)_msg;
 	struct svc_common_resp resp;
@@ -372,59 +434,54 @@ static void do_svc_module_clock(struct avp_svc_info *avp_svc,
 
 send_response:
 	resp.svc_id = SVC_MODULE_CLOCK_RESPONSE;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_null_response(struct avp_svc_info *avp_svc,
 				 struct svc_msg *_msg,
-				 size_t len, u32 resp_svc_id)
+				 struct svc_req *req, u32 resp_svc_id)
 {
 	struct svc_common_resp resp;
 	resp.svc_id = resp_svc_id;
 	resp.err = 0;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_dfs_get_state(struct avp_svc_info *avp_svc,
 				 struct svc_msg *_msg,
-				 size_t len)
+				 struct svc_req *req)
 {
 	struct svc_dfs_get_state_resp resp;
 	resp.svc_id = SVC_DFS_GETSTATE_RESPONSE;
 	resp.state = AVP_DFS_STATE_STOPPED;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_dfs_get_clk_util(struct avp_svc_info *avp_svc,
 				    struct svc_msg *_msg,
-				    size_t len)
+				    struct svc_req *req)
 {
 	struct svc_dfs_get_clk_util_resp resp;
 
 	resp.svc_id = SVC_DFS_GET_CLK_UTIL_RESPONSE;
 	resp.err = 0;
 	memset(&resp.usage, 0, sizeof(struct avp_clk_usage));
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_pwr_max_freq(struct avp_svc_info *avp_svc,
 				struct svc_msg *_msg,
-				size_t len)
+				struct svc_req *req)
 {
 	struct svc_pwr_max_freq_resp resp;
 
 	resp.svc_id = SVC_POWER_MAXFREQ;
 	resp.freq = 0;
-	trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep, &resp,
-		      sizeof(resp), GFP_KERNEL);
+	svc_set_resp(req, &resp, sizeof(resp));
 }
 
 static void do_svc_printf(struct avp_svc_info *avp_svc, struct svc_msg *_msg,
-			  size_t len)
+			  struct svc_req *req)
 {
 	struct svc_printf *msg = (struct svc_printf *)_msg;
 	char tmp_str[SVC_MAX_STRING_LEN];
@@ -434,44 +491,43 @@ static void do_svc_printf(struct avp_svc_info *avp_svc, struct svc_msg *_msg,
 	pr_info("[AVP]: %s", tmp_str);
 }
 
-static int dispatch_svc_message(struct avp_svc_info *avp_svc,
-				struct svc_msg *msg,
-				size_t len)
+static int run_svc_message(struct avp_svc_info *avp_svc, struct svc_req *req)
 {
+	struct svc_msg *msg = (struct svc_msg *)req->buf;
 	int ret = 0;
 
 	switch (msg->svc_id) {
 	case SVC_NVMAP_CREATE:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got nvmap_create\n", __func__);
-		do_svc_nvmap_create(avp_svc, msg, len);
+		do_svc_nvmap_create(avp_svc, msg, req);
 		break;
 	case SVC_NVMAP_ALLOC:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got nvmap_alloc\n", __func__);
-		do_svc_nvmap_alloc(avp_svc, msg, len);
+		do_svc_nvmap_alloc(avp_svc, msg, req);
 		break;
 	case SVC_NVMAP_FREE:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got nvmap_free\n", __func__);
-		do_svc_nvmap_free(avp_svc, msg, len);
+		do_svc_nvmap_free(avp_svc, msg, req);
 		break;
 	case SVC_NVMAP_PIN:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got nvmap_pin\n", __func__);
-		do_svc_nvmap_pin(avp_svc, msg, len);
+		do_svc_nvmap_pin(avp_svc, msg, req);
 		break;
 	case SVC_NVMAP_UNPIN:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got nvmap_unpin\n", __func__);
-		do_svc_nvmap_unpin(avp_svc, msg, len);
+		do_svc_nvmap_unpin(avp_svc, msg, req);
 		break;
 	case SVC_NVMAP_FROM_ID:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got nvmap_from_id\n", __func__);
-		do_svc_nvmap_from_id(avp_svc, msg, len);
+		do_svc_nvmap_from_id(avp_svc, msg, req);
 		break;
 	case SVC_NVMAP_GET_ADDRESS:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got nvmap_get_addr\n", __func__);
-		do_svc_nvmap_get_addr(avp_svc, msg, len);
+		do_svc_nvmap_get_addr(avp_svc, msg, req);
 		break;
 	case SVC_POWER_REGISTER:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got power_register\n", __func__);
-		do_svc_pwr_register(avp_svc, msg, len);
+		do_svc_pwr_register(avp_svc, msg, req);
 		break;
 	case SVC_POWER_UNREGISTER:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got power_unregister\n", __func__);
@@ -486,32 +542,32 @@ static int dispatch_svc_message(struct avp_svc_info *avp_svc,
 	case SVC_POWER_STARVATION:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got power busy/starve hint\n",
 		    __func__);
-		do_svc_null_response(avp_svc, msg, len, SVC_POWER_RESPONSE);
+		do_svc_null_response(avp_svc, msg, req, SVC_POWER_RESPONSE);
 		break;
 	case SVC_POWER_MAXFREQ:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got power get_max_freq\n",
 		    __func__);
-		do_svc_pwr_max_freq(avp_svc, msg, len);
+		do_svc_pwr_max_freq(avp_svc, msg, req);
 		break;
 	case SVC_DFS_GETSTATE:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got dfs_get_state\n", __func__);
-		do_svc_dfs_get_state(avp_svc, msg, len);
+		do_svc_dfs_get_state(avp_svc, msg, req);
 		break;
 	case SVC_MODULE_RESET:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got module_reset\n", __func__);
-		do_svc_module_reset(avp_svc, msg, len);
+		do_svc_module_reset(avp_svc, msg, req);
 		break;
 	case SVC_MODULE_CLOCK:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got module_clock\n", __func__);
-		do_svc_module_clock(avp_svc, msg, len);
+		do_svc_module_clock(avp_svc, msg, req);
 		break;
 	case SVC_DFS_GET_CLK_UTIL:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got get_clk_util\n", __func__);
-		do_svc_dfs_get_clk_util(avp_svc, msg, len);
+		do_svc_dfs_get_clk_util(avp_svc, msg, req);
 		break;
 	case SVC_PRINTF:
 		DBG(AVP_DBG_TRACE_SVC, "%s: got remote printf\n", __func__);
-		do_svc_printf(avp_svc, msg, len);
+		do_svc_printf(avp_svc, msg, req);
 		break;
 	case SVC_AVP_WDT_RESET:
 		pr_err("avp_svc: AVP has been reset by watchdog\n");
@@ -525,11 +581,147 @@ static int dispatch_svc_message(struct avp_svc_info *avp_svc,
 	return ret;
 }
 
+/* marks req as done and sends the answers which are no longer held up
+ * by an earlier request that is still running */
+static void svc_complete(struct avp_svc_info *avp_svc, struct svc_req *req)
+{
+	struct svc_msg *msg;
+	struct svc_stat *stat;
+	u32 us;
+
+	mutex_lock(&avp_svc->reply_lock);
+	req->done = true;
+	while (!list_empty(&avp_svc->reply_list)) {
+		req = list_first_entry(&avp_svc->reply_list, struct svc_req,
+				       list);
+		if (!req->done)
+			break;
+		list_del(&req->list);
+
+		if (req->resp_len)
+			trpc_send_msg(avp_svc->rpc_node, avp_svc->cpu_ep,
+				      req->resp, req->resp_len, GFP_KERNEL);
+
+		msg = (struct svc_msg *)req->buf;
+		if (msg->svc_id < NUM_SVC_IDS) {
+			stat = &avp_svc->stats[msg->svc_id];
+			us = ktime_us_delta(ktime_get(), req->stamp);
+			stat->count++;
+			stat->total_us += us;
+			if (us > stat->max_us)
+				stat->max_us = us;
+		}
+		kfree(req);
+	}
+	mutex_unlock(&avp_svc->reply_lock);
+}
+
+static void svc_work(struct work_struct *work)
+{
+	struct svc_req *req = container_of(work, struct svc_req, work);
+	struct avp_svc_info *avp_svc = req->avp_svc;
+
+	run_svc_message(avp_svc, req);
+	if (atomic_dec_and_test(&avp_svc->slow_pending))
+		wake_up(&avp_svc->slow_wq);
+	svc_complete(avp_svc, req);
+}
+
+enum {
+	SVC_CLASS_FAST,
+	SVC_CLASS_NVMAP,
+	SVC_CLASS_SLOW,
+};
+
+static int svc_class(u32 svc_id)
+{
+	switch (svc_id) {
+	case SVC_NVMAP_ALLOC:
+	case SVC_NVMAP_PIN:
+		return SVC_CLASS_SLOW;
+	case SVC_NVMAP_CREATE:
+	case SVC_NVMAP_FREE:
+	case SVC_NVMAP_UNPIN:
+	case SVC_NVMAP_FROM_ID:
+	case SVC_NVMAP_GET_ADDRESS:
+		return SVC_CLASS_NVMAP;
+	default:
+		return SVC_CLASS_FAST;
+	}
+}
+
+/* Slow requests are handed to the workers.  The AVP waits for the answer
+ * to an allocation before pinning the handle, so they don't depend on
+ * each other, but the other nvmap requests may act on a handle which is
+ * still being allocated or pinned and wait for those to finish first.
+ * Everything else is run right away. */
+static void dispatch_svc_message(struct avp_svc_info *avp_svc,
+				 struct svc_req *req)
+{
+	struct svc_msg *msg = (struct svc_msg *)req->buf;
+	int class = svc_class(msg->svc_id);
+
+	mutex_lock(&avp_svc->reply_lock);
+	list_add_tail(&req->list, &avp_svc->reply_list);
+	mutex_unlock(&avp_svc->reply_lock);
+
+	if (class == SVC_CLASS_SLOW) {
+		DBG(AVP_DBG_TRACE_SVC, "%s: queueing svc 0x%x\n", __func__,
+		    msg->svc_id);
+		atomic_inc(&avp_svc->slow_pending);
+		INIT_WORK(&req->work, svc_work);
+		queue_work(avp_svc->svc_wq, &req->work);
+		return;
+	}
+
+	if (class == SVC_CLASS_NVMAP)
+		wait_event(avp_svc->slow_wq,
+			   !atomic_read(&avp_svc->slow_pending));
+	run_svc_message(avp_svc, req);
+	svc_complete(avp_svc, req);
+}
+
+/* per request type: count, average and max time from the request coming
+ * in to its answer going out */
+static int svc_latency_show(struct seq_file *s, void *data)
+{
+	struct avp_svc_info *avp_svc = s->private;
+	struct svc_stat stats[NUM_SVC_IDS];
+	int i;
+
+	mutex_lock(&avp_svc->reply_lock);
+	memcpy(stats, avp_svc->stats, sizeof(stats));
+	mutex_unlock(&avp_svc->reply_lock);
+
+	seq_printf(s, "%-22s %8s %10s %10s\n", "request", "count", "avg_us",
+		   "max_us");
+	for (i = 0; i < NUM_SVC_IDS; i++) {
+		if (!svc_names[i] || !stats[i].count)
+			continue;
+		seq_printf(s, "%-22s %8u %10llu %10u\n", svc_names[i],
+			   stats[i].count,
+			   div_u64(stats[i].total_us, stats[i].count),
+			   stats[i].max_us);
+	}
+	return 0;
+}
+
+static int svc_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, svc_latency_show, inode->i_private);
+}
+
+static const struct file_operations svc_latency_fops = {
+	.open		= svc_latency_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int avp_svc_thread(void *data)
 {
 	struct avp_svc_info *avp_svc = data;
-	u8 buf[TEGRA_RPC_MAX_MSG_LEN];
-	struct svc_msg *msg = (struct svc_msg *)buf;
+	struct svc_req *req;
 	int ret;
 
 	BUG_ON(!avp_svc->cpu_ep);
@@ -544,22 +736,35 @@ static int avp_svc_thread(void *data)
 	pr_info("%s: got remote peer\n", __func__);
 
 	while (!kthread_should_stop()) {
+		req = kzalloc(sizeof(struct svc_req), GFP_KERNEL);
+		if (!req) {
+			pr_err("%s: can't alloc request\n", __func__);
+			msleep(10);
+			continue;
+		}
+
 		DBG(AVP_DBG_TRACE_SVC, "%s: waiting for message\n", __func__);
-		ret = trpc_recv_msg(avp_svc->rpc_node, avp_svc->cpu_ep, buf,
+		ret = trpc_recv_msg(avp_svc->rpc_node, avp_svc->cpu_ep, req->buf,
 				    TEGRA_RPC_MAX_MSG_LEN, -1);
 		DBG(AVP_DBG_TRACE_SVC, "%s: got message\n", __func__);
 		if (ret < 0) {
 			pr_err("%s: couldn't receive msg\n", __func__);
+			kfree(req);
 			/* XXX: port got closed? we should exit? */
 			goto err;
 		} else if (!ret) {
 			pr_err("%s: received msg of len 0?!\n", __func__);
+			kfree(req);
 			continue;
 		}
-		dispatch_svc_message(avp_svc, msg, ret);
+		req->avp_svc = avp_svc;
+		req->stamp = ktime_get();
+		dispatch_svc_message(avp_svc, req);
 	}
 
 err:
+	/* the workers still answer on the port */
+	flush_workqueue(avp_svc->svc_wq);
 	trpc_put(avp_svc->cpu_ep);
 	pr_info("%s: done\n", __func__);
 	return ret;
@@ -704,6 +909,23 @@ struct avp_svc_info *avp_svc_init(struct platform_device *pdev,
 	avp_svc->rpc_node = rpc_node;
 
 	mutex_init(&avp_svc->clk_lock);
+	INIT_LIST_HEAD(&avp_svc->reply_list);
+	mutex_init(&avp_svc->reply_lock);
+	atomic_set(&avp_svc->slow_pending, 0);
+	init_waitqueue_head(&avp_svc->slow_wq);
+
+	avp_svc->svc_wq = alloc_workqueue("avp_svc", WQ_UNBOUND,
+					  AVP_SVC_WORKERS);
+	if (!avp_svc->svc_wq) {
+		pr_err("avp_svc: Couldn't create workqueue\n");
+		ret = -ENOMEM;
+		goto err_get_clks;
+	}
+
+	avp_svc->debugfs_root = debugfs_create_dir("tegra_avp_svc", NULL);
+	if (!IS_ERR_OR_NULL(avp_svc->debugfs_root))
+		debugfs_create_file("latency", 0444, avp_svc->debugfs_root,
+				    avp_svc, &svc_latency_fops);
 
 	return avp_svc;
 
@@ -715,6 +937,7 @@ err_get_clks:
 		clk_put(avp_svc->sclk);
 	if (!IS_ERR_OR_NULL(avp_svc->emcclk))
 		clk_put(avp_svc->emcclk);
+	kfree(avp_svc);
 err_alloc:
 	return ERR_PTR(ret);
 }
@@ -723,6 +946,9 @@ void avp_svc_destroy(struct avp_svc_info *avp_svc)
 {
 	int i;
 
+	debugfs_remove_recursive(avp_svc->debugfs_root);
+	destroy_workqueue(avp_svc->svc_wq);
+
 	for (i = 0; i < NUM_CLK_REQUESTS; i++)
 		clk_put(avp_svc->clks[i].clk);
 	clk_put(avp_svc->sclk);
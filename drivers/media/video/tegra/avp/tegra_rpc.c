@@ -21,8 +21,10 @@
 #include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/err.h>
+#include <linux/gfp.h>
 #include <linux/kref.h>
 #include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rbtree.h>
@@ -35,10 +37,18 @@
 
 #include "trpc.h"
 
+/* how long a sender which may sleep waits for a credit on a full ring */
+#define TRPC_CREDIT_TIMEOUT	(HZ)
+
 struct trpc_port;
 struct trpc_endpoint {
-	struct list_head	msg_list;
+	/* receive ring, NULL for endpoints which have a send op. rx_head is
+	 * our copy of ring->head, which the reader may be able to write */
+	struct tegra_rpc_ring	*ring;
+	u32			rx_head;
 	wait_queue_head_t	msg_waitq;
+	wait_queue_head_t	credit_waitq;
+	unsigned int		credit_stalls;
 
 	struct trpc_endpoint	*out;
 	struct trpc_port	*port;
@@ -77,8 +87,6 @@ module_param_named(debug_mask, trpc_debug_mask, uint, S_IWUSR | S_IRUGO);
 	do { if (trpc_debug_mask & (flag)) pr_info(args); } while (0)
 
 struct tegra_rpc_info {
-	struct kmem_cache		*msg_cache;
-
 	spinlock_t			ports_lock;
 	struct rb_root			ports;
 
@@ -86,18 +94,9 @@ struct tegra_rpc_info {
 	struct mutex			node_lock;
 };
 
-struct trpc_msg {
-	struct list_head		list;
-
-	size_t				len;
-	u8				payload[TEGRA_RPC_MAX_MSG_LEN];
-};
-
 static struct tegra_rpc_info *tegra_rpc;
 static struct dentry *trpc_debug_root;
 
-static struct trpc_msg *dequeue_msg_locked(struct trpc_endpoint *ep);
-
 /* a few accessors for the outside world to keep the trpc_endpoint struct
  * definition private to this module */
 void *trpc_priv(struct trpc_endpoint *ep)
@@ -125,19 +124,57 @@ static inline bool is_closed(struct trpc_port *port)
 	return port->closed;
 }
 
+/* The rings are whole pages so that they can be mapped to userspace, and
+ * are not vmalloc'ed since the last reference to a port may be dropped
+ * from interrupt context. */
+static inline int ring_order(void)
+{
+	return get_order(sizeof(struct tegra_rpc_ring));
+}
+
+static struct tegra_rpc_ring *ring_alloc(struct trpc_ep_ops *ops)
+{
+	struct tegra_rpc_ring *ring;
+
+	/* messages for endpoints with a send op are never queued */
+	if (ops && ops->send)
+		return NULL;
+
+	ring = (struct tegra_rpc_ring *)__get_free_pages(GFP_KERNEL |
+							 __GFP_ZERO,
+							 ring_order());
+	if (ring)
+		ring->num_slots = TEGRA_RPC_RING_SLOTS;
+	return ring;
+}
+
+static void ring_free(struct tegra_rpc_ring *ring)
+{
+	if (ring)
+		free_pages((unsigned long)ring, ring_order());
+}
+
+/* the number of queued messages. The tail may have been written by a
+ * reader which has the ring mapped, so a bogus one is taken as a full
+ * ring rather than trusted. */
+static u32 ring_used(struct trpc_endpoint *ep)
+{
+	u32 used = ep->rx_head - ACCESS_ONCE(ep->ring->tail);
+
+	return min_t(u32, used, TEGRA_RPC_RING_SLOTS);
+}
+
+static inline u32 ring_credits(struct trpc_endpoint *ep)
+{
+	return TEGRA_RPC_RING_SLOTS - ring_used(ep);
+}
+
 static void rpc_port_free(struct tegra_rpc_info *info, struct trpc_port *port)
 {
-	struct trpc_msg *msg;
 	int i;
 
-	for (i = 0; i < 2; ++i) {
-		struct list_head *list = &port->peers[i].msg_list;
-		while (!list_empty(list)) {
-			msg = list_first_entry(list, struct trpc_msg, list);
-			list_del(&msg->list);
-			kmem_cache_free(info->msg_cache, msg);
-		}
-	}
+	for (i = 0; i < 2; ++i)
+		ring_free(port->peers[i].ring);
 	kfree(port);
 }
 
@@ -236,8 +273,8 @@ static struct trpc_port *rpc_port_alloc(const char *name)
 	strlcpy(port->name, name, TEGRA_RPC_MAX_NAME_LEN);
 	for (i = 0; i < 2; i++) {
 		struct trpc_endpoint *ep = port->peers + i;
-		INIT_LIST_HEAD(&ep->msg_list);
 		init_waitqueue_head(&ep->msg_waitq);
+		init_waitqueue_head(&ep->credit_waitq);
 		ep->port = port;
 	}
 	port->peers[0].out = &port->peers[1];
@@ -258,15 +295,19 @@ static inline void handle_port_connected(struct trpc_port *port)
 			complete(port->peers[i].connect_done);
 }
 
+/* takes over the ring, which was allocated before any locks were taken */
 static inline void _ready_ep(struct trpc_endpoint *ep,
 			     struct trpc_node *owner,
 			     struct trpc_ep_ops *ops,
-			     void *priv)
+			     void *priv,
+			     struct tegra_rpc_ring **ring)
 {
 	ep->ready = true;
 	ep->owner = owner;
 	ep->ops = ops;
 	ep->priv = priv;
+	ep->ring = *ring;
+	*ring = NULL;
 }
 
 /* this keeps a reference on the port */
@@ -274,7 +315,8 @@ static struct trpc_endpoint *_create_peer(struct tegra_rpc_info *info,
 					  struct trpc_node *owner,
 					  struct trpc_endpoint *ep,
 					  struct trpc_ep_ops *ops,
-					  void *priv)
+					  void *priv,
+					  struct tegra_rpc_ring **ring)
 {
 	struct trpc_port *port = ep->port;
 	struct trpc_endpoint *peer = ep->out;
@@ -286,7 +328,7 @@ static struct trpc_endpoint *_create_peer(struct tegra_rpc_info *info,
 		peer = NULL;
 		goto out;
 	}
-	_ready_ep(peer, owner, ops, priv);
+	_ready_ep(peer, owner, ops, priv, ring);
 	if (WARN_ON(!is_connected(port)))
 		pr_warning("%s: created peer but no connection established?!\n",
 			   __func__);
@@ -306,6 +348,7 @@ struct trpc_endpoint *trpc_create(struct trpc_node *owner, const char *name,
 	struct trpc_endpoint *ep;
 	struct trpc_port *new_port;
 	struct trpc_port *port;
+	struct tegra_rpc_ring *ring;
 	unsigned long flags;
 
 	BUG_ON(!owner);
@@ -314,8 +357,11 @@ struct trpc_endpoint *trpc_create(struct trpc_node *owner, const char *name,
 	 * is slightly inefficient, but it allows us to do the allocation
 	 * without holding our ports_lock spinlock. */
 	new_port = rpc_port_alloc(name);
-	if (!new_port) {
+	ring = ring_alloc(ops);
+	if (!new_port || (!ring && !(ops && ops->send))) {
 		pr_err("%s: can't allocate memory for '%s'\n", __func__, name);
+		kfree(new_port);
+		ring_free(ring);
 		return ERR_PTR(-ENOMEM);
 	}
 
@@ -326,7 +372,8 @@ struct trpc_endpoint *trpc_create(struct trpc_node *owner, const char *name,
 		/* There was already a port by that name in the rb_tree,
 		 * so just try to create its peer[1], i.e. peer for peer[0]
 		 */
-		ep = _create_peer(info, owner, &port->peers[0], ops, priv);
+		ep = _create_peer(info, owner, &port->peers[0], ops, priv,
+				  &ring);
 		if (!ep) {
 			pr_err("%s: port '%s' is not in a connectable state\n",
 			       __func__, port->name);
@@ -339,9 +386,10 @@ struct trpc_endpoint *trpc_create(struct trpc_node *owner, const char *name,
 	 * it, and thus noone could have gotten a reference to this port
 	 * and thus the state couldn't have been touched */
 	ep = &port->peers[0];
-	_ready_ep(ep, owner, ops, priv);
+	_ready_ep(ep, owner, ops, priv, &ring);
 out:
 	spin_unlock_irqrestore(&info->ports_lock, flags);
+	ring_free(ring);
 	return ep;
 }
 
@@ -352,13 +400,19 @@ struct trpc_endpoint *trpc_create_peer(struct trpc_node *owner,
 {
 	struct tegra_rpc_info *info = tegra_rpc;
 	struct trpc_endpoint *peer;
+	struct tegra_rpc_ring *ring;
 	unsigned long flags;
 
 	BUG_ON(!owner);
 
+	ring = ring_alloc(ops);
+	if (!ring && !(ops && ops->send))
+		return NULL;
+
 	spin_lock_irqsave(&info->ports_lock, flags);
-	peer = _create_peer(info, owner, ep, ops, priv);
+	peer = _create_peer(info, owner, ep, ops, priv, &ring);
 	spin_unlock_irqrestore(&info->ports_lock, flags);
+	ring_free(ring);
 	return peer;
 }
 
@@ -447,6 +501,9 @@ void trpc_close(struct trpc_endpoint *ep)
 	BUG_ON(!ep->ready);
 	ep->ready = false;
 	port->closed = true;
+	/* a sender on either side may be waiting for a credit */
+	wake_up_all(&ep->credit_waitq);
+	wake_up_all(&peer->credit_waitq);
 	if (peer->ready) {
 		need_close_op = true;
 		/* the peer may be waiting for a message */
@@ -515,15 +572,32 @@ static inline int _ep_id(struct trpc_endpoint *ep)
 	return ep - ep->port->peers;
 }
 
+static bool __has_credit(struct trpc_endpoint *ep)
+{
+	struct trpc_port *port = ep->port;
+	unsigned long flags;
+	bool ret;
+
+	spin_lock_irqsave(&port->lock, flags);
+	ret = ring_credits(ep) || is_closed(port);
+	spin_unlock_irqrestore(&port->lock, flags);
+	return ret;
+}
+
+/* Copies the message straight into the next slot of the peer's ring. Each
+ * free slot is a credit; when there are none left, senders which can't
+ * sleep get -ENOMEM, and the others wait for the reader to return one, or
+ * get -EAGAIN if it doesn't within TRPC_CREDIT_TIMEOUT. The message is not
+ * queued in either case, so it is up to the sender to try again. */
 static int queue_msg(struct trpc_node *src, struct trpc_endpoint *from,
 		     void *buf, size_t len, gfp_t gfp_flags)
 {
-	struct tegra_rpc_info *info = tegra_rpc;
 	struct trpc_endpoint *peer = from->out;
 	struct trpc_port *port = from->port;
-	struct trpc_msg *msg;
+	struct tegra_rpc_ring_slot *slot;
 	unsigned long flags;
-	int ret;
+	u32 used;
+	long ret;
 
 	BUG_ON(len > TEGRA_RPC_MAX_MSG_LEN);
 	/* shouldn't be enqueueing to the endpoint */
@@ -532,42 +606,68 @@ static int queue_msg(struct trpc_node *src, struct trpc_endpoint *from,
 	DBG(TRPC_TRACE_MSG, "%s: queueing message for %s.%d\n", __func__,
 	    port->name, _ep_id(peer));
 
-	msg = kmem_cache_alloc(info->msg_cache, gfp_flags);
-	if (!msg) {
-		pr_err("%s: can't alloc memory for msg\n", __func__);
-		return -ENOMEM;
-	}
+	spin_lock_irqsave(&port->lock, flags);
+	for (;;) {
+		if (is_closed(port)) {
+			pr_err("%s: cannot send message for closed port %s.%d\n",
+			       __func__, port->name, _ep_id(peer));
+			ret = -ECONNRESET;
+			goto err;
+		} else if (!is_connected(port)) {
+			pr_err("%s: cannot send message for unconnected port "
+			       "%s.%d\n", __func__, port->name, _ep_id(peer));
+			ret = -ENOTCONN;
+			goto err;
+		}
 
-	memcpy(msg->payload, buf, len);
-	msg->len = len;
+		if (ring_credits(peer))
+			break;
+		peer->credit_stalls++;
+		if (!(gfp_flags & __GFP_WAIT)) {
+			ret = -ENOMEM;
+			goto err;
+		}
+		spin_unlock_irqrestore(&port->lock, flags);
 
-	spin_lock_irqsave(&port->lock, flags);
-	if (is_closed(port)) {
-		pr_err("%s: cannot send message for closed port %s.%d\n",
-		       __func__, port->name, _ep_id(peer));
-		ret = -ECONNRESET;
-		goto err;
-	} else if (!is_connected(port)) {
-		pr_err("%s: cannot send message for unconnected port %s.%d\n",
-		       __func__, port->name, _ep_id(peer));
-		ret = -ENOTCONN;
-		goto err;
+		DBG(TRPC_TRACE_MSG, "%s: waiting for credit for %s.%d\n",
+		    __func__, port->name, _ep_id(peer));
+		ret = wait_event_timeout(peer->credit_waitq,
+					 __has_credit(peer),
+					 TRPC_CREDIT_TIMEOUT);
+
+		spin_lock_irqsave(&port->lock, flags);
+		if (!ret && !ring_credits(peer) && !is_closed(port)) {
+			pr_warning("%s: no credit returned for port %s.%d\n",
+				   __func__, port->name, _ep_id(peer));
+			ret = -EAGAIN;
+			goto err;
+		}
 	}
 
-	list_add_tail(&msg->list, &peer->msg_list);
+	/* don't reuse the slot before the reader is done with it */
+	used = ring_used(peer);
+	smp_mb();
+	slot = &peer->ring->slots[peer->rx_head % TEGRA_RPC_RING_SLOTS];
+	memcpy(slot->payload, buf, len);
+	slot->len = len;
+	smp_wmb();
+	peer->ring->head = ++peer->rx_head;
+
 	if (peer->ops && peer->ops->notify_recv)
 		peer->ops->notify_recv(peer);
-	wake_up_all(&peer->msg_waitq);
+	/* readers only sleep on an empty ring */
+	if (!used)
+		wake_up_all(&peer->msg_waitq);
 	spin_unlock_irqrestore(&port->lock, flags);
 	return 0;
 
 err:
 	spin_unlock_irqrestore(&port->lock, flags);
-	kmem_cache_free(info->msg_cache, msg);
 	return ret;
 }
 
-/* Returns -ENOMEM if failed to allocate memory for the message. */
+/* Returns -ENOMEM if the peer has no credit left and gfp_flags don't allow
+ * waiting for one, or -EAGAIN if none was returned in time. */
 int trpc_send_msg(struct trpc_node *src, struct trpc_endpoint *from,
 		  void *buf, size_t len, gfp_t gfp_flags)
 {
@@ -588,16 +688,32 @@ int trpc_send_msg(struct trpc_node *src, struct trpc_endpoint *from,
 	}
 }
 
-static inline struct trpc_msg *dequeue_msg_locked(struct trpc_endpoint *ep)
+/* copies out the oldest queued message and returns its slot to the
+ * sender. Returns the length copied, or -ENOENT if the ring is empty. */
+static int dequeue_msg_locked(struct trpc_endpoint *ep, void *buf,
+			      size_t buf_len)
 {
-	struct trpc_msg *msg = NULL;
+	struct tegra_rpc_ring *ring = ep->ring;
+	struct tegra_rpc_ring_slot *slot;
+	u32 used = ring_used(ep);
+	u32 tail;
+	size_t len;
 
-	if (!list_empty(&ep->msg_list)) {
-		msg = list_first_entry(&ep->msg_list, struct trpc_msg, list);
-		list_del_init(&msg->list);
-	}
+	if (!used)
+		return -ENOENT;
 
-	return msg;
+	smp_rmb();
+	tail = ACCESS_ONCE(ring->tail);
+	slot = &ring->slots[tail % TEGRA_RPC_RING_SLOTS];
+	len = min_t(size_t, buf_len, slot->len);
+	memcpy(buf, slot->payload, len);
+	smp_mb();
+	ring->tail = tail + 1;
+
+	/* senders only sleep on a full ring */
+	if (used == TEGRA_RPC_RING_SLOTS)
+		wake_up_all(&ep->credit_waitq);
+	return len;
 }
 
 static bool __should_wake(struct trpc_endpoint *ep)
@@ -607,7 +723,7 @@ static bool __should_wake(struct trpc_endpoint *ep)
 	bool ret;
 
 	spin_lock_irqsave(&port->lock, flags);
-	ret = !list_empty(&ep->msg_list) || is_closed(port);
+	ret = ring_used(ep) || is_closed(port);
 	spin_unlock_irqrestore(&port->lock, flags);
 	return ret;
 }
@@ -615,20 +731,21 @@ static bool __should_wake(struct trpc_endpoint *ep)
 int trpc_recv_msg(struct trpc_node *src, struct trpc_endpoint *ep,
 		  void *buf, size_t buf_len, long timeout)
 {
-	struct tegra_rpc_info *info = tegra_rpc;
 	struct trpc_port *port = ep->port;
-	struct trpc_msg *msg;
-	size_t len;
+	int len;
 	long ret;
 	unsigned long flags;
 
 	BUG_ON(buf_len > TEGRA_RPC_MAX_MSG_LEN);
+	if (WARN_ON(!ep->ring))
+		return -EINVAL;
 
 	spin_lock_irqsave(&port->lock, flags);
 	/* we allow closed ports to finish receiving already-queued messages */
-	msg = dequeue_msg_locked(ep);
-	if (msg) {
-		goto got_msg;
+	len = dequeue_msg_locked(ep, buf, buf_len);
+	if (len >= 0) {
+		ret = len;
+		goto out;
 	} else if (is_closed(port)) {
 		ret = -ECONNRESET;
 		goto out;
@@ -654,8 +771,10 @@ int trpc_recv_msg(struct trpc_node *src, struct trpc_endpoint *ep,
 
 	DBG(TRPC_TRACE_MSG, "%s: woke up for %s\n", __func__, port->name);
 	spin_lock_irqsave(&port->lock, flags);
-	msg = dequeue_msg_locked(ep);
-	if (!msg) {
+	len = dequeue_msg_locked(ep, buf, buf_len);
+	if (len >= 0) {
+		ret = len;
+	} else {
 		if (is_closed(port))
 			ret = -ECONNRESET;
 		else if (!ret)
@@ -665,21 +784,35 @@ int trpc_recv_msg(struct trpc_node *src, struct trpc_endpoint *ep,
 		else
 			pr_err("%s: error (%d) while receiving msg for '%s'\n",
 			       __func__, (int)ret, port->name);
-		goto out;
 	}
 
-got_msg:
-	spin_unlock_irqrestore(&port->lock, flags);
-	len = min(buf_len, msg->len);
-	memcpy(buf, msg->payload, len);
-	kmem_cache_free(info->msg_cache, msg);
-	return len;
-
 out:
 	spin_unlock_irqrestore(&port->lock, flags);
 	return ret;
 }
 
+/* maps the receive ring of ep, see struct tegra_rpc_ring */
+int trpc_ring_mmap(struct trpc_endpoint *ep, struct vm_area_struct *vma)
+{
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (!ep->ring)
+		return -ENODEV;
+	if (vma->vm_pgoff || size > (PAGE_SIZE << ring_order()))
+		return -EINVAL;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(ep->ring) >> PAGE_SHIFT,
+			       size, vma->vm_page_prot);
+}
+
+/* for readers which advance the tail of a mapped ring themselves */
+void trpc_ring_sync(struct trpc_endpoint *ep)
+{
+	if (ep->ring)
+		wake_up_all(&ep->credit_waitq);
+}
+
 int trpc_node_register(struct trpc_node *node)
 {
 	struct tegra_rpc_info *info = tegra_rpc;
@@ -726,6 +859,9 @@ static int trpc_debug_ports_show(struct seq_file *s, void *data)
 			seq_printf(s, "  peer%d: %s\n    ready:%s\n", i,
 				   ep->owner ? ep->owner->name: "<none>",
 				   ep->ready ? "yes" : "no");
+			if (ep->ring)
+				seq_printf(s, "    queued:%u credit_stalls:%u\n",
+					   ring_used(ep), ep->credit_stalls);
 			if (ep->ops && ep->ops->show)
 				ep->ops->show(s, ep);
 		}
@@ -763,7 +899,6 @@ static void trpc_debug_init(struct tegra_rpc_info *info)
 static int __init tegra_rpc_init(void)
 {
 	struct tegra_rpc_info *rpc_info;
-	int ret;
 
 	rpc_info = kzalloc(sizeof(struct tegra_rpc_info), GFP_KERNEL);
 	if (!rpc_info) {
@@ -776,21 +911,10 @@ static int __init tegra_rpc_init(void)
 	INIT_LIST_HEAD(&rpc_info->node_list);
 	mutex_init(&rpc_info->node_lock);
 
-	rpc_info->msg_cache = KMEM_CACHE(trpc_msg, 0);
-	if (!rpc_info->msg_cache) {
-		pr_err("%s: unable to create message cache\n", __func__);
-		ret = -ENOMEM;
-		goto err_kmem_cache;
-	}
-
 	trpc_debug_init(rpc_info);
 	tegra_rpc = rpc_info;
 
 	return 0;
-
-err_kmem_cache:
-	kfree(rpc_info);
-	return ret;
 }
 
 subsys_initcall(tegra_rpc_init);
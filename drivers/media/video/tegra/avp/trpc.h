@@ -23,6 +23,7 @@
 #include <linux/tegra_rpc.h>
 
 struct trpc_endpoint;
+struct vm_area_struct;
 struct trpc_ep_ops {
 	/* send is allowed to sleep */
 	int	(*send)(struct trpc_endpoint *ep, void *buf, size_t len);
@@ -73,6 +74,8 @@ struct trpc_endpoint *trpc_create_peer(struct trpc_node *owner,
 				       void *priv);
 void trpc_close(struct trpc_endpoint *ep);
 int trpc_wait_peer(struct trpc_endpoint *ep, long timeout);
+int trpc_ring_mmap(struct trpc_endpoint *ep, struct vm_area_struct *vma);
+void trpc_ring_sync(struct trpc_endpoint *ep);
 
 int trpc_node_register(struct trpc_node *node);
 void trpc_node_unregister(struct trpc_node *node);
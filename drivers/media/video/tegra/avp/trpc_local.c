@@ -23,6 +23,7 @@
 #include <linux/fs.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/spinlock.h>
@@ -265,6 +266,13 @@ static long local_rpc_ioctl(struct file *file, unsigned int cmd,
 			goto err;
 		}
 		break;
+	case TEGRA_RPC_IOCTL_PORT_RING_SYNC:
+		if (!info->rpc_ep) {
+			ret = -EINVAL;
+			goto err;
+		}
+		trpc_ring_sync(info->rpc_ep);
+		break;
 	default:
 		pr_err("%s: unknown cmd %d\n", __func__, _IOC_NR(cmd));
 		ret = -EINVAL;
@@ -358,6 +366,17 @@ static ssize_t local_rpc_read(struct file *file, char __user *buf, size_t max,
 	return ret;
 }
 
+/* maps the receive ring of the port, see struct tegra_rpc_ring */
+static int local_rpc_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct rpc_info *info = file->private_data;
+
+	if (!info->rpc_ep)
+		return -EINVAL;
+
+	return trpc_ring_mmap(info->rpc_ep, vma);
+}
+
 static const struct file_operations local_rpc_misc_fops = {
 	.owner		= THIS_MODULE,
 	.open		= local_rpc_open,
@@ -365,6 +384,7 @@ static const struct file_operations local_rpc_misc_fops = {
 	.unlocked_ioctl	= local_rpc_ioctl,
 	.write		= local_rpc_write,
 	.read		= local_rpc_read,
+	.mmap		= local_rpc_mmap,
 };
 
 static struct miscdevice local_rpc_misc_device = {
@@ -21,19 +21,23 @@
  *      - Add support for 16bit bus width
  */
 
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/dma-mapping.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/mtd/nand.h>
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/partitions.h>
 #include <linux/platform_device.h>
+#include <linux/seq_file.h>
 #include <linux/types.h>
 #include <linux/clk.h>
+#include <linux/crc32.h>
 #include <linux/slab.h>
 
 #include <mach/nand.h>
@@ -71,6 +75,30 @@
 static const char *part_probes[] = { "cmdlinepart", NULL,  };
 #endif
 
+#ifdef CONFIG_MTD_NAND_TEGRA_BBT
+/* The bad block table lives in the last TEGRA_NAND_BBT_BLOCKS blocks of the
+ * device, which are reported as bad to the MTD users. Two copies are kept,
+ * each at the start of one of those blocks, so that one survives if power
+ * is lost while the other is being rewritten. At probe, the valid copy
+ * with the highest sequence number wins. */
+#define TEGRA_NAND_BBT_BLOCKS		4
+#define TEGRA_NAND_BBT_COPIES		2
+#define TEGRA_NAND_BBT_MAGIC		0x54424254	/* "TBBT" */
+#define TEGRA_NAND_BBT_FORMAT		1
+
+/* followed by the bitmap, in the format of tegra_nand_info.bb_bitmap */
+struct tegra_nand_bbt_hdr {
+	uint32_t	magic;
+	uint32_t	format;
+	uint32_t	seq;
+	uint32_t	num_blocks;
+	/* crc32 of the header, taken with crc == 0, and the bitmap */
+	uint32_t	crc;
+};
+#else
+#define TEGRA_NAND_BBT_BLOCKS		0
+#endif
+
 struct tegra_nand_chip {
 	spinlock_t		lock;
 	uint32_t		chipsize;
@@ -91,6 +119,22 @@ struct tegra_nand_chip {
 	void			*priv;
 };
 
+struct tegra_nand_xfer_stats {
+	uint32_t		ops;
+	uint64_t		bytes;
+	uint64_t		us;
+};
+
+struct tegra_nand_stats {
+	/* single page and multi-page data transfers */
+	struct tegra_nand_xfer_stats	read;
+	struct tegra_nand_xfer_stats	seq_read;
+	struct tegra_nand_xfer_stats	write;
+	struct tegra_nand_xfer_stats	seq_write;
+	uint32_t			cache_read_pages;
+	uint32_t			cache_prog_pages;
+};
+
 struct tegra_nand_info {
 	struct tegra_nand_chip		chip;
 	struct mtd_info			mtd;
@@ -120,10 +164,23 @@ struct tegra_nand_info {
 	struct completion		cmd_complete;
 	struct completion		dma_complete;
 
-	/* bad block bitmap: 1 == good, 0 == bad/unknown */
+	/* bad block bitmap: 1 == good, 0 == bad. Filled in at probe, from
+	 * the table in flash or by a full scan. */
 	unsigned long			*bb_bitmap;
+	/* blocks from here on are reserved for the bad block table */
+	uint32_t			bbt_first_block;
+	uint32_t			bbt_seq;
+	/* serializes writing out the table, taken outside of lock */
+	struct mutex			bbt_mutex;
 
 	struct clk			*clk;
+
+	/* TEGRA_NAND_* flags of the chip_parms entry for the chip found */
+	uint32_t			chip_flags;
+
+	/* protected by lock */
+	struct tegra_nand_stats		stats;
+	struct dentry			*debugfs_root;
 };
 #define MTD_TO_INFO(mtd)	container_of((mtd), struct tegra_nand_info, mtd)
 
@@ -174,6 +231,20 @@ find_nand_flash_vendor(int vendor_id)
 	return vendor->id ? vendor : NULL;
 }
 
+/* flags of the board's chip_parms entry for this part, see mach/nand.h */
+static uint32_t
+find_chip_flags(struct tegra_nand_info *info, int vendor_id, int dev_id)
+{
+	struct tegra_nand_chip_parms *parms = info->plat->chip_parms;
+	int i;
+
+	for (i = 0; i < info->plat->nr_chip_parms; i++)
+		if (parms[i].vendor_id == vendor_id &&
+		    parms[i].device_id == dev_id)
+			return parms[i].flags;
+	return 0;
+}
+
 #define REG_NAME(name)			{ name, #name }
 static struct {
 	uint32_t addr;
@@ -342,14 +413,20 @@ cfg_hwstatus_mon(struct tegra_nand_info *info)
 	writel(val, HWSTATUS_MASK_REG);
 }
 
-/* Tells the NAND controller to initiate the command. */
-static int
-tegra_nand_go(struct tegra_nand_info *info)
+static void
+tegra_nand_start(struct tegra_nand_info *info)
 {
 	BUG_ON(!tegra_nand_is_cmd_done(info));
 
 	INIT_COMPLETION(info->cmd_complete);
 	writel(info->command_reg | COMMAND_GO, COMMAND_REG);
+}
+
+/* Tells the NAND controller to initiate the command. */
+static int
+tegra_nand_go(struct tegra_nand_info *info)
+{
+	tegra_nand_start(info);
 
 	if (unlikely(tegra_nand_wait_cmd_done(info))) {
 		/* TODO: abort command if needed? */
@@ -416,21 +493,17 @@ nand_cmd_get_status(struct tegra_nand_info *info, uint32_t *status)
 }
 
 
-/* must be called with lock held */
+/* reads the factory bad block marker. must be called with lock held */
 static int
-check_block_isbad(struct mtd_info *mtd, loff_t offs)
+read_bad_block_marker(struct mtd_info *mtd, loff_t offs)
 {
 	struct tegra_nand_info *info = MTD_TO_INFO(mtd);
-	uint32_t block = offs >> info->chip.block_shift;
 	int chipnr;
 	uint32_t page;
 	uint32_t column;
 	int ret = 0;
 	int i;
 
-	if (info->bb_bitmap[BIT_WORD(block)] & BIT_MASK(block))
-		return 0;
-
 	offs &= ~(mtd->erasesize - 1);
 
 	/* Only set COM_BSY. */
@@ -475,12 +548,15 @@ check_block_isbad(struct mtd_info *mtd, loff_t offs)
 	}
 
 out:
-	/* update the bitmap if the block is good */
-	if (ret == 0)
-		set_bit(block, info->bb_bitmap);
 	return ret;
 }
 
+static inline int
+block_isbad(struct tegra_nand_info *info, uint32_t block)
+{
+	return block >= info->bbt_first_block ||
+		!test_bit(block, info->bb_bitmap);
+}
 
 static int
 tegra_nand_block_isbad(struct mtd_info *mtd, loff_t offs)
@@ -491,9 +567,7 @@ tegra_nand_block_isbad(struct mtd_info *mtd, loff_t offs)
 	if (offs >= mtd->size)
 		return -EINVAL;
 
-	mutex_lock(&info->lock);
-	ret = check_block_isbad(mtd, offs);
-	mutex_unlock(&info->lock);
+	ret = block_isbad(info, offs >> info->chip.block_shift);
 
 #if 0
 	if (ret > 0)
@@ -506,6 +580,254 @@ tegra_nand_block_isbad(struct mtd_info *mtd, loff_t offs)
 }
 
 
+/* must be called with lock held */
+static int
+erase_block_locked(struct tegra_nand_info *info, loff_t offs)
+{
+	int chipnr;
+	uint32_t page;
+	uint32_t column;
+	uint32_t status = 0;
+
+	split_addr(info, offs, &chipnr, &page, &column);
+	if (chipnr != info->chip.curr_chip)
+		select_chip(info, chipnr);
+	TEGRA_DBG("%s: addr=0x%08llx, page=0x%08x\n", __func__, offs, page);
+
+	info->command_reg =
+		COMMAND_CE(info->chip.curr_chip) | COMMAND_CLE | COMMAND_ALE |
+		COMMAND_ALE_BYTE_SIZE(2) | COMMAND_RBSY_CHK | COMMAND_SEC_CMD;
+	writel(NAND_CMD_ERASE1, CMD_REG1);
+	writel(NAND_CMD_ERASE2, CMD_REG2);
+
+	writel(page & 0xffffff, ADDR_REG1);
+	writel(0, ADDR_REG2);
+	writel(CONFIG_COM_BSY, CONFIG_REG);
+
+	if (tegra_nand_go(info) != 0)
+		return -EIO;
+
+	/* TODO: do we want a timeout here? */
+	if ((nand_cmd_get_status(info, &status) != 0) ||
+	    (status & NAND_STATUS_FAIL) ||
+	    ((status & NAND_STATUS_READY) != NAND_STATUS_READY)) {
+		pr_info("%s: erase failed @ 0x%08llx (stat=0x%08x)\n",
+			__func__, offs, status);
+		return -EIO;
+	}
+	return 0;
+}
+
+#ifdef CONFIG_MTD_NAND_TEGRA_BBT
+static inline uint32_t
+bbt_num_blocks(struct tegra_nand_info *info)
+{
+	return info->mtd.size >> info->chip.block_shift;
+}
+
+static inline size_t
+bbt_bitmap_size(struct tegra_nand_info *info)
+{
+	return BITS_TO_LONGS(bbt_num_blocks(info)) * sizeof(unsigned long);
+}
+
+/* a copy takes whole pages */
+static inline size_t
+bbt_size(struct tegra_nand_info *info)
+{
+	return roundup(sizeof(struct tegra_nand_bbt_hdr) + bbt_bitmap_size(info),
+		       info->mtd.writesize);
+}
+
+static uint32_t
+bbt_crc(struct tegra_nand_info *info, struct tegra_nand_bbt_hdr *hdr)
+{
+	uint32_t saved = hdr->crc;
+	uint32_t crc;
+
+	hdr->crc = 0;
+	crc = crc32_le(~0, (unsigned char *)hdr,
+		       sizeof(*hdr) + bbt_bitmap_size(info));
+	hdr->crc = saved;
+	return crc;
+}
+
+static int
+bbt_read_copy(struct tegra_nand_info *info, uint32_t block,
+	      struct tegra_nand_bbt_hdr *hdr)
+{
+	struct mtd_info *mtd = &info->mtd;
+	struct mtd_oob_ops ops;
+	int ret;
+
+	memset(&ops, 0, sizeof(ops));
+	ops.mode = MTD_OOB_AUTO;
+	ops.len = bbt_size(info);
+	ops.datbuf = (uint8_t *)hdr;
+	ret = mtd->read_oob(mtd, (loff_t)block << info->chip.block_shift, &ops);
+	if (ret && ret != -EUCLEAN)
+		return ret;
+
+	if (hdr->magic != TEGRA_NAND_BBT_MAGIC ||
+	    hdr->format != TEGRA_NAND_BBT_FORMAT ||
+	    hdr->num_blocks != bbt_num_blocks(info) ||
+	    hdr->crc != bbt_crc(info, hdr))
+		return -EINVAL;
+	return 0;
+}
+
+static inline bool
+bbt_holds(struct tegra_nand_info *info, uint32_t block,
+	  struct tegra_nand_bbt_hdr *buf, uint32_t seq)
+{
+	return !bbt_read_copy(info, block, buf) && buf->seq == seq;
+}
+
+/* writes both copies of the table, into the first good reserved blocks.
+ * a block which holds the current table is only rewritten once the others
+ * have the new one, so that there is a valid copy on the flash throughout:
+ * the first pass writes the blocks which don't hold the current table,
+ * the second the ones which don't hold the new one yet. */
+static int
+bbt_save(struct tegra_nand_info *info)
+{
+	struct mtd_info *mtd = &info->mtd;
+	struct tegra_nand_bbt_hdr *hdr;
+	struct tegra_nand_bbt_hdr *buf;
+	struct mtd_oob_ops ops;
+	uint32_t num_blocks = bbt_num_blocks(info);
+	uint32_t block;
+	loff_t offs;
+	int copies = 0;
+	int slots;
+	int pass;
+	int ret;
+
+	hdr = kzalloc(bbt_size(info), GFP_KERNEL);
+	buf = kmalloc(bbt_size(info), GFP_KERNEL);
+	if (!hdr || !buf) {
+		kfree(hdr);
+		kfree(buf);
+		return -ENOMEM;
+	}
+
+	/* two saves must not interleave, or each could take the copy the
+	 * other is keeping as the valid one */
+	mutex_lock(&info->bbt_mutex);
+	mutex_lock(&info->lock);
+	hdr->magic = TEGRA_NAND_BBT_MAGIC;
+	hdr->format = TEGRA_NAND_BBT_FORMAT;
+	hdr->seq = ++info->bbt_seq;
+	hdr->num_blocks = num_blocks;
+	memcpy(hdr + 1, info->bb_bitmap, bbt_bitmap_size(info));
+	hdr->crc = bbt_crc(info, hdr);
+	mutex_unlock(&info->lock);
+
+	for (pass = 0; pass < 2; pass++) {
+		slots = 0;
+		for (block = info->bbt_first_block;
+		     block < num_blocks && slots < TEGRA_NAND_BBT_COPIES;
+		     block++) {
+			if (!test_bit(block, info->bb_bitmap))
+				continue;
+			slots++;
+
+			if (bbt_holds(info, block, buf,
+				      pass ? hdr->seq : hdr->seq - 1))
+				continue;
+
+			offs = (loff_t)block << info->chip.block_shift;
+			mutex_lock(&info->lock);
+			ret = erase_block_locked(info, offs);
+			mutex_unlock(&info->lock);
+
+			if (!ret) {
+				memset(&ops, 0, sizeof(ops));
+				ops.mode = MTD_OOB_AUTO;
+				ops.len = bbt_size(info);
+				ops.datbuf = (uint8_t *)hdr;
+				ret = mtd->write_oob(mtd, offs, &ops);
+			}
+
+			if (ret) {
+				/* goes into the table the next time it is
+				 * written */
+				pr_err("%s: can't write bad block table to "
+				       "block %u (%d)\n", __func__, block, ret);
+				clear_bit(block, info->bb_bitmap);
+				slots--;
+				continue;
+			}
+			copies++;
+		}
+	}
+	mutex_unlock(&info->bbt_mutex);
+	kfree(buf);
+	kfree(hdr);
+
+	if (copies < TEGRA_NAND_BBT_COPIES)
+		pr_warning("%s: only %d copies of bad block table %u written\n",
+			   DRIVER_NAME, copies, info->bbt_seq);
+	return copies ? 0 : -EIO;
+}
+
+static int
+bbt_load(struct tegra_nand_info *info)
+{
+	struct tegra_nand_bbt_hdr *hdr;
+	uint32_t num_blocks = bbt_num_blocks(info);
+	uint32_t block;
+	int found = 0;
+	int copies = 0;
+
+	hdr = kmalloc(bbt_size(info), GFP_KERNEL);
+	if (!hdr)
+		return -ENOMEM;
+
+	for (block = info->bbt_first_block; block < num_blocks; block++) {
+		if (bbt_read_copy(info, block, hdr))
+			continue;
+
+		if (found && hdr->seq == info->bbt_seq) {
+			copies++;
+			continue;
+		} else if (found && (int32_t)(hdr->seq - info->bbt_seq) < 0) {
+			continue;
+		}
+
+		found = 1;
+		copies = 1;
+		info->bbt_seq = hdr->seq;
+		memcpy(info->bb_bitmap, hdr + 1, bbt_bitmap_size(info));
+	}
+	kfree(hdr);
+
+	if (!found)
+		return -ENOENT;
+
+	pr_info("%s: bad block table %u loaded\n", DRIVER_NAME, info->bbt_seq);
+
+	/* an older or a missing copy is rewritten, so that the table is
+	 * mirrored again */
+	if (copies < TEGRA_NAND_BBT_COPIES)
+		bbt_save(info);
+	return 0;
+}
+#else
+static inline int
+bbt_save(struct tegra_nand_info *info)
+{
+	return 0;
+}
+
+static inline int
+bbt_load(struct tegra_nand_info *info)
+{
+	return -ENODEV;
+}
+#endif
+
+
 static int
 tegra_nand_block_markbad(struct mtd_info *mtd, loff_t offs)
 {
@@ -520,6 +842,11 @@ tegra_nand_block_markbad(struct mtd_info *mtd, loff_t offs)
 	if (offs >= mtd->size)
 		return -EINVAL;
 
+	/* the table blocks are managed by bbt_save() and already reported
+	 * bad, so they are never marked or counted */
+	if (block >= info->bbt_first_block)
+		return 0;
+
 	pr_info("tegra_nand: setting block %d bad\n", block);
 
 	mutex_lock(&info->lock);
@@ -562,6 +889,10 @@ tegra_nand_block_markbad(struct mtd_info *mtd, loff_t offs)
 
 out:
 	mutex_unlock(&info->lock);
+
+	/* the table is what counts from now on, even if the marker could not
+	 * be written */
+	bbt_save(info);
 	return ret;
 }
 
@@ -572,10 +903,6 @@ tegra_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 	struct tegra_nand_info *info = MTD_TO_INFO(mtd);
 	uint32_t num_blocks;
 	uint32_t offs;
-	int chipnr;
-	uint32_t page;
-	uint32_t column;
-	uint32_t status = 0;
 
 	TEGRA_DBG("tegra_nand_erase: addr=0x%08llx len=%lld\n", instr->addr,
 	       instr->len);
@@ -612,40 +939,15 @@ tegra_nand_erase(struct mtd_info *mtd, struct erase_info *instr)
 	select_chip(info, -1);
 
 	while (num_blocks--) {
-		split_addr(info, offs, &chipnr, &page, &column);
-		if (chipnr != info->chip.curr_chip)
-			select_chip(info, chipnr);
-		TEGRA_DBG("tegra_nand_erase: addr=0x%08x, page=0x%08x\n", offs, page);
-
-		if (check_block_isbad(mtd, offs)) {
+		if (block_isbad(info, offs >> info->chip.block_shift)) {
 			pr_info("%s: skipping bad block @ 0x%08x\n", __func__, offs);
 			goto next_block;
 		}
 
-		info->command_reg =
-			COMMAND_CE(info->chip.curr_chip) | COMMAND_CLE | COMMAND_ALE |
-			COMMAND_ALE_BYTE_SIZE(2) | COMMAND_RBSY_CHK | COMMAND_SEC_CMD;
-		writel(NAND_CMD_ERASE1, CMD_REG1);
-		writel(NAND_CMD_ERASE2, CMD_REG2);
-
-		writel(page & 0xffffff, ADDR_REG1);
-		writel(0, ADDR_REG2);
-		writel(CONFIG_COM_BSY, CONFIG_REG);
-
-		if (tegra_nand_go(info) != 0) {
+		if (erase_block_locked(info, offs) != 0) {
 			instr->fail_addr = offs;
 			goto out_err;
 		}
-
-		/* TODO: do we want a timeout here? */
-		if ((nand_cmd_get_status(info, &status) != 0) ||
-		    (status & NAND_STATUS_FAIL) ||
-		    ((status & NAND_STATUS_READY) != NAND_STATUS_READY)) {
-			instr->fail_addr = offs;
-			pr_info("%s: erase failed @ 0x%08x (stat=0x%08x)\n",
-				__func__, offs, status);
-			goto out_err;
-		}
 next_block:
 		offs += mtd->erasesize;
 	}
@@ -842,11 +1144,130 @@ tegra_nand_dma_map(struct device *dev, void *addr, size_t size,
 	return dma_map_page(dev, page, offset, size, dir);
 }
 
+/* starts the transfer set up by prep_transfer_dma(), without waiting for it */
+static void
+tegra_nand_start_xfer(struct tegra_nand_info *info)
+{
+	writel(info->config_reg, CONFIG_REG);
+	writel(info->dmactrl_reg, DMA_MST_CTRL_REG);
+
+	INIT_COMPLETION(info->dma_complete);
+	tegra_nand_start(info);
+}
+
+static int
+tegra_nand_wait_xfer(struct tegra_nand_info *info)
+{
+	if (unlikely(tegra_nand_wait_cmd_done(info))) {
+		pr_err("%s: Timeout while waiting for command\n", __func__);
+		return -ETIMEDOUT;
+	}
+
+	if (!wait_for_completion_timeout(&info->dma_complete, 2*HZ)) {
+		pr_err("%s: dma completion timeout\n", __func__);
+		dump_nand_regs();
+		return -ETIMEDOUT;
+	}
+	return 0;
+}
+
+/* a cache read or program run is kept within an erase block, and so within
+ * a chip and a plane */
+static inline int
+next_page_in_block(struct tegra_nand_info *info, loff_t offs)
+{
+	return ((offs + info->mtd.writesize) >> info->chip.block_shift) ==
+		(offs >> info->chip.block_shift);
+}
+
+/* loads the first page of a cache read run into the chip's data register */
+static int
+nand_cmd_read_cache_start(struct tegra_nand_info *info, uint32_t page)
+{
+	info->command_reg =
+		COMMAND_CE(info->chip.curr_chip) | COMMAND_CLE | COMMAND_ALE |
+		COMMAND_ALE_BYTE_SIZE(4) | COMMAND_SEC_CMD | COMMAND_RBSY_CHK;
+	writel(NAND_CMD_READ0, CMD_REG1);
+	writel(NAND_CMD_READSTART, CMD_REG2);
+
+	writel((page & 0xffff) << 16, ADDR_REG1);
+	writel((page >> 16) & 0xff, ADDR_REG2);
+	writel(CONFIG_COM_BSY, CONFIG_REG);
+
+	return tegra_nand_go(info);
+}
+
+/* takes the chip out of a cache read run that was cut short, which would
+ * otherwise take the next command for part of the run. A reset works
+ * whatever state the aborted transfer left the chip in. */
+static int
+nand_cmd_reset(struct tegra_nand_info *info)
+{
+	int err;
+
+	/* the command that timed out may still be holding the controller */
+	if (!tegra_nand_is_cmd_done(info))
+		writel(0, COMMAND_REG);
+
+	info->command_reg = (COMMAND_CLE | COMMAND_RBSY_CHK |
+			     COMMAND_CE(info->chip.curr_chip));
+	writel(NAND_CMD_RESET, CMD_REG1);
+	writel(0, CMD_REG2);
+	writel(0, ADDR_REG1);
+	writel(0, ADDR_REG2);
+	writel(CONFIG_COM_BSY, CONFIG_REG);
+
+	err = tegra_nand_go(info);
+	if (err != 0)
+		pr_err("%s: chip %d did not come back from reset\n", __func__,
+		       info->chip.curr_chip);
+	return err;
+}
+
+/* turns the page read set up by prep_transfer_dma() into a read from the
+ * chip's cache register. For 31h, the chip fetches the next page from the
+ * array while this one is being transferred; 3Fh ends the run. */
+static void
+prep_cache_read(struct tegra_nand_info *info, int last)
+{
+	info->command_reg &= ~(COMMAND_ALE | COMMAND_SEC_CMD |
+			       COMMAND_ALE_BYTE_SIZE(0xf));
+	writel(last ? NAND_CMD_READCACHE_END : NAND_CMD_READCACHE_SEQ,
+	       CMD_REG1);
+	writel(0, CMD_REG2);
+}
+
+static int
+ecc_errs_pending(struct tegra_nand_info *info)
+{
+	unsigned long flags;
+	int ret;
+
+	spin_lock_irqsave(&info->ecc_lock, flags);
+	ret = info->num_ecc_errs != 0;
+	spin_unlock_irqrestore(&info->ecc_lock, flags);
+	return ret;
+}
+
+static void
+account_xfer(struct tegra_nand_xfer_stats *stats, uint32_t bytes,
+	     ktime_t start)
+{
+	stats->ops++;
+	stats->bytes += bytes;
+	stats->us += ktime_us_delta(ktime_get(), start);
+}
+
 /* if mode == RAW, then we read data only, with no ECC
  * if mode == PLACE, we read ONLY the OOB data from a raw offset into the spare
  * area (ooboffs).
  * if mode == AUTO, we read main data and the OOB data from the oobfree areas as
  * specified by nand_ecclayout.
+ *
+ * Multi-page reads are pipelined: the next page's buffer is mapped and the
+ * previous one unmapped while the controller is busy with the current page,
+ * and chips which can do it get the next page from the array while the
+ * current one is being transferred (cache read).
  */
 static int
 do_read_oob(struct mtd_info *mtd, loff_t from, struct mtd_oob_ops *ops)
@@ -862,9 +1283,18 @@ do_read_oob(struct mtd_info *mtd, loff_t from, struct mtd_oob_ops *ops)
 	uint32_t ooblen = oobbuf ? ops->ooblen : 0;
 	uint32_t oobsz;
 	uint32_t page_count;
+	uint32_t num_pages;
 	int err;
 	int do_ecc = 1;
+	int use_cache;
+	int in_cache_run = 0;
+	uint32_t a_len;
+	uint32_t prev_len = 0;
+	uint32_t next_len = 0;
 	dma_addr_t datbuf_dma_addr = 0;
+	dma_addr_t prev_dma_addr = 0;
+	dma_addr_t next_dma_addr = 0;
+	ktime_t start;
 
 #if 0
 	dump_mtd_oob_ops(mtd, ops);
@@ -896,6 +1326,7 @@ do_read_oob(struct mtd_info *mtd, loff_t from, struct mtd_oob_ops *ops)
 	} else {
 		page_count = max((uint32_t)(ops->len / mtd->writesize), (uint32_t)1);
 	}
+	num_pages = page_count;
 
 	mutex_lock(&info->lock);
 
@@ -913,50 +1344,81 @@ do_read_oob(struct mtd_info *mtd, loff_t from, struct mtd_oob_ops *ops)
 	/* reset it to point back to beginning of page */
 	from -= column;
 
+	/* the OOB is only read for single pages, so the one oob_dma_buf is
+	 * never needed for two pages at once */
+	use_cache = (info->chip_flags & TEGRA_NAND_CACHE_READ) && datbuf &&
+		    !oobbuf && page_count > 1;
+
+	start = ktime_get();
+	a_len = min(mtd->writesize - column, len);
+	if (datbuf)
+		datbuf_dma_addr = tegra_nand_dma_map(info->dev, datbuf, a_len, DMA_FROM_DEVICE);
+
 	while (page_count--) {
-		int a_len = min(mtd->writesize - column, len);
 		int b_len = min(oobsz, ooblen);
+		int more = page_count && next_page_in_block(info, from);
 
 #if 0
 		pr_info("%s: chip:=%d page=%d col=%d\n", __func__, chipnr,
 			page, column);
 #endif
 
-		clear_regs(info);
-		if (datbuf)
-			datbuf_dma_addr = tegra_nand_dma_map(info->dev, datbuf, a_len, DMA_FROM_DEVICE);
+		if (use_cache && !in_cache_run && more) {
+			err = nand_cmd_read_cache_start(info, page);
+			if (err != 0)
+				goto out_unmap;
+			in_cache_run = 1;
+		}
 
+		clear_regs(info);
 		prep_transfer_dma(info, 1, do_ecc, page, column, datbuf_dma_addr,
 				  a_len, info->oob_dma_addr,
 				  b_len);
-		writel(info->config_reg, CONFIG_REG);
-		writel(info->dmactrl_reg, DMA_MST_CTRL_REG);
-
-		INIT_COMPLETION(info->dma_complete);
-		err = tegra_nand_go(info);
-		if (err != 0)
-			goto out_err;
+		if (in_cache_run) {
+			prep_cache_read(info, !more);
+			info->stats.cache_read_pages++;
+		}
+		tegra_nand_start_xfer(info);
 
-		if (!wait_for_completion_timeout(&info->dma_complete, 2*HZ)) {
-			pr_err("%s: dma completion timeout\n", __func__);
-			dump_nand_regs();
-			err = -ETIMEDOUT;
-			goto out_err;
+		/* get the previous and the next page out of the way while
+		 * this one is in flight */
+		if (prev_len) {
+			dma_unmap_page(info->dev, prev_dma_addr, prev_len, DMA_FROM_DEVICE);
+			prev_len = 0;
+		}
+		if (datbuf && page_count) {
+			next_len = min(mtd->writesize, len - a_len);
+			next_dma_addr = tegra_nand_dma_map(info->dev, datbuf + a_len,
+							   next_len, DMA_FROM_DEVICE);
 		}
 
-		/*pr_info("tegra_read_oob: DMA complete\n");*/
+		err = tegra_nand_wait_xfer(info);
+		if (err != 0)
+			goto out_unmap;
+		/* the run is only over once the 3Fh transfer went through */
+		in_cache_run = in_cache_run && more;
 
-		/* if we are here, transfer is done */
-		if (datbuf)
-			dma_unmap_page(info->dev, datbuf_dma_addr, a_len, DMA_FROM_DEVICE);
+		/*pr_info("tegra_read_oob: DMA complete\n");*/
 
-		if (oobbuf) {
-			uint32_t ofs = datbuf && oobbuf ? 4 : 0; /* skipped bytes */
-			memcpy(oobbuf, info->oob_dma_buf + ofs, b_len);
+		/* if we are here, transfer is done. The data only has to be
+		 * looked at if there was an ECC error, so a clean page is left
+		 * mapped until the next one has been started. */
+		if (!datbuf || oobbuf || ecc_errs_pending(info)) {
+			if (datbuf)
+				dma_unmap_page(info->dev, datbuf_dma_addr, a_len, DMA_FROM_DEVICE);
+
+			if (oobbuf) {
+				uint32_t ofs = datbuf && oobbuf ? 4 : 0; /* skipped bytes */
+				memcpy(oobbuf, info->oob_dma_buf + ofs, b_len);
+			}
+
+			correct_ecc_errors_on_blank_page(info, datbuf, oobbuf, a_len, b_len);
+			update_ecc_counts(info, oobbuf != NULL);
+		} else {
+			prev_dma_addr = datbuf_dma_addr;
+			prev_len = a_len;
 		}
 
-		correct_ecc_errors_on_blank_page(info, datbuf, oobbuf, a_len, b_len);
-
 		if (datbuf) {
 			len -= a_len;
 			datbuf += a_len;
@@ -969,11 +1431,13 @@ do_read_oob(struct mtd_info *mtd, loff_t from, struct mtd_oob_ops *ops)
 			ops->oobretlen += b_len;
 		}
 
-		update_ecc_counts(info, oobbuf != NULL);
-
 		if (!page_count)
 			break;
 
+		datbuf_dma_addr = next_dma_addr;
+		a_len = next_len;
+		next_len = 0;
+
 		from += mtd->writesize;
 		column = 0;
 
@@ -982,8 +1446,15 @@ do_read_oob(struct mtd_info *mtd, loff_t from, struct mtd_oob_ops *ops)
 			select_chip(info, chipnr);
 	}
 
+	if (prev_len)
+		dma_unmap_page(info->dev, prev_dma_addr, prev_len, DMA_FROM_DEVICE);
+
 	disable_ints(info, IER_ECC_ERR);
 
+	if (ops->datbuf)
+		account_xfer(num_pages > 1 ? &info->stats.seq_read :
+			     &info->stats.read, ops->retlen, start);
+
 	if (mtd->ecc_stats.failed != old_ecc_stats.failed)
 		err = -EBADMSG;
 	else if (mtd->ecc_stats.corrected != old_ecc_stats.corrected)
@@ -994,10 +1465,20 @@ do_read_oob(struct mtd_info *mtd, loff_t from, struct mtd_oob_ops *ops)
 	mutex_unlock(&info->lock);
 	return err;
 
-out_err:
+out_unmap:
+	if (datbuf)
+		dma_unmap_page(info->dev, datbuf_dma_addr, a_len, DMA_FROM_DEVICE);
+	if (prev_len)
+		dma_unmap_page(info->dev, prev_dma_addr, prev_len, DMA_FROM_DEVICE);
+	if (next_len)
+		dma_unmap_page(info->dev, next_dma_addr, next_len, DMA_FROM_DEVICE);
+
 	ops->retlen = 0;
 	ops->oobretlen = 0;
 
+	if (in_cache_run)
+		nand_cmd_reset(info);
+
 	disable_ints(info, IER_ECC_ERR);
 	mutex_unlock(&info->lock);
 	return err;
@@ -1050,6 +1531,9 @@ tegra_nand_write(struct mtd_info *mtd, loff_t to, size_t len,
 	return ret;
 }
 
+/* Pipelined like do_read_oob(). Chips which can do it take the next page
+ * into their cache register while the previous one is being programmed
+ * (cache program). */
 static int
 do_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 {
@@ -1063,9 +1547,17 @@ do_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 	uint32_t ooblen = oobbuf ? ops->ooblen : 0;
 	uint32_t oobsz;
 	uint32_t page_count;
+	uint32_t num_pages;
 	int err;
 	int do_ecc = 1;
+	int use_cache;
+	uint32_t a_len;
+	uint32_t prev_len = 0;
+	uint32_t next_len = 0;
 	dma_addr_t datbuf_dma_addr = 0;
+	dma_addr_t prev_dma_addr = 0;
+	dma_addr_t next_dma_addr = 0;
+	ktime_t start;
 
 #if 0
 	dump_mtd_oob_ops(mtd, ops);
@@ -1093,41 +1585,55 @@ do_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 		page_count = 1;
 	} else
 		page_count = max((uint32_t)(ops->len / mtd->writesize), (uint32_t)1);
+	num_pages = page_count;
 
 	mutex_lock(&info->lock);
 
 	split_addr(info, to, &chipnr, &page, &column);
 	select_chip(info, chipnr);
 
+	use_cache = (info->chip_flags & TEGRA_NAND_CACHE_PROG) && datbuf &&
+		    !oobbuf && page_count > 1;
+
+	start = ktime_get();
+	a_len = min(mtd->writesize, len);
+	if (datbuf)
+		datbuf_dma_addr = tegra_nand_dma_map(info->dev, datbuf, a_len, DMA_TO_DEVICE);
+
 	while (page_count--) {
-		int a_len = min(mtd->writesize, len);
 		int b_len = min(oobsz, ooblen);
 
-		if (datbuf)
-			datbuf_dma_addr = tegra_nand_dma_map(info->dev, datbuf, a_len, DMA_TO_DEVICE);
 		if (oobbuf)
 			memcpy(info->oob_dma_buf, oobbuf, b_len);
 
 		clear_regs(info);
 		prep_transfer_dma(info, 0, do_ecc, page, column, datbuf_dma_addr,
 				  a_len, info->oob_dma_addr, b_len);
+		/* the last page of a run is programmed with 10h, which waits
+		 * for all of the run to be written */
+		if (use_cache && page_count && next_page_in_block(info, to)) {
+			writel(NAND_CMD_CACHEDPROG, CMD_REG2);
+			info->stats.cache_prog_pages++;
+		}
+		tegra_nand_start_xfer(info);
 
-		writel(info->config_reg, CONFIG_REG);
-		writel(info->dmactrl_reg, DMA_MST_CTRL_REG);
+		if (prev_len) {
+			dma_unmap_page(info->dev, prev_dma_addr, prev_len, DMA_TO_DEVICE);
+			prev_len = 0;
+		}
+		if (datbuf && page_count) {
+			next_len = min(mtd->writesize, len - a_len);
+			next_dma_addr = tegra_nand_dma_map(info->dev, datbuf + a_len,
+							   next_len, DMA_TO_DEVICE);
+		}
 
-		INIT_COMPLETION(info->dma_complete);
-		err = tegra_nand_go(info);
+		err = tegra_nand_wait_xfer(info);
 		if (err != 0)
-			goto out_err;
-
-		if (!wait_for_completion_timeout(&info->dma_complete, 2*HZ)) {
-			pr_err("%s: dma completion timeout\n", __func__);
-			dump_nand_regs();
-			goto out_err;
-		}
+			goto out_unmap;
 
 		if (datbuf) {
-			dma_unmap_page(info->dev, datbuf_dma_addr, a_len, DMA_TO_DEVICE);
+			prev_dma_addr = datbuf_dma_addr;
+			prev_len = a_len;
 			len -= a_len;
 			datbuf += a_len;
 			ops->retlen += a_len;
@@ -1141,6 +1647,10 @@ do_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 		if (!page_count)
 			break;
 
+		datbuf_dma_addr = next_dma_addr;
+		a_len = next_len;
+		next_len = 0;
+
 		to += mtd->writesize;
 		column = 0;
 
@@ -1149,10 +1659,24 @@ do_write_oob(struct mtd_info *mtd, loff_t to, struct mtd_oob_ops *ops)
 			select_chip(info, chipnr);
 	}
 
+	if (prev_len)
+		dma_unmap_page(info->dev, prev_dma_addr, prev_len, DMA_TO_DEVICE);
+
+	if (ops->datbuf)
+		account_xfer(num_pages > 1 ? &info->stats.seq_write :
+			     &info->stats.write, ops->retlen, start);
+
 	mutex_unlock(&info->lock);
-	return err;
+	return 0;
+
+out_unmap:
+	if (datbuf)
+		dma_unmap_page(info->dev, datbuf_dma_addr, a_len, DMA_TO_DEVICE);
+	if (prev_len)
+		dma_unmap_page(info->dev, prev_dma_addr, prev_len, DMA_TO_DEVICE);
+	if (next_len)
+		dma_unmap_page(info->dev, next_dma_addr, next_len, DMA_TO_DEVICE);
 
-out_err:
 	ops->retlen = 0;
 	ops->oobretlen = 0;
 
@@ -1190,6 +1714,8 @@ tegra_nand_resume(struct mtd_info *mtd)
 {
 }
 
+/* Fills in the bad block bitmap, from the table in flash if there is a
+ * valid one, and otherwise by reading the marker of every block. */
 static int
 scan_bad_blocks(struct tegra_nand_info *info)
 {
@@ -1198,11 +1724,14 @@ scan_bad_blocks(struct tegra_nand_info *info)
 	uint32_t block;
 	int is_bad = 0;
 
+	if (bbt_load(info) == 0)
+		goto out;
+
 	for (block = 0; block < num_blocks; ++block) {
-		/* make sure the bit is cleared, meaning it's bad/unknown before
-		 * we check. */
-		clear_bit(block, info->bb_bitmap);
-		is_bad = mtd->block_isbad(mtd, block << info->chip.block_shift);
+		mutex_lock(&info->lock);
+		is_bad = read_bad_block_marker(mtd,
+				(loff_t)block << info->chip.block_shift);
+		mutex_unlock(&info->lock);
 
 		if (is_bad == 0)
 			set_bit(block, info->bb_bitmap);
@@ -1214,6 +1743,12 @@ scan_bad_blocks(struct tegra_nand_info *info)
 			return is_bad;
 		}
 	}
+	bbt_save(info);
+
+out:
+	for (block = 0; block < info->bbt_first_block; ++block)
+		if (!test_bit(block, info->bb_bitmap))
+			mtd->ecc_stats.badblocks++;
 	return 0;
 }
 
@@ -1305,6 +1840,14 @@ tegra_nand_scan(struct mtd_info *mtd, int maxchips)
 	       dev_info->name);
 	info->chip.num_chips = cnt;
 	info->chip.chipsize = dev_info->chipsize << 20;
+
+	info->chip_flags = find_chip_flags(info, vendor_id, dev_id);
+	if (info->chip_flags & (TEGRA_NAND_CACHE_READ | TEGRA_NAND_CACHE_PROG))
+		pr_info("%s: using%s%s\n", DRIVER_NAME,
+			info->chip_flags & TEGRA_NAND_CACHE_READ ?
+				" cache read" : "",
+			info->chip_flags & TEGRA_NAND_CACHE_PROG ?
+				" cache program" : "");
 	mtd->size = info->chip.num_chips * info->chip.chipsize;
 
 	/* format of 4th id byte returned by READ ID
@@ -1386,6 +1929,53 @@ out_error:
 	return err;
 }
 
+static void
+stats_show_xfer(struct seq_file *s, const char *name,
+		struct tegra_nand_xfer_stats *stats)
+{
+	/* bytes per ms, so kB/s */
+	uint64_t kbps = stats->us ? div64_u64(stats->bytes * 1000, stats->us) : 0;
+	uint32_t rem;
+	uint64_t mbps = div_u64_rem(kbps, 1000, &rem);
+
+	seq_printf(s, "%-10s %8u %12llu %12llu %5llu.%02u\n", name,
+		   stats->ops, stats->bytes, stats->us, mbps, rem / 10);
+}
+
+static int
+tegra_nand_stats_show(struct seq_file *s, void *data)
+{
+	struct tegra_nand_info *info = s->private;
+	struct tegra_nand_stats stats;
+
+	mutex_lock(&info->lock);
+	stats = info->stats;
+	mutex_unlock(&info->lock);
+
+	seq_printf(s, "%-10s %8s %12s %12s %8s\n", "", "ops", "bytes", "us",
+		   "MB/s");
+	stats_show_xfer(s, "read", &stats.read);
+	stats_show_xfer(s, "seq_read", &stats.seq_read);
+	stats_show_xfer(s, "write", &stats.write);
+	stats_show_xfer(s, "seq_write", &stats.seq_write);
+	seq_printf(s, "cache read pages:    %u\n", stats.cache_read_pages);
+	seq_printf(s, "cache program pages: %u\n", stats.cache_prog_pages);
+	return 0;
+}
+
+static int
+tegra_nand_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tegra_nand_stats_show, inode->i_private);
+}
+
+static const struct file_operations tegra_nand_stats_fops = {
+	.open		= tegra_nand_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int __devinit
 tegra_nand_probe(struct platform_device *pdev)
 {
@@ -1421,6 +2011,7 @@ tegra_nand_probe(struct platform_device *pdev)
 	init_completion(&info->dma_complete);
 
 	mutex_init(&info->lock);
+	mutex_init(&info->bbt_mutex);
 	spin_lock_init(&info->ecc_lock);
 
 	chip = &info->chip;
@@ -1506,6 +2097,9 @@ tegra_nand_probe(struct platform_device *pdev)
 		goto out_free_ecc;
 	}
 
+	info->bbt_first_block = num_erase_blocks - TEGRA_NAND_BBT_BLOCKS;
+	mtd->ecc_stats.bbtblocks = TEGRA_NAND_BBT_BLOCKS;
+
 	err = scan_bad_blocks(info);
 	if (err != 0)
 		goto out_free_bbbmap;
@@ -1528,6 +2122,11 @@ tegra_nand_probe(struct platform_device *pdev)
 
 	dev_set_drvdata(&pdev->dev, info);
 
+	info->debugfs_root = debugfs_create_dir(DRIVER_NAME, NULL);
+	if (!IS_ERR_OR_NULL(info->debugfs_root))
+		debugfs_create_file("stats", S_IRUGO, info->debugfs_root, info,
+				    &tegra_nand_stats_fops);
+
 	pr_debug("%s: probe done.\n", __func__);
 	return 0;
 
@@ -1563,6 +2162,7 @@ tegra_nand_remove(struct platform_device *pdev)
 	dev_set_drvdata(&pdev->dev, NULL);
 
 	if (info) {
+		debugfs_remove_recursive(info->debugfs_root);
 		free_irq(pdev->resource[0].start, info);
 		kfree(info->bb_bitmap);
 		kfree(info->ecc_errs);
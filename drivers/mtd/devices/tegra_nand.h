@@ -57,6 +57,10 @@
 #define LL_PTR_REG				(TEGRA_NAND_BASE + 0x5c)
 #define LL_STATUS_REG				(TEGRA_NAND_BASE + 0x60)
 
+/* cache read commands, not in linux/mtd/nand.h */
+#define NAND_CMD_READCACHE_SEQ			0x31
+#define NAND_CMD_READCACHE_END			0x3f
+
 /* nand_command bits */
 #define COMMAND_GO				REG_BIT(31)
 #define COMMAND_CLE				REG_BIT(30)
@@ -41,9 +41,9 @@
 #include "dc_reg.h"
 #include "dc_priv.h"
 
-static int no_vsync;
+static int tegra_dc_no_vsync;
 
-module_param_named(no_vsync, no_vsync, int, S_IRUGO | S_IWUSR);
+module_param_named(no_vsync, tegra_dc_no_vsync, int, S_IRUGO | S_IWUSR);
 
 struct tegra_dc *tegra_dcs[TEGRA_MAX_DC];
 
@@ -560,12 +560,16 @@ static inline u32 compute_initial_dda(fixed20_12 in)
 }
 
 /* does not support updating windows on multiple dcs in one call */
-int tegra_dc_update_windows(struct tegra_dc_win *windows[], int n)
+/* with immediate set, the new window state is written to the active
+ * registers rather than latched at the next vblank, as with no_vsync */
+static int _tegra_dc_update_windows(struct tegra_dc_win *windows[], int n,
+				    bool immediate)
 {
 	struct tegra_dc *dc;
 	unsigned long update_mask = GENERAL_ACT_REQ;
 	unsigned long val;
 	bool update_blend = false;
+	bool no_vsync = immediate || tegra_dc_no_vsync;
 	int i;
 
 	dc = windows[0]->dc;
@@ -704,9 +708,13 @@ int tegra_dc_update_windows(struct tegra_dc_win *windows[], int n)
 	tegra_dc_writel(dc, update_mask << 8, DC_CMD_STATE_CONTROL);
 
 	if (!no_vsync) {
+		unsigned long flags;
+
+		spin_lock_irqsave(&dc->frame_lock, flags);
 		val = tegra_dc_readl(dc, DC_CMD_INT_ENABLE);
 		val |= FRAME_END_INT;
 		tegra_dc_writel(dc, val, DC_CMD_INT_ENABLE);
+		spin_unlock_irqrestore(&dc->frame_lock, flags);
 
 		val = tegra_dc_readl(dc, DC_CMD_INT_MASK);
 		val |= FRAME_END_INT;
@@ -718,8 +726,138 @@ int tegra_dc_update_windows(struct tegra_dc_win *windows[], int n)
 
 	return 0;
 }
+
+int tegra_dc_update_windows(struct tegra_dc_win *windows[], int n)
+{
+	return _tegra_dc_update_windows(windows, n, false);
+}
 EXPORT_SYMBOL(tegra_dc_update_windows);
 
+int tegra_dc_update_windows_immediate(struct tegra_dc_win *windows[], int n)
+{
+	return _tegra_dc_update_windows(windows, n, true);
+}
+EXPORT_SYMBOL(tegra_dc_update_windows_immediate);
+
+/* keeps the FRAME_END interrupt enabled, so that every frame is counted
+ * and wakes dc->wq, until the matching tegra_dc_frame_irq_put() */
+void tegra_dc_frame_irq_get(struct tegra_dc *dc)
+{
+	unsigned long flags;
+	unsigned long val;
+
+	mutex_lock(&dc->lock);
+	spin_lock_irqsave(&dc->frame_lock, flags);
+	if (!dc->frame_irq_refs++ && dc->enabled) {
+		val = tegra_dc_readl(dc, DC_CMD_INT_ENABLE);
+		val |= FRAME_END_INT;
+		tegra_dc_writel(dc, val, DC_CMD_INT_ENABLE);
+	}
+	spin_unlock_irqrestore(&dc->frame_lock, flags);
+	mutex_unlock(&dc->lock);
+}
+EXPORT_SYMBOL(tegra_dc_frame_irq_get);
+
+/* the interrupt itself is turned off by tegra_dc_irq once it is no
+ * longer needed */
+void tegra_dc_frame_irq_put(struct tegra_dc *dc)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dc->frame_lock, flags);
+	BUG_ON(dc->frame_irq_refs <= 0);
+	dc->frame_irq_refs--;
+	spin_unlock_irqrestore(&dc->frame_lock, flags);
+}
+EXPORT_SYMBOL(tegra_dc_frame_irq_put);
+
+u32 tegra_dc_get_frame_count(struct tegra_dc *dc)
+{
+	unsigned long flags;
+	u32 count;
+
+	spin_lock_irqsave(&dc->frame_lock, flags);
+	count = dc->frame_count;
+	spin_unlock_irqrestore(&dc->frame_lock, flags);
+
+	return count;
+}
+EXPORT_SYMBOL(tegra_dc_get_frame_count);
+
+/* returns the time at which FRAME_END number frame occurred, if it has
+ * occurred and is recent enough to still be recorded */
+bool tegra_dc_get_frame_stamp(struct tegra_dc *dc, u32 frame, ktime_t *stamp)
+{
+	unsigned long flags;
+	bool ret = false;
+
+	spin_lock_irqsave(&dc->frame_lock, flags);
+	if (dc->frame_count - frame < TEGRA_DC_FRAME_STAMPS) {
+		*stamp = dc->frame_stamp[frame & (TEGRA_DC_FRAME_STAMPS - 1)];
+		ret = true;
+	}
+	spin_unlock_irqrestore(&dc->frame_lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(tegra_dc_get_frame_stamp);
+
+/* keeps the V_BLANK interrupt enabled, so that vblanks are counted, wake
+ * dc->wq and are reported to dc ext, until tegra_dc_vblank_put() */
+void tegra_dc_vblank_get(struct tegra_dc *dc)
+{
+	unsigned long flags;
+	unsigned long val;
+
+	mutex_lock(&dc->lock);
+	spin_lock_irqsave(&dc->frame_lock, flags);
+	if (!dc->vblank_refs++ && dc->enabled) {
+		val = tegra_dc_readl(dc, DC_CMD_INT_ENABLE);
+		val |= V_BLANK_INT;
+		tegra_dc_writel(dc, val, DC_CMD_INT_ENABLE);
+	}
+	spin_unlock_irqrestore(&dc->frame_lock, flags);
+	mutex_unlock(&dc->lock);
+}
+EXPORT_SYMBOL(tegra_dc_vblank_get);
+
+void tegra_dc_vblank_put(struct tegra_dc *dc)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&dc->frame_lock, flags);
+	BUG_ON(dc->vblank_refs <= 0);
+	dc->vblank_refs--;
+	spin_unlock_irqrestore(&dc->frame_lock, flags);
+}
+EXPORT_SYMBOL(tegra_dc_vblank_put);
+
+/* returns the number of vblanks counted, and the time of the last one */
+u32 tegra_dc_get_vblank(struct tegra_dc *dc, ktime_t *stamp)
+{
+	unsigned long flags;
+	u32 count;
+
+	spin_lock_irqsave(&dc->frame_lock, flags);
+	count = dc->vblank_count;
+	if (stamp)
+		*stamp = dc->vblank_stamp;
+	spin_unlock_irqrestore(&dc->frame_lock, flags);
+
+	return count;
+}
+EXPORT_SYMBOL(tegra_dc_get_vblank);
+
+static void tegra_dc_vblank_worker(struct work_struct *work)
+{
+	struct tegra_dc *dc = container_of(work, struct tegra_dc, vblank_work);
+	ktime_t stamp;
+	u32 count;
+
+	count = tegra_dc_get_vblank(dc, &stamp);
+	tegra_dc_ext_process_vblank(dc->ndev->id, count, ktime_to_ns(stamp));
+}
+
 u32 tegra_dc_get_syncpt_id(const struct tegra_dc *dc, int i)
 {
 	return dc->syncpt[i].id;
@@ -952,6 +1090,7 @@ EXPORT_SYMBOL(tegra_dc_get_out_width);
 static irqreturn_t tegra_dc_irq(int irq, void *ptr)
 {
 	struct tegra_dc *dc = ptr;
+	ktime_t now = ktime_get();
 	unsigned long status;
 	unsigned long val;
 	unsigned long underflow_mask;
@@ -964,6 +1103,11 @@ static irqreturn_t tegra_dc_irq(int irq, void *ptr)
 		int completed = 0;
 		int dirty = 0;
 
+		spin_lock(&dc->frame_lock);
+		dc->frame_count++;
+		dc->frame_stamp[dc->frame_count & (TEGRA_DC_FRAME_STAMPS - 1)] =
+			now;
+
 		val = tegra_dc_readl(dc, DC_CMD_STATE_CONTROL);
 		for (i = 0; i < DC_N_WINDOWS; i++) {
 			if (!(val & (WIN_A_UPDATE << i))) {
@@ -974,12 +1118,16 @@ static irqreturn_t tegra_dc_irq(int irq, void *ptr)
 			}
 		}
 
-		if (!dirty) {
+		if (!dirty && !dc->frame_irq_refs) {
 			val = tegra_dc_readl(dc, DC_CMD_INT_ENABLE);
 			val &= ~FRAME_END_INT;
 			tegra_dc_writel(dc, val, DC_CMD_INT_ENABLE);
 		}
 
+		if (dc->frame_irq_refs)
+			completed = 1;
+		spin_unlock(&dc->frame_lock);
+
 		if (completed)
 			wake_up(&dc->wq);
 	}
@@ -993,14 +1141,28 @@ static irqreturn_t tegra_dc_irq(int irq, void *ptr)
 	 */
 	underflow_mask = status & (WIN_A_UF_INT | WIN_B_UF_INT | WIN_C_UF_INT);
 	if (underflow_mask) {
+		spin_lock(&dc->frame_lock);
 		val = tegra_dc_readl(dc, DC_CMD_INT_ENABLE);
 		val |= V_BLANK_INT;
 		tegra_dc_writel(dc, val, DC_CMD_INT_ENABLE);
+		spin_unlock(&dc->frame_lock);
 		dc->underflow_mask |= underflow_mask;
 	}
 
 	if (status & V_BLANK_INT) {
 		int i;
+		bool listening;
+
+		spin_lock(&dc->frame_lock);
+		dc->vblank_count++;
+		dc->vblank_stamp = now;
+		listening = dc->vblank_refs > 0;
+		spin_unlock(&dc->frame_lock);
+
+		if (listening) {
+			wake_up(&dc->wq);
+			schedule_work(&dc->vblank_work);
+		}
 
 		for (i = 0; i< DC_N_WINDOWS; i++) {
 			if (dc->underflow_mask & (WIN_A_UF_INT <<i)) {
@@ -1013,11 +1175,13 @@ static irqreturn_t tegra_dc_irq(int irq, void *ptr)
 			}
 		}
 
-		if (!dc->underflow_mask) {
+		spin_lock(&dc->frame_lock);
+		if (!dc->underflow_mask && !dc->vblank_refs) {
 			val = tegra_dc_readl(dc, DC_CMD_INT_ENABLE);
 			val &= ~V_BLANK_INT;
 			tegra_dc_writel(dc, val, DC_CMD_INT_ENABLE);
 		}
+		spin_unlock(&dc->frame_lock);
 
 		dc->underflow_mask = 0;
 	}
@@ -1182,7 +1346,10 @@ static void tegra_dc_init(struct tegra_dc *dc)
 			     WIN_C_UF_INT), DC_CMD_INT_MASK);
 	tegra_dc_writel(dc, (WIN_A_UF_INT |
 			     WIN_B_UF_INT |
-			     WIN_C_UF_INT), DC_CMD_INT_ENABLE);
+			     WIN_C_UF_INT |
+			     (dc->frame_irq_refs ? FRAME_END_INT : 0) |
+			     (dc->vblank_refs ? V_BLANK_INT : 0)),
+			DC_CMD_INT_ENABLE);
 
 	tegra_dc_writel(dc, 0x00000000, DC_DISP_BORDER_COLOR);
 
@@ -1405,7 +1572,9 @@ static int tegra_dc_probe(struct nvhost_device *ndev)
 
 	mutex_init(&dc->lock);
 	init_waitqueue_head(&dc->wq);
+	spin_lock_init(&dc->frame_lock);
 	INIT_WORK(&dc->reset_work, tegra_dc_reset_worker);
+	INIT_WORK(&dc->vblank_work, tegra_dc_vblank_worker);
 
 	dc->n_windows = DC_N_WINDOWS;
 	for (i = 0; i < dc->n_windows; i++) {
@@ -1516,6 +1685,7 @@ static int tegra_dc_remove(struct nvhost_device *ndev)
 		_tegra_dc_disable(dc);
 
 	free_irq(dc->irq, dc);
+	cancel_work_sync(&dc->vblank_work);
 	clk_put(dc->emc_clk);
 	clk_put(dc->clk);
 	iounmap(dc->base);
@@ -22,12 +22,17 @@
 #include <linux/list.h>
 #include <linux/mutex.h>
 #include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
 #include "../host/dev.h"
 
 #include <mach/tegra_dc_ext.h>
 
 struct tegra_dc;
 
+/* number of recent FRAME_END timestamps kept; must be a power of two */
+#define TEGRA_DC_FRAME_STAMPS		4
+
 struct tegra_dc_blend {
 	unsigned z[DC_N_WINDOWS];
 	unsigned flags[DC_N_WINDOWS];
@@ -81,6 +86,21 @@ struct tegra_dc {
 
 	struct mutex			lock;
 
+	/* FRAME_END interrupts are counted and timestamped while the
+	 * interrupt is enabled, which it is while any window update is
+	 * pending or frame_irq_refs is held. protected by frame_lock. */
+	spinlock_t			frame_lock;
+	int				frame_irq_refs;
+	u32				frame_count;
+	ktime_t				frame_stamp[TEGRA_DC_FRAME_STAMPS];
+
+	/* likewise, V_BLANK interrupts are counted while vblank_refs is
+	 * held; each one is also reported to dc ext from vblank_work */
+	int				vblank_refs;
+	u32				vblank_count;
+	ktime_t				vblank_stamp;
+	struct work_struct		vblank_work;
+
 	struct resource			*fb_mem;
 	struct tegra_fb_info		*fb;
 
@@ -145,6 +165,16 @@ static inline void *tegra_dc_get_outdata(struct tegra_dc *dc)
 
 void tegra_dc_setup_clk(struct tegra_dc *dc, struct clk *clk);
 
+void tegra_dc_frame_irq_get(struct tegra_dc *dc);
+void tegra_dc_frame_irq_put(struct tegra_dc *dc);
+u32 tegra_dc_get_frame_count(struct tegra_dc *dc);
+bool tegra_dc_get_frame_stamp(struct tegra_dc *dc, u32 frame, ktime_t *stamp);
+int tegra_dc_update_windows_immediate(struct tegra_dc_win *windows[], int n);
+
+void tegra_dc_vblank_get(struct tegra_dc *dc);
+void tegra_dc_vblank_put(struct tegra_dc *dc);
+u32 tegra_dc_get_vblank(struct tegra_dc *dc, ktime_t *stamp);
+
 extern struct tegra_dc_out_ops tegra_dc_rgb_ops;
 extern struct tegra_dc_out_ops tegra_dc_hdmi_ops;
 
@@ -24,6 +24,7 @@
 #include <linux/module.h>
 #include <linux/uaccess.h>
 
+#include "../dc_priv.h"
 #include "tegra_dc_ext_priv.h"
 
 static struct tegra_dc_ext_control g_control;
@@ -33,6 +34,17 @@ int tegra_dc_ext_process_hotplug(int output)
 	return tegra_dc_ext_queue_hotplug(&g_control, output);
 }
 
+int tegra_dc_ext_process_vblank(int output, u32 count, u64 timestamp_ns)
+{
+	return tegra_dc_ext_queue_vblank(&g_control, output, count,
+					 timestamp_ns);
+}
+
+int tegra_dc_ext_process_flip(struct tegra_dc_ext_control_event_flip *flip)
+{
+	return tegra_dc_ext_queue_flip(&g_control, flip);
+}
+
 static int
 get_output_properties(struct tegra_dc_ext_control_output_properties *properties)
 {
@@ -68,6 +80,73 @@ static int get_output_edid(struct tegra_dc_ext_control_output_edid *edid)
 	return -ENOTSUPP;
 }
 
+/* called with vblank_lock held */
+static void vblank_get_dc(struct tegra_dc_ext_control *control,
+			  struct tegra_dc *dc)
+{
+	int i = dc->ndev->id;
+
+	if (control->vblank_dcs[i])
+		return;
+	tegra_dc_vblank_get(dc);
+	control->vblank_dcs[i] = dc;
+}
+
+/* the vblank interrupt of every head is kept on while anybody listens
+ * for vblank events. only the heads which were given a reference are
+ * put, as a head may have come along after the first listener. */
+static void update_vblank_listeners(struct tegra_dc_ext_control *control,
+				    u32 old_mask, u32 new_mask)
+{
+	int delta = !!(new_mask & TEGRA_DC_EXT_EVENT_VBLANK) -
+		    !!(old_mask & TEGRA_DC_EXT_EVENT_VBLANK);
+	int i;
+
+	if (!delta)
+		return;
+
+	mutex_lock(&control->vblank_lock);
+	control->vblank_listeners += delta;
+	if (control->vblank_listeners == (delta > 0 ? 1 : 0)) {
+		for (i = 0; i < TEGRA_MAX_DC; i++) {
+			struct tegra_dc *dc = tegra_dc_get_dc(i);
+
+			if (delta > 0) {
+				if (dc)
+					vblank_get_dc(control, dc);
+			} else if (control->vblank_dcs[i]) {
+				tegra_dc_vblank_put(control->vblank_dcs[i]);
+				control->vblank_dcs[i] = NULL;
+			}
+		}
+	}
+	mutex_unlock(&control->vblank_lock);
+}
+
+/* a head registered while there are listeners gets its reference too */
+void tegra_dc_ext_control_add_dc(struct tegra_dc *dc)
+{
+	struct tegra_dc_ext_control *control = &g_control;
+
+	mutex_lock(&control->vblank_lock);
+	if (control->vblank_listeners)
+		vblank_get_dc(control, dc);
+	mutex_unlock(&control->vblank_lock);
+}
+
+void tegra_dc_ext_control_remove_dc(struct tegra_dc *dc)
+{
+	struct tegra_dc_ext_control *control = &g_control;
+	int i = dc->ndev->id;
+
+	mutex_lock(&control->vblank_lock);
+	if (control->vblank_dcs[i] == dc) {
+		tegra_dc_vblank_put(dc);
+		control->vblank_dcs[i] = NULL;
+	}
+	mutex_unlock(&control->vblank_lock);
+}
+
 static int set_event_mask(struct tegra_dc_ext_control_user *user, u32 mask)
 {
 	struct list_head *list, *tmp;
@@ -77,6 +156,8 @@ static int set_event_mask(struct tegra_dc_ext_control_user *user, u32 mask)
 
 	mutex_lock(&user->lock);
 
+	update_vblank_listeners(user->control, user->event_mask, mask);
+
 	user->event_mask = mask;
 
 	list_for_each_safe(list, tmp, &user->event_list) {
@@ -219,6 +300,7 @@ int tegra_dc_ext_control_init(void)
 	}
 
 	mutex_init(&control->lock);
+	mutex_init(&control->vblank_lock);
 
 	INIT_LIST_HEAD(&control->users);
 
@@ -20,9 +20,10 @@
 
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
-#include <linux/workqueue.h>
 
 #include <video/tegra_dc_ext.h>
 
@@ -53,10 +54,16 @@ struct tegra_dc_ext_flip_win {
 
 struct tegra_dc_ext_flip_data {
 	struct tegra_dc_ext		*ext;
-	struct work_struct		work;
+	struct list_head		list;
 	struct tegra_dc_ext_flip_win	win[DC_N_WINDOWS];
+	u32				swap_interval;
+	u32				post_syncpt_id;
+	u32				post_syncpt_val;
+	ktime_t				queued;
 };
 
+#define TEGRA_DC_EXT_MAX_SWAP_INTERVAL	2
+
 int tegra_dc_ext_get_num_outputs(void)
 {
 	/* TODO: decouple output count from head count */
@@ -121,7 +128,7 @@ static int tegra_dc_ext_put_window(struct tegra_dc_ext_user *user,
 	mutex_lock(&win->lock);
 
 	if (win->user == user) {
-		flush_workqueue(win->flip_wq);
+		tegra_dc_ext_flush_flips(ext);
 		win->user = 0;
 	} else {
 		ret = -EACCES;
@@ -160,18 +167,13 @@ void tegra_dc_ext_enable(struct tegra_dc_ext *ext)
 
 void tegra_dc_ext_disable(struct tegra_dc_ext *ext)
 {
-	int i;
 	set_enable(ext, false);
 
 	/*
 	 * Flush the flip queue -- note that this must be called with dc->lock
 	 * unlocked or else it will hang.
 	 */
-	for (i = 0; i < ext->dc->n_windows; i++) {
-		struct tegra_dc_ext_win *win = &ext->win[i];
-
-		flush_workqueue(win->flip_wq);
-	}
+	tegra_dc_ext_flush_flips(ext);
 }
 
 static int tegra_dc_ext_set_windowattr(struct tegra_dc_ext *ext,
@@ -235,14 +237,45 @@ static void process_window_change(struct tegra_dc_ext *ext, int delta)
 	mutex_unlock(&ext->enable_change_lock);
 }
 
-static void tegra_dc_ext_flip_worker(struct work_struct *work)
+static bool flip_report_ready(struct tegra_dc_ext *ext)
+{
+	return ext->flip.report_pending &&
+		(s32)(tegra_dc_get_frame_count(ext->dc) -
+		      ext->flip.latch_frame) > 0;
+}
+
+/* sends the timestamps of the last flip to the control node. the flip was
+ * scanned out by the end of the frame following the one it was latched
+ * in; if that frame is not known, scanout_ns is left zero. */
+static void flip_send_report(struct tegra_dc_ext *ext)
+{
+	struct tegra_dc_ext_control_event_flip *report = &ext->flip.report;
+	ktime_t stamp;
+
+	if (tegra_dc_get_frame_stamp(ext->dc, ext->flip.latch_frame + 1,
+				     &stamp) &&
+	    (s32)(tegra_dc_get_frame_count(ext->dc) -
+		  ext->flip.latch_frame) > 0)
+		report->scanout_ns = ktime_to_ns(stamp);
+	else
+		report->scanout_ns = 0;
+
+	tegra_dc_ext_process_flip(report);
+
+	ext->flip.report_pending = false;
+	tegra_dc_frame_irq_put(ext->dc);
+}
+
+static void tegra_dc_ext_flip_worker(struct tegra_dc_ext_flip_data *data)
 {
-	struct tegra_dc_ext_flip_data *data =
-		container_of(work, struct tegra_dc_ext_flip_data, work);
 	struct tegra_dc_ext *ext = data->ext;
+	struct tegra_dc *dc = ext->dc;
 	struct tegra_dc_win *wins[DC_N_WINDOWS];
 	struct nvmap_handle_ref *unpin_handles[DC_N_WINDOWS];
+	struct tegra_dc_ext_control_event_flip *report = &ext->flip.report;
 	int i, nr_unpin = 0, nr_win = 0, nr_disable = 0;
+	ktime_t latched;
+	u32 frame;
 
 	for (i = 0; i < DC_N_WINDOWS; i++) {
 		struct tegra_dc_ext_flip_win *flip_win = &data->win[i];
@@ -254,7 +287,7 @@ static void tegra_dc_ext_flip_worker(struct work_struct *work)
 		if (index < 0)
 			continue;
 
-		win = tegra_dc_get_window(ext->dc, index);
+		win = tegra_dc_get_window(dc, index);
 		ext_win = &ext->win[index];
 
 		old_ena = ext->win[index].enabled;
@@ -275,9 +308,35 @@ static void tegra_dc_ext_flip_worker(struct work_struct *work)
 		wins[nr_win++] = win;
 	}
 
-	tegra_dc_update_windows(wins, nr_win);
-	/* TODO: implement swapinterval here */
-	tegra_dc_sync_windows(wins, nr_win);
+	/* count frames from here until this flip's report has been sent */
+	tegra_dc_frame_irq_get(dc);
+
+	/*
+	 * The previous flip was latched at the end of frame latch_frame and
+	 * is shown from the next frame on.  An update programmed now is
+	 * latched at the end of the current frame at the earliest, so the
+	 * previous flip is shown for swap_interval frames if programming
+	 * waits for swap_interval - 1 further frames.
+	 */
+	if (data->swap_interval > 1 && ext->flip.latched) {
+		u32 target = ext->flip.latch_frame + data->swap_interval - 1;
+
+		wait_event_timeout(dc->wq,
+			(s32)(tegra_dc_get_frame_count(dc) - target) >= 0 ||
+			!dc->enabled, HZ);
+	}
+
+	if (data->swap_interval) {
+		tegra_dc_update_windows(wins, nr_win);
+		tegra_dc_sync_windows(wins, nr_win);
+		frame = tegra_dc_get_frame_count(dc);
+		if (!tegra_dc_get_frame_stamp(dc, frame, &latched))
+			latched = ktime_get();
+	} else {
+		tegra_dc_update_windows_immediate(wins, nr_win);
+		frame = tegra_dc_get_frame_count(dc);
+		latched = ktime_get();
+	}
 
 	for (i = 0; i < DC_N_WINDOWS; i++) {
 		struct tegra_dc_ext_flip_win *flip_win = &data->win[i];
@@ -286,8 +345,7 @@ static void tegra_dc_ext_flip_worker(struct work_struct *work)
 		if (index < 0)
 			continue;
 
-		tegra_dc_incr_syncpt_min(ext->dc, index,
-			flip_win->syncpt_max);
+		tegra_dc_incr_syncpt_min(dc, index, flip_win->syncpt_max);
 	}
 
 	/* unpin and deref previous front buffers */
@@ -299,9 +357,105 @@ static void tegra_dc_ext_flip_worker(struct work_struct *work)
 	if (nr_disable)
 		process_window_change(ext, -nr_disable);
 
+	/* the previous flip has normally been scanned out by now */
+	if (ext->flip.report_pending)
+		flip_send_report(ext);
+
+	report->handle = dc->ndev->id;
+	report->post_syncpt_id = data->post_syncpt_id;
+	report->post_syncpt_val = data->post_syncpt_val;
+	report->swap_interval = data->swap_interval;
+	report->queued_ns = ktime_to_ns(data->queued);
+	report->latched_ns = ktime_to_ns(latched);
+	ext->flip.report_pending = true;
+	ext->flip.latch_frame = frame;
+	ext->flip.latched = true;
+
 	kfree(data);
 }
 
+static bool flip_queue_empty(struct tegra_dc_ext *ext)
+{
+	bool empty;
+
+	spin_lock(&ext->flip.lock);
+	empty = list_empty(&ext->flip.queue);
+	spin_unlock(&ext->flip.lock);
+
+	return empty;
+}
+
+static bool flip_idle(struct tegra_dc_ext *ext)
+{
+	bool idle;
+
+	spin_lock(&ext->flip.lock);
+	idle = list_empty(&ext->flip.queue) && !ext->flip.busy;
+	spin_unlock(&ext->flip.lock);
+
+	return idle;
+}
+
+static struct tegra_dc_ext_flip_data *flip_dequeue(struct tegra_dc_ext *ext)
+{
+	struct tegra_dc_ext_flip_data *data = NULL;
+
+	spin_lock(&ext->flip.lock);
+	if (!list_empty(&ext->flip.queue)) {
+		data = list_first_entry(&ext->flip.queue,
+					struct tegra_dc_ext_flip_data, list);
+		list_del(&data->list);
+		ext->flip.busy = true;
+	}
+	spin_unlock(&ext->flip.lock);
+
+	return data;
+}
+
+/*
+ * Flips are applied in order by one real-time thread per head.  The thread
+ * sleeps on the dc wait queue, which is woken for queued flips and, while
+ * a report is outstanding, on every FRAME_END.
+ */
+static int tegra_dc_ext_flip_thread(void *arg)
+{
+	struct tegra_dc_ext *ext = arg;
+	struct tegra_dc *dc = ext->dc;
+
+	while (!kthread_should_stop()) {
+		struct tegra_dc_ext_flip_data *data;
+
+		wait_event_interruptible(dc->wq,
+			!flip_queue_empty(ext) || flip_report_ready(ext) ||
+			kthread_should_stop());
+
+		if (flip_report_ready(ext))
+			flip_send_report(ext);
+
+		data = flip_dequeue(ext);
+		if (data) {
+			tegra_dc_ext_flip_worker(data);
+
+			spin_lock(&ext->flip.lock);
+			ext->flip.busy = false;
+			spin_unlock(&ext->flip.lock);
+			wake_up(&ext->flip.idle_wq);
+		}
+	}
+
+	if (ext->flip.report_pending) {
+		ext->flip.report_pending = false;
+		tegra_dc_frame_irq_put(dc);
+	}
+
+	return 0;
+}
+
+void tegra_dc_ext_flush_flips(struct tegra_dc_ext *ext)
+{
+	wait_event(ext->flip.idle_wq, flip_idle(ext));
+}
+
 static int lock_windows_for_flip(struct tegra_dc_ext_user *user,
 				 struct tegra_dc_ext_flip *args)
 {
@@ -385,7 +539,6 @@ static int tegra_dc_ext_flip(struct tegra_dc_ext_user *user,
 {
 	struct tegra_dc_ext *ext = user->ext;
 	struct tegra_dc_ext_flip_data *data;
-	int work_index;
 	int i, ret = 0;
 
 	if (!user->nvmap)
@@ -399,8 +552,8 @@ static int tegra_dc_ext_flip(struct tegra_dc_ext_user *user,
 	if (!data)
 		return -ENOMEM;
 
-	INIT_WORK(&data->work, tegra_dc_ext_flip_worker);
 	data->ext = ext;
+	data->queued = ktime_get();
 
 	for (i = 0; i < DC_N_WINDOWS; i++) {
 		struct tegra_dc_ext_flip_win *flip_win = &data->win[i];
@@ -411,6 +564,11 @@ static int tegra_dc_ext_flip(struct tegra_dc_ext_user *user,
 		if (index < 0)
 			continue;
 
+		/* the longest interval of any of the windows wins */
+		data->swap_interval = max_t(u32, data->swap_interval,
+			min_t(u32, flip_win->attr.swap_interval,
+			      TEGRA_DC_EXT_MAX_SWAP_INTERVAL));
+
 		ret = tegra_dc_ext_pin_window(user, flip_win->attr.buff_id,
 					      &flip_win->handle,
 					      &flip_win->phys_addr);
@@ -444,9 +602,14 @@ static int tegra_dc_ext_flip(struct tegra_dc_ext_user *user,
 		 */
 		args->post_syncpt_val = syncpt_max;
 		args->post_syncpt_id = tegra_dc_get_syncpt_id(ext->dc, index);
-		work_index = index;
 	}
-	queue_work(ext->win[work_index].flip_wq, &data->work);
+	data->post_syncpt_id = args->post_syncpt_id;
+	data->post_syncpt_val = args->post_syncpt_val;
+
+	spin_lock(&ext->flip.lock);
+	list_add_tail(&data->list, &ext->flip.queue);
+	spin_unlock(&ext->flip.lock);
+	wake_up(&ext->dc->wq);
 
 	unlock_windows_for_flip(user, args);
 
@@ -512,6 +675,57 @@ static u32 tegra_dc_ext_get_vblank_syncpt(struct tegra_dc_ext_user *user)
 	return dc->vblank_syncpt;
 }
 
+static bool vblank_reached(struct tegra_dc *dc, u32 target)
+{
+	return (s32)(tegra_dc_get_vblank(dc, NULL) - target) >= 0 ||
+		!dc->enabled;
+}
+
+static int tegra_dc_ext_wait_vblank(struct tegra_dc_ext_user *user,
+				    struct tegra_dc_ext_vblank *args)
+{
+	struct tegra_dc *dc = user->ext->dc;
+	ktime_t stamp;
+	u32 target;
+	long ret = 0;
+
+	if (args->flags & ~TEGRA_DC_EXT_VBLANK_RELATIVE)
+		return -EINVAL;
+
+	tegra_dc_vblank_get(dc);
+
+	target = args->count;
+	if (args->flags & TEGRA_DC_EXT_VBLANK_RELATIVE)
+		target += tegra_dc_get_vblank(dc, NULL);
+
+	/* a vblank comes along at least every few tens of ms while the
+	 * head is enabled; give up if none arrives for a whole second */
+	while (!vblank_reached(dc, target)) {
+		u32 before = tegra_dc_get_vblank(dc, NULL);
+
+		ret = wait_event_interruptible_timeout(dc->wq,
+			tegra_dc_get_vblank(dc, NULL) != before ||
+			vblank_reached(dc, target), HZ);
+		if (ret < 0)
+			break;
+		if (ret == 0) {
+			ret = -ETIMEDOUT;
+			break;
+		}
+		ret = 0;
+	}
+
+	if (!ret && !dc->enabled)
+		ret = -ENXIO;
+
+	args->count = tegra_dc_get_vblank(dc, &stamp);
+	args->timestamp_ns = ktime_to_ns(stamp);
+
+	tegra_dc_vblank_put(dc);
+
+	return ret;
+}
+
 static int tegra_dc_ext_get_status(struct tegra_dc_ext_user *user,
 				   struct tegra_dc_ext_status *status)
 {
@@ -599,6 +813,22 @@ static long tegra_dc_ioctl(struct file *filp, unsigned int cmd,
 		return 0;
 	}
 
+	case TEGRA_DC_EXT_WAIT_VBLANK:
+	{
+		struct tegra_dc_ext_vblank args;
+		int ret;
+
+		if (copy_from_user(&args, user_arg, sizeof(args)))
+			return -EFAULT;
+
+		ret = tegra_dc_ext_wait_vblank(user, &args);
+
+		if (copy_to_user(user_arg, &args, sizeof(args)))
+			return -EFAULT;
+
+		return ret;
+	}
+
 	case TEGRA_DC_EXT_GET_STATUS:
 	{
 		struct tegra_dc_ext_status args;
@@ -657,35 +887,30 @@ static int tegra_dc_release(struct inode *inode, struct file *filp)
 
 static int tegra_dc_ext_setup_windows(struct tegra_dc_ext *ext)
 {
-	int i, ret;
+	struct sched_param param = { .sched_priority = MAX_USER_RT_PRIO / 2 };
+	int i;
 
 	for (i = 0; i < ext->dc->n_windows; i++) {
 		struct tegra_dc_ext_win *win = &ext->win[i];
-		char name[32];
 
 		win->ext = ext;
 		win->idx = i;
 
-		snprintf(name, sizeof(name), "tegradc.%d/%c",
-			 ext->dc->ndev->id, 'a' + i);
-		win->flip_wq = create_singlethread_workqueue(name);
-		if (!win->flip_wq) {
-			ret = -ENOMEM;
-			goto cleanup;
-		}
-
 		mutex_init(&win->lock);
 	}
 
-	return 0;
+	INIT_LIST_HEAD(&ext->flip.queue);
+	spin_lock_init(&ext->flip.lock);
+	init_waitqueue_head(&ext->flip.idle_wq);
 
-cleanup:
-	while (i--) {
-		struct tegra_dc_ext_win *win = &ext->win[i];
-		destroy_workqueue(win->flip_wq);
-	}
+	ext->flip.thread = kthread_run(tegra_dc_ext_flip_thread, ext,
+				       "tegradc.%d/flip", ext->dc->ndev->id);
+	if (IS_ERR(ext->flip.thread))
+		return PTR_ERR(ext->flip.thread);
 
-	return ret;
+	sched_setscheduler(ext->flip.thread, SCHED_FIFO, &param);
+
+	return 0;
 }
 
 static const struct file_operations tegra_dc_devops = {
@@ -746,6 +971,8 @@ struct tegra_dc_ext *tegra_dc_ext_register(struct nvhost_device *ndev,
 
 	head_count++;
 
+	tegra_dc_ext_control_add_dc(dc);
+
 	return ext;
 
 cleanup_nvmap:
@@ -765,14 +992,10 @@ cleanup_alloc:
 
 void tegra_dc_ext_unregister(struct tegra_dc_ext *ext)
 {
-	int i;
-
-	for (i = 0; i < ext->dc->n_windows; i++) {
-		struct tegra_dc_ext_win *win = &ext->win[i];
+	tegra_dc_ext_control_remove_dc(ext->dc);
 
-		flush_workqueue(win->flip_wq);
-		destroy_workqueue(win->flip_wq);
-	}
+	tegra_dc_ext_flush_flips(ext);
+	kthread_stop(ext->flip.thread);
 
 	nvmap_client_put(ext->nvmap);
 	device_del(ext->dev);
@@ -135,6 +135,27 @@ ssize_t tegra_dc_ext_event_read(struct file *filp, char __user *buf,
 	return to_copy ? to_copy : retval;
 }
 
+/* the vblank event of the same head still waiting to be read, if any */
+static struct tegra_dc_ext_event_list *
+find_pending_vblank(struct tegra_dc_ext_control_user *user,
+		    struct tegra_dc_ext_event *event)
+{
+	struct tegra_dc_ext_control_event_vblank *vblank =
+		(struct tegra_dc_ext_control_event_vblank *)event->data;
+	struct tegra_dc_ext_event_list *ev_list;
+
+	list_for_each_entry(ev_list, &user->event_list, list) {
+		struct tegra_dc_ext_control_event_vblank *pending =
+			(struct tegra_dc_ext_control_event_vblank *)
+			ev_list->event.data;
+
+		if (ev_list->event.type == TEGRA_DC_EXT_EVENT_VBLANK &&
+		    pending->handle == vblank->handle)
+			return ev_list;
+	}
+	return NULL;
+}
+
 static int tegra_dc_ext_queue_event(struct tegra_dc_ext_control *control,
 				    struct tegra_dc_ext_event *event)
 {
@@ -155,6 +176,21 @@ static int tegra_dc_ext_queue_event(struct tegra_dc_ext_control *control,
 			continue;
 		}
 
+		/* vblanks come in at the refresh rate, so one which hasn't
+		 * been read yet is brought up to date rather than another
+		 * one queued; its count tells how many were missed */
+		if (event->type == TEGRA_DC_EXT_EVENT_VBLANK) {
+			ev_list = find_pending_vblank(user, event);
+			if (ev_list) {
+				memcpy(&ev_list->event, event,
+					sizeof(*event) + event->data_size);
+				list_move_tail(&ev_list->list,
+					       &user->event_list);
+				mutex_unlock(&user->lock);
+				continue;
+			}
+		}
+
 		ev_list = kmalloc(sizeof(*ev_list), GFP_KERNEL);
 		if (!ev_list) {
 			retval = -ENOMEM;
@@ -195,3 +231,41 @@ int tegra_dc_ext_queue_hotplug(struct tegra_dc_ext_control *control, int output)
 
 	return 0;
 }
+
+int tegra_dc_ext_queue_vblank(struct tegra_dc_ext_control *control,
+			      int output, u32 count, u64 timestamp_ns)
+{
+	struct {
+		struct tegra_dc_ext_event event;
+		struct tegra_dc_ext_control_event_vblank vblank;
+	} __packed pack;
+
+	pack.event.type = TEGRA_DC_EXT_EVENT_VBLANK;
+	pack.event.data_size = sizeof(pack.vblank);
+
+	pack.vblank.handle = output;
+	pack.vblank.count = count;
+	pack.vblank.timestamp_ns = timestamp_ns;
+
+	tegra_dc_ext_queue_event(control, &pack.event);
+
+	return 0;
+}
+
+int tegra_dc_ext_queue_flip(struct tegra_dc_ext_control *control,
+			    struct tegra_dc_ext_control_event_flip *flip)
+{
+	struct {
+		struct tegra_dc_ext_event event;
+		struct tegra_dc_ext_control_event_flip flip;
+	} __packed pack;
+
+	pack.event.type = TEGRA_DC_EXT_EVENT_FLIP;
+	pack.event.data_size = sizeof(pack.flip);
+
+	pack.flip = *flip;
+
+	tegra_dc_ext_queue_event(control, &pack.event);
+
+	return 0;
+}
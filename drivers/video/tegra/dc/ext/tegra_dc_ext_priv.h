@@ -23,6 +23,7 @@
 #include <linux/list.h>
 #include <linux/mutex.h>
 #include <linux/poll.h>
+#include <linux/spinlock.h>
 
 #include <mach/dc.h>
 #include <mach/nvmap.h>
@@ -47,8 +48,6 @@ struct tegra_dc_ext_win {
 
 	struct nvmap_handle_ref	*cur_handle;
 	bool enabled;
-
-	struct workqueue_struct	*flip_wq;
 };
 
 struct tegra_dc_ext {
@@ -71,12 +70,28 @@ struct tegra_dc_ext {
 	int				nr_win_ena;
 
 	bool				enabled;
+
+	struct {
+		struct task_struct	*thread;
+		/* queue and busy are protected by lock */
+		struct list_head	queue;
+		spinlock_t		lock;
+		bool			busy;
+		wait_queue_head_t	idle_wq;
+
+		/* owned by the flip thread */
+		bool			latched;
+		u32			latch_frame;
+		bool			report_pending;
+		struct tegra_dc_ext_control_event_flip report;
+	} flip;
 };
 
 #define TEGRA_DC_EXT_EVENT_MASK_ALL \
-	TEGRA_DC_EXT_EVENT_HOTPLUG
+	(TEGRA_DC_EXT_EVENT_HOTPLUG | TEGRA_DC_EXT_EVENT_FLIP | \
+	 TEGRA_DC_EXT_EVENT_VBLANK)
 
-#define TEGRA_DC_EXT_EVENT_MAX_SZ	8
+#define TEGRA_DC_EXT_EVENT_MAX_SZ	40
 
 struct tegra_dc_ext_event_list {
 	struct tegra_dc_ext_event	event;
@@ -108,6 +123,12 @@ struct tegra_dc_ext_control {
 
 	struct list_head		users;
 
+	/* number of users listening for TEGRA_DC_EXT_EVENT_VBLANK, and the
+	 * heads on which they hold a vblank reference */
+	int				vblank_listeners;
+	struct tegra_dc			*vblank_dcs[TEGRA_MAX_DC];
+	struct mutex			vblank_lock;
+
 	struct mutex			lock;
 };
 
@@ -126,9 +147,19 @@ extern int tegra_dc_ext_set_cursor(struct tegra_dc_ext_user *user,
 				   struct tegra_dc_ext_cursor *);
 
 extern int tegra_dc_ext_control_init(void);
+extern void tegra_dc_ext_control_add_dc(struct tegra_dc *dc);
+extern void tegra_dc_ext_control_remove_dc(struct tegra_dc *dc);
 
 extern int tegra_dc_ext_queue_hotplug(struct tegra_dc_ext_control *,
 				      int output);
+extern int tegra_dc_ext_queue_flip(struct tegra_dc_ext_control *,
+			struct tegra_dc_ext_control_event_flip *flip);
+extern int tegra_dc_ext_process_flip(
+			struct tegra_dc_ext_control_event_flip *flip);
+extern int tegra_dc_ext_queue_vblank(struct tegra_dc_ext_control *,
+				     int output, u32 count, u64 timestamp_ns);
+
+extern void tegra_dc_ext_flush_flips(struct tegra_dc_ext *ext);
 extern ssize_t tegra_dc_ext_event_read(struct file *filp, char __user *buf,
 				       size_t size, loff_t *ppos);
 extern unsigned int tegra_dc_ext_event_poll(struct file *, poll_table *);
@@ -17,6 +17,7 @@
 
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
+#include <linux/math64.h>
 
 #include <asm/io.h>
 
@@ -155,6 +156,89 @@ static int nvhost_debug_show(struct seq_file *s, void *unused)
 
 	}
 
+	seq_printf(s, "\n---- syncpt waiters ----\n");
+	for (i = 0; i < NV_HOST1X_SYNCPT_NB_PTS; i++) {
+		struct nvhost_intr_syncpt *sp = &m->intr.syncpt[i];
+		struct nvhost_intr_stat stat;
+		unsigned int depth;
+
+		if (!sp->irq_requested)
+			continue;
+
+		spin_lock(&sp->lock);
+		depth = sp->wait_len;
+		stat = sp->stat;
+		spin_unlock(&sp->lock);
+
+		seq_printf(s, "id %d (%s) depth %u max %u completed %lu "
+			   "irqs %lu latency avg %llu max %u us\n",
+			   i, nvhost_syncpt_name(i), depth, stat.max_depth,
+			   stat.completed, stat.irqs,
+			   stat.irqs ? div_u64(stat.total_us, stat.irqs) : 0ULL,
+			   stat.max_us);
+	}
+
+	seq_printf(s, "\n---- channel stalls ----\n");
+	for (i = 0; i < NVHOST_NUMCHANNELS; i++) {
+		struct nvhost_cdma *cdma = &m->channels[i].cdma;
+		struct nvhost_cdma_stats stats;
+		u32 pb_size;
+
+		/* the cdma is set up when the channel is first opened */
+		if (!cdma->push_buffer.size)
+			continue;
+
+		mutex_lock(&cdma->lock);
+		stats = cdma->stats;
+		pb_size = cdma->push_buffer.size;
+		mutex_unlock(&cdma->lock);
+
+		seq_printf(s, "%d-%s: pb %u slots, stalls pb %u sq %u, "
+			   "would block %u, pb grown %u times\n",
+			   i, m->channels[i].mod.name, pb_size / 8,
+			   stats.pb_stalls, stats.sq_stalls,
+			   stats.would_block, stats.pb_grows);
+	}
+
+	seq_printf(s, "\n---- context switches ----\n");
+	for (i = 0; i < NVHOST_NUMCHANNELS; i++) {
+		struct nvhost_channel *ch = &m->channels[i];
+		struct nvhost_ctxsw_stats stats = ch->ctxsw_stats;
+
+		if (!ch->ctxhandler.alloc)
+			continue;
+
+		seq_printf(s, "%d-%s: %u switches, saves %u (%u skipped), "
+			   "restores %u (%u delta), %llu restore words skipped\n",
+			   i, ch->desc->name, stats.switches, stats.saves,
+			   stats.saves_skipped, stats.restores,
+			   stats.delta_restores, stats.restore_words_skipped);
+	}
+
+	seq_printf(s, "\n---- submit queue wait ----\n");
+	for (i = 0; i < NVHOST_NUMCHANNELS; i++) {
+		static const char *prio_names[NVHOST_NUM_PRIORITIES] = {
+			"low", "medium", "high"
+		};
+		struct nvhost_sched *sched = &m->channels[i].sched;
+		struct nvhost_sched_stats stats[NVHOST_NUM_PRIORITIES];
+		int p;
+
+		spin_lock(&sched->lock);
+		memcpy(stats, sched->stats, sizeof(stats));
+		spin_unlock(&sched->lock);
+
+		for (p = 0; p < NVHOST_NUM_PRIORITIES; p++) {
+			if (!stats[p].submits)
+				continue;
+			seq_printf(s, "%d-%s %s: %u submits, wait avg %llu "
+				   "max %u us\n", i, m->channels[i].desc->name,
+				   prio_names[p], stats[p].submits,
+				   div_u64(stats[p].wait_us, stats[p].submits),
+				   stats[p].max_wait_us);
+		}
+	}
+
 	seq_printf(s, "\n---- channels ----\n");
 	for (i = 0; i < NVHOST_NUMCHANNELS; i++) {
 		void __iomem *regs = m->channels[i].aperture;
@@ -21,6 +21,7 @@
  */
 
 #include "dev.h"
+#include "nvhost_fence.h"
 
 #include <linux/slab.h>
 #include <linux/string.h>
@@ -31,6 +32,8 @@
 #include <linux/uaccess.h>
 #include <linux/file.h>
 #include <linux/clk.h>
+#include <linux/poll.h>
+#include <linux/capability.h>
 
 #include <asm/io.h>
 
@@ -54,6 +57,11 @@ struct nvhost_channel_userctx {
 	struct nvmap_pinarray_elem pinarray[NVHOST_MAX_HANDLES];
 	struct nvmap_handle *unpinarray[NVHOST_MAX_HANDLES];
 	struct nvmap_client *nvmap;
+	/* size of the last submit turned away with -EAGAIN, for poll */
+	unsigned int wait_slots;
+	unsigned int wait_entries;
+	unsigned int wait_handles;
+	int priority;
 };
 
 struct nvhost_ctrl_userctx {
@@ -101,6 +109,7 @@ static int nvhost_channelopen(struct inode *inode, struct file *filp)
 	}
 	filp->private_data = priv;
 	priv->ch = ch;
+	priv->priority = NVHOST_PRIORITY_MEDIUM;
 	gather_size = sizeof(struct nvhost_op_pair) * NVHOST_MAX_GATHERS;
 	priv->gather_mem = nvmap_alloc(ch->dev->nvmap, gather_size, 32,
 				       NVMAP_HANDLE_CACHEABLE);
@@ -208,17 +217,196 @@ static ssize_t nvhost_channelwrite(struct file *filp, const char __user *buf,
 	return (count - remaining);
 }
 
-static int nvhost_ioctl_channel_flush(struct nvhost_channel_userctx *ctx,
-				      struct nvhost_get_param_args *args,
-				      int null_kickoff)
+/* the interrupt waiters of a job, allocated before any job of a submit
+ * is pushed so that pushing can't fail part way through */
+struct nvhost_job_waiters {
+	void *ctxsave;
+	void *complete;
+};
+
+/* allocates the waiters nvhost_push_job needs for a job on syncpt_id; only
+ * the first job of a submit can switch out the context loaded in the unit.
+ * called with submitlock held. */
+static int alloc_job_waiters(struct nvhost_channel_userctx *ctx,
+			     u32 syncpt_id, bool first,
+			     struct nvhost_job_waiters *w)
+{
+	struct nvhost_channel *ch = ctx->ch;
+	struct nvhost_intr *intr = &ch->dev->intr;
+	int err;
+
+	w->ctxsave = NULL;
+	err = nvhost_intr_alloc_waiter(intr, syncpt_id, &w->complete);
+	if (err)
+		return err;
+
+	if (first && ch->cur_ctx && ch->cur_ctx != ctx->hwctx) {
+		err = nvhost_intr_alloc_waiter(intr, syncpt_id, &w->ctxsave);
+		if (err)
+			nvhost_intr_free_waiter(intr, syncpt_id, w->complete);
+	}
+	return err;
+}
+
+static void free_job_waiters(struct nvhost_channel_userctx *ctx,
+			     u32 syncpt_id, struct nvhost_job_waiters *w)
+{
+	struct nvhost_intr *intr = &ctx->ch->dev->intr;
+
+	nvhost_intr_free_waiter(intr, syncpt_id, w->complete);
+	if (w->ctxsave)
+		nvhost_intr_free_waiter(intr, syncpt_id, w->ctxsave);
+}
+
+/* pushes the gathers ctx->gathers[first..end) to the channel as one job.
+ * the slots just below first are reserved for the context switch, the
+ * setclass and one host wait per wait check. called with submitlock held,
+ * with the waiters from alloc_job_waiters(); returns the syncpt value
+ * which marks completion of the job. */
+static u32 nvhost_push_job(struct nvhost_channel_userctx *ctx,
+			   int first, int end, u32 syncpt_id, u32 syncpt_incrs,
+			   const struct nvhost_waitchk *waitchks,
+			   int num_waitchks, struct nvmap_handle **unpins,
+			   int num_unpins, int null_kickoff,
+			   struct nvhost_job_waiters *waiters)
 {
+	struct nvhost_channel *ch = ctx->ch;
+	struct nvhost_syncpt *sp = &ch->dev->syncpt;
 	struct nvhost_cpuinterrupt ctxsw;
-	int gather_idx = 2;
+	int gather_idx = first;
 	int num_intrs = 0;
+	int nulled_incrs = null_kickoff ? syncpt_incrs : 0;
 	u32 syncval;
+	int i;
+
+	/* context switch */
+	if (ch->cur_ctx != ctx->hwctx) {
+		struct nvhost_hwctx *hw = ctx->hwctx;
+		struct nvhost_hwctx *out = ch->cur_ctx;
+
+		ch->ctxsw_stats.switches++;
+		if (hw && hw->valid) {
+			u32 restore_phys = hw->restore_phys;
+
+			/* if this is the only save of the outgoing context in
+			 * flight, its save service fills in the delta restore
+			 * against the state it leaves in the unit */
+			if (out && hw->restore_delta_phys &&
+			    !atomic_read(&out->saves_pending)) {
+				out->next = hw;
+				ch->ctxhandler.get(hw);
+				restore_phys = hw->restore_delta_phys;
+				ch->ctxsw_stats.delta_restores++;
+			}
+			gather_idx--;
+			ctx->gathers[gather_idx].op1 =
+				nvhost_opcode_gather(0, hw->restore_size);
+			ctx->gathers[gather_idx].op2 = restore_phys;
+			syncpt_incrs += hw->restore_incrs;
+			ch->ctxsw_stats.restores++;
+		}
+		hw = out;
+		if (hw) {
+			gather_idx--;
+			ctx->gathers[gather_idx].op1 =
+				nvhost_opcode_gather(0, hw->save_size);
+			ctx->gathers[gather_idx].op2 = hw->save_phys;
+			syncpt_incrs += hw->save_incrs;
+			num_intrs = 1;
+			ctxsw.syncpt_val = hw->save_incrs - 1;
+			ctxsw.intr_data = hw;
+			ctxsw.waiter = waiters->ctxsave;
+			hw->valid = true;
+			ch->ctxhandler.get(hw);
+			atomic_inc(&hw->saves_pending);
+			ch->ctxsw_stats.saves++;
+		}
+		ch->cur_ctx = ctx->hwctx;
+	}
+
+	/* add a setclass for modules that require it */
+	if (gather_idx == first && ch->desc->class) {
+		gather_idx--;
+		ctx->gathers[gather_idx].op1 =
+			nvhost_opcode_setclass(ch->desc->class, 0, 0);
+		ctx->gathers[gather_idx].op2 = NVHOST_OPCODE_NOOP;
+	}
+
+	/* waits which have already been satisfied are dropped, rather than
+	 * costing a host wait in the channel; the rest are pushed ahead of
+	 * the job */
+	for (i = 0; i < num_waitchks; i++) {
+		u32 id = waitchks[i].syncpt_id;
+		u32 thresh = waitchks[i].thresh;
+
+		if (nvhost_syncpt_min_cmp(sp, id, thresh))
+			continue;
+		nvhost_syncpt_update_min(sp, id);
+		if (nvhost_syncpt_min_cmp(sp, id, thresh))
+			continue;
+
+		gather_idx--;
+		ctx->gathers[gather_idx].op1 =
+			nvhost_opcode_setclass(NV_HOST1X_CLASS_ID,
+					       NV_CLASS_HOST_WAIT_SYNCPT, 1);
+		ctx->gathers[gather_idx].op2 =
+			nvhost_class_host_wait_syncpt(id, thresh);
+	}
+
+	/* get absolute sync value */
+	if (BIT(syncpt_id) & NVSYNCPTS_CLIENT_MANAGED)
+		syncval = nvhost_syncpt_set_max(sp, syncpt_id, syncpt_incrs);
+	else
+		syncval = nvhost_syncpt_incr_max(sp, syncpt_id, syncpt_incrs);
+
+	/* patch absolute syncpt value into interrupt triggers */
+	ctxsw.syncpt_val += syncval - syncpt_incrs;
+
+	nvhost_channel_submit(ch, ctx->nvmap, &ctx->gathers[gather_idx],
+			      (null_kickoff ? first : end) - gather_idx,
+			      &ctxsw, num_intrs, unpins, num_unpins,
+			      syncpt_id, syncval, nulled_incrs);
+
+	/* schedule a submit complete interrupt */
+	nvhost_intr_add_waiter(&ch->dev->intr, syncpt_id, syncval,
+			NVHOST_INTR_ACTION_SUBMIT_COMPLETE, ch,
+			waiters->complete, NULL);
+
+	return syncval;
+}
+
+/* upper bound of the push buffer slots nvhost_push_job uses for a job
+ * spanning num_gathers gathers, including its reserved slots */
+static unsigned int job_slots(int num_gathers, u32 syncpt_incrs,
+			      int null_kickoff)
+{
+	return num_gathers + (null_kickoff ? syncpt_incrs / 2 + 2 : 0);
+}
+
+/* for non-blocking channels, checks that the channel can take a submit
+ * without sleeping; called with submitlock held */
+static int nvhost_reserve_submit(struct nvhost_channel_userctx *ctx,
+				 unsigned int slots, unsigned int entries,
+				 unsigned int handles)
+{
+	int err;
+
+	err = nvhost_cdma_try_reserve(&ctx->ch->cdma, slots, entries, handles);
+	if (err) {
+		ctx->wait_slots = slots;
+		ctx->wait_entries = entries;
+		ctx->wait_handles = handles;
+	}
+	return err;
+}
+
+static int nvhost_ioctl_channel_flush(struct nvhost_channel_userctx *ctx,
+				      struct nvhost_get_param_args *args,
+				      int null_kickoff, bool nonblock)
+{
+	struct nvhost_job_waiters waiters;
 	int num_unpin;
 	int err;
-	int nulled_incrs = null_kickoff ? ctx->submit_hdr.syncpt_incrs : 0;
 
 	if (ctx->submit_hdr.num_relocs || ctx->submit_hdr.num_cmdbufs) {
 		reset_submit(ctx);
@@ -248,75 +436,222 @@ static int nvhost_ioctl_channel_flush(struct nvhost_channel_userctx *ctx,
 	}
 
 	/* get submit lock */
-	err = mutex_lock_interruptible(&ctx->ch->submitlock);
+	err = nvhost_channel_submit_lock(ctx->ch, ctx->priority);
+	if (!err && nonblock)
+		err = nvhost_reserve_submit(ctx,
+				job_slots(ctx->num_gathers,
+					  ctx->submit_hdr.syncpt_incrs,
+					  null_kickoff),
+				1, num_unpin);
 	if (err) {
+		if (err == -EAGAIN)
+			nvhost_channel_submit_unlock(ctx->ch);
 		nvmap_unpin_handles(ctx->nvmap, ctx->unpinarray, num_unpin);
 		nvhost_module_idle(&ctx->ch->mod);
 		return err;
 	}
 
-	/* context switch */
-	if (ctx->ch->cur_ctx != ctx->hwctx) {
-		struct nvhost_hwctx *hw = ctx->hwctx;
-		if (hw && hw->valid) {
-			gather_idx--;
-			ctx->gathers[gather_idx].op1 =
-				nvhost_opcode_gather(0, hw->restore_size);
-			ctx->gathers[gather_idx].op2 = hw->restore_phys;
-			ctx->submit_hdr.syncpt_incrs += hw->restore_incrs;
+	err = alloc_job_waiters(ctx, ctx->submit_hdr.syncpt_id, true,
+				&waiters);
+	if (err) {
+		nvhost_channel_submit_unlock(ctx->ch);
+		nvmap_unpin_handles(ctx->nvmap, ctx->unpinarray, num_unpin);
+		nvhost_module_idle(&ctx->ch->mod);
+		return err;
+	}
+
+	args->value = nvhost_push_job(ctx, 2, ctx->num_gathers,
+				      ctx->submit_hdr.syncpt_id,
+				      ctx->submit_hdr.syncpt_incrs,
+				      NULL, 0, ctx->unpinarray, num_unpin,
+				      null_kickoff, &waiters);
+
+	nvhost_channel_submit_unlock(ctx->ch);
+	return 0;
+}
+
+/* submits several jobs with a single pin pass and a single hold of the
+ * submit lock. the gathers of each job are laid out back to back in
+ * ctx->gathers, each preceded by the slots nvhost_push_job needs. */
+static int nvhost_ioctl_channel_submit(struct nvhost_channel_userctx *ctx,
+				       struct nvhost_submit_args *args,
+				       bool nonblock)
+{
+	struct device *dev = &ctx->ch->dev->pdev->dev;
+	struct nvhost_submit_job *jobs = NULL;
+	struct nvhost_cmdbuf *cmdbufs = NULL;
+	struct nvhost_waitchk *waitchks = NULL;
+	struct nvhost_job_waiters *waiters;
+	u32 *fences = NULL;
+	int null_kickoff = args->flags & NVHOST_SUBMIT_FLAG_NULL_KICKOFF;
+	int num_cmdbufs = 0;
+	int num_relocs = 0;
+	int num_waitchks = 0;
+	int num_gathers = 0;
+	unsigned int slots = 0;
+	int num_unpin;
+	int i, j, idx;
+	int err = 0;
+
+	if (ctx->submit_hdr.num_relocs || ctx->submit_hdr.num_cmdbufs) {
+		reset_submit(ctx);
+		dev_err(dev, "channel submit out of sync\n");
+		return -EFAULT;
+	}
+	if (!ctx->nvmap) {
+		dev_err(dev, "no nvmap context set\n");
+		return -EFAULT;
+	}
+	if (!args->num_jobs)
+		return 0;
+	if (args->num_jobs > NVHOST_MAX_GATHERS / 3)
+		return -EINVAL;
+
+	jobs = kmalloc(args->num_jobs * (sizeof(*jobs) + sizeof(*waiters) +
+					 sizeof(*fences)), GFP_KERNEL);
+	if (!jobs)
+		return -ENOMEM;
+	waiters = (struct nvhost_job_waiters *)(jobs + args->num_jobs);
+	fences = (u32 *)(waiters + args->num_jobs);
+
+	if (copy_from_user(jobs, args->jobs,
+			   args->num_jobs * sizeof(*jobs))) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < args->num_jobs; i++) {
+		if (jobs[i].syncpt_id >= NV_HOST1X_SYNCPT_NB_PTS ||
+		    !jobs[i].num_cmdbufs ||
+		    jobs[i].num_cmdbufs > NVHOST_MAX_GATHERS ||
+		    jobs[i].num_waitchks > NVHOST_MAX_GATHERS ||
+		    jobs[i].num_relocs > NVHOST_MAX_HANDLES) {
+			err = -EINVAL;
+			goto out;
 		}
-		hw = ctx->ch->cur_ctx;
-		if (hw) {
-			gather_idx--;
-			ctx->gathers[gather_idx].op1 =
-				nvhost_opcode_gather(0, hw->save_size);
-			ctx->gathers[gather_idx].op2 = hw->save_phys;
-			ctx->submit_hdr.syncpt_incrs += hw->save_incrs;
-			num_intrs = 1;
-			ctxsw.syncpt_val = hw->save_incrs - 1;
-			ctxsw.intr_data = hw;
-			hw->valid = true;
-			ctx->ch->ctxhandler.get(hw);
+		num_cmdbufs += jobs[i].num_cmdbufs;
+		num_relocs += jobs[i].num_relocs;
+		num_waitchks += jobs[i].num_waitchks;
+		num_gathers += 2 + jobs[i].num_waitchks + jobs[i].num_cmdbufs;
+		slots += job_slots(2 + jobs[i].num_waitchks +
+				   jobs[i].num_cmdbufs,
+				   jobs[i].syncpt_incrs, null_kickoff);
+	}
+
+	if (num_gathers > NVHOST_MAX_GATHERS ||
+	    num_cmdbufs + num_relocs > NVHOST_MAX_HANDLES) {
+		err = -E2BIG;
+		goto out;
+	}
+
+	cmdbufs = kmalloc(num_cmdbufs * sizeof(*cmdbufs) +
+			  num_waitchks * sizeof(*waitchks), GFP_KERNEL);
+	if (!cmdbufs) {
+		err = -ENOMEM;
+		goto out;
+	}
+	waitchks = (struct nvhost_waitchk *)(cmdbufs + num_cmdbufs);
+
+	/* relocs are copied straight into the tail of the pin array,
+	 * after the gather relocations of all of the jobs */
+	if (copy_from_user(cmdbufs, args->cmdbufs,
+			   num_cmdbufs * sizeof(*cmdbufs)) ||
+	    copy_from_user(waitchks, args->waitchks,
+			   num_waitchks * sizeof(*waitchks)) ||
+	    copy_from_user(&ctx->pinarray[num_cmdbufs], args->relocs,
+			   num_relocs * sizeof(struct nvhost_reloc))) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < num_waitchks; i++) {
+		if (waitchks[i].syncpt_id >= NV_HOST1X_SYNCPT_NB_PTS) {
+			err = -EINVAL;
+			goto out;
 		}
-		ctx->ch->cur_ctx = ctx->hwctx;
 	}
 
-	/* add a setclass for modules that require it */
-	if (gather_idx == 2 && ctx->ch->desc->class) {
-		gather_idx--;
-		ctx->gathers[gather_idx].op1 =
-			nvhost_opcode_setclass(ctx->ch->desc->class, 0, 0);
-		ctx->gathers[gather_idx].op2 = NVHOST_OPCODE_NOOP;
+	ctx->pinarray_size = 0;
+	for (i = 0, j = 0, idx = 0; i < args->num_jobs; i++) {
+		u32 k;
+
+		idx += 2 + jobs[i].num_waitchks;
+		for (k = 0; k < jobs[i].num_cmdbufs; k++, j++)
+			add_gather(ctx, idx++, cmdbufs[j].mem,
+				   cmdbufs[j].words, cmdbufs[j].offset);
 	}
+	ctx->pinarray_size += num_relocs;
 
-	/* get absolute sync value */
-	if (BIT(ctx->submit_hdr.syncpt_id) & NVSYNCPTS_CLIENT_MANAGED)
-		syncval = nvhost_syncpt_set_max(&ctx->ch->dev->syncpt,
-						ctx->submit_hdr.syncpt_id,
-						ctx->submit_hdr.syncpt_incrs);
-	else
-		syncval = nvhost_syncpt_incr_max(&ctx->ch->dev->syncpt,
-						ctx->submit_hdr.syncpt_id,
-						ctx->submit_hdr.syncpt_incrs);
+	/* keep module powered; each job drops one reference when its
+	 * submit complete interrupt fires */
+	for (i = 0; i < args->num_jobs; i++)
+		nvhost_module_busy(&ctx->ch->mod);
 
-	/* patch absolute syncpt value into interrupt triggers */
-	ctxsw.syncpt_val += syncval - ctx->submit_hdr.syncpt_incrs;
+	num_unpin = nvmap_pin_array(ctx->nvmap,
+				    nvmap_ref_to_handle(ctx->gather_mem),
+				    ctx->pinarray, ctx->pinarray_size,
+				    ctx->unpinarray);
+	if (num_unpin < 0) {
+		dev_warn(dev, "nvmap_pin_array failed: %d\n", num_unpin);
+		nvhost_module_idle_mult(&ctx->ch->mod, args->num_jobs);
+		err = num_unpin;
+		goto out;
+	}
 
-	nvhost_channel_submit(ctx->ch, ctx->nvmap, &ctx->gathers[gather_idx],
-			      (null_kickoff ?
-				2 : ctx->num_gathers) -
-				gather_idx, &ctxsw, num_intrs,
-			      ctx->unpinarray, num_unpin,
-			      ctx->submit_hdr.syncpt_id,
-			      syncval, nulled_incrs);
+	err = nvhost_channel_submit_lock(ctx->ch, ctx->priority);
+	if (!err && nonblock)
+		err = nvhost_reserve_submit(ctx, slots, args->num_jobs,
+					    num_unpin);
+	if (err) {
+		if (err == -EAGAIN)
+			nvhost_channel_submit_unlock(ctx->ch);
+		nvmap_unpin_handles(ctx->nvmap, ctx->unpinarray, num_unpin);
+		nvhost_module_idle_mult(&ctx->ch->mod, args->num_jobs);
+		goto out;
+	}
 
-	/* schedule a submit complete interrupt */
-	nvhost_intr_add_action(&ctx->ch->dev->intr, ctx->submit_hdr.syncpt_id, syncval,
-			NVHOST_INTR_ACTION_SUBMIT_COMPLETE, ctx->ch, NULL);
+	for (i = 0; i < args->num_jobs; i++) {
+		err = alloc_job_waiters(ctx, jobs[i].syncpt_id, i == 0,
+					&waiters[i]);
+		if (err) {
+			while (i--)
+				free_job_waiters(ctx, jobs[i].syncpt_id,
+						 &waiters[i]);
+			nvhost_channel_submit_unlock(ctx->ch);
+			nvmap_unpin_handles(ctx->nvmap, ctx->unpinarray,
+					    num_unpin);
+			nvhost_module_idle_mult(&ctx->ch->mod, args->num_jobs);
+			goto out;
+		}
+	}
 
-	mutex_unlock(&ctx->ch->submitlock);
-	args->value = syncval;
-	return 0;
+	/* the channel completes jobs in order, so the pinned handles are
+	 * handed to the sync queue with the last job only */
+	for (i = 0, j = 0, idx = 0; i < args->num_jobs; i++) {
+		int first = idx + 2 + jobs[i].num_waitchks;
+		bool last = (i == args->num_jobs - 1);
+
+		idx = first + jobs[i].num_cmdbufs;
+		fences[i] = nvhost_push_job(ctx, first, idx,
+					    jobs[i].syncpt_id,
+					    jobs[i].syncpt_incrs,
+					    &waitchks[j], jobs[i].num_waitchks,
+					    last ? ctx->unpinarray : NULL,
+					    last ? num_unpin : 0,
+					    null_kickoff, &waiters[i]);
+		j += jobs[i].num_waitchks;
+	}
+
+	nvhost_channel_submit_unlock(ctx->ch);
+
+	if (args->fences && copy_to_user(args->fences, fences,
+					 args->num_jobs * sizeof(*fences)))
+		err = -EFAULT;
+
+out:
+	kfree(cmdbufs);
+	kfree(jobs);
+	return err;
 }
 
 static long nvhost_channelctl(struct file *filp,
@@ -324,6 +659,7 @@ static long nvhost_channelctl(struct file *filp,
 {
 	struct nvhost_channel_userctx *priv = filp->private_data;
 	u8 buf[NVHOST_IOCTL_CHANNEL_MAX_ARG_SIZE];
+	bool nonblock = filp->f_flags & O_NONBLOCK;
 	int err = 0;
 
 	if ((_IOC_TYPE(cmd) != NVHOST_IOCTL_MAGIC) ||
@@ -340,10 +676,16 @@ static long nvhost_channelctl(struct file *filp,
 
 	switch (cmd) {
 	case NVHOST_IOCTL_CHANNEL_FLUSH:
-		err = nvhost_ioctl_channel_flush(priv, (void *)buf, 0);
+		err = nvhost_ioctl_channel_flush(priv, (void *)buf, 0,
+						 nonblock);
 		break;
 	case NVHOST_IOCTL_CHANNEL_NULL_KICKOFF:
-		err = nvhost_ioctl_channel_flush(priv, (void *)buf, 1);
+		err = nvhost_ioctl_channel_flush(priv, (void *)buf, 1,
+						 nonblock);
+		break;
+	case NVHOST_IOCTL_CHANNEL_SUBMIT:
+		err = nvhost_ioctl_channel_submit(priv, (void *)buf,
+						  nonblock);
 		break;
 	case NVHOST_IOCTL_CHANNEL_GET_SYNCPOINTS:
 		((struct nvhost_get_param_args *)buf)->value =
@@ -373,6 +715,20 @@ static long nvhost_channelctl(struct file *filp,
 		priv->nvmap = new_client;
 		break;
 	}
+	case NVHOST_IOCTL_CHANNEL_SET_PRIORITY:
+	{
+		u32 priority =
+			((struct nvhost_set_priority_args *)buf)->priority;
+
+		if (priority > NVHOST_PRIORITY_HIGH)
+			err = -EINVAL;
+		else if (priority == NVHOST_PRIORITY_HIGH &&
+			 !capable(CAP_SYS_NICE))
+			err = -EPERM;
+		else
+			priv->priority = priority;
+		break;
+	}
 	default:
 		err = -ENOTTY;
 		break;
@@ -384,11 +740,27 @@ static long nvhost_channelctl(struct file *filp,
 	return err;
 }
 
+/* a channel is writable once the submit last turned away with -EAGAIN
+ * (or any submit, if none was) would go through */
+static unsigned int nvhost_channelpoll(struct file *filp, poll_table *wait)
+{
+	struct nvhost_channel_userctx *priv = filp->private_data;
+	struct nvhost_cdma *cdma = &priv->ch->cdma;
+
+	poll_wait(filp, &cdma->space_wq, wait);
+
+	if (nvhost_cdma_has_space(cdma, priv->wait_slots,
+				  priv->wait_entries, priv->wait_handles))
+		return POLLOUT | POLLWRNORM;
+	return 0;
+}
+
 static struct file_operations nvhost_channelops = {
 	.owner = THIS_MODULE,
 	.release = nvhost_channelrelease,
 	.open = nvhost_channelopen,
 	.write = nvhost_channelwrite,
+	.poll = nvhost_channelpoll,
 	.unlocked_ioctl = nvhost_channelctl
 };
 
@@ -457,6 +829,28 @@ static int nvhost_ioctl_ctrl_syncpt_wait(
 					args->thresh, timeout);
 }
 
+static int nvhost_ioctl_ctrl_syncpt_fence(
+	struct nvhost_ctrl_userctx *ctx,
+	struct nvhost_ctrl_syncpt_fence_args *args)
+{
+	int fd = nvhost_fence_create(ctx->dev, args->id, args->thresh);
+	if (fd < 0)
+		return fd;
+	args->fd = fd;
+	return 0;
+}
+
+static int nvhost_ioctl_ctrl_fence_merge(
+	struct nvhost_ctrl_userctx *ctx,
+	struct nvhost_ctrl_fence_merge_args *args)
+{
+	int fd = nvhost_fence_merge(ctx->dev, args->fd1, args->fd2);
+	if (fd < 0)
+		return fd;
+	args->fd = fd;
+	return 0;
+}
+
 static int nvhost_ioctl_ctrl_module_mutex(
 	struct nvhost_ctrl_userctx *ctx,
 	struct nvhost_ctrl_module_mutex_args *args)
@@ -560,6 +954,12 @@ static long nvhost_ctrlctl(struct file *filp,
 	case NVHOST_IOCTL_CTRL_MODULE_REGRDWR:
 		err = nvhost_ioctl_ctrl_module_regrdwr(priv, (void *)buf);
 		break;
+	case NVHOST_IOCTL_CTRL_SYNCPT_FENCE:
+		err = nvhost_ioctl_ctrl_syncpt_fence(priv, (void *)buf);
+		break;
+	case NVHOST_IOCTL_CTRL_FENCE_MERGE:
+		err = nvhost_ioctl_ctrl_fence_merge(priv, (void *)buf);
+		break;
 	default:
 		err = -ENOTTY;
 		break;
@@ -678,6 +1078,12 @@ static int __devinit nvhost_probe(struct platform_device *pdev)
 
 	host->pdev = pdev;
 
+	/* the channel devices can be opened as soon as they are created,
+	 * so the statistics have to be usable before then */
+	nvhost_module_init_stats(&host->mod);
+	for (i = 0; i < NVHOST_NUMCHANNELS; i++)
+		nvhost_module_init_stats(&host->channels[i].mod);
+
 	host->nvmap = nvmap_create_client(nvmap_dev, "nvhost");
 	if (!host->nvmap) {
 		dev_err(&pdev->dev, "unable to create nvmap client\n");
@@ -720,6 +1126,22 @@ static int __devinit nvhost_probe(struct platform_device *pdev)
 	err = nvhost_module_init(&host->mod, "host1x", power_host, NULL, &pdev->dev);
 	if (err) goto fail;
 
+	host->acm_kobj = kobject_create_and_add("acm", &pdev->dev.kobj);
+	if (!host->acm_kobj) {
+		err = -ENOMEM;
+		goto fail;
+	}
+	err = nvhost_module_add_stats(&host->mod, "host1x", host->acm_kobj);
+	if (err) goto fail;
+	for (i = 0; i < NVHOST_NUMCHANNELS; i++) {
+		struct nvhost_channel *ch = &host->channels[i];
+		err = nvhost_module_add_stats(&ch->mod, ch->desc->name,
+					      host->acm_kobj);
+		if (err) goto fail;
+		err = nvhost_scale_init(&ch->scale, ch);
+		if (err) goto fail;
+	}
+
 	platform_set_drvdata(pdev, host);
 
 	clk_enable(host->mod.clk[0]);
@@ -734,6 +1156,12 @@ static int __devinit nvhost_probe(struct platform_device *pdev)
 	return 0;
 
 fail:
+	/* the statistics kobjects are embedded in host */
+	for (i = 0; i < NVHOST_NUMCHANNELS; i++)
+		nvhost_module_remove_stats(&host->channels[i].mod);
+	nvhost_module_remove_stats(&host->mod);
+	if (host->acm_kobj)
+		kobject_put(host->acm_kobj);
 	if (host->nvmap)
 		nvmap_client_put(host->nvmap);
 	/* TODO: [ahatala 2010-05-04] */
@@ -749,7 +1177,10 @@ static int __exit nvhost_remove(struct platform_device *pdev)
 static int nvhost_suspend(struct platform_device *pdev, pm_message_t state)
 {
 	struct nvhost_master *host = platform_get_drvdata(pdev);
+	int i;
 	dev_info(&pdev->dev, "suspending\n");
+	for (i = 0; i < NVHOST_NUMCHANNELS; i++)
+		nvhost_channel_save_context(&host->channels[i]);
 	nvhost_module_suspend(&host->mod);
 	clk_enable(host->mod.clk[0]);
 	nvhost_syncpt_save(&host->syncpt);
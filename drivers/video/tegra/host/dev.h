@@ -44,6 +44,7 @@ struct nvhost_master {
 	struct nvhost_cpuaccess cpuaccess;
 	struct nvhost_intr intr;
 	struct nvhost_module mod;
+	struct kobject *acm_kobj;
 	struct nvhost_channel channels[NVHOST_NUMCHANNELS];
 };
 
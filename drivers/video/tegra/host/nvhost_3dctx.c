@@ -256,6 +256,61 @@ static void setup_restore(u32 *ptr, u32 waitbase)
 	wmb();
 }
 
+/*
+ * Fills ptr with a restore of the register values in image, leaving out
+ * the registers whose values in cur (the state the unit is left in) are
+ * the same.  Each register range is written or left out as a whole, and
+ * an indirect offset stays together with its data.  The restore gather
+ * was sized when it was queued, so the rest of it is padded with no-ops.
+ * Returns the number of words left out.
+ */
+static unsigned int setup_restore_delta(u32 *ptr, const u32 *image,
+					const u32 *cur)
+{
+	const struct hwctx_reginfo *r;
+	const struct hwctx_reginfo *rend;
+	unsigned int pos = RESTORE_BEGIN_SIZE;
+	unsigned int start = pos;
+	unsigned int len = RESTORE_BEGIN_SIZE;
+	unsigned int skipped = 0;
+
+	memcpy(ptr, image, RESTORE_BEGIN_SIZE * 4);
+
+	r = ctxsave_regs_3d;
+	rend = ctxsave_regs_3d + ARRAY_SIZE(ctxsave_regs_3d);
+	for ( ; r != rend; ++r) {
+		u32 count = r->count;
+		switch (r->type) {
+		case HWCTX_REGINFO_DIRECT:
+			pos += RESTORE_DIRECT_SIZE;
+			break;
+		case HWCTX_REGINFO_INDIRECT:
+			pos += RESTORE_INDOFFSET_SIZE + RESTORE_INDDATA_SIZE;
+			break;
+		case HWCTX_REGINFO_INDIRECT_OFFSET:
+			pos += RESTORE_INDOFFSET_SIZE;
+			continue; /* INDIRECT_DATA follows with real count */
+		case HWCTX_REGINFO_INDIRECT_DATA:
+			pos += RESTORE_INDDATA_SIZE;
+			break;
+		}
+		pos += count;
+		if (memcmp(image + pos - count, cur + pos - count, count * 4)) {
+			memcpy(ptr + len, image + start, (pos - start) * 4);
+			len += pos - start;
+		} else {
+			skipped += pos - start;
+		}
+		start = pos;
+	}
+
+	while (len < context_restore_size - RESTORE_END_SIZE)
+		ptr[len++] = NVHOST_OPCODE_NOOP;
+	restore_end(ptr + len, NVSYNCPT_3D);
+	wmb();
+	return skipped;
+}
+
 /*** save ***/
 
 /* the same context save command sequence is used for all contexts. */
@@ -405,28 +460,40 @@ static struct nvhost_hwctx *ctx3d_alloc(struct nvhost_channel *ch)
 {
 	struct nvhost_hwctx *ctx;
 	struct nvmap_client *nvmap = ch->dev->nvmap;
+	size_t size = context_restore_size * 4;
 
 	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
 	if (!ctx)
 		return NULL;
-	ctx->restore = nvmap_alloc(nvmap, context_restore_size * 4, 32,
-				   NVMAP_HANDLE_WRITE_COMBINE);
 
-	if (IS_ERR_OR_NULL(ctx->restore)) {
-		kfree(ctx);
-		return NULL;
-	}
+	ctx->image = kzalloc(size, GFP_KERNEL);
+	if (!ctx->image)
+		goto fail_image;
+
+	ctx->restore = nvmap_alloc(nvmap, size, 32,
+				   NVMAP_HANDLE_WRITE_COMBINE);
+	if (IS_ERR_OR_NULL(ctx->restore))
+		goto fail_restore;
 
 	ctx->save_cpu_data = nvmap_mmap(ctx->restore);
-	if (!ctx->save_cpu_data) {
-		nvmap_free(nvmap, ctx->restore);
-		kfree(ctx);
-		return NULL;
-	}
+	if (!ctx->save_cpu_data)
+		goto fail_restore_mmap;
 
-	setup_restore(ctx->save_cpu_data, NVWAITBASE_3D);
+	ctx->restore_delta = nvmap_alloc(nvmap, size, 32,
+					 NVMAP_HANDLE_WRITE_COMBINE);
+	if (IS_ERR_OR_NULL(ctx->restore_delta))
+		goto fail_delta;
+
+	ctx->restore_delta_cpu = nvmap_mmap(ctx->restore_delta);
+	if (!ctx->restore_delta_cpu)
+		goto fail_delta_mmap;
+
+	setup_restore(ctx->image, NVWAITBASE_3D);
+	memcpy(ctx->save_cpu_data, ctx->image, size);
+	wmb();
 	ctx->channel = ch;
 	ctx->restore_phys = nvmap_pin(nvmap, ctx->restore);
+	ctx->restore_delta_phys = nvmap_pin(nvmap, ctx->restore_delta);
 	ctx->restore_size = context_restore_size;
 	ctx->save = context_save_buf;
 	ctx->save_phys = context_save_phys;
@@ -434,8 +501,21 @@ static struct nvhost_hwctx *ctx3d_alloc(struct nvhost_channel *ch)
 	ctx->save_incrs = 3;
 	ctx->restore_incrs = 1;
 	ctx->valid = false;
+	atomic_set(&ctx->saves_pending, 0);
 	kref_init(&ctx->ref);
 	return ctx;
+
+fail_delta_mmap:
+	nvmap_free(nvmap, ctx->restore_delta);
+fail_delta:
+	nvmap_munmap(ctx->restore, ctx->save_cpu_data);
+fail_restore_mmap:
+	nvmap_free(nvmap, ctx->restore);
+fail_restore:
+	kfree(ctx->image);
+fail_image:
+	kfree(ctx);
+	return NULL;
 }
 
 static void ctx3d_free(struct kref *ref)
@@ -443,9 +523,13 @@ static void ctx3d_free(struct kref *ref)
 	struct nvhost_hwctx *ctx = container_of(ref, struct nvhost_hwctx, ref);
 	struct nvmap_client *nvmap = ctx->channel->dev->nvmap;
 
+	nvmap_munmap(ctx->restore_delta, ctx->restore_delta_cpu);
+	nvmap_unpin(nvmap, ctx->restore_delta);
+	nvmap_free(nvmap, ctx->restore_delta);
 	nvmap_munmap(ctx->restore, ctx->save_cpu_data);
 	nvmap_unpin(nvmap, ctx->restore);
 	nvmap_free(nvmap, ctx->restore);
+	kfree(ctx->image);
 	kfree(ctx);
 }
 
@@ -463,8 +547,9 @@ static void ctx3d_save_service(struct nvhost_hwctx *ctx)
 {
 	const struct hwctx_reginfo *r;
 	const struct hwctx_reginfo *rend;
+	struct nvhost_hwctx *next = ctx->next;
 	unsigned int pending = 0;
-	u32 *ptr = (u32 *)ctx->save_cpu_data + RESTORE_BEGIN_SIZE;
+	u32 *ptr = (u32 *)ctx->image + RESTORE_BEGIN_SIZE;
 
 	BUG_ON(!ctx->save_cpu_data);
 
@@ -490,9 +575,24 @@ static void ctx3d_save_service(struct nvhost_hwctx *ctx)
 		ptr += count;
 	}
 
-	BUG_ON((u32)((ptr + RESTORE_END_SIZE) - (u32*)ctx->save_cpu_data)
+	BUG_ON((u32)((ptr + RESTORE_END_SIZE) - (u32*)ctx->image)
 		!= context_restore_size);
 
+	/* the registers are read into the cached image, which the delta
+	 * restores are computed from, and then copied out for the gather */
+	memcpy(ctx->save_cpu_data, ctx->image, context_restore_size * 4);
+
+	/* the unit is now left with this context's registers, so the
+	 * context restored next only needs the ones that differ */
+	if (next) {
+		unsigned int skipped = setup_restore_delta(
+			next->restore_delta_cpu, next->image, ctx->image);
+
+		ctx->channel->ctxsw_stats.restore_words_skipped += skipped;
+		ctx->next = NULL;
+		ctx->channel->ctxhandler.put(next);
+	}
+
 	wmb();
 	nvhost_syncpt_cpu_incr(&ctx->channel->dev->syncpt, NVSYNCPT_3D);
 }
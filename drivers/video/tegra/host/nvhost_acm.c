@@ -25,59 +25,165 @@
 #include <linux/sched.h>
 #include <linux/err.h>
 #include <linux/device.h>
+#include <linux/kobject.h>
+#include <linux/ktime.h>
 #include <mach/powergate.h>
 #include <mach/clk.h>
 
 #include "dev.h"
+#include "nvhost_scale.h"
 
+/* longest time a module is kept clocked after it goes idle */
 #define ACM_TIMEOUT (25*HZ/1000)
+/* shortest time a module is kept clocked after it goes idle */
+#define ACM_MIN_TIMEOUT_US 2000
+/* a power-gated module must stay off for at least this many wakeup
+ * latencies (and never less than ACM_POWERGATE_MIN_IDLE_US) to pay for
+ * the power-up sequence */
+#define ACM_POWERGATE_BREAKEVEN 4
+#define ACM_POWERGATE_MIN_IDLE_US 10000
+/* weight of a new sample in the running averages is 1/2^ACM_AVG_SHIFT */
+#define ACM_AVG_SHIFT 3
 
 #define DISABLE_3D_POWERGATING
 #define DISABLE_MPE_POWERGATING
 
+static void update_avg(s64 *avg, s64 sample)
+{
+	if (*avg)
+		*avg += (sample - *avg) >> ACM_AVG_SHIFT;
+	else
+		*avg = sample;
+}
+
+static s64 powergate_breakeven_us(struct nvhost_module *mod)
+{
+	return max_t(s64, ACM_POWERGATE_MIN_IDLE_US,
+		     mod->powerup_avg_us * ACM_POWERGATE_BREAKEVEN);
+}
+
+/* how long to keep the clocks running after the module goes idle: long
+ * enough to cover the gaps usually seen between submits, but modules
+ * whose gaps are longer than ACM_TIMEOUT drop their clocks right away */
+static unsigned long clockgate_delay(struct nvhost_module *mod)
+{
+	s64 max_us = jiffies_to_usecs(ACM_TIMEOUT);
+	s64 us;
+
+	if (!mod->idle_avg_us)
+		us = max_us;
+	else if (mod->idle_avg_us > max_us)
+		us = ACM_MIN_TIMEOUT_US;
+	else
+		us = clamp_t(s64, mod->idle_avg_us * 2,
+			     ACM_MIN_TIMEOUT_US, max_us);
+
+	return usecs_to_jiffies(us);
+}
+
+static void power_up(struct nvhost_module *mod)
+{
+	ktime_t start = ktime_get();
+	bool from_powergate = mod->powergated;
+	unsigned long flags;
+	s64 us;
+
+	if (mod->parent)
+		nvhost_module_busy(mod->parent);
+	if (mod->powergated) {
+		BUG_ON(mod->num_clks != 1);
+		tegra_powergate_sequence_power_up(
+			mod->powergate_id, mod->clk[0]);
+		mod->powergated = false;
+	} else {
+		int i;
+		for (i = 0; i < mod->num_clks; i++)
+			clk_enable(mod->clk[i]);
+	}
+	if (mod->func)
+		mod->func(mod, NVHOST_POWER_ACTION_ON);
+	mod->powered = true;
+	if (mod->scale)
+		nvhost_scale_start(mod->scale);
+
+	us = ktime_us_delta(ktime_get(), start);
+	if (from_powergate)
+		update_avg(&mod->powerup_avg_us, us);
+
+	spin_lock_irqsave(&mod->stat_lock, flags);
+	mod->stats.powerup_count++;
+	if (from_powergate)
+		mod->stats.unpowergate_count++;
+	mod->stats.wakeup_us += us;
+	if (us > mod->stats.wakeup_max_us)
+		mod->stats.wakeup_max_us = us;
+	spin_unlock_irqrestore(&mod->stat_lock, flags);
+}
+
+static void clock_gate(struct nvhost_module *mod)
+{
+	int i;
+
+	if (mod->scale)
+		nvhost_scale_stop(mod->scale, false);
+	if (mod->func)
+		mod->func(mod, NVHOST_POWER_ACTION_OFF);
+	for (i = 0; i < mod->num_clks; i++)
+		clk_disable(mod->clk[i]);
+	mod->powered = false;
+	if (mod->parent)
+		nvhost_module_idle(mod->parent);
+}
+
+static void power_gate(struct nvhost_module *mod)
+{
+	tegra_periph_reset_assert(mod->clk[0]);
+	tegra_powergate_power_off(mod->powergate_id);
+	mod->powergated = true;
+}
+
 void nvhost_module_busy(struct nvhost_module *mod)
 {
 	mutex_lock(&mod->lock);
 	cancel_delayed_work(&mod->powerdown);
-	if ((atomic_inc_return(&mod->refcount) == 1) && !mod->powered) {
-		if (mod->parent)
-			nvhost_module_busy(mod->parent);
-		if (mod->powergate_id != -1) {
-			BUG_ON(mod->num_clks != 1);
-			tegra_powergate_sequence_power_up(
-				mod->powergate_id, mod->clk[0]);
-		} else {
-			int i;
-			for (i = 0; i < mod->num_clks; i++)
-				clk_enable(mod->clk[i]);
-		}
-		if (mod->func)
-			mod->func(mod, NVHOST_POWER_ACTION_ON);
-		mod->powered = true;
+	if (atomic_inc_return(&mod->refcount) == 1) {
+		ktime_t now = ktime_get();
+
+		if (mod->idle_start.tv64)
+			update_avg(&mod->idle_avg_us,
+				   ktime_us_delta(now, mod->idle_start));
+		mod->busy_start = now;
+
+		if (!mod->powered)
+			power_up(mod);
 	}
 	mutex_unlock(&mod->lock);
 }
 EXPORT_SYMBOL_GPL(nvhost_module_busy);
 
+/* stops the clocks of an idle module.  Power-gated modules are then
+ * powered off as well if the idle gap is predicted to outlast the
+ * break-even time; if not, the work is rescheduled to power the module
+ * off once the gap has lasted that long anyway. */
 static void powerdown_handler(struct work_struct *work)
 {
 	struct nvhost_module *mod;
 	mod = container_of(to_delayed_work(work), struct nvhost_module, powerdown);
 	mutex_lock(&mod->lock);
-	if ((atomic_read(&mod->refcount) == 0) && mod->powered) {
-		int i;
-		if (mod->func)
-			mod->func(mod, NVHOST_POWER_ACTION_OFF);
-		for (i = 0; i < mod->num_clks; i++) {
-			clk_disable(mod->clk[i]);
-		}
+	if (atomic_read(&mod->refcount) == 0 && mod->powered) {
+		clock_gate(mod);
 		if (mod->powergate_id != -1) {
-			tegra_periph_reset_assert(mod->clk[0]);
-			tegra_powergate_power_off(mod->powergate_id);
+			s64 breakeven = powergate_breakeven_us(mod);
+
+			if (mod->idle_avg_us >= breakeven)
+				power_gate(mod);
+			else
+				schedule_delayed_work(&mod->powerdown,
+					usecs_to_jiffies(breakeven));
 		}
-		mod->powered = false;
-		if (mod->parent)
-			nvhost_module_idle(mod->parent);
+	} else if (atomic_read(&mod->refcount) == 0 &&
+		   mod->powergate_id != -1 && !mod->powergated) {
+		power_gate(mod);
 	}
 	mutex_unlock(&mod->lock);
 }
@@ -88,8 +194,16 @@ void nvhost_module_idle_mult(struct nvhost_module *mod, int refs)
 
 	mutex_lock(&mod->lock);
 	if (atomic_sub_return(refs, &mod->refcount) == 0) {
+		unsigned long flags;
+		ktime_t now = ktime_get();
+
 		BUG_ON(!mod->powered);
-		schedule_delayed_work(&mod->powerdown, ACM_TIMEOUT);
+		spin_lock_irqsave(&mod->stat_lock, flags);
+		mod->stats.busy_us += ktime_us_delta(now, mod->busy_start);
+		spin_unlock_irqrestore(&mod->stat_lock, flags);
+		mod->idle_start = now;
+
+		schedule_delayed_work(&mod->powerdown, clockgate_delay(mod));
 		kick = true;
 	}
 	mutex_unlock(&mod->lock);
@@ -99,6 +213,21 @@ void nvhost_module_idle_mult(struct nvhost_module *mod, int refs)
 }
 EXPORT_SYMBOL_GPL(nvhost_module_idle_mult);
 
+/* total time, in us, that the module has spent with references held */
+u64 nvhost_module_busy_time(struct nvhost_module *mod)
+{
+	unsigned long flags;
+	u64 busy_us;
+
+	spin_lock_irqsave(&mod->stat_lock, flags);
+	busy_us = mod->stats.busy_us;
+	spin_unlock_irqrestore(&mod->stat_lock, flags);
+	if (atomic_read(&mod->refcount))
+		busy_us += ktime_us_delta(ktime_get(), mod->busy_start);
+
+	return busy_us;
+}
+
 static const char *get_module_clk_id(const char *module, int index)
 {
 	if (index == 1 && strcmp(module, "gr2d") == 0)
@@ -152,6 +281,8 @@ int nvhost_module_init(struct nvhost_module *mod, const char *name,
 	mod->parent = parent;
 	mod->powered = false;
 	mod->powergate_id = get_module_powergate_id(name);
+	mod->powergated = (mod->powergate_id != -1);
+	mod->idle_start = ktime_set(0, 0);
 
 #ifdef DISABLE_3D_POWERGATING
 	/*
@@ -164,6 +295,7 @@ int nvhost_module_init(struct nvhost_module *mod, const char *name,
 			mod->clk[0]);
 		clk_disable(mod->clk[0]);
 		mod->powergate_id = -1;
+		mod->powergated = false;
 	}
 #endif
 
@@ -177,6 +309,7 @@ int nvhost_module_init(struct nvhost_module *mod, const char *name,
 			mod->clk[0]);
 		clk_disable(mod->clk[0]);
 		mod->powergate_id = -1;
+		mod->powergated = false;
 	}
 #endif
 
@@ -205,13 +338,147 @@ void nvhost_module_suspend(struct nvhost_module *mod)
 	if (ret == 0)
 		nvhost_debug_dump();
 	flush_delayed_work(&mod->powerdown);
+	/* the powerdown work may have left the module clock-gated and
+	 * waiting to be power-gated; do that now */
+	cancel_delayed_work_sync(&mod->powerdown);
+	mutex_lock(&mod->lock);
 	BUG_ON(mod->powered);
+	if (mod->powergate_id != -1 && !mod->powergated)
+		power_gate(mod);
+	mutex_unlock(&mod->lock);
 }
 
 void nvhost_module_deinit(struct nvhost_module *mod)
 {
 	int i;
 	nvhost_module_suspend(mod);
+	if (mod->scale)
+		nvhost_scale_stop(mod->scale, true);
 	for (i = 0; i < mod->num_clks; i++)
 		clk_put(mod->clk[i]);
 }
+
+static const char *module_state(struct nvhost_module *mod)
+{
+	if (mod->powered)
+		return "on";
+	return mod->powergated ? "powergated" : "clockgated";
+}
+
+#define to_module(k) container_of(k, struct nvhost_module, kobj)
+
+static ssize_t busy_us_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n",
+		       nvhost_module_busy_time(to_module(kobj)));
+}
+
+static ssize_t powerup_count_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", to_module(kobj)->stats.powerup_count);
+}
+
+static ssize_t unpowergate_count_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", to_module(kobj)->stats.unpowergate_count);
+}
+
+static ssize_t wakeup_avg_us_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	struct nvhost_module *mod = to_module(kobj);
+	unsigned long flags;
+	u64 total;
+	u32 count;
+
+	spin_lock_irqsave(&mod->stat_lock, flags);
+	total = mod->stats.wakeup_us;
+	count = mod->stats.powerup_count;
+	spin_unlock_irqrestore(&mod->stat_lock, flags);
+
+	return sprintf(buf, "%llu\n", count ? div_u64(total, count) : 0);
+}
+
+static ssize_t wakeup_max_us_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", to_module(kobj)->stats.wakeup_max_us);
+}
+
+static ssize_t idle_predict_us_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lld\n", to_module(kobj)->idle_avg_us);
+}
+
+static ssize_t state_show(struct kobject *kobj,
+			  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", module_state(to_module(kobj)));
+}
+
+static struct kobj_attribute busy_us_attr = __ATTR_RO(busy_us);
+static struct kobj_attribute powerup_count_attr = __ATTR_RO(powerup_count);
+static struct kobj_attribute unpowergate_count_attr =
+	__ATTR_RO(unpowergate_count);
+static struct kobj_attribute wakeup_avg_us_attr = __ATTR_RO(wakeup_avg_us);
+static struct kobj_attribute wakeup_max_us_attr = __ATTR_RO(wakeup_max_us);
+static struct kobj_attribute idle_predict_us_attr =
+	__ATTR_RO(idle_predict_us);
+static struct kobj_attribute state_attr = __ATTR_RO(state);
+
+static struct attribute *module_stat_attrs[] = {
+	&busy_us_attr.attr,
+	&powerup_count_attr.attr,
+	&unpowergate_count_attr.attr,
+	&wakeup_avg_us_attr.attr,
+	&wakeup_max_us_attr.attr,
+	&idle_predict_us_attr.attr,
+	&state_attr.attr,
+	NULL
+};
+
+/* the kobject is embedded in the nvhost master, which is never freed */
+static void module_kobj_release(struct kobject *kobj)
+{
+}
+
+static struct kobj_type module_ktype = {
+	.release = module_kobj_release,
+	.sysfs_ops = &kobj_sysfs_ops,
+	.default_attrs = module_stat_attrs,
+};
+
+/*
+ * Sets up the module's power management statistics.  Unlike the rest of
+ * the module state, the statistics live as long as the nvhost master, so
+ * this is called once at probe time, before anything can use the module,
+ * rather than from nvhost_module_init().
+ */
+void nvhost_module_init_stats(struct nvhost_module *mod)
+{
+	spin_lock_init(&mod->stat_lock);
+}
+
+/*
+ * Exports the module's power management statistics under <parent>/<name>/.
+ */
+int nvhost_module_add_stats(struct nvhost_module *mod, const char *name,
+			    struct kobject *parent)
+{
+	return kobject_init_and_add(&mod->kobj, &module_ktype, parent,
+				    "%s", name);
+}
+
+/*
+ * Undoes nvhost_module_add_stats(), whether or not it succeeded; does
+ * nothing if it wasn't called.
+ */
+void nvhost_module_remove_stats(struct nvhost_module *mod)
+{
+	if (mod->kobj.state_initialized)
+		kobject_put(&mod->kobj);
+}
@@ -27,10 +27,14 @@
 #include <linux/wait.h>
 #include <linux/mutex.h>
 #include <linux/clk.h>
+#include <linux/kobject.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
 
 #define NVHOST_MODULE_MAX_CLOCKS 3
 
 struct nvhost_module;
+struct nvhost_scale;
 
 enum nvhost_power_action {
 	NVHOST_POWER_ACTION_OFF,
@@ -39,6 +43,14 @@ enum nvhost_power_action {
 
 typedef void (*nvhost_modulef)(struct nvhost_module *mod, enum nvhost_power_action action);
 
+struct nvhost_module_stats {
+	u64 busy_us;		/* time spent with refcount > 0 */
+	u32 powerup_count;	/* times the clocks were turned back on */
+	u32 unpowergate_count;	/* ...of which the module was power-gated */
+	u64 wakeup_us;		/* time spent in powering up */
+	u32 wakeup_max_us;
+};
+
 struct nvhost_module {
 	const char *name;
 	nvhost_modulef func;
@@ -51,6 +63,18 @@ struct nvhost_module {
 	wait_queue_head_t idle;
 	struct nvhost_module *parent;
 	int powergate_id;
+	bool powergated;
+	/* idle predictor, protected by lock */
+	ktime_t busy_start;
+	ktime_t idle_start;
+	s64 idle_avg_us;
+	s64 powerup_avg_us;
+	/* statistics exported in sysfs, protected by stat_lock */
+	spinlock_t stat_lock;
+	struct nvhost_module_stats stats;
+	struct kobject kobj;
+	/* clock scaling governor, if the module has one */
+	struct nvhost_scale *scale;
 };
 
 int nvhost_module_init(struct nvhost_module *mod, const char *name,
@@ -58,9 +82,14 @@ int nvhost_module_init(struct nvhost_module *mod, const char *name,
 		struct device *dev);
 void nvhost_module_deinit(struct nvhost_module *mod);
 void nvhost_module_suspend(struct nvhost_module *mod);
+void nvhost_module_init_stats(struct nvhost_module *mod);
+int nvhost_module_add_stats(struct nvhost_module *mod, const char *name,
+			    struct kobject *parent);
+void nvhost_module_remove_stats(struct nvhost_module *mod);
 
 void nvhost_module_busy(struct nvhost_module *mod);
 void nvhost_module_idle_mult(struct nvhost_module *mod, int refs);
+u64 nvhost_module_busy_time(struct nvhost_module *mod);
 
 static inline bool nvhost_module_powered(struct nvhost_module *mod)
 {
@@ -26,16 +26,13 @@
 
 /*
  * TODO:
- *   stats
- *     - for figuring out what to optimize further
- *   resizable push buffer & sync queue
+ *   resizable sync queue
  *     - some channels hardly need any, some channels (3d) could use more
  */
 
 #define cdma_to_channel(cdma) container_of(cdma, struct nvhost_channel, cdma)
 #define cdma_to_dev(cdma) ((cdma_to_channel(cdma))->dev)
 #define cdma_to_nvmap(cdma) ((cdma_to_dev(cdma))->nvmap)
-#define pb_to_cdma(pb) container_of(pb, struct nvhost_cdma, push_buffer)
 
 /*
  * push_buffer
@@ -47,32 +44,34 @@
 
 // 8 bytes per slot. (This number does not include the final RESTART.)
 #define PUSH_BUFFER_SIZE (NVHOST_GATHER_QUEUE_SIZE * 8)
+#define PUSH_BUFFER_MAX_SIZE (NVHOST_GATHER_QUEUE_MAX * 8)
 
-static void destroy_push_buffer(struct push_buffer *pb);
+static void destroy_push_buffer(struct nvmap_client *nvmap,
+				struct push_buffer *pb);
 
 /**
  * Reset to empty push buffer
  */
 static void reset_push_buffer(struct push_buffer *pb)
 {
-	pb->fence = PUSH_BUFFER_SIZE - 8;
+	pb->fence = pb->size - 8;
 	pb->cur = 0;
 }
 
 /**
  * Init push buffer resources
  */
-static int init_push_buffer(struct push_buffer *pb)
+static int init_push_buffer(struct nvmap_client *nvmap,
+			    struct push_buffer *pb, u32 size)
 {
-	struct nvhost_cdma *cdma = pb_to_cdma(pb);
-	struct nvmap_client *nvmap = cdma_to_nvmap(cdma);
 	pb->mem = NULL;
 	pb->mapped = NULL;
 	pb->phys = 0;
+	pb->size = size;
 	reset_push_buffer(pb);
 
 	/* allocate and map pushbuffer memory */
-	pb->mem = nvmap_alloc(nvmap, PUSH_BUFFER_SIZE + 4, 32,
+	pb->mem = nvmap_alloc(nvmap, pb->size + 4, 32,
 			      NVMAP_HANDLE_WRITE_COMBINE);
 	if (IS_ERR_OR_NULL(pb->mem)) {
 		pb->mem = NULL;
@@ -90,22 +89,21 @@ static int init_push_buffer(struct push_buffer *pb)
 	}
 
 	/* put the restart at the end of pushbuffer memory */
-	*(pb->mapped + (PUSH_BUFFER_SIZE >> 2)) = nvhost_opcode_restart(pb->phys);
+	*(pb->mapped + (pb->size >> 2)) = nvhost_opcode_restart(pb->phys);
 
 	return 0;
 
 fail:
-	destroy_push_buffer(pb);
+	destroy_push_buffer(nvmap, pb);
 	return -ENOMEM;
 }
 
 /**
  * Clean up push buffer resources
  */
-static void destroy_push_buffer(struct push_buffer *pb)
+static void destroy_push_buffer(struct nvmap_client *nvmap,
+				struct push_buffer *pb)
 {
-	struct nvhost_cdma *cdma = pb_to_cdma(pb);
-	struct nvmap_client *nvmap = cdma_to_nvmap(cdma);
 	if (pb->mapped)
 		nvmap_munmap(pb->mem, pb->mapped);
 
@@ -131,7 +129,7 @@ static void push_to_push_buffer(struct push_buffer *pb, u32 op1, u32 op2)
 	BUG_ON(cur == pb->fence);
 	*(p++) = op1;
 	*(p++) = op2;
-	pb->cur = (cur + 8) & (PUSH_BUFFER_SIZE - 1);
+	pb->cur = (cur + 8) & (pb->size - 1);
 	/* printk("push_to_push_buffer: op1=%08x; op2=%08x; cur=%x\n", op1, op2, pb->cur); */
 }
 
@@ -141,7 +139,7 @@ static void push_to_push_buffer(struct push_buffer *pb, u32 op1, u32 op2)
  */
 static void pop_from_push_buffer(struct push_buffer *pb, unsigned int slots)
 {
-	pb->fence = (pb->fence + slots * 8) & (PUSH_BUFFER_SIZE - 1);
+	pb->fence = (pb->fence + slots * 8) & (pb->size - 1);
 }
 
 /**
@@ -149,7 +147,15 @@ static void pop_from_push_buffer(struct push_buffer *pb, unsigned int slots)
  */
 static u32 push_buffer_space(struct push_buffer *pb)
 {
-	return ((pb->fence - pb->cur) & (PUSH_BUFFER_SIZE - 1)) / 8;
+	return ((pb->fence - pb->cur) & (pb->size - 1)) / 8;
+}
+
+/**
+ * Return the number of two word slots in an empty push buffer
+ */
+static u32 push_buffer_capacity(struct push_buffer *pb)
+{
+	return pb->size / 8 - 1;
 }
 
 static u32 push_buffer_putptr(struct push_buffer *pb)
@@ -189,6 +195,7 @@ static void reset_sync_queue(struct sync_queue *queue)
 {
 	queue->read = 0;
 	queue->write = 0;
+	queue->entries = 0;
 }
 
 /**
@@ -281,6 +288,7 @@ static void add_to_sync_queue(struct sync_queue *queue,
 	}
 
 	queue->write = write;
+	queue->entries++;
 }
 
 /**
@@ -321,6 +329,7 @@ dequeue_sync_queue_head(struct sync_queue *queue)
 		read = 0;
 
 	queue->read = read;
+	queue->entries--;
 }
 
 
@@ -372,11 +381,23 @@ static unsigned int cdma_status(struct nvhost_cdma *cdma, enum cdma_event event)
  */
 static unsigned int wait_cdma(struct nvhost_cdma *cdma, enum cdma_event event)
 {
+	bool stalled = false;
+
 	for (;;) {
 		unsigned int space = cdma_status(cdma, event);
 		if (space)
 			return space;
 
+		if (!stalled) {
+			stalled = true;
+			if (event == CDMA_EVENT_PUSH_BUFFER_SPACE) {
+				cdma->stats.pb_stalls++;
+				cdma->grow = true;
+			} else if (event == CDMA_EVENT_SYNC_QUEUE_SPACE) {
+				cdma->stats.sq_stalls++;
+			}
+		}
+
 		BUG_ON(cdma->event != CDMA_EVENT_NONE);
 		cdma->event = event;
 
@@ -399,6 +420,7 @@ static unsigned int wait_cdma(struct nvhost_cdma *cdma, enum cdma_event event)
 static void update_cdma(struct nvhost_cdma *cdma)
 {
 	bool signal = false;
+	bool freed = false;
 	struct nvhost_master *dev = cdma_to_dev(cdma);
 
 	BUG_ON(!cdma->running);
@@ -453,8 +475,13 @@ static void update_cdma(struct nvhost_cdma *cdma)
 		dequeue_sync_queue_head(&cdma->sync_queue);
 		if (cdma->event == CDMA_EVENT_SYNC_QUEUE_SPACE)
 			signal = true;
+		freed = true;
 	}
 
+	/* wake up pollers waiting for room to submit */
+	if (freed)
+		wake_up(&cdma->space_wq);
+
 	/* Wake up CdmaWait() if the requested event happened */
 	if (signal) {
 		cdma->event = CDMA_EVENT_NONE;
@@ -467,13 +494,24 @@ static void update_cdma(struct nvhost_cdma *cdma)
  */
 int nvhost_cdma_init(struct nvhost_cdma *cdma)
 {
+	u32 size = cdma->push_buffer.size;
 	int err;
 
 	mutex_init(&cdma->lock);
 	sema_init(&cdma->sem, 0);
 	cdma->event = CDMA_EVENT_NONE;
 	cdma->running = false;
-	err = init_push_buffer(&cdma->push_buffer);
+	cdma->grow = false;
+	init_waitqueue_head(&cdma->space_wq);
+	/* a channel which is reopened starts off with the push buffer size
+	 * it had grown to before, or the default if that can't be had */
+	err = -ENOMEM;
+	if (size > PUSH_BUFFER_SIZE)
+		err = init_push_buffer(cdma_to_nvmap(cdma), &cdma->push_buffer,
+				       size);
+	if (err)
+		err = init_push_buffer(cdma_to_nvmap(cdma), &cdma->push_buffer,
+				       PUSH_BUFFER_SIZE);
 	if (err)
 		return err;
 	reset_sync_queue(&cdma->sync_queue);
@@ -486,7 +524,7 @@ int nvhost_cdma_init(struct nvhost_cdma *cdma)
 void nvhost_cdma_deinit(struct nvhost_cdma *cdma)
 {
 	BUG_ON(cdma->running);
-	destroy_push_buffer(&cdma->push_buffer);
+	destroy_push_buffer(cdma_to_nvmap(cdma), &cdma->push_buffer);
 }
 
 static void start_cdma(struct nvhost_cdma *cdma)
@@ -532,18 +570,114 @@ void nvhost_cdma_stop(struct nvhost_cdma *cdma)
 	mutex_unlock(&cdma->lock);
 }
 
+/**
+ * Double the size of the push buffer, if a submit has had to wait for
+ * push buffer space and the channel is idle, so that nothing in the old
+ * push buffer is left to be fetched.  On allocation failure, the old push
+ * buffer is kept.
+ * Must be called with the cdma lock held.
+ */
+static void grow_push_buffer(struct nvhost_cdma *cdma)
+{
+	struct nvmap_client *nvmap = cdma_to_nvmap(cdma);
+	void __iomem *chan_regs = cdma_to_channel(cdma)->aperture;
+	struct push_buffer *pb = &cdma->push_buffer;
+	struct push_buffer new_pb;
+
+	if (!cdma->grow || sync_queue_head(&cdma->sync_queue))
+		return;
+	cdma->grow = false;
+	if (pb->size >= PUSH_BUFFER_MAX_SIZE)
+		return;
+	if (init_push_buffer(nvmap, &new_pb, pb->size * 2))
+		return;
+
+	if (cdma->running) {
+		writel(nvhost_channel_dmactrl(true, false, false),
+			chan_regs + HOST1X_CHANNEL_DMACTRL);
+		cdma->running = false;
+	}
+	destroy_push_buffer(nvmap, pb);
+	*pb = new_pb;
+	cdma->stats.pb_grows++;
+}
+
 /**
  * Begin a cdma submit
  */
 void nvhost_cdma_begin(struct nvhost_cdma *cdma)
 {
 	mutex_lock(&cdma->lock);
+	grow_push_buffer(cdma);
 	if (!cdma->running)
 		start_cdma(cdma);
 	cdma->slots_free = 0;
 	cdma->slots_used = 0;
 }
 
+/**
+ * Check whether a submit of the given number of push buffer slots, sync
+ * queue entries and handles to unpin can be made without waiting.  A
+ * submit larger than the whole push buffer fits once the channel is idle
+ * (at which point the push buffer grows).
+ * Must be called with the cdma lock held.
+ */
+static bool cdma_has_space(struct nvhost_cdma *cdma, unsigned int slots,
+			   unsigned int entries, unsigned int handles)
+{
+	struct push_buffer *pb = &cdma->push_buffer;
+
+	if (cdma->running)
+		update_cdma(cdma);
+
+	if (!sync_queue_head(&cdma->sync_queue))
+		return true;
+	if (slots > push_buffer_space(pb))
+		return false;
+	/* each entry takes at most SYNC_QUEUE_MIN_ENTRY words, plus one
+	 * word per handle */
+	return sync_queue_space(&cdma->sync_queue) >=
+		entries * SYNC_QUEUE_MIN_ENTRY + handles;
+}
+
+/**
+ * Make sure that the next submit of the given size goes through without
+ * waiting for the channel.  If it would have to wait, returns -EAGAIN,
+ * and the caller can poll for nvhost_cdma_has_space().  Only the holder
+ * of the channel's submit lock may push to the cdma, so the space is
+ * still there when it does.
+ */
+int nvhost_cdma_try_reserve(struct nvhost_cdma *cdma, unsigned int slots,
+			    unsigned int entries, unsigned int handles)
+{
+	int err = 0;
+
+	mutex_lock(&cdma->lock);
+	if (slots > push_buffer_capacity(&cdma->push_buffer))
+		cdma->grow = true;
+	if (!cdma_has_space(cdma, slots, entries, handles)) {
+		cdma->stats.would_block++;
+		if (slots > push_buffer_space(&cdma->push_buffer))
+			cdma->grow = true;
+		err = -EAGAIN;
+	}
+	mutex_unlock(&cdma->lock);
+
+	return err;
+}
+
+bool nvhost_cdma_has_space(struct nvhost_cdma *cdma, unsigned int slots,
+			   unsigned int entries, unsigned int handles)
+{
+	bool ret;
+
+	mutex_lock(&cdma->lock);
+	ret = cdma_has_space(cdma, slots, entries, handles);
+	mutex_unlock(&cdma->lock);
+
+	return ret;
+}
+
 /**
  * Push two words into a push buffer slot
  * Blocks as necessary if the push buffer is full.
@@ -25,6 +25,7 @@
 
 #include <linux/sched.h>
 #include <linux/semaphore.h>
+#include <linux/wait.h>
 
 #include <mach/nvhost.h>
 #include <mach/nvmap.h>
@@ -50,13 +51,17 @@
 #define NVHOST_SYNC_QUEUE_SIZE 8192
 
 /* Number of gathers we allow to be queued up per channel. Must be a
-   power of two. Currently sized such that pushbuffer is 4KB (512*8B). */
+   power of two. Currently sized such that pushbuffer is 4KB (512*8B).
+   Channels whose submits have to wait for push buffer space get their
+   push buffer doubled, up to NVHOST_GATHER_QUEUE_MAX gathers (32KB). */
 #define NVHOST_GATHER_QUEUE_SIZE 512
+#define NVHOST_GATHER_QUEUE_MAX 4096
 
 struct push_buffer {
 	struct nvmap_handle_ref *mem; /* handle to pushbuffer memory */
 	u32 *mapped;		/* mapped pushbuffer memory */
 	u32 phys;		/* physical address of pushbuffer */
+	u32 size;		/* size in bytes, a power of two */
 	u32 fence;		/* index we've written */
 	u32 cur;		/* index to write to */
 };
@@ -64,6 +69,7 @@ struct push_buffer {
 struct sync_queue {
 	unsigned int read;		    /* read position within buffer */
 	unsigned int write;		    /* write position within buffer */
+	unsigned int entries;		    /* number of entries queued */
 	u32 buffer[NVHOST_SYNC_QUEUE_SIZE]; /* queue data */
 };
 
@@ -74,6 +80,13 @@ enum cdma_event {
 	CDMA_EVENT_PUSH_BUFFER_SPACE	/* wait for space in push buffer */
 };
 
+struct nvhost_cdma_stats {
+	unsigned int pb_stalls;		/* submits which waited for pb space */
+	unsigned int sq_stalls;		/* ...and for sync queue space */
+	unsigned int would_block;	/* non-blocking submits turned away */
+	unsigned int pb_grows;		/* times the pb was enlarged */
+};
+
 struct nvhost_cdma {
 	struct mutex lock;		/* controls access to shared state */
 	struct semaphore sem;		/* signalled when event occurs */
@@ -84,12 +97,21 @@ struct nvhost_cdma {
 	struct push_buffer push_buffer;	/* channel's push buffer */
 	struct sync_queue sync_queue;	/* channel's sync queue */
 	bool running;
+	bool grow;			/* enlarge pb when next idle */
+	wait_queue_head_t space_wq;	/* woken when space is freed */
+	struct nvhost_cdma_stats stats;
 };
 
 int	nvhost_cdma_init(struct nvhost_cdma *cdma);
 void	nvhost_cdma_deinit(struct nvhost_cdma *cdma);
 void	nvhost_cdma_stop(struct nvhost_cdma *cdma);
 void	nvhost_cdma_begin(struct nvhost_cdma *cdma);
+int	nvhost_cdma_try_reserve(struct nvhost_cdma *cdma,
+				unsigned int slots, unsigned int entries,
+				unsigned int handles);
+bool	nvhost_cdma_has_space(struct nvhost_cdma *cdma,
+			      unsigned int slots, unsigned int entries,
+			      unsigned int handles);
 void	nvhost_cdma_push(struct nvhost_cdma *cdma, u32 op1, u32 op2);
 void	nvhost_cdma_end(struct nvmap_client *user_nvmap,
 			struct nvhost_cdma *cdma,
@@ -97,7 +119,14 @@ void	nvhost_cdma_end(struct nvmap_client *user_nvmap,
 			struct nvmap_handle **handles, unsigned int nr_handles);
 void	nvhost_cdma_update(struct nvhost_cdma *cdma);
 void	nvhost_cdma_flush(struct nvhost_cdma *cdma);
+
 void    nvhost_cdma_find_gather(struct nvhost_cdma *cdma, u32 dmaget,
                 u32 *addr, u32 *size);
 
+/* number of sync queue entries, i.e. submits, still waiting to complete */
+static inline unsigned int nvhost_cdma_queue_depth(struct nvhost_cdma *cdma)
+{
+	return cdma->sync_queue.entries;
+}
+
 #endif
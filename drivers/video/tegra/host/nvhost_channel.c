@@ -37,7 +37,99 @@
 #define NVMODMUTEX_DSI       (9)
 
 static void power_2d(struct nvhost_module *mod, enum nvhost_power_action action);
-static void power_3d(struct nvhost_module *mod, enum nvhost_power_action action);
+/* saves the context loaded in the unit; called with submitlock held */
+static void save_cur_ctx(struct nvhost_channel *ch)
+{
+	DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
+	struct nvhost_intr *intr = &ch->dev->intr;
+	struct nvhost_op_pair save;
+	struct nvhost_cpuinterrupt ctxsw;
+	void *wakeup;
+	u32 syncval;
+	void *ref;
+	int err;
+
+	err = nvhost_intr_alloc_waiter(intr, NVSYNCPT_3D, &ctxsw.waiter);
+	if (!err) {
+		err = nvhost_intr_alloc_waiter(intr, NVSYNCPT_3D, &wakeup);
+		if (err)
+			nvhost_intr_free_waiter(intr, NVSYNCPT_3D,
+						ctxsw.waiter);
+	}
+	if (err) {
+		/* the context is restored from its last save, if any */
+		dev_err(&ch->dev->pdev->dev,
+			"can't save context, dropping it (%d)\n", err);
+		ch->cur_ctx = NULL;
+		return;
+	}
+
+	syncval = nvhost_syncpt_incr_max(&ch->dev->syncpt,
+					NVSYNCPT_3D,
+					ch->cur_ctx->save_incrs);
+	save.op1 = nvhost_opcode_gather(0, ch->cur_ctx->save_size);
+	save.op2 = ch->cur_ctx->save_phys;
+	ctxsw.intr_data = ch->cur_ctx;
+	ctxsw.syncpt_val = syncval - 1;
+	ch->cur_ctx->valid = true;
+	ch->ctxhandler.get(ch->cur_ctx);
+	atomic_inc(&ch->cur_ctx->saves_pending);
+	ch->cur_ctx = NULL;
+	ch->ctxsw_stats.saves++;
+
+	nvhost_channel_submit(ch, ch->dev->nvmap,
+			      &save, 1, &ctxsw, 1, NULL, 0,
+			      NVSYNCPT_3D, syncval, 0);
+
+	nvhost_intr_add_waiter(intr, NVSYNCPT_3D,
+			       syncval,
+			       NVHOST_INTR_ACTION_WAKEUP,
+			       &wq, wakeup, &ref);
+	wait_event(wq,
+		   nvhost_syncpt_min_cmp(&ch->dev->syncpt,
+					 NVSYNCPT_3D, syncval));
+	nvhost_intr_put_ref(intr, ref);
+	nvhost_cdma_update(&ch->cdma);
+}
+
+/*
+ * Saves the context loaded in the channel's unit ahead of the unit losing
+ * its registers, so that the context is restored on its next submit.
+ * Needed on suspend, since clock gating alone leaves the context loaded
+ * when the unit keeps its power (see power_3d()).
+ */
+void nvhost_channel_save_context(struct nvhost_channel *ch)
+{
+	mutex_lock(&ch->reflock);
+	if (ch->refcount && ch->ctxhandler.alloc) {
+		nvhost_module_busy(&ch->mod);
+		mutex_lock(&ch->submitlock);
+		if (ch->cur_ctx)
+			save_cur_ctx(ch);
+		mutex_unlock(&ch->submitlock);
+		nvhost_module_idle(&ch->mod);
+	}
+	mutex_unlock(&ch->reflock);
+}
+
+static void power_3d(struct nvhost_module *mod, enum nvhost_power_action action)
+{
+	struct nvhost_channel *ch = container_of(mod, struct nvhost_channel, mod);
+
+	if (action == NVHOST_POWER_ACTION_OFF) {
+		mutex_lock(&ch->submitlock);
+		if (ch->cur_ctx) {
+			/* without power gating, the registers survive clock
+			 * gating and the save waits for the next switch */
+			if (mod->powergate_id == -1)
+				ch->ctxsw_stats.saves_skipped++;
+			else
+				save_cur_ctx(ch);
+		}
+		mutex_unlock(&ch->submitlock);
+	}
+}
+
 static void power_mpe(struct nvhost_module *mod, enum nvhost_power_action action);
 
 static const struct nvhost_channeldesc channelmap[] = {
@@ -115,10 +207,122 @@ int __init nvhost_channel_init(struct nvhost_channel *ch,
 	ch->aperture = channel_aperture(dev->aperture, index);
 	mutex_init(&ch->reflock);
 	mutex_init(&ch->submitlock);
+	spin_lock_init(&ch->sched.lock);
+	INIT_LIST_HEAD(&ch->sched.waiters);
+	init_waitqueue_head(&ch->sched.wq);
 
 	return nvhost_hwctx_handler_init(&ch->ctxhandler, ch->desc->name);
 }
 
+/*
+ * User submits get the channel one submit at a time in order of priority
+ * rather than of arrival, so a high priority client only ever waits for
+ * the submit in progress.  Each waiter also gets a deadline, a budget for
+ * its priority after it starts waiting; waiters past their deadline go
+ * first, earliest deadline first, so lower priorities are not starved.
+ */
+static const unsigned int sched_budget_us[NVHOST_NUM_PRIORITIES] = {
+	[NVHOST_PRIORITY_LOW]    = 100000,
+	[NVHOST_PRIORITY_MEDIUM] = 16000,
+	[NVHOST_PRIORITY_HIGH]   = 2000,
+};
+
+struct sched_waiter {
+	struct list_head list;
+	int priority;
+	ktime_t deadline;
+	bool granted;
+};
+
+static bool sched_before(struct sched_waiter *a, struct sched_waiter *b,
+			 ktime_t now)
+{
+	bool a_late = a->deadline.tv64 <= now.tv64;
+	bool b_late = b->deadline.tv64 <= now.tv64;
+
+	if (a_late != b_late)
+		return a_late;
+	if (!a_late && a->priority != b->priority)
+		return a->priority > b->priority;
+	return a->deadline.tv64 < b->deadline.tv64;
+}
+
+/* hands the channel over to the first waiter; called with sched->lock */
+static void sched_next(struct nvhost_sched *sched)
+{
+	struct sched_waiter *w, *next = NULL;
+	ktime_t now = ktime_get();
+
+	list_for_each_entry(w, &sched->waiters, list)
+		if (!next || sched_before(w, next, now))
+			next = w;
+
+	if (next) {
+		list_del(&next->list);
+		next->granted = true;
+		wake_up_all(&sched->wq);
+	} else {
+		sched->busy = false;
+	}
+}
+
+/* takes submitlock for a user submit of the given priority */
+int nvhost_channel_submit_lock(struct nvhost_channel *ch, int priority)
+{
+	struct nvhost_sched *sched = &ch->sched;
+	struct nvhost_sched_stats *stats = &sched->stats[priority];
+	struct sched_waiter w;
+	ktime_t start = ktime_get();
+	s64 us;
+	int err;
+
+	w.priority = priority;
+	w.deadline = ktime_add_us(start, sched_budget_us[priority]);
+	w.granted = false;
+
+	spin_lock(&sched->lock);
+	if (!sched->busy) {
+		sched->busy = true;
+		w.granted = true;
+	} else {
+		list_add_tail(&w.list, &sched->waiters);
+	}
+	spin_unlock(&sched->lock);
+
+	err = wait_event_interruptible(sched->wq, w.granted);
+	if (err) {
+		spin_lock(&sched->lock);
+		if (w.granted)
+			sched_next(sched);
+		else
+			list_del(&w.list);
+		spin_unlock(&sched->lock);
+		return err;
+	}
+
+	/* only taken by the driver itself besides the scheduled submits */
+	mutex_lock(&ch->submitlock);
+
+	us = ktime_us_delta(ktime_get(), start);
+	spin_lock(&sched->lock);
+	stats->submits++;
+	stats->wait_us += us;
+	if (us > stats->max_wait_us)
+		stats->max_wait_us = us;
+	spin_unlock(&sched->lock);
+
+	return 0;
+}
+
+void nvhost_channel_submit_unlock(struct nvhost_channel *ch)
+{
+	mutex_unlock(&ch->submitlock);
+
+	spin_lock(&ch->sched.lock);
+	sched_next(&ch->sched);
+	spin_unlock(&ch->sched.lock);
+}
+
 struct nvhost_channel *nvhost_getchannel(struct nvhost_channel *ch)
 {
 	int err = 0;
@@ -182,8 +386,9 @@ void nvhost_channel_submit(struct nvhost_channel *ch,
 
 	/* schedule interrupts */
 	for (i = 0; i < num_intrs; i++) {
-		nvhost_intr_add_action(&ch->dev->intr, syncpt_id, intrs[i].syncpt_val,
-				NVHOST_INTR_ACTION_CTXSAVE, intrs[i].intr_data, NULL);
+		nvhost_intr_add_waiter(&ch->dev->intr, syncpt_id, intrs[i].syncpt_val,
+				NVHOST_INTR_ACTION_CTXSAVE, intrs[i].intr_data,
+				intrs[i].waiter, NULL);
 	}
 
 	/* begin a CDMA submit */
@@ -231,47 +436,6 @@ static void power_2d(struct nvhost_module *mod, enum nvhost_power_action action)
 	}
 }
 
-static void power_3d(struct nvhost_module *mod, enum nvhost_power_action action)
-{
-	struct nvhost_channel *ch = container_of(mod, struct nvhost_channel, mod);
-
-	if (action == NVHOST_POWER_ACTION_OFF) {
-		mutex_lock(&ch->submitlock);
-		if (ch->cur_ctx) {
-			DECLARE_WAIT_QUEUE_HEAD_ONSTACK(wq);
-			struct nvhost_op_pair save;
-			struct nvhost_cpuinterrupt ctxsw;
-			u32 syncval;
-			void *ref;
-			syncval = nvhost_syncpt_incr_max(&ch->dev->syncpt,
-							NVSYNCPT_3D,
-							ch->cur_ctx->save_incrs);
-			save.op1 = nvhost_opcode_gather(0, ch->cur_ctx->save_size);
-			save.op2 = ch->cur_ctx->save_phys;
-			ctxsw.intr_data = ch->cur_ctx;
-			ctxsw.syncpt_val = syncval - 1;
-			ch->cur_ctx->valid = true;
-			ch->ctxhandler.get(ch->cur_ctx);
-			ch->cur_ctx = NULL;
-
-			nvhost_channel_submit(ch, ch->dev->nvmap,
-					      &save, 1, &ctxsw, 1, NULL, 0,
-					      NVSYNCPT_3D, syncval, 0);
-
-			nvhost_intr_add_action(&ch->dev->intr, NVSYNCPT_3D,
-					       syncval,
-					       NVHOST_INTR_ACTION_WAKEUP,
-					       &wq, &ref);
-			wait_event(wq,
-				   nvhost_syncpt_min_cmp(&ch->dev->syncpt,
-							 NVSYNCPT_3D, syncval));
-			nvhost_intr_put_ref(&ch->dev->intr, ref);
-			nvhost_cdma_update(&ch->cdma);
-		}
-		mutex_unlock(&ch->submitlock);
-	}
-}
-
 static void power_mpe(struct nvhost_module *mod, enum nvhost_power_action action)
 {
 }
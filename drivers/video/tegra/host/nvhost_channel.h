@@ -26,9 +26,13 @@
 #include "nvhost_cdma.h"
 #include "nvhost_acm.h"
 #include "nvhost_hwctx.h"
+#include "nvhost_scale.h"
 
 #include <linux/cdev.h>
 #include <linux/io.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
 
 #define NVHOST_CHANNEL_BASE 0
 #define NVHOST_NUMCHANNELS (NV_HOST1X_CHANNELS - 1)
@@ -46,6 +50,38 @@ struct nvhost_channeldesc {
 	u32 class;
 };
 
+/* context switches of the channel's unit; sampled without locking */
+struct nvhost_ctxsw_stats {
+	u32 switches;
+	u32 saves;
+	u32 saves_skipped;	/* unit clock-gated with its state kept */
+	u32 restores;
+	u32 delta_restores;	/* restores of just the changed registers */
+	/* words of register writes left out of the delta restores; the
+	 * restore gather is still fetched at full size, with no-ops in
+	 * their place, so this is work saved in the unit, not in memory
+	 * traffic */
+	u64 restore_words_skipped;
+};
+
+#define NVHOST_NUM_PRIORITIES (NVHOST_PRIORITY_HIGH + 1)
+
+struct nvhost_sched_stats {
+	u32 submits;
+	u64 wait_us;
+	u32 max_wait_us;
+};
+
+/* orders the user submits waiting for the channel, see
+ * nvhost_channel_submit_lock() */
+struct nvhost_sched {
+	spinlock_t lock;
+	bool busy;
+	struct list_head waiters;
+	wait_queue_head_t wq;
+	struct nvhost_sched_stats stats[NVHOST_NUM_PRIORITIES];
+};
+
 struct nvhost_channel {
 	int refcount;
 	struct mutex reflock;
@@ -59,6 +95,9 @@ struct nvhost_channel {
 	struct nvhost_hwctx_handler ctxhandler;
 	struct nvhost_module mod;
 	struct nvhost_cdma cdma;
+	struct nvhost_scale scale;
+	struct nvhost_ctxsw_stats ctxsw_stats;
+	struct nvhost_sched sched;
 };
 
 struct nvhost_op_pair {
@@ -69,6 +108,8 @@ struct nvhost_op_pair {
 struct nvhost_cpuinterrupt {
 	u32 syncpt_val;
 	void *intr_data;
+	/* from nvhost_intr_alloc_waiter(), so that submitting can't fail */
+	void *waiter;
 };
 
 int nvhost_channel_init(
@@ -91,5 +132,8 @@ void nvhost_channel_submit(
 struct nvhost_channel *nvhost_getchannel(struct nvhost_channel *ch);
 void nvhost_putchannel(struct nvhost_channel *ch, struct nvhost_hwctx *ctx);
 void nvhost_channel_suspend(struct nvhost_channel *ch);
+void nvhost_channel_save_context(struct nvhost_channel *ch);
+int nvhost_channel_submit_lock(struct nvhost_channel *ch, int priority);
+void nvhost_channel_submit_unlock(struct nvhost_channel *ch);
 
 #endif
@@ -0,0 +1,259 @@
+/*
+ * drivers/video/tegra/host/nvhost_fence.c
+ *
+ * Tegra Graphics Host Syncpoint Fences
+ *
+ * Copyright (c) 2010, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "nvhost_fence.h"
+#include "dev.h"
+
+#include <linux/anon_inodes.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+
+struct nvhost_fence_pt {
+	u32 id;
+	u32 thresh;
+	void *ref;
+};
+
+/* a fence is signaled once every one of its points has been reached. each
+ * point which was still pending when the fence was created has a wakeup
+ * action queued on the sync point, which wakes pollers on wq. while any
+ * point may be pending the host module is kept busy, so that threshold
+ * interrupts keep being delivered. */
+struct nvhost_fence {
+	struct nvhost_master *dev;
+	wait_queue_head_t wq;
+	atomic_t busy;
+	int num_pts;
+	struct nvhost_fence_pt pts[0];
+};
+
+static const struct file_operations nvhost_fence_ops;
+
+static struct nvhost_fence *fence_alloc(struct nvhost_master *dev,
+					int num_pts)
+{
+	struct nvhost_fence *f;
+
+	f = kzalloc(sizeof(*f) + num_pts * sizeof(f->pts[0]), GFP_KERNEL);
+	if (!f)
+		return NULL;
+
+	f->dev = dev;
+	init_waitqueue_head(&f->wq);
+	atomic_set(&f->busy, 0);
+	f->num_pts = num_pts;
+	return f;
+}
+
+static bool fence_signaled(struct nvhost_fence *f)
+{
+	int i;
+
+	for (i = 0; i < f->num_pts; i++)
+		if (!nvhost_syncpt_min_cmp(&f->dev->syncpt, f->pts[i].id,
+					   f->pts[i].thresh))
+			return false;
+	return true;
+}
+
+static void fence_idle(struct nvhost_fence *f)
+{
+	if (atomic_xchg(&f->busy, 0))
+		nvhost_module_idle(&f->dev->mod);
+}
+
+static void fence_free(struct nvhost_fence *f)
+{
+	int i;
+
+	for (i = 0; i < f->num_pts; i++)
+		if (f->pts[i].ref)
+			nvhost_intr_put_ref(&f->dev->intr, f->pts[i].ref);
+	fence_idle(f);
+	kfree(f);
+}
+
+/* queues wakeups for the pending points of f and wraps it in a new file
+ * descriptor; f is freed on failure */
+static int fence_install(struct nvhost_fence *f)
+{
+	struct nvhost_syncpt *sp = &f->dev->syncpt;
+	bool pending = false;
+	int err;
+	int i;
+
+	nvhost_module_busy(&f->dev->mod);
+	atomic_set(&f->busy, 1);
+
+	for (i = 0; i < f->num_pts; i++) {
+		struct nvhost_fence_pt *pt = &f->pts[i];
+
+		if (nvhost_syncpt_min_cmp(sp, pt->id, pt->thresh))
+			continue;
+		nvhost_syncpt_update_min(sp, pt->id);
+		if (nvhost_syncpt_min_cmp(sp, pt->id, pt->thresh))
+			continue;
+
+		err = nvhost_intr_add_action(&f->dev->intr, pt->id, pt->thresh,
+				NVHOST_INTR_ACTION_WAKEUP_INTERRUPTIBLE,
+				&f->wq, &pt->ref);
+		if (err) {
+			pt->ref = NULL;
+			fence_free(f);
+			return err;
+		}
+		pending = true;
+	}
+
+	if (!pending)
+		fence_idle(f);
+
+	err = anon_inode_getfd("nvhost_fence", &nvhost_fence_ops, f,
+			       O_RDONLY | O_CLOEXEC);
+	if (err < 0)
+		fence_free(f);
+
+	return err;
+}
+
+static int nvhost_fence_release(struct inode *inode, struct file *filp)
+{
+	struct nvhost_fence *f = filp->private_data;
+
+	filp->private_data = NULL;
+	fence_free(f);
+	return 0;
+}
+
+static unsigned int nvhost_fence_poll(struct file *filp, poll_table *wait)
+{
+	struct nvhost_fence *f = filp->private_data;
+
+	poll_wait(filp, &f->wq, wait);
+
+	if (!fence_signaled(f))
+		return 0;
+
+	fence_idle(f);
+	return POLLIN | POLLRDNORM;
+}
+
+static const struct file_operations nvhost_fence_ops = {
+	.owner = THIS_MODULE,
+	.release = nvhost_fence_release,
+	.poll = nvhost_fence_poll,
+};
+
+int nvhost_fence_create(struct nvhost_master *dev, u32 id, u32 thresh)
+{
+	struct nvhost_fence *f;
+
+	if (id >= NV_HOST1X_SYNCPT_NB_PTS)
+		return -EINVAL;
+
+	/* a threshold beyond the max can never be reached by the host */
+	if (!(BIT(id) & NVSYNCPTS_CLIENT_MANAGED) &&
+	    (s32)(nvhost_syncpt_read_max(&dev->syncpt, id) - thresh) < 0)
+		return -EINVAL;
+
+	f = fence_alloc(dev, 1);
+	if (!f)
+		return -ENOMEM;
+
+	f->pts[0].id = id;
+	f->pts[0].thresh = thresh;
+
+	return fence_install(f);
+}
+
+static struct nvhost_fence *fence_get(int fd, struct file **filp)
+{
+	struct file *file = fget(fd);
+
+	if (!file)
+		return NULL;
+	if (file->f_op != &nvhost_fence_ops) {
+		fput(file);
+		return NULL;
+	}
+	*filp = file;
+	return file->private_data;
+}
+
+/* adds the points of src to dst; a sync point which appears in both keeps
+ * only the later of the two thresholds */
+static void fence_add_pts(struct nvhost_fence *dst, struct nvhost_fence *src)
+{
+	int i, j;
+
+	for (i = 0; i < src->num_pts; i++) {
+		struct nvhost_fence_pt *pt = &src->pts[i];
+
+		for (j = 0; j < dst->num_pts; j++)
+			if (dst->pts[j].id == pt->id)
+				break;
+
+		if (j == dst->num_pts) {
+			dst->pts[j].id = pt->id;
+			dst->pts[j].thresh = pt->thresh;
+			dst->num_pts++;
+		} else if ((s32)(pt->thresh - dst->pts[j].thresh) > 0) {
+			dst->pts[j].thresh = pt->thresh;
+		}
+	}
+}
+
+int nvhost_fence_merge(struct nvhost_master *dev, int fd1, int fd2)
+{
+	struct file *file1, *file2;
+	struct nvhost_fence *a, *b, *f;
+	int err = -EINVAL;
+
+	a = fence_get(fd1, &file1);
+	if (!a)
+		return -EINVAL;
+
+	b = fence_get(fd2, &file2);
+	if (!b)
+		goto put_a;
+
+	f = fence_alloc(dev, a->num_pts + b->num_pts);
+	if (!f) {
+		err = -ENOMEM;
+		goto put_b;
+	}
+
+	f->num_pts = 0;
+	fence_add_pts(f, a);
+	fence_add_pts(f, b);
+
+	err = fence_install(f);
+
+put_b:
+	fput(file2);
+put_a:
+	fput(file1);
+	return err;
+}
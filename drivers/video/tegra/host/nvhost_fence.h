@@ -0,0 +1,42 @@
+/*
+ * drivers/video/tegra/host/nvhost_fence.h
+ *
+ * Tegra Graphics Host Syncpoint Fences
+ *
+ * Copyright (c) 2010, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __NVHOST_FENCE_H
+#define __NVHOST_FENCE_H
+
+#include <linux/types.h>
+
+struct nvhost_master;
+
+/**
+ * Create a fence file descriptor which becomes readable (POLLIN) once
+ * sync point id reaches thresh. Returns the fd, or a negative error.
+ */
+int nvhost_fence_create(struct nvhost_master *dev, u32 id, u32 thresh);
+
+/**
+ * Create a fence file descriptor which is signaled once both of the
+ * fences fd1 and fd2 are. Returns the fd, or a negative error.
+ */
+int nvhost_fence_merge(struct nvhost_master *dev, int fd1, int fd2);
+
+#endif
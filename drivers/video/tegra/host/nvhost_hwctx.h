@@ -26,6 +26,8 @@
 #include <linux/string.h>
 #include <linux/kref.h>
 
+#include <asm/atomic.h>
+
 #include <mach/nvhost.h>
 #include <mach/nvmap.h>
 
@@ -47,6 +49,20 @@ struct nvhost_hwctx {
 	u32 restore_phys;
 	u32 restore_size;
 	u32 restore_incrs;
+
+	/*
+	 * Alternative restore, of the same size, which only replays the
+	 * registers that differ from those of the context saved just before
+	 * it.  It is written by the save service of that context, which
+	 * finds this context in its next pointer; restore_delta_phys is 0
+	 * if the handler does not support delta restores.
+	 */
+	struct nvmap_handle_ref *restore_delta;
+	u32 restore_delta_phys;
+	void *restore_delta_cpu;
+	void *image;			/* cached copy of the saved registers */
+	struct nvhost_hwctx *next;
+	atomic_t saves_pending;		/* saves not yet serviced */
 };
 
 struct nvhost_hwctx_handler {
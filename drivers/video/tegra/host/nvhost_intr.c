@@ -27,6 +27,7 @@
 #include <linux/irq.h>
 
 #define intr_to_dev(x) container_of(x, struct nvhost_master, intr)
+#define WAIT_HEAP_INIT_SIZE 16
 
 
 /*** HW sync point threshold interrupt management ***/
@@ -53,6 +54,7 @@ struct nvhost_waitlist {
 	atomic_t state;
 	void *data;
 	int count;
+	u32 seq;
 };
 
 enum waitlist_state
@@ -69,39 +71,124 @@ static void waiter_release(struct kref *kref)
 }
 
 /*
- * add a waiter to a waiter queue, sorted by threshold
- * returns true if it was added at the head of the queue
+ * returns true if waiter a must be completed before waiter b. thresholds
+ * are compared with wraparound; waiters with equal thresholds complete in
+ * the order in which they were added.
  */
-static bool add_waiter_to_queue(struct nvhost_waitlist *waiter,
-				struct list_head *queue)
+static inline bool waiter_before(const struct nvhost_waitlist *a,
+				 const struct nvhost_waitlist *b)
+{
+	s32 d = (s32)(a->thresh - b->thresh);
+
+	if (d)
+		return d < 0;
+	return (s32)(a->seq - b->seq) < 0;
+}
+
+static void wait_heap_sift_up(struct nvhost_waitlist **heap, unsigned int i)
+{
+	struct nvhost_waitlist *w = heap[i];
+
+	while (i) {
+		unsigned int parent = (i - 1) / 2;
+		if (!waiter_before(w, heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = w;
+}
+
+static void wait_heap_sift_down(struct nvhost_waitlist **heap,
+				unsigned int len, unsigned int i)
 {
-	struct nvhost_waitlist *pos;
-	u32 thresh = waiter->thresh;
+	struct nvhost_waitlist *w = heap[i];
 
-	list_for_each_entry_reverse(pos, queue, list)
-		if ((s32)(pos->thresh - thresh) <= 0) {
-			list_add(&waiter->list, &pos->list);
-			return false;
+	for (;;) {
+		unsigned int child = 2 * i + 1;
+		if (child >= len)
+			break;
+		if (child + 1 < len && waiter_before(heap[child + 1], heap[child]))
+			child++;
+		if (!waiter_before(heap[child], w))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = w;
+}
+
+/*
+ * make room for one more waiter in the heap, besides the reserved ones.
+ * called with the syncpt lock held; the lock is dropped while the larger
+ * heap is allocated.
+ */
+static int grow_wait_heap(struct nvhost_intr_syncpt *syncpt)
+{
+	while (syncpt->wait_len + syncpt->wait_reserved >= syncpt->wait_size) {
+		unsigned int size = syncpt->wait_size ?
+			syncpt->wait_size * 2 : WAIT_HEAP_INIT_SIZE;
+		struct nvhost_waitlist **heap;
+
+		spin_unlock(&syncpt->lock);
+		heap = kmalloc(size * sizeof(*heap), GFP_KERNEL);
+		spin_lock(&syncpt->lock);
+		if (!heap)
+			return -ENOMEM;
+
+		if (size > syncpt->wait_size) {
+			memcpy(heap, syncpt->wait_heap,
+			       syncpt->wait_len * sizeof(*heap));
+			swap(heap, syncpt->wait_heap);
+			syncpt->wait_size = size;
 		}
+		kfree(heap);
+	}
+	return 0;
+}
+
+/*
+ * add a waiter to a syncpt's waiter heap; there must be room for it.
+ * returns true if it is now the first waiter to complete
+ */
+static bool add_waiter_to_queue(struct nvhost_waitlist *waiter,
+				struct nvhost_intr_syncpt *syncpt)
+{
+	unsigned int i = syncpt->wait_len++;
+
+	waiter->seq = syncpt->wait_seq++;
+	syncpt->wait_heap[i] = waiter;
+	wait_heap_sift_up(syncpt->wait_heap, i);
+
+	if (syncpt->wait_len > syncpt->stat.max_depth)
+		syncpt->stat.max_depth = syncpt->wait_len;
 
-	list_add(&waiter->list, queue);
-	return true;
+	return syncpt->wait_heap[0] == waiter;
 }
 
 /*
- * run through a waiter queue for a single sync point ID
- * and gather all completed waiters into lists by actions
+ * pop all completed waiters off a single sync point's waiter heap
+ * and gather them into lists by actions
  */
-static void remove_completed_waiters(struct list_head *head, u32 sync,
+static void remove_completed_waiters(struct nvhost_intr_syncpt *syncpt,
+			u32 sync,
 			struct list_head completed[NVHOST_INTR_ACTION_COUNT])
 {
+	struct nvhost_waitlist **heap = syncpt->wait_heap;
 	struct list_head *dest;
-	struct nvhost_waitlist *waiter, *next, *prev;
+	struct nvhost_waitlist *waiter, *prev;
 
-	list_for_each_entry_safe(waiter, next, head, list) {
+	while (syncpt->wait_len) {
+		waiter = heap[0];
 		if ((s32)(waiter->thresh - sync) > 0)
 			break;
 
+		if (--syncpt->wait_len) {
+			heap[0] = heap[syncpt->wait_len];
+			wait_heap_sift_down(heap, syncpt->wait_len, 0);
+		}
+		syncpt->stat.completed++;
+
 		dest = completed + waiter->action;
 
 		/* consolidate submit cleanups */
@@ -116,12 +203,10 @@ static void remove_completed_waiters(struct list_head *head, u32 sync,
 		}
 
 		/* PENDING->REMOVED or CANCELLED->HANDLED */
-		if (atomic_inc_return(&waiter->state) == WLS_HANDLED || !dest) {
-			list_del(&waiter->list);
+		if (atomic_inc_return(&waiter->state) == WLS_HANDLED || !dest)
 			kref_put(&waiter->refcount, waiter_release);
-		} else {
-			list_move_tail(&waiter->list, dest);
-		}
+		else
+			list_add_tail(&waiter->list, dest);
 	}
 }
 
@@ -140,6 +225,7 @@ static void action_ctxsave(struct nvhost_waitlist *waiter)
 	struct nvhost_channel *channel = hwctx->channel;
 
 	channel->ctxhandler.save_service(hwctx);
+	atomic_dec(&hwctx->saves_pending);
 	channel->ctxhandler.put(hwctx);
 }
 
@@ -235,6 +321,7 @@ static irqreturn_t syncpt_thresh_isr(int irq, void *dev_id)
 	writel(BIT(id),
 		sync_regs + HOST1X_SYNC_SYNCPT_THRESH_CPU0_INT_STATUS);
 
+	syncpt->isr_stamp = ktime_get();
 	return IRQ_WAKE_THREAD;
 }
 
@@ -255,6 +342,7 @@ static irqreturn_t syncpt_thresh_fn(int irq, void *dev_id)
 	struct list_head completed[NVHOST_INTR_ACTION_COUNT];
 	u32 sync;
 	unsigned int i;
+	s64 us;
 
 	for (i = 0; i < NVHOST_INTR_ACTION_COUNT; ++i)
 		INIT_LIST_HEAD(completed + i);
@@ -263,13 +351,11 @@ static irqreturn_t syncpt_thresh_fn(int irq, void *dev_id)
 
 	spin_lock(&syncpt->lock);
 
-	remove_completed_waiters(&syncpt->wait_head, sync, completed);
-
-	if (!list_empty(&syncpt->wait_head)) {
-		u32 thresh = list_first_entry(&syncpt->wait_head,
-					struct nvhost_waitlist, list)->thresh;
+	remove_completed_waiters(syncpt, sync, completed);
 
-		set_syncpt_threshold(sync_regs, id, thresh);
+	if (syncpt->wait_len) {
+		set_syncpt_threshold(sync_regs, id,
+				     syncpt->wait_heap[0]->thresh);
 		enable_syncpt_interrupt(sync_regs, id);
 	}
 
@@ -277,6 +363,12 @@ static irqreturn_t syncpt_thresh_fn(int irq, void *dev_id)
 
 	run_handlers(completed);
 
+	us = ktime_us_delta(ktime_get(), syncpt->isr_stamp);
+	syncpt->stat.irqs++;
+	syncpt->stat.total_us += us;
+	if (us > syncpt->stat.max_us)
+		syncpt->stat.max_us = us;
+
 	return IRQ_HANDLED;
 }
 
@@ -286,7 +378,7 @@ static irqreturn_t syncpt_thresh_fn(int irq, void *dev_id)
 static int request_syncpt_irq(struct nvhost_intr_syncpt *syncpt)
 {
 	static DEFINE_MUTEX(mutex);
-	int err;
+	int err = 0;
 
 	mutex_lock(&mutex);
 	if (!syncpt->irq_requested) {
@@ -303,52 +395,82 @@ static int request_syncpt_irq(struct nvhost_intr_syncpt *syncpt)
 
 /*** Main API ***/
 
-int nvhost_intr_add_action(struct nvhost_intr *intr, u32 id, u32 thresh,
-			enum nvhost_intr_action action, void *data,
-			void **ref)
+int nvhost_intr_alloc_waiter(struct nvhost_intr *intr, u32 id, void **waiter)
 {
-	struct nvhost_waitlist *waiter;
+	struct nvhost_waitlist *w;
 	struct nvhost_intr_syncpt *syncpt;
-	void __iomem *sync_regs;
-	int queue_was_empty;
 	int err;
 
-	/* create and initialize a new waiter */
-	waiter = kmalloc(sizeof(*waiter), GFP_KERNEL);
-	if (!waiter)
-		return -ENOMEM;
-	INIT_LIST_HEAD(&waiter->list);
-	kref_init(&waiter->refcount);
-	if (ref)
-		kref_get(&waiter->refcount);
-	waiter->thresh = thresh;
-	waiter->action = action;
-	atomic_set(&waiter->state, WLS_PENDING);
-	waiter->data = data;
-	waiter->count = 1;
-
 	BUG_ON(id >= NV_HOST1X_SYNCPT_NB_PTS);
 	syncpt = intr->syncpt + id;
-	sync_regs = intr_to_dev(intr)->sync_aperture;
 
-	spin_lock(&syncpt->lock);
+	w = kmalloc(sizeof(*w), GFP_KERNEL);
+	if (!w)
+		return -ENOMEM;
 
 	/* lazily request irq for this sync point */
 	if (!syncpt->irq_requested) {
-		spin_unlock(&syncpt->lock);
-
 		err = request_syncpt_irq(syncpt);
 		if (err) {
-			kfree(waiter);
+			kfree(w);
 			return err;
 		}
+	}
 
-		spin_lock(&syncpt->lock);
+	/* keep room in the heap for the waiter until it is added */
+	spin_lock(&syncpt->lock);
+	err = grow_wait_heap(syncpt);
+	if (!err)
+		syncpt->wait_reserved++;
+	spin_unlock(&syncpt->lock);
+	if (err) {
+		kfree(w);
+		return err;
 	}
 
-	queue_was_empty = list_empty(&syncpt->wait_head);
+	*waiter = w;
+	return 0;
+}
+
+void nvhost_intr_free_waiter(struct nvhost_intr *intr, u32 id, void *waiter)
+{
+	struct nvhost_intr_syncpt *syncpt = intr->syncpt + id;
+
+	spin_lock(&syncpt->lock);
+	syncpt->wait_reserved--;
+	spin_unlock(&syncpt->lock);
+	kfree(waiter);
+}
+
+void nvhost_intr_add_waiter(struct nvhost_intr *intr, u32 id, u32 thresh,
+			enum nvhost_intr_action action, void *data,
+			void *waiter, void **ref)
+{
+	struct nvhost_waitlist *w = waiter;
+	struct nvhost_intr_syncpt *syncpt;
+	void __iomem *sync_regs;
+	int queue_was_empty;
+
+	/* initialize the waiter */
+	INIT_LIST_HEAD(&w->list);
+	kref_init(&w->refcount);
+	if (ref)
+		kref_get(&w->refcount);
+	w->thresh = thresh;
+	w->action = action;
+	atomic_set(&w->state, WLS_PENDING);
+	w->data = data;
+	w->count = 1;
+
+	syncpt = intr->syncpt + id;
+	sync_regs = intr_to_dev(intr)->sync_aperture;
+
+	spin_lock(&syncpt->lock);
+
+	syncpt->wait_reserved--;
+	queue_was_empty = !syncpt->wait_len;
 
-	if (add_waiter_to_queue(waiter, &syncpt->wait_head)) {
+	if (add_waiter_to_queue(w, syncpt)) {
 		/* added at head of list - new threshold value */
 		set_syncpt_threshold(sync_regs, id, thresh);
 
@@ -360,7 +482,20 @@ int nvhost_intr_add_action(struct nvhost_intr *intr, u32 id, u32 thresh,
 	spin_unlock(&syncpt->lock);
 
 	if (ref)
-		*ref = waiter;
+		*ref = w;
+}
+
+int nvhost_intr_add_action(struct nvhost_intr *intr, u32 id, u32 thresh,
+			enum nvhost_intr_action action, void *data,
+			void **ref)
+{
+	void *waiter;
+	int err;
+
+	err = nvhost_intr_alloc_waiter(intr, id, &waiter);
+	if (err)
+		return err;
+	nvhost_intr_add_waiter(intr, id, thresh, action, data, waiter, ref);
 	return 0;
 }
 
@@ -397,7 +532,12 @@ int nvhost_intr_init(struct nvhost_intr *intr, u32 irq_gen, u32 irq_sync)
 		syncpt->irq = irq_sync + id;
 		syncpt->irq_requested = 0;
 		spin_lock_init(&syncpt->lock);
-		INIT_LIST_HEAD(&syncpt->wait_head);
+		syncpt->wait_heap = NULL;
+		syncpt->wait_len = 0;
+		syncpt->wait_size = 0;
+		syncpt->wait_reserved = 0;
+		syncpt->wait_seq = 0;
+		memset(&syncpt->stat, 0, sizeof(syncpt->stat));
 		snprintf(syncpt->thresh_irq_name,
 			 sizeof(syncpt->thresh_irq_name),
 			 "%s", nvhost_syncpt_name(id));
@@ -418,20 +558,28 @@ void nvhost_intr_deinit(struct nvhost_intr *intr)
 	for (id = 0, syncpt = intr->syncpt;
 	     id < NV_HOST1X_SYNCPT_NB_PTS;
 	     ++id, ++syncpt) {
-		struct nvhost_waitlist *waiter, *next;
-		list_for_each_entry_safe(waiter, next, &syncpt->wait_head, list) {
+		unsigned int i, remaining = 0;
+
+		for (i = 0; i < syncpt->wait_len; i++) {
+			struct nvhost_waitlist *waiter = syncpt->wait_heap[i];
 			if (atomic_cmpxchg(&waiter->state, WLS_CANCELLED, WLS_HANDLED)
-				== WLS_CANCELLED) {
-				list_del(&waiter->list);
+				== WLS_CANCELLED)
 				kref_put(&waiter->refcount, waiter_release);
-			}
+			else
+				remaining++;
 		}
 
-		if(!list_empty(&syncpt->wait_head)) {  // output diagnostics
+		if (remaining) {  // output diagnostics
 			printk("%s id=%d\n",__func__,id);
 			BUG_ON(1);
 		}
 
+		kfree(syncpt->wait_heap);
+		syncpt->wait_heap = NULL;
+		syncpt->wait_len = 0;
+		syncpt->wait_size = 0;
+		syncpt->wait_reserved = 0;
+
 		if (syncpt->irq_requested)
 			free_irq(syncpt->irq, syncpt);
 	}
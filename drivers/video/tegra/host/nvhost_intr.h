@@ -25,10 +25,12 @@
 
 #include <linux/kthread.h>
 #include <linux/semaphore.h>
+#include <linux/ktime.h>
 
 #include "nvhost_hardware.h"
 
 struct nvhost_channel;
+struct nvhost_waitlist;
 
 enum nvhost_intr_action {
 	/**
@@ -58,12 +60,32 @@ enum nvhost_intr_action {
 	NVHOST_INTR_ACTION_COUNT
 };
 
+/* counters are only written by the syncpt's irq thread, except max_depth
+ * which is updated under the syncpt lock */
+struct nvhost_intr_stat {
+	unsigned int max_depth;
+	unsigned long completed;
+	unsigned long irqs;
+	u64 total_us;
+	u32 max_us;
+};
+
 struct nvhost_intr_syncpt {
 	u8 id;
 	u8 irq_requested;
 	u16 irq;
 	spinlock_t lock;
-	struct list_head wait_head;
+	/* min-heap of waiters, ordered by threshold (with wraparound)
+	 * and then by order of submission */
+	struct nvhost_waitlist **wait_heap;
+	unsigned int wait_len;
+	unsigned int wait_size;
+	/* waiters allocated with nvhost_intr_alloc_waiter(), which there
+	 * is room for in the heap */
+	unsigned int wait_reserved;
+	u32 wait_seq;
+	ktime_t isr_stamp;
+	struct nvhost_intr_stat stat;
 	char thresh_irq_name[12];
 };
 
@@ -88,6 +110,27 @@ int nvhost_intr_add_action(struct nvhost_intr *intr, u32 id, u32 thresh,
 			enum nvhost_intr_action action, void *data,
 			void **ref);
 
+/**
+ * Allocate a waiter for sync point id ahead of scheduling an action, for
+ * callers which can't handle nvhost_intr_add_action() failing: once the
+ * waiter is allocated, nvhost_intr_add_waiter() can't fail.
+ * @waiter is set to the waiter on success
+ */
+int nvhost_intr_alloc_waiter(struct nvhost_intr *intr, u32 id, void **waiter);
+
+/**
+ * Free a waiter from nvhost_intr_alloc_waiter() which wasn't used.
+ */
+void nvhost_intr_free_waiter(struct nvhost_intr *intr, u32 id, void *waiter);
+
+/**
+ * As nvhost_intr_add_action(), with a waiter from
+ * nvhost_intr_alloc_waiter() for the same sync point.
+ */
+void nvhost_intr_add_waiter(struct nvhost_intr *intr, u32 id, u32 thresh,
+			enum nvhost_intr_action action, void *data,
+			void *waiter, void **ref);
+
 /**
  * Unreference an action submitted to nvhost_intr_add_action().
  * You must call this if you passed non-NULL as ref.
@@ -0,0 +1,306 @@
+/*
+ * drivers/video/tegra/host/nvhost_scale.c
+ *
+ * Tegra Graphics Host Module Clock Scaling
+ *
+ * Copyright (c) 2010, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "nvhost_scale.h"
+#include "dev.h"
+
+#include <linux/clk.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/sysfs.h>
+
+/*
+ * While a scaled module is powered, its utilization is sampled every
+ * SCALE_PERIOD, ondemand style: above up_threshold percent busy, or with
+ * at least SCALE_QUEUE_BUSY jobs queued up in its channel, the clocks go
+ * to the maximum rate; below (up_threshold - down_differential) they are
+ * lowered to the rate at which the module would have been about
+ * (up_threshold - down_differential / 2) percent busy.  The rates are
+ * set through clk_set_rate(), so the core voltage follows the dvfs
+ * tables.
+ */
+#define SCALE_PERIOD (50*HZ/1000)
+#define SCALE_QUEUE_BUSY 4
+#define SCALE_UP_THRESHOLD 90
+#define SCALE_DOWN_DIFFERENTIAL 20
+/* the core voltage tables bottom out at about a quarter of the maximum
+ * rate of each module, so there is nothing to gain from going lower */
+#define SCALE_MIN_DIVISOR 4
+
+static const struct {
+	const char *name;
+	unsigned long clk_mask;
+} scaled_modules[] = {
+	/* gr2d and epp share a dvfs table; the emc clock is shared with
+	 * the rest of the system and is left alone */
+	{ "gr2d", (1 << 0) | (1 << 1) },
+	{ "gr3d", (1 << 0) },
+	{ "mpe",  (1 << 0) },
+};
+
+static unsigned long scale_rate(struct nvhost_module *mod,
+				unsigned long *max_rate)
+{
+	int i = __ffs(mod->scale->clk_mask);
+
+	*max_rate = clk_round_rate(mod->clk[i], UINT_MAX);
+	return clk_get_rate(mod->clk[i]);
+}
+
+static void set_rate(struct nvhost_scale *scale, unsigned long rate)
+{
+	struct nvhost_module *mod = &scale->ch->mod;
+	int i;
+
+	for (i = 0; i < mod->num_clks; i++) {
+		long r;
+
+		if (!(scale->clk_mask & (1 << i)))
+			continue;
+		r = clk_round_rate(mod->clk[i], rate);
+		if (r > 0 && r != clk_get_rate(mod->clk[i]))
+			clk_set_rate(mod->clk[i], r);
+	}
+}
+
+static void add_trace(struct nvhost_scale *scale, ktime_t now,
+		      unsigned int util, unsigned int queued,
+		      unsigned long old_rate, unsigned long new_rate)
+{
+	struct nvhost_scale_record *rec;
+	unsigned long flags;
+
+	spin_lock_irqsave(&scale->trace_lock, flags);
+	rec = &scale->trace[scale->trace_count % NVHOST_SCALE_TRACE_SIZE];
+	rec->stamp_us = ktime_to_us(now);
+	rec->util = util;
+	rec->queued = queued;
+	rec->old_khz = old_rate / 1000;
+	rec->new_khz = new_rate / 1000;
+	scale->trace_count++;
+	spin_unlock_irqrestore(&scale->trace_lock, flags);
+}
+
+static void scale_worker(struct work_struct *work)
+{
+	struct nvhost_scale *scale = container_of(to_delayed_work(work),
+						  struct nvhost_scale, work);
+	struct nvhost_channel *ch = scale->ch;
+	struct nvhost_module *mod = &ch->mod;
+	unsigned long rate, max_rate, min_rate, target;
+	unsigned int util, queued;
+	ktime_t now = ktime_get();
+	u64 busy_us = nvhost_module_busy_time(mod);
+	s64 elapsed;
+
+	elapsed = ktime_us_delta(now, scale->last_sample);
+	util = 0;
+	if (elapsed > 0)
+		util = min_t(u64, 100, div64_u64(100 * (busy_us -
+					scale->last_busy_us), elapsed));
+	scale->last_sample = now;
+	scale->last_busy_us = busy_us;
+	queued = nvhost_cdma_queue_depth(&ch->cdma);
+
+	rate = scale_rate(mod, &max_rate);
+	min_rate = max_rate / SCALE_MIN_DIVISOR;
+
+	if (!scale->enabled || util >= scale->up_threshold ||
+	    queued >= SCALE_QUEUE_BUSY) {
+		target = max_rate;
+	} else if (util < scale->up_threshold - scale->down_differential) {
+		target = div_u64((u64)rate * util, scale->up_threshold -
+				 scale->down_differential / 2);
+		target = clamp(target, min_rate, max_rate);
+	} else {
+		target = rate;
+	}
+
+	if (target != rate) {
+		set_rate(scale, target);
+		add_trace(scale, now, util, queued, rate,
+			  scale_rate(mod, &max_rate));
+	}
+
+	if (mod->powered)
+		schedule_delayed_work(&scale->work, SCALE_PERIOD);
+}
+
+/* called by nvhost_acm when the module is powered up */
+void nvhost_scale_start(struct nvhost_scale *scale)
+{
+	scale->last_sample = ktime_get();
+	scale->last_busy_us = nvhost_module_busy_time(&scale->ch->mod);
+	schedule_delayed_work(&scale->work, SCALE_PERIOD);
+}
+
+/* called by nvhost_acm when the module is clock-gated (!sync) or
+ * deinitialized (sync) */
+void nvhost_scale_stop(struct nvhost_scale *scale, bool sync)
+{
+	if (sync)
+		cancel_delayed_work_sync(&scale->work);
+	else
+		cancel_delayed_work(&scale->work);
+}
+
+#define to_scale(k) \
+	(&container_of(container_of(k, struct nvhost_module, kobj), \
+		       struct nvhost_channel, mod)->scale)
+
+static ssize_t enable_show(struct kobject *kobj,
+			   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", to_scale(kobj)->enabled);
+}
+
+static ssize_t enable_store(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	unsigned long val;
+
+	if (strict_strtoul(buf, 10, &val))
+		return -EINVAL;
+	to_scale(kobj)->enabled = !!val;
+	return count;
+}
+
+static ssize_t up_threshold_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", to_scale(kobj)->up_threshold);
+}
+
+static ssize_t up_threshold_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct nvhost_scale *scale = to_scale(kobj);
+	unsigned long val;
+
+	if (strict_strtoul(buf, 10, &val))
+		return -EINVAL;
+	if (val > 100 || val <= scale->down_differential)
+		return -EINVAL;
+	scale->up_threshold = val;
+	return count;
+}
+
+static ssize_t down_differential_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", to_scale(kobj)->down_differential);
+}
+
+static ssize_t down_differential_store(struct kobject *kobj,
+				       struct kobj_attribute *attr,
+				       const char *buf, size_t count)
+{
+	struct nvhost_scale *scale = to_scale(kobj);
+	unsigned long val;
+
+	if (strict_strtoul(buf, 10, &val))
+		return -EINVAL;
+	if (val >= scale->up_threshold)
+		return -EINVAL;
+	scale->down_differential = val;
+	return count;
+}
+
+/* one line per rate change: time (us), busy %, queued jobs, old and new
+ * rate (kHz) */
+static ssize_t trace_show(struct kobject *kobj,
+			  struct kobj_attribute *attr, char *buf)
+{
+	struct nvhost_scale *scale = to_scale(kobj);
+	unsigned long flags;
+	unsigned int i, first;
+	ssize_t len = 0;
+
+	spin_lock_irqsave(&scale->trace_lock, flags);
+	first = 0;
+	if (scale->trace_count > NVHOST_SCALE_TRACE_SIZE)
+		first = scale->trace_count - NVHOST_SCALE_TRACE_SIZE;
+	for (i = first; i < scale->trace_count; i++) {
+		struct nvhost_scale_record *rec =
+			&scale->trace[i % NVHOST_SCALE_TRACE_SIZE];
+
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%lld %u%% %u %lu -> %lu\n",
+				 rec->stamp_us, rec->util, rec->queued,
+				 rec->old_khz, rec->new_khz);
+	}
+	spin_unlock_irqrestore(&scale->trace_lock, flags);
+
+	return len;
+}
+
+static struct kobj_attribute enable_attr =
+	__ATTR(enable, S_IRUGO | S_IWUSR, enable_show, enable_store);
+static struct kobj_attribute up_threshold_attr =
+	__ATTR(up_threshold, S_IRUGO | S_IWUSR,
+	       up_threshold_show, up_threshold_store);
+static struct kobj_attribute down_differential_attr =
+	__ATTR(down_differential, S_IRUGO | S_IWUSR,
+	       down_differential_show, down_differential_store);
+static struct kobj_attribute trace_attr = __ATTR_RO(trace);
+
+static struct attribute *scale_attrs[] = {
+	&enable_attr.attr,
+	&up_threshold_attr.attr,
+	&down_differential_attr.attr,
+	&trace_attr.attr,
+	NULL
+};
+
+static struct attribute_group scale_attr_group = {
+	.name = "scale",
+	.attrs = scale_attrs,
+};
+
+/*
+ * Sets up clock scaling for the module of channel ch, if it is one of the
+ * scaled modules; its tunables and trace are exported in the "scale"
+ * directory of the module's statistics (see nvhost_module_add_stats()).
+ */
+int nvhost_scale_init(struct nvhost_scale *scale, struct nvhost_channel *ch)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(scaled_modules); i++)
+		if (!strcmp(scaled_modules[i].name, ch->desc->name))
+			break;
+	if (i == ARRAY_SIZE(scaled_modules))
+		return 0;
+
+	scale->ch = ch;
+	scale->clk_mask = scaled_modules[i].clk_mask;
+	scale->enabled = true;
+	scale->up_threshold = SCALE_UP_THRESHOLD;
+	scale->down_differential = SCALE_DOWN_DIFFERENTIAL;
+	INIT_DELAYED_WORK(&scale->work, scale_worker);
+	spin_lock_init(&scale->trace_lock);
+	ch->mod.scale = scale;
+
+	return sysfs_create_group(&ch->mod.kobj, &scale_attr_group);
+}
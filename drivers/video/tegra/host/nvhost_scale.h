@@ -0,0 +1,62 @@
+/*
+ * drivers/video/tegra/host/nvhost_scale.h
+ *
+ * Tegra Graphics Host Module Clock Scaling
+ *
+ * Copyright (c) 2010, NVIDIA Corporation.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __NVHOST_SCALE_H
+#define __NVHOST_SCALE_H
+
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
+struct nvhost_channel;
+
+#define NVHOST_SCALE_TRACE_SIZE 32
+
+struct nvhost_scale_record {
+	s64 stamp_us;
+	unsigned int util;
+	unsigned int queued;
+	unsigned long old_khz;
+	unsigned long new_khz;
+};
+
+struct nvhost_scale {
+	struct nvhost_channel *ch;
+	unsigned long clk_mask;		/* module clocks which are scaled */
+	bool enabled;
+	unsigned int up_threshold;	/* % busy to go to full clock */
+	unsigned int down_differential;	/* % below that before slowing */
+	struct delayed_work work;
+	ktime_t last_sample;
+	u64 last_busy_us;
+
+	/* the last NVHOST_SCALE_TRACE_SIZE rate changes, oldest first */
+	spinlock_t trace_lock;
+	struct nvhost_scale_record trace[NVHOST_SCALE_TRACE_SIZE];
+	unsigned int trace_count;
+};
+
+int nvhost_scale_init(struct nvhost_scale *scale, struct nvhost_channel *ch);
+void nvhost_scale_start(struct nvhost_scale *scale);
+void nvhost_scale_stop(struct nvhost_scale *scale, bool sync);
+
+#endif
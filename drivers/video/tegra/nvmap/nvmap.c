@@ -43,20 +43,13 @@
 /* map the backing pages for a heap_pgalloc handle into its IOVMM area */
 static void map_iovmm_area(struct nvmap_handle *h)
 {
-	tegra_iovmm_addr_t va;
-	unsigned long i;
-
 	BUG_ON(!h->heap_pgalloc || !h->pgalloc.area);
 	BUG_ON(h->size & ~PAGE_MASK);
 	WARN_ON(!h->pgalloc.dirty);
 
-	for (va = h->pgalloc.area->iovm_start, i = 0;
-	     va < (h->pgalloc.area->iovm_start + h->size);
-	     i++, va += PAGE_SIZE) {
-		BUG_ON(!pfn_valid(page_to_pfn(h->pgalloc.pages[i])));
-		tegra_iovmm_vm_insert_pfn(h->pgalloc.area, va,
-					  page_to_pfn(h->pgalloc.pages[i]));
-	}
+	tegra_iovmm_vm_insert_pages(h->pgalloc.area,
+				    h->pgalloc.area->iovm_start,
+				    h->pgalloc.pages, h->size >> PAGE_SHIFT);
 	h->pgalloc.dirty = false;
 }
 
@@ -50,6 +50,7 @@
 
 #define nvmap_ref_to_id(_ref)		((unsigned long)(_ref)->handle)
 
+struct dentry;
 struct nvmap_device;
 struct page;
 struct tegra_iovmm_area;
@@ -59,7 +60,8 @@ struct tegra_iovmm_area;
 struct nvmap_pgalloc {
 	struct page **pages;
 	struct tegra_iovmm_area *area;
-	struct list_head mru_list;	/* MRU entry for IOVMM reclamation */
+	struct list_head mru_list;	/* LRU entry for IOVMM reclamation */
+	struct nvmap_client *mru_owner;	/* client charged for the LRU entry */
 	bool contig;			/* contiguous system memory */
 	bool dirty;			/* area is invalid and needs mapping */
 };
@@ -81,6 +83,7 @@ struct nvmap_handle {
 	bool secure;		/* zap IOVMM area on unpin */
 	bool heap_pgalloc;	/* handle is page allocated (sysmem / iovmm) */
 	bool alloc;		/* handle has memory allocated */
+	bool sticky;		/* evict IOVMM mapping only as a last resort */
 	struct mutex lock;
 };
 
@@ -92,6 +95,11 @@ struct nvmap_share {
 	spinlock_t mru_lock;
 	struct list_head *mru_lists;
 	int nr_mru;
+	size_t vm_size;
+	unsigned long mru_hits;		/* re-pins of still-mapped handles */
+	unsigned long mru_misses;	/* pins which needed a new area */
+	unsigned long mru_steals;	/* areas re-used from unpinned handles */
+	unsigned long mru_evicts;	/* areas freed from unpinned handles */
 #endif
 };
 
@@ -107,6 +115,7 @@ struct nvmap_client {
 	struct rb_root			handle_refs;
 	atomic_t			iovm_commit;
 	size_t				iovm_limit;
+	size_t				iovm_cached;	/* under mru_lock */
 	spinlock_t			ref_lock;
 	bool				super;
 	atomic_t			count;
@@ -210,4 +219,16 @@ static inline pgprot_t nvmap_pgprot(struct nvmap_handle *h, pgprot_t prot)
 
 int is_nvmap_vma(struct vm_area_struct *vma);
 
+#ifdef CONFIG_NVMAP_PAGE_POOLS
+int nvmap_page_pool_init(void);
+
+void nvmap_page_pool_deinit(void);
+
+void nvmap_page_pool_debugfs_init(struct dentry *root);
+#else
+#define nvmap_page_pool_init()			0
+#define nvmap_page_pool_deinit()		do { } while (0)
+#define nvmap_page_pool_debugfs_init(_root)	do { } while (0)
+#endif
+
 #endif
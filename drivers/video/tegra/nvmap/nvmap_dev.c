@@ -651,8 +651,10 @@ static void destroy_client(struct nvmap_client *client)
 		pins = atomic_read(&ref->pin);
 
 		mutex_lock(&ref->handle->lock);
-		if (ref->handle->owner == client)
-		    ref->handle->owner = NULL;
+		if (ref->handle->owner == client) {
+			nvmap_mru_disown(client->share, ref->handle);
+			ref->handle->owner = NULL;
+		}
 		mutex_unlock(&ref->handle->lock);
 
 		while (pins--)
@@ -1133,6 +1135,10 @@ static int nvmap_probe(struct platform_device *pdev)
 	nvmap_debug_root = debugfs_create_dir("nvmap", NULL);
 	if (IS_ERR_OR_NULL(nvmap_debug_root))
 		dev_err(&pdev->dev, "couldn't create debug files\n");
+	else {
+		nvmap_page_pool_debugfs_init(nvmap_debug_root);
+		nvmap_mru_debugfs_init(&dev->iovmm_master, nvmap_debug_root);
+	}
 
 	for (i = 0; i < plat->nr_carveouts; i++) {
 		struct nvmap_carveout_node *node = &dev->heaps[i];
@@ -1260,8 +1266,15 @@ static int __init nvmap_init_driver(void)
 	if (e)
 		goto fail;
 
+	e = nvmap_page_pool_init();
+	if (e) {
+		nvmap_heap_deinit();
+		goto fail;
+	}
+
 	e = platform_driver_register(&nvmap_driver);
 	if (e) {
+		nvmap_page_pool_deinit();
 		nvmap_heap_deinit();
 		goto fail;
 	}
@@ -1274,6 +1287,7 @@ fs_initcall(nvmap_init_driver);
 static void __exit nvmap_exit_driver(void)
 {
 	platform_driver_unregister(&nvmap_driver);
+	nvmap_page_pool_deinit();
 	nvmap_heap_deinit();
 	nvmap_dev = NULL;
 }
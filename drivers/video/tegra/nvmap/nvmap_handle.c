@@ -20,12 +20,16 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <linux/debugfs.h>
 #include <linux/err.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
 #include <linux/mm.h>
+#include <linux/moduleparam.h>
 #include <linux/rbtree.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/vmalloc.h>
 
 #include <asm/cacheflush.h>
@@ -69,6 +73,204 @@ static inline void altfree(void *ptr, size_t len)
 		kfree(ptr);
 }
 
+extern void __flush_dcache_page(struct address_space *, struct page *);
+
+#ifdef CONFIG_NVMAP_PAGE_POOLS
+/* pages which are only ever accessed through uncached or write-combined
+ * mappings never have dirty lines in the CPU caches, so when a handle with
+ * one of those attributes is freed its pages are kept in a pool for that
+ * attribute and handed out again without the cost of another cache flush.
+ * the pools are drained back to the page allocator by a shrinker when the
+ * system is under memory pressure. */
+enum {
+	NVMAP_POOL_UC,
+	NVMAP_POOL_WC,
+	NVMAP_NUM_POOLS,
+};
+
+struct nvmap_page_pool {
+	spinlock_t lock;
+	struct list_head pages;		/* linked through page->lru */
+	unsigned int count;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long fills;
+	unsigned long shrinks;
+	const char *name;
+};
+
+static struct nvmap_page_pool nvmap_page_pools[NVMAP_NUM_POOLS] = {
+	[NVMAP_POOL_UC] = { .name = "uc" },
+	[NVMAP_POOL_WC] = { .name = "wc" },
+};
+
+/* maximum number of pages kept in each pool */
+static unsigned int page_pool_size = (16 * 1024 * 1024) >> PAGE_SHIFT;
+module_param(page_pool_size, uint, 0644);
+
+static struct nvmap_page_pool *page_pool_of(struct nvmap_handle *h)
+{
+	if (h->flags == NVMAP_HANDLE_UNCACHEABLE)
+		return &nvmap_page_pools[NVMAP_POOL_UC];
+	else if (h->flags == NVMAP_HANDLE_WRITE_COMBINE)
+		return &nvmap_page_pools[NVMAP_POOL_WC];
+	return NULL;
+}
+
+static struct page *nvmap_page_pool_get(struct nvmap_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	spin_lock(&pool->lock);
+	if (!list_empty(&pool->pages)) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+		pool->hits++;
+	} else {
+		pool->misses++;
+	}
+	spin_unlock(&pool->lock);
+
+	return page;
+}
+
+static bool nvmap_page_pool_put(struct nvmap_page_pool *pool,
+				struct page *page)
+{
+	bool ret = false;
+
+	spin_lock(&pool->lock);
+	if (pool->count < page_pool_size) {
+		list_add(&page->lru, &pool->pages);
+		pool->count++;
+		pool->fills++;
+		ret = true;
+	}
+	spin_unlock(&pool->lock);
+
+	return ret;
+}
+
+static int nvmap_page_pool_shrink(struct shrinker *shrinker,
+				  int nr_to_scan, gfp_t gfp_mask)
+{
+	LIST_HEAD(freelist);
+	struct page *page, *tmp;
+	int total = 0;
+	int i;
+
+	for (i = 0; i < NVMAP_NUM_POOLS; i++) {
+		struct nvmap_page_pool *pool = &nvmap_page_pools[i];
+
+		spin_lock(&pool->lock);
+		while (nr_to_scan > 0 && !list_empty(&pool->pages)) {
+			page = list_first_entry(&pool->pages, struct page, lru);
+			list_move(&page->lru, &freelist);
+			pool->count--;
+			pool->shrinks++;
+			nr_to_scan--;
+		}
+		total += pool->count;
+		spin_unlock(&pool->lock);
+	}
+
+	list_for_each_entry_safe(page, tmp, &freelist, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+
+	return total;
+}
+
+static struct shrinker nvmap_page_pool_shrinker = {
+	.shrink = nvmap_page_pool_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int nvmap_page_pool_debug_show(struct seq_file *s, void *unused)
+{
+	int i;
+
+	seq_printf(s, "%4s %8s %10s %10s %10s %10s\n", "pool", "pages",
+		   "hits", "misses", "fills", "shrinks");
+	for (i = 0; i < NVMAP_NUM_POOLS; i++) {
+		struct nvmap_page_pool *pool = &nvmap_page_pools[i];
+
+		spin_lock(&pool->lock);
+		seq_printf(s, "%4s %8u %10lu %10lu %10lu %10lu\n", pool->name,
+			   pool->count, pool->hits, pool->misses, pool->fills,
+			   pool->shrinks);
+		spin_unlock(&pool->lock);
+	}
+	return 0;
+}
+
+static int nvmap_page_pool_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nvmap_page_pool_debug_show, inode->i_private);
+}
+
+static const struct file_operations debug_page_pool_fops = {
+	.open = nvmap_page_pool_debug_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void nvmap_page_pool_debugfs_init(struct dentry *root)
+{
+	debugfs_create_file("pagepool", 0444, root, NULL,
+			    &debug_page_pool_fops);
+}
+
+int nvmap_page_pool_init(void)
+{
+	int i;
+
+	for (i = 0; i < NVMAP_NUM_POOLS; i++) {
+		spin_lock_init(&nvmap_page_pools[i].lock);
+		INIT_LIST_HEAD(&nvmap_page_pools[i].pages);
+	}
+	register_shrinker(&nvmap_page_pool_shrinker);
+	return 0;
+}
+
+void nvmap_page_pool_deinit(void)
+{
+	unregister_shrinker(&nvmap_page_pool_shrinker);
+	nvmap_page_pool_shrink(NULL, INT_MAX, GFP_KERNEL);
+}
+#else
+#define page_pool_of(_h)		NULL
+#define nvmap_page_pool_get(_pool)	NULL
+#define nvmap_page_pool_put(_pool, _page)	false
+#endif
+
+static struct page *nvmap_alloc_pages_exact(gfp_t gfp, size_t size);
+
+/* allocates a single page for handle h, preferring a recycled page which
+ * has already been flushed from the CPU caches */
+static struct page *nvmap_alloc_page(struct nvmap_handle *h)
+{
+	struct nvmap_page_pool *pool = page_pool_of(h);
+	struct page *page = NULL;
+
+	if (pool)
+		page = nvmap_page_pool_get(pool);
+	if (!page)
+		page = nvmap_alloc_pages_exact(GFP_NVMAP, PAGE_SIZE);
+	return page;
+}
+
+static void nvmap_free_page(struct nvmap_handle *h, struct page *page)
+{
+	struct nvmap_page_pool *pool = page_pool_of(h);
+
+	if (!pool || !nvmap_page_pool_put(pool, page))
+		__free_page(page);
+}
+
 void _nvmap_handle_free(struct nvmap_handle *h)
 {
 	struct nvmap_device *dev = h->dev;
@@ -96,7 +298,7 @@ void _nvmap_handle_free(struct nvmap_handle *h)
 		tegra_iovmm_free_vm(h->pgalloc.area);
 
 	for (i = 0; i < nr_page; i++)
-		__free_page(h->pgalloc.pages[i]);
+		nvmap_free_page(h, h->pgalloc.pages[i]);
 
 	altfree(h->pgalloc.pages, nr_page * sizeof(struct page *));
 
@@ -104,8 +306,6 @@ out:
 	kfree(h);
 }
 
-extern void __flush_dcache_page(struct address_space *, struct page *);
-
 static struct page *nvmap_alloc_pages_exact(gfp_t gfp, size_t size)
 {
 	struct page *page, *p, *e;
@@ -157,7 +357,10 @@ static int handle_page_alloc(struct nvmap_client *client,
 	h->pgalloc.area = NULL;
 	if (contiguous) {
 		struct page *page;
-		page = nvmap_alloc_pages_exact(GFP_NVMAP, size);
+		if (nr_page == 1)
+			page = nvmap_alloc_page(h);
+		else
+			page = nvmap_alloc_pages_exact(GFP_NVMAP, size);
 		if (!page)
 			goto fail;
 
@@ -166,7 +369,7 @@ static int handle_page_alloc(struct nvmap_client *client,
 
 	} else {
 		for (i = 0; i < nr_page; i++) {
-			pages[i] = nvmap_alloc_pages_exact(GFP_NVMAP, PAGE_SIZE);
+			pages[i] = nvmap_alloc_page(h);
 			if (!pages[i])
 				goto fail;
 		}
@@ -190,7 +393,7 @@ static int handle_page_alloc(struct nvmap_client *client,
 
 fail:
 	while (i--)
-		__free_page(pages[i]);
+		nvmap_free_page(h, pages[i]);
 	altfree(pages, nr_page * sizeof(*pages));
 	return -ENOMEM;
 }
@@ -295,6 +498,7 @@ int nvmap_alloc_handle_id(struct nvmap_client *client,
 
 	nr_page = ((h->size + PAGE_SIZE - 1) >> PAGE_SHIFT);
 	h->secure = !!(flags & NVMAP_HANDLE_SECURE);
+	h->sticky = !!(flags & NVMAP_HANDLE_STICKY);
 	h->flags = (flags & NVMAP_HANDLE_CACHE_FLAG);
 
 	/* secure allocations can only be served from secure heaps */
@@ -379,8 +583,10 @@ void nvmap_free_handle_id(struct nvmap_client *client, unsigned long id)
 	while (pins--)
 		nvmap_unpin_handles(client, &ref->handle, 1);
 
-	if (h->owner == client)
+	if (h->owner == client) {
+		nvmap_mru_disown(client->share, h);
 		h->owner = NULL;
+	}
 
 	kfree(ref);
 
@@ -23,8 +23,10 @@
 #include <linux/device.h>
 #include <linux/kernel.h>
 #include <linux/list.h>
+#include <linux/math64.h>
 #include <linux/mm.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
 #include <linux/slab.h>
 
 #include <mach/nvmap.h>
@@ -63,10 +65,20 @@
  * and to ensure that the minimum free block size in the carveout (i.e., the
  * "small" threshold) is still a meaningful size.
  *
+ * free blocks are kept in segregated size classes ("bins"), each of which
+ * is an rbtree sorted by address. a first-fit (or last-fit) search only
+ * needs to look at the lowest (highest) fitting block of each bin which is
+ * large enough for the request, rather than walking every free block in
+ * the heap. the all_list of blocks is kept in address order, so a freed
+ * block can be coalesced with its physical neighbours in constant time.
+ *
  */
 
 #define MAX_BUDDY_NR	128	/* maximum buddies in a buddy allocator */
 
+#define NR_FREE_BINS	20	/* number of free block size classes */
+#define FREE_BIN_SHIFT	PAGE_SHIFT	/* bin 0 holds blocks < 1 << shift */
+
 enum direction {
 	TOP_DOWN,
 	BOTTOM_UP
@@ -81,6 +93,7 @@ struct heap_stat {
 	size_t free;		/* total free size */
 	size_t free_largest;	/* largest free block */
 	size_t free_count;	/* number of free blocks */
+	size_t free_smallest;	/* smallest free block */
 	size_t total;		/* total size */
 	size_t largest;		/* largest unique block */
 	size_t count;		/* total number of blocks */
@@ -100,7 +113,8 @@ struct list_block {
 	unsigned long orig_addr;
 	size_t size;
 	struct nvmap_heap *heap;
-	struct list_head free_list;
+	struct rb_node free_node;	/* empty if the block is allocated */
+	unsigned int bin;
 };
 
 struct combo_block {
@@ -123,8 +137,8 @@ struct buddy_heap {
 };
 
 struct nvmap_heap {
-	struct list_head all_list;
-	struct list_head free_list;
+	struct list_head all_list;	/* sorted by address */
+	struct rb_root free_bins[NR_FREE_BINS];
 	struct mutex lock;
 	struct list_head buddy_list;
 	unsigned int min_buddy_shift;
@@ -149,6 +163,63 @@ static inline unsigned int order_of(size_t len, size_t min_shift)
 	return fls(len)-1;
 }
 
+/* bin 0 holds blocks smaller than 1 << FREE_BIN_SHIFT; bin n holds
+ * blocks in [1 << (FREE_BIN_SHIFT + n - 1), 1 << (FREE_BIN_SHIFT + n)),
+ * with the last bin also holding everything larger. */
+static inline unsigned int bin_of(size_t len)
+{
+	return min_t(unsigned int, fls(len >> FREE_BIN_SHIFT),
+		     NR_FREE_BINS - 1);
+}
+
+static inline bool block_is_free(struct list_block *b)
+{
+	return !RB_EMPTY_NODE(&b->free_node);
+}
+
+/* adds b to the free bin for its size; must be called while holding the
+ * heap's lock. */
+static void free_insert(struct nvmap_heap *heap, struct list_block *b)
+{
+	struct rb_node **p;
+	struct rb_node *parent = NULL;
+
+	b->bin = bin_of(b->size);
+	p = &heap->free_bins[b->bin].rb_node;
+
+	while (*p) {
+		struct list_block *n;
+		parent = *p;
+		n = rb_entry(parent, struct list_block, free_node);
+		if (b->block.base < n->block.base)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&b->free_node, parent, p);
+	rb_insert_color(&b->free_node, &heap->free_bins[b->bin]);
+}
+
+static void free_remove(struct nvmap_heap *heap, struct list_block *b)
+{
+	BUG_ON(!block_is_free(b));
+	rb_erase(&b->free_node, &heap->free_bins[b->bin]);
+	RB_CLEAR_NODE(&b->free_node);
+}
+
+static struct list_block *list_block_alloc(void)
+{
+	struct list_block *b;
+
+	b = kmem_cache_zalloc(block_cache, GFP_KERNEL);
+	if (b) {
+		b->block.type = BLOCK_FIRST_FIT;
+		RB_CLEAR_NODE(&b->free_node);
+	}
+	return b;
+}
+
 /* returns the free size in bytes of the buddy heap; must be called while
  * holding the parent heap's lock. */
 static void buddy_stat(struct buddy_heap *heap, struct heap_stat *stat)
@@ -179,9 +250,12 @@ static unsigned long heap_stat(struct nvmap_heap *heap, struct heap_stat *stat)
 {
 	struct buddy_heap *bh;
 	struct list_block *l = NULL;
+	struct rb_node *n;
 	unsigned long base = -1ul;
+	unsigned int bin;
 
 	memset(stat, 0, sizeof(*stat));
+	stat->free_smallest = -1;
 	mutex_lock(&heap->lock);
 	list_for_each_entry(l, &heap->all_list, all_list) {
 		stat->total += l->size;
@@ -199,13 +273,20 @@ static unsigned long heap_stat(struct nvmap_heap *heap, struct heap_stat *stat)
 		stat->count--;
 	}
 
-	list_for_each_entry(l, &heap->free_list, free_list) {
-		stat->free += l->size;
-		stat->free_count++;
-		stat->free_largest = max(l->size, stat->free_largest);
+	for (bin = 0; bin < NR_FREE_BINS; bin++) {
+		for (n = rb_first(&heap->free_bins[bin]); n; n = rb_next(n)) {
+			l = rb_entry(n, struct list_block, free_node);
+			stat->free += l->size;
+			stat->free_count++;
+			stat->free_largest = max(l->size, stat->free_largest);
+			stat->free_smallest = min(l->size, stat->free_smallest);
+		}
 	}
 	mutex_unlock(&heap->lock);
 
+	if (!stat->free_count)
+		stat->free_smallest = 0;
+
 	return base;
 }
 
@@ -233,6 +314,12 @@ static struct device_attribute heap_stat_free_count =
 static struct device_attribute heap_stat_free_size =
 	__ATTR(free_size, S_IRUGO, heap_stat_show, NULL);
 
+static struct device_attribute heap_stat_free_min =
+	__ATTR(free_min, S_IRUGO, heap_stat_show, NULL);
+
+static struct device_attribute heap_stat_fragmentation =
+	__ATTR(fragmentation, S_IRUGO, heap_stat_show, NULL);
+
 static struct device_attribute heap_stat_base =
 	__ATTR(base, S_IRUGO, heap_stat_show, NULL);
 
@@ -246,6 +333,8 @@ static struct attribute *heap_stat_attrs[] = {
 	&heap_stat_free_max.attr,
 	&heap_stat_free_count.attr,
 	&heap_stat_free_size.attr,
+	&heap_stat_free_min.attr,
+	&heap_stat_fragmentation.attr,
 	&heap_stat_base.attr,
 	&heap_attr_name.attr,
 	NULL,
@@ -284,6 +373,17 @@ static ssize_t heap_stat_show(struct device *dev,
 		return sprintf(buf, "%u\n", stat.free_count);
 	else if (attr == &heap_stat_free_size)
 		return sprintf(buf, "%u\n", stat.free);
+	else if (attr == &heap_stat_free_min)
+		return sprintf(buf, "%u\n", stat.free_smallest);
+	else if (attr == &heap_stat_fragmentation) {
+		/* percentage of free memory outside of the largest free
+		 * block; 0 means all free space is one contiguous block */
+		unsigned int frag = 0;
+		if (stat.free)
+			frag = 100 - (unsigned int)div_u64(
+				(u64)stat.free_largest * 100, stat.free);
+		return sprintf(buf, "%u\n", frag);
+	}
 	else if (attr == &heap_stat_base)
 		return sprintf(buf, "%08lx\n", base);
 	else
@@ -371,12 +471,80 @@ static struct buddy_heap *do_buddy_free(struct nvmap_heap_block *block)
 	return NULL;
 }
 
+/* checks whether len bytes aligned to align can be carved out of the free
+ * block b, using the placement policy for dir; on success, the base
+ * address of the allocation is returned in fix_base. */
+static bool block_fits(struct list_block *b, size_t len, size_t align,
+		       enum direction dir, unsigned long *fix_base)
+{
+	unsigned long base;
+
+	if (b->size < len)
+		return false;
+
+	if (dir == BOTTOM_UP) {
+		base = ALIGN(b->block.base, align);
+		if (base - b->block.base > b->size - len)
+			return false;
+	} else {
+		base = b->block.base + b->size - len;
+		base &= ~(align-1);
+		if (base < b->block.base)
+			return false;
+	}
+
+	*fix_base = base;
+	return true;
+}
+
+/* finds the lowest (BOTTOM_UP) or highest (TOP_DOWN) addressed free block
+ * which can hold the allocation. only bins which may contain a large
+ * enough block are searched, and since each bin is sorted by address the
+ * search of a bin stops as soon as it can no longer improve on the best
+ * block found so far. */
+static struct list_block *free_find(struct nvmap_heap *heap, size_t len,
+				    size_t align, enum direction dir,
+				    unsigned long *fix_base)
+{
+	struct list_block *b = NULL;
+	unsigned int bin;
+
+	for (bin = bin_of(len); bin < NR_FREE_BINS; bin++) {
+		struct rb_node *n;
+
+		if (dir == BOTTOM_UP)
+			n = rb_first(&heap->free_bins[bin]);
+		else
+			n = rb_last(&heap->free_bins[bin]);
+
+		while (n) {
+			struct list_block *i;
+			unsigned long base;
+
+			i = rb_entry(n, struct list_block, free_node);
+			if (b && ((dir == BOTTOM_UP) ?
+				  i->block.base > b->block.base :
+				  i->block.base < b->block.base))
+				break;
+
+			if (block_fits(i, len, align, dir, &base)) {
+				b = i;
+				*fix_base = base;
+				break;
+			}
+
+			n = (dir == BOTTOM_UP) ? rb_next(n) : rb_prev(n);
+		}
+	}
+
+	return b;
+}
+
 static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 					      size_t len, size_t align,
 					      unsigned int mem_prot)
 {
 	struct list_block *b = NULL;
-	struct list_block *i = NULL;
 	struct list_block *rem = NULL;
 	unsigned long fix_base;
 	enum direction dir;
@@ -394,35 +562,14 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 
 	dir = (len <= heap->small_alloc) ? BOTTOM_UP : TOP_DOWN;
 
-	if (dir == BOTTOM_UP) {
-		list_for_each_entry(i, &heap->free_list, free_list) {
-			size_t fix_size;
-			fix_base = ALIGN(i->block.base, align);
-			fix_size = i->size - (fix_base - i->block.base);
-
-			if (fix_size >= len) {
-				b = i;
-				break;
-			}
-		}
-	} else {
-		list_for_each_entry_reverse(i, &heap->free_list, free_list) {
-			if (i->size >= len) {
-				fix_base = i->block.base + i->size - len;
-				fix_base &= ~(align-1);
-				if (fix_base >= i->block.base) {
-					b = i;
-					break;
-				}
-			}
-		}
-	}
-
+	b = free_find(heap, len, align, dir, &fix_base);
 	if (!b)
 		return NULL;
 
+	free_remove(heap, b);
+
 	if (b->block.base != fix_base) {
-		rem = kmem_cache_zalloc(block_cache, GFP_KERNEL);
+		rem = list_block_alloc();
 		if (!rem) {
 			b->orig_addr = b->block.base;
 			b->block.base = fix_base;
@@ -430,36 +577,33 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 			goto out;
 		}
 
-		rem->block.type = BLOCK_FIRST_FIT;
 		rem->block.base = b->block.base;
 		rem->orig_addr = rem->block.base;
 		rem->size = fix_base - rem->block.base;
 		b->block.base = fix_base;
 		b->orig_addr = fix_base;
 		b->size -= rem->size;
-		list_add_tail(&rem->all_list, &heap->all_list);
-		list_add_tail(&rem->free_list, &b->free_list);
+		list_add_tail(&rem->all_list, &b->all_list);
+		free_insert(heap, rem);
 	}
 
 	b->orig_addr = b->block.base;
 
 	if (b->size > len) {
-		rem = kmem_cache_zalloc(block_cache, GFP_KERNEL);
+		rem = list_block_alloc();
 		if (!rem)
 			goto out;
 
-		rem->block.type = BLOCK_FIRST_FIT;
 		rem->block.base = b->block.base + len;
 		rem->size = b->size - len;
 		BUG_ON(rem->size > b->size);
 		rem->orig_addr = rem->block.base;
 		b->size = len;
-		list_add_tail(&rem->all_list, &heap->all_list);
-		list_add(&rem->free_list, &b->free_list);
+		list_add(&rem->all_list, &b->all_list);
+		free_insert(heap, rem);
 	}
 
 out:
-	list_del(&b->free_list);
 	b->heap = heap;
 	b->mem_prot = mem_prot;
 	return &b->block;
@@ -472,12 +616,14 @@ static void freelist_debug(struct nvmap_heap *heap, const char *title,
 	int i;
 	struct list_block *n;
 
-	dev_debug(&heap->dev, "%s\n", title);
+	dev_dbg(&heap->dev, "%s\n", title);
 	i = 0;
-	list_for_each_entry(n, &heap->free_list, free_list) {
-		dev_debug(&heap->dev,"\t%d [%p..%p]%s\n", i, (void *)n->orig_addr,
-			  (void *)(n->orig_addr + n->size),
-			  (n == token) ? "<--" : "");
+	list_for_each_entry(n, &heap->all_list, all_list) {
+		if (!block_is_free(n) && n != token)
+			continue;
+		dev_dbg(&heap->dev, "\t%d [%p..%p] bin %u%s\n", i,
+			(void *)n->orig_addr, (void *)(n->orig_addr + n->size),
+			n->bin, (n == token) ? "<--" : "");
 		i++;
 	}
 }
@@ -495,40 +641,40 @@ static void do_heap_free(struct nvmap_heap_block *block)
 	b->size += (b->block.base - b->orig_addr);
 	b->block.base = b->orig_addr;
 
-	freelist_debug(heap, "free list before", b);
-
-	list_for_each_entry(n, &heap->free_list, free_list) {
-		if (n->block.base > b->block.base)
-			break;
-	}
-
-	list_add_tail(&b->free_list, &n->free_list);
 	BUG_ON(list_empty(&b->all_list));
+	BUG_ON(block_is_free(b));
 
-	freelist_debug(heap, "free list pre-merge", b);
+	freelist_debug(heap, "free list before", b);
 
-	if (!list_is_last(&b->free_list, &heap->free_list)) {
-		n = list_first_entry(&b->free_list, struct list_block, free_list);
-		if (n->block.base == b->block.base + b->size) {
+	/* the all_list is sorted by address, so the only blocks which can
+	 * be merged with b are its immediate neighbours in that list */
+	if (!list_is_last(&b->all_list, &heap->all_list)) {
+		n = list_entry(b->all_list.next, struct list_block, all_list);
+		if (block_is_free(n) &&
+		    n->block.base == b->block.base + b->size) {
+			free_remove(heap, n);
 			list_del(&n->all_list);
-			list_del(&n->free_list);
 			BUG_ON(b->orig_addr >= n->orig_addr);
 			b->size += n->size;
 			kmem_cache_free(block_cache, n);
 		}
 	}
 
-	if (b->free_list.prev != &heap->free_list) {
-		n = list_entry(b->free_list.prev, struct list_block, free_list);
-		if (n->block.base + n->size == b->block.base) {
+	if (b->all_list.prev != &heap->all_list) {
+		n = list_entry(b->all_list.prev, struct list_block, all_list);
+		if (block_is_free(n) &&
+		    n->block.base + n->size == b->block.base) {
+			free_remove(heap, n);
 			list_del(&b->all_list);
-			list_del(&b->free_list);
 			BUG_ON(n->orig_addr >= b->orig_addr);
 			n->size += b->size;
 			kmem_cache_free(block_cache, b);
+			b = n;
 		}
 	}
 
+	free_insert(heap, b);
+
 	freelist_debug(heap, "free list after", b);
 }
 
@@ -647,6 +793,7 @@ struct nvmap_heap *nvmap_heap_create(struct device *parent, const char *name,
 {
 	struct nvmap_heap *h = NULL;
 	struct list_block *l = NULL;
+	unsigned int i;
 
 	if (WARN_ON(buddy_size && buddy_size < NVMAP_HEAP_MIN_BUDDY_SIZE)) {
 		dev_warn(parent, "%s: buddy_size %u too small\n", __func__,
@@ -682,7 +829,7 @@ struct nvmap_heap *nvmap_heap_create(struct device *parent, const char *name,
 		goto fail_alloc;
 	}
 
-	l = kmem_cache_zalloc(block_cache, GFP_KERNEL);
+	l = list_block_alloc();
 	if (!l) {
 		dev_err(parent, "%s: out of memory\n", __func__);
 		goto fail_alloc;
@@ -707,16 +854,16 @@ struct nvmap_heap *nvmap_heap_create(struct device *parent, const char *name,
 	h->buddy_heap_size = buddy_size;
 	if (buddy_size)
 		h->min_buddy_shift = ilog2(buddy_size / MAX_BUDDY_NR);
-	INIT_LIST_HEAD(&h->free_list);
+	for (i = 0; i < NR_FREE_BINS; i++)
+		h->free_bins[i] = RB_ROOT;
 	INIT_LIST_HEAD(&h->buddy_list);
 	INIT_LIST_HEAD(&h->all_list);
 	mutex_init(&h->lock);
 	l->block.base = base;
-	l->block.type = BLOCK_FIRST_FIT;
 	l->size = len;
 	l->orig_addr = base;
-	list_add_tail(&l->free_list, &h->free_list);
 	list_add_tail(&l->all_list, &h->all_list);
+	free_insert(h, l);
 	return h;
 
 fail_register:
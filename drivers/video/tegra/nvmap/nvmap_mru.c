@@ -20,7 +20,10 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <linux/debugfs.h>
 #include <linux/list.h>
+#include <linux/moduleparam.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/mm_types.h>
 
@@ -32,20 +35,33 @@
 #include "nvmap_mru.h"
 
 /* if IOVMM reclamation is enabled (CONFIG_NVMAP_RECLAIM_UNPINNED_VM),
- * unpinned handles are placed onto a most-recently-used eviction list;
- * multiple lists are maintained, segmented by size (sizes were chosen to
- * roughly correspond with common sizes for graphics surfaces).
+ * unpinned handles keep their IOVMM area (and its GART mappings), and are
+ * placed onto a least-recently-used eviction list; multiple lists are
+ * maintained, segmented by size (sizes were chosen to roughly correspond
+ * with common sizes for graphics surfaces). re-pinning a handle which is
+ * still on an LRU list only needs to remove it from the list.
  *
- * if a handle is located on the MRU list, then the code below may
+ * if a handle is located on an LRU list, then the code below may
  * steal its IOVMM area at any time to satisfy a pin operation if no
- * free IOVMM space is available
+ * free IOVMM space is available. the least-recently unpinned handles
+ * are evicted first, and handles allocated with NVMAP_HANDLE_STICKY
+ * (e.g., surfaces which are pinned every frame) are kept on a separate
+ * set of lists which are only evicted once the regular lists are empty.
+ *
+ * each client may keep at most cache_quota percent of the IOVMM space
+ * mapped for unpinned handles; beyond that, its unpinned handles are
+ * queued to be the next evicted rather than the last.
  */
 
 static const size_t mru_cutoff[] = {
 	262144, 393216, 786432, 1048576, 1572864
 };
 
-static inline struct list_head *mru_list(struct nvmap_share *share, size_t size)
+static unsigned int cache_quota = 50;
+module_param(cache_quota, uint, 0644);
+
+static inline struct list_head *mru_list(struct nvmap_share *share,
+					 size_t size, bool sticky)
 {
 	unsigned int i;
 
@@ -54,9 +70,30 @@ static inline struct list_head *mru_list(struct nvmap_share *share, size_t size)
 		if (size <= mru_cutoff[i])
 			break;
 
+	if (sticky)
+		i += share->nr_mru;
+
 	return &share->mru_lists[i];
 }
 
+/* the least-recently used handle on an LRU list */
+static inline struct nvmap_handle *mru_lru_entry(struct list_head *mru)
+{
+	return list_entry(mru->prev, struct nvmap_handle, pgalloc.mru_list);
+}
+
+/* removes h from its LRU list and uncharges its owner; must be called
+ * with the mru lock held */
+static void mru_del_locked(struct nvmap_handle *h)
+{
+	list_del_init(&h->pgalloc.mru_list);
+	if (h->pgalloc.mru_owner) {
+		h->pgalloc.mru_owner->iovm_cached -=
+			h->pgalloc.area->iovm_length;
+		h->pgalloc.mru_owner = NULL;
+	}
+}
+
 size_t nvmap_mru_vm_size(struct tegra_iovmm_client *iovmm)
 {
 	size_t vm_size = tegra_iovmm_get_vm_size(iovmm);
@@ -67,29 +104,58 @@ size_t nvmap_mru_vm_size(struct tegra_iovmm_client *iovmm)
 void nvmap_mru_insert_locked(struct nvmap_share *share, struct nvmap_handle *h)
 {
 	size_t len = h->pgalloc.area->iovm_length;
-	list_add(&h->pgalloc.mru_list, mru_list(share, len));
+	struct list_head *mru = mru_list(share, len, h->sticky);
+	struct nvmap_client *owner = h->owner;
+	size_t quota = (share->vm_size / 100) * cache_quota;
+
+	if (owner && owner->iovm_cached + len > quota)
+		list_add_tail(&h->pgalloc.mru_list, mru);
+	else
+		list_add(&h->pgalloc.mru_list, mru);
+
+	if (owner) {
+		owner->iovm_cached += len;
+		h->pgalloc.mru_owner = owner;
+	}
 }
 
 void nvmap_mru_remove(struct nvmap_share *s, struct nvmap_handle *h)
 {
 	nvmap_mru_lock(s);
 	if (!list_empty(&h->pgalloc.mru_list))
-		list_del(&h->pgalloc.mru_list);
+		mru_del_locked(h);
 	nvmap_mru_unlock(s);
 	INIT_LIST_HEAD(&h->pgalloc.mru_list);
 }
 
+/* called when h's owner releases it, so that the owner is no longer
+ * charged for h's cached mapping */
+void nvmap_mru_disown(struct nvmap_share *s, struct nvmap_handle *h)
+{
+	if (!h->alloc || !h->heap_pgalloc)
+		return;
+
+	nvmap_mru_lock(s);
+	if (h->pgalloc.mru_owner) {
+		h->pgalloc.mru_owner->iovm_cached -=
+			h->pgalloc.area->iovm_length;
+		h->pgalloc.mru_owner = NULL;
+	}
+	nvmap_mru_unlock(s);
+}
+
 /* returns a tegra_iovmm_area for a handle. if the handle already has
- * an iovmm_area allocated, the handle is simply removed from its MRU list
+ * an iovmm_area allocated, the handle is simply removed from its LRU list
  * and the existing iovmm_area is returned.
  *
  * if no existing allocation exists, try to allocate a new IOVMM area.
  *
- * if a new area can not be allocated, try to re-use the most-recently-unpinned
- * handle's allocation.
+ * if a new area can not be allocated, try to re-use the least-recently-
+ * unpinned handle's allocation from the same size bin.
  *
- * and if that fails, iteratively evict handles from the MRU lists and free
- * their allocations, until the new allocation succeeds.
+ * and if that fails, iteratively evict handles from the LRU lists (sticky
+ * handles last) and free their allocations, until the new allocation
+ * succeeds.
  */
 struct tegra_iovmm_area *nvmap_handle_iovmm(struct nvmap_client *c,
 					    struct nvmap_handle *h)
@@ -97,7 +163,7 @@ struct tegra_iovmm_area *nvmap_handle_iovmm(struct nvmap_client *c,
 	struct list_head *mru;
 	struct nvmap_handle *evict = NULL;
 	struct tegra_iovmm_area *vm = NULL;
-	unsigned int i, idx;
+	unsigned int i, idx, start;
 	pgprot_t prot;
 
 	BUG_ON(!h || !c || !c->share);
@@ -110,52 +176,55 @@ struct tegra_iovmm_area *nvmap_handle_iovmm(struct nvmap_client *c,
 		 * where h->pgalloc.area is changed after the comparison */
 		nvmap_mru_lock(c->share);
 		BUG_ON(list_empty(&h->pgalloc.mru_list));
-		list_del(&h->pgalloc.mru_list);
-		INIT_LIST_HEAD(&h->pgalloc.mru_list);
+		mru_del_locked(h);
+		c->share->mru_hits++;
 		nvmap_mru_unlock(c->share);
 		return h->pgalloc.area;
 	}
 
 	vm = tegra_iovmm_create_vm(c->share->iovmm, NULL, h->size, prot);
 
+	nvmap_mru_lock(c->share);
+	c->share->mru_misses++;
+
 	if (vm) {
+		nvmap_mru_unlock(c->share);
 		INIT_LIST_HEAD(&h->pgalloc.mru_list);
 		return vm;
 	}
-	/* attempt to re-use the most recently unpinned IOVMM area in the
+	/* attempt to re-use the least recently unpinned IOVMM area in the
 	 * same size bin as the current handle. If that fails, iteratively
-	 * evict handles (starting from the current bin) until an allocation
-	 * succeeds or no more areas can be evicted */
+	 * evict handles (starting from the current bin, and leaving the
+	 * sticky bins for last) until an allocation succeeds or no more
+	 * areas can be evicted */
 
-	nvmap_mru_lock(c->share);
-	mru = mru_list(c->share, h->size);
+	mru = mru_list(c->share, h->size, false);
 	if (!list_empty(mru))
-		evict = list_first_entry(mru, struct nvmap_handle,
-					 pgalloc.mru_list);
+		evict = mru_lru_entry(mru);
 
 	if (evict && evict->pgalloc.area->iovm_length >= h->size) {
-		list_del(&evict->pgalloc.mru_list);
+		mru_del_locked(evict);
 		vm = evict->pgalloc.area;
 		evict->pgalloc.area = NULL;
-		INIT_LIST_HEAD(&evict->pgalloc.mru_list);
+		c->share->mru_steals++;
 		nvmap_mru_unlock(c->share);
 		return vm;
 	}
 
-	idx = mru - c->share->mru_lists;
+	start = mru - c->share->mru_lists;
 
-	for (i = 0; i < c->share->nr_mru && !vm; i++, idx++) {
-		if (idx >= c->share->nr_mru)
-			idx = 0;
+	for (i = 0; i < c->share->nr_mru * 2 && !vm; i++) {
+		idx = (start + i) % c->share->nr_mru;
+		if (i >= c->share->nr_mru)
+			idx += c->share->nr_mru;
 		mru = &c->share->mru_lists[idx];
 		while (!list_empty(mru) && !vm) {
-			evict = list_first_entry(mru, struct nvmap_handle,
-						 pgalloc.mru_list);
+			evict = mru_lru_entry(mru);
 
 			BUG_ON(atomic_read(&evict->pin) != 0);
 			BUG_ON(!evict->pgalloc.area);
-			list_del(&evict->pgalloc.mru_list);
-			INIT_LIST_HEAD(&evict->pgalloc.mru_list);
+			mru_del_locked(evict);
+			c->share->mru_evicts++;
 			nvmap_mru_unlock(c->share);
 			tegra_iovmm_free_vm(evict->pgalloc.area);
 			evict->pgalloc.area = NULL;
@@ -168,19 +237,63 @@ struct tegra_iovmm_area *nvmap_handle_iovmm(struct nvmap_client *c,
 	return vm;
 }
 
+static int nvmap_mru_debug_show(struct seq_file *s, void *unused)
+{
+	struct nvmap_share *share = s->private;
+	size_t cached = 0, sticky = 0;
+	struct nvmap_handle *h;
+	int i;
+
+	nvmap_mru_lock(share);
+	for (i = 0; i < share->nr_mru * 2; i++) {
+		list_for_each_entry(h, &share->mru_lists[i], pgalloc.mru_list) {
+			if (i < share->nr_mru)
+				cached += h->pgalloc.area->iovm_length;
+			else
+				sticky += h->pgalloc.area->iovm_length;
+		}
+	}
+	seq_printf(s, "cached: %u sticky: %u\n", cached, sticky);
+	seq_printf(s, "hits: %lu misses: %lu steals: %lu evicts: %lu\n",
+		   share->mru_hits, share->mru_misses, share->mru_steals,
+		   share->mru_evicts);
+	nvmap_mru_unlock(share);
+
+	return 0;
+}
+
+static int nvmap_mru_debug_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nvmap_mru_debug_show, inode->i_private);
+}
+
+static const struct file_operations debug_mru_fops = {
+	.open = nvmap_mru_debug_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+void nvmap_mru_debugfs_init(struct nvmap_share *share, struct dentry *root)
+{
+	debugfs_create_file("iovmm_cache", 0444, root, share, &debug_mru_fops);
+}
+
 int nvmap_mru_init(struct nvmap_share *share)
 {
 	int i;
 	spin_lock_init(&share->mru_lock);
 	share->nr_mru = ARRAY_SIZE(mru_cutoff) + 1;
+	share->vm_size = tegra_iovmm_get_vm_size(share->iovmm);
 
-	share->mru_lists = kzalloc(sizeof(struct list_head) * share->nr_mru,
+	/* regular lists followed by the sticky lists */
+	share->mru_lists = kzalloc(sizeof(struct list_head) * share->nr_mru * 2,
 				   GFP_KERNEL);
 
 	if (!share->mru_lists)
 		return -ENOMEM;
 
-	for (i = 0; i <= share->nr_mru; i++)
+	for (i = 0; i < share->nr_mru * 2; i++)
 		INIT_LIST_HEAD(&share->mru_lists[i]);
 
 	return 0;
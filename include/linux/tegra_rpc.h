@@ -21,6 +21,8 @@
 #ifndef __LINUX_TEGRA_RPC_H
 #define __LINUX_TEGRA_RPC_H
 
+#include <linux/types.h>
+
 #define TEGRA_RPC_MAX_MSG_LEN		256
 
 /* Note: the actual size of the name in the protocol message is 16 bytes,
@@ -34,14 +36,38 @@ struct tegra_rpc_port_desc {
 			* message has been received */
 };
 
+/* Messages for a port are queued in a receive ring, which can be mapped
+ * (offset 0, sizeof(struct tegra_rpc_ring)) from the tegra_rpc device to
+ * take them without a read() copy.  head is advanced by the kernel as
+ * messages are queued and tail by the reader as it consumes them; the
+ * free slots are the credits the sender has, and a sender which has run
+ * out waits for them.  A reader which advances tail itself has to issue
+ * TEGRA_RPC_IOCTL_PORT_RING_SYNC afterwards to let such a sender go on. */
+#define TEGRA_RPC_RING_SLOTS		16
+
+struct tegra_rpc_ring_slot {
+	__u32 len;
+	__u32 reserved;
+	__u8 payload[TEGRA_RPC_MAX_MSG_LEN];
+};
+
+struct tegra_rpc_ring {
+	__u32 head;
+	__u32 tail;
+	__u32 num_slots;
+	__u32 reserved[13];
+	struct tegra_rpc_ring_slot slots[TEGRA_RPC_RING_SLOTS];
+};
+
 #define TEGRA_RPC_IOCTL_MAGIC		'r'
 
 #define TEGRA_RPC_IOCTL_PORT_CREATE	_IOW(TEGRA_RPC_IOCTL_MAGIC, 0x20, struct tegra_rpc_port_desc)
 #define TEGRA_RPC_IOCTL_PORT_GET_NAME	_IOR(TEGRA_RPC_IOCTL_MAGIC, 0x21, char *)
 #define TEGRA_RPC_IOCTL_PORT_CONNECT	_IOR(TEGRA_RPC_IOCTL_MAGIC, 0x22, long)
 #define TEGRA_RPC_IOCTL_PORT_LISTEN	_IOR(TEGRA_RPC_IOCTL_MAGIC, 0x23, long)
+#define TEGRA_RPC_IOCTL_PORT_RING_SYNC	_IO(TEGRA_RPC_IOCTL_MAGIC, 0x24)
 
 #define TEGRA_RPC_IOCTL_MIN_NR		_IOC_NR(TEGRA_RPC_IOCTL_PORT_CREATE)
-#define TEGRA_RPC_IOCTL_MAX_NR		_IOC_NR(TEGRA_RPC_IOCTL_PORT_LISTEN)
+#define TEGRA_RPC_IOCTL_MAX_NR		_IOC_NR(TEGRA_RPC_IOCTL_PORT_RING_SYNC)
 
 #endif
@@ -202,6 +202,23 @@ struct tegra_dc_ext_status {
 #define TEGRA_DC_EXT_GET_VBLANK_SYNCPT \
 	_IOR('D', 0x09, __u32)
 
+/*
+ * Waits until the head's vblank counter reaches count (or count vblanks
+ * from now, with TEGRA_DC_EXT_VBLANK_RELATIVE).  On return, count and
+ * timestamp_ns (monotonic clock) describe the latest vblank.  vblanks are
+ * only counted while somebody waits for them or listens for
+ * TEGRA_DC_EXT_EVENT_VBLANK.
+ */
+#define TEGRA_DC_EXT_VBLANK_RELATIVE	(1 << 0)
+struct tegra_dc_ext_vblank {
+	__u32 count;
+	__u32 flags;
+	__u64 timestamp_ns;
+};
+
+#define TEGRA_DC_EXT_WAIT_VBLANK \
+	_IOWR('D', 0x0a, struct tegra_dc_ext_vblank)
+
 
 enum tegra_dc_ext_control_output_type {
 	TEGRA_DC_EXT_DSI,
@@ -247,6 +264,32 @@ struct tegra_dc_ext_control_event_hotplug {
 	__u32 handle;
 };
 
+/*
+ * Sent once per flip, after it has been scanned out.  All times are in
+ * nanoseconds on the monotonic clock:
+ * queued: the flip ioctl was called
+ * latched: the display controller latched the new window state
+ * scanout: the first frame showing the flip was completely scanned out,
+ *	or 0 if unknown
+ */
+#define TEGRA_DC_EXT_EVENT_FLIP		0x2
+struct tegra_dc_ext_control_event_flip {
+	__u32 handle;
+	__u32 post_syncpt_id;
+	__u32 post_syncpt_val;
+	__u32 swap_interval;
+	__u64 queued_ns;
+	__u64 latched_ns;
+	__u64 scanout_ns;
+};
+
+#define TEGRA_DC_EXT_EVENT_VBLANK	0x4
+struct tegra_dc_ext_control_event_vblank {
+	__u32 handle;
+	__u32 count;
+	__u64 timestamp_ns;
+};
+
 #define TEGRA_DC_EXT_CONTROL_GET_NUM_OUTPUTS \
 	_IOR('C', 0x00, __u32)
 #define TEGRA_DC_EXT_CONTROL_GET_OUTPUT_PROPERTIES \
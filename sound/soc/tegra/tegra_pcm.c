@@ -50,42 +50,143 @@ static const struct snd_pcm_hardware tegra_pcm_hardware = {
 	.formats		= SNDRV_PCM_FMTBIT_S16_LE,
 	.channels_min		= 2,
 	.channels_max		= 2,
-	.period_bytes_min	= 1024,
+	.period_bytes_min	= 256,
 	.period_bytes_max	= PAGE_SIZE,
 	.periods_min		= 2,
-	.periods_max		= 8,
+	.periods_max		= TEGRA_PCM_MAX_SEGS * 2,
 	.buffer_bytes_max	= PAGE_SIZE * 8,
 	.fifo_size		= 4,
 };
 
-static void tegra_pcm_queue_dma(struct tegra_runtime_data *prtd)
+static inline int req_index(struct tegra_runtime_data *prtd,
+			    struct tegra_dma_req *req)
 {
-	struct snd_pcm_substream *substream = prtd->substream;
-	struct snd_dma_buffer *buf = &substream->dma_buffer;
-	struct tegra_dma_req *dma_req;
-	unsigned long addr;
+	return req - prtd->dma_req;
+}
+
+/* Position of the DMA in the buffer, from the word count of the request in
+ * flight. Requests are queued in buffer order, so a count which has run
+ * past the end of its request is still right modulo the buffer size.
+ */
+static int tegra_pcm_dma_pos(struct tegra_runtime_data *prtd)
+{
+	int pos;
+	int i;
+
+	for (i = 0; i < TEGRA_PCM_NUM_REQS; i++) {
+		pos = tegra_dma_get_transfer_count(prtd->dma_chan,
+						   &prtd->dma_req[i]);
+		if (pos >= 0)
+			return (prtd->req_start[i] + pos) % prtd->buffer_bytes;
+	}
+	return prtd->dma_pos;
+}
 
-	dma_req = &prtd->dma_req[prtd->dma_req_idx];
-	prtd->dma_req_idx = 1 - prtd->dma_req_idx;
+static void tegra_pcm_queue_req(struct tegra_runtime_data *prtd,
+				struct tegra_dma_req *req)
+{
+	int i = (prtd->queue_head + prtd->queue_len++) % TEGRA_PCM_NUM_REQS;
 
-	addr = buf->addr + prtd->dma_pos;
-	prtd->dma_pos += dma_req->size;
-	if (prtd->dma_pos >= prtd->dma_pos_end)
-		prtd->dma_pos = 0;
+	prtd->queue[i] = req;
+	tegra_dma_enqueue_req(prtd->dma_chan, req);
+}
+
+/* The ring is made of requests of two periods, so that the cyclic DMA
+ * interrupts at the end of each period. Starting again part way in, the
+ * rest of the segment is queued ahead of the ring in lead-ins which end on
+ * period boundaries too. Called with prtd->lock held.
+ */
+static void tegra_pcm_start_dma(struct tegra_runtime_data *prtd)
+{
+	struct snd_pcm_substream *substream = prtd->substream;
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	struct snd_dma_buffer *buf = &substream->dma_buffer;
+	int period_bytes = frames_to_bytes(runtime, runtime->period_size);
+	struct tegra_dma_req *req;
+	int start, seg, seg_end;
+	int lead = TEGRA_PCM_MAX_SEGS;
+	int i;
+
+	/* cyclic buffers are a multiple of 8 bytes; rounding up skips at
+	 * most a frame, but keeps the position from going backwards */
+	start = ALIGN(prtd->dma_pos, 8);
+	if (start >= prtd->buffer_bytes)
+		start = 0;
+	seg = start / (period_bytes * 2);
+	seg_end = prtd->req_start[seg] + prtd->dma_req[seg].size;
+
+	prtd->queue_head = 0;
+	prtd->queue_len = 0;
+
+	if (start != prtd->req_start[seg]) {
+		while (start < seg_end) {
+			int end = min((start / period_bytes + 1) * period_bytes,
+				      seg_end);
+
+			req = &prtd->dma_req[lead];
+			prtd->req_start[lead++] = start;
+			req->size = end - start;
+			if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+				req->source_addr = buf->addr + start;
+			else
+				req->dest_addr = buf->addr + start;
+			tegra_pcm_queue_req(prtd, req);
+			start = end;
+		}
+		seg++;
+	}
 
-	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
-		dma_req->source_addr = addr;
-	else
-		dma_req->dest_addr = addr;
+	for (i = 0; i < prtd->num_segs; i++)
+		tegra_pcm_queue_req(prtd,
+			&prtd->dma_req[(seg + i) % prtd->num_segs]);
+}
 
-	tegra_dma_enqueue_req(prtd->dma_chan, dma_req);
+static void tegra_pcm_stop_dma(struct tegra_runtime_data *prtd)
+{
+	struct tegra_dma_req *queue[TEGRA_PCM_NUM_REQS];
+	struct tegra_dma_req *req;
+	unsigned long flags;
+	int n, i;
+
+	/* the dequeue of a request which isn't in flight leaves its
+	 * bytes_transferred alone, so the one which was has the only count */
+	spin_lock_irqsave(&prtd->lock, flags);
+	n = prtd->queue_len;
+	for (i = 0; i < n; i++) {
+		req = prtd->queue[(prtd->queue_head + i) % TEGRA_PCM_NUM_REQS];
+		req->bytes_transferred = -1;
+		queue[i] = req;
+	}
+	prtd->queue_len = 0;
+	spin_unlock_irqrestore(&prtd->lock, flags);
+
+	/* back to front, so that dequeueing one doesn't start the next */
+	for (i = n - 1; i >= 0; i--)
+		tegra_dma_dequeue_req(prtd->dma_chan, queue[i]);
+
+	for (i = 0; i < n; i++) {
+		req = queue[i];
+		if (req->status == -TEGRA_DMA_REQ_ERROR_ABORTED &&
+		    req->bytes_transferred >= 0) {
+			prtd->dma_pos = (prtd->req_start[req_index(prtd, req)] +
+					 req->bytes_transferred) %
+					prtd->buffer_bytes;
+			break;
+		}
+	}
 }
 
-static void dma_complete_callback(struct tegra_dma_req *req)
+/* Called at each half of the request in flight, which is a period of a
+ * segment, and again part way through a lead-in or a one period segment.
+ * Only tells ALSA when the DMA has got into another period since the last
+ * time.
+ */
+static void dma_period_callback(struct tegra_dma_req *req)
 {
 	struct tegra_runtime_data *prtd = (struct tegra_runtime_data *)req->dev;
 	struct snd_pcm_substream *substream = prtd->substream;
 	struct snd_pcm_runtime *runtime = substream->runtime;
+	int period;
 
 	spin_lock(&prtd->lock);
 
@@ -94,20 +195,51 @@ static void dma_complete_callback(struct tegra_dma_req *req)
 		return;
 	}
 
-	if (++prtd->period_index >= runtime->periods)
-		prtd->period_index = 0;
-
-	tegra_pcm_queue_dma(prtd);
+	period = tegra_pcm_dma_pos(prtd) /
+		frames_to_bytes(runtime, runtime->period_size);
+	if (period == prtd->period_index) {
+		spin_unlock(&prtd->lock);
+		return;
+	}
+	prtd->period_index = period;
 
 	spin_unlock(&prtd->lock);
 
 	snd_pcm_period_elapsed(substream);
 }
 
+/* Called once the next request has taken over from req, from the DMA ISR,
+ * or when tegra_pcm_stop_dma() dequeues it. A segment goes back on the
+ * tail of the ring straight away.
+ */
+static void dma_complete_callback(struct tegra_dma_req *req)
+{
+	struct tegra_runtime_data *prtd = (struct tegra_runtime_data *)req->dev;
+
+	if (req->status == -TEGRA_DMA_REQ_ERROR_ABORTED)
+		return;
+
+	spin_lock(&prtd->lock);
+	if (!prtd->running) {
+		spin_unlock(&prtd->lock);
+		return;
+	}
+
+	/* the channel completes requests in order */
+	prtd->queue_head = (prtd->queue_head + 1) % TEGRA_PCM_NUM_REQS;
+	prtd->queue_len--;
+	if (req_index(prtd, req) < prtd->num_segs)
+		tegra_pcm_queue_req(prtd, req);
+	spin_unlock(&prtd->lock);
+
+	dma_period_callback(req);
+}
+
 static void setup_dma_tx_request(struct tegra_dma_req *req,
 					struct tegra_pcm_dma_params * dmap)
 {
 	req->complete = dma_complete_callback;
+	req->threshold = dma_period_callback;
 	req->to_memory = false;
 	req->dest_addr = dmap->addr;
 	req->dest_wrap = dmap->wrap;
@@ -121,6 +253,7 @@ static void setup_dma_rx_request(struct tegra_dma_req *req,
 					struct tegra_pcm_dma_params * dmap)
 {
 	req->complete = dma_complete_callback;
+	req->threshold = dma_period_callback;
 	req->to_memory = true;
 	req->source_addr = dmap->addr;
 	req->dest_wrap = 0;
@@ -137,6 +270,7 @@ static int tegra_pcm_open(struct snd_pcm_substream *substream)
 	struct snd_soc_pcm_runtime *rtd = substream->private_data;
 	struct tegra_pcm_dma_params * dmap;
 	int ret = 0;
+	int i;
 
 	prtd = kzalloc(sizeof(struct tegra_runtime_data), GFP_KERNEL);
 	if (prtd == NULL)
@@ -147,20 +281,16 @@ static int tegra_pcm_open(struct snd_pcm_substream *substream)
 
 	spin_lock_init(&prtd->lock);
 
-	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK) {
-		dmap = snd_soc_dai_get_dma_data(rtd->cpu_dai, substream);
-		setup_dma_tx_request(&prtd->dma_req[0], dmap);
-		setup_dma_tx_request(&prtd->dma_req[1], dmap);
-	} else {
-		dmap = snd_soc_dai_get_dma_data(rtd->cpu_dai, substream);
-		setup_dma_rx_request(&prtd->dma_req[0], dmap);
-		setup_dma_rx_request(&prtd->dma_req[1], dmap);
+	dmap = snd_soc_dai_get_dma_data(rtd->cpu_dai, substream);
+	for (i = 0; i < TEGRA_PCM_NUM_REQS; i++) {
+		if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+			setup_dma_tx_request(&prtd->dma_req[i], dmap);
+		else
+			setup_dma_rx_request(&prtd->dma_req[i], dmap);
+		prtd->dma_req[i].dev = prtd;
 	}
 
-	prtd->dma_req[0].dev = prtd;
-	prtd->dma_req[1].dev = prtd;
-
-	prtd->dma_chan = tegra_dma_allocate_channel(TEGRA_DMA_MODE_CONTINUOUS_SINGLE);
+	prtd->dma_chan = tegra_dma_allocate_channel(TEGRA_DMA_MODE_CYCLIC);
 	if (prtd->dma_chan == NULL) {
 		ret = -ENOMEM;
 		goto err;
@@ -175,6 +305,13 @@ static int tegra_pcm_open(struct snd_pcm_substream *substream)
 	if (ret < 0)
 		goto err;
 
+	/* and that the cyclic DMA can split its segments into halves of
+	 * whole words */
+	ret = snd_pcm_hw_constraint_step(runtime, 0,
+					 SNDRV_PCM_HW_PARAM_PERIOD_BYTES, 8);
+	if (ret < 0)
+		goto err;
+
 	return 0;
 
 err:
@@ -204,11 +341,26 @@ static int tegra_pcm_hw_params(struct snd_pcm_substream *substream,
 {
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	struct tegra_runtime_data *prtd = runtime->private_data;
-
-	snd_pcm_set_runtime_buffer(substream, &substream->dma_buffer);
-
-	prtd->dma_req[0].size = params_period_bytes(params);
-	prtd->dma_req[1].size = prtd->dma_req[0].size;
+	struct snd_dma_buffer *buf = &substream->dma_buffer;
+	int seg_bytes = params_period_bytes(params) * 2;
+	struct tegra_dma_req *req;
+	int start, i;
+
+	snd_pcm_set_runtime_buffer(substream, buf);
+
+	prtd->buffer_bytes = params_buffer_bytes(params);
+	prtd->num_segs = DIV_ROUND_UP(prtd->buffer_bytes, seg_bytes);
+	for (i = 0; i < prtd->num_segs; i++) {
+		req = &prtd->dma_req[i];
+		start = i * seg_bytes;
+		prtd->req_start[i] = start;
+		/* the last one is a single period for an odd number */
+		req->size = min(seg_bytes, prtd->buffer_bytes - start);
+		if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK)
+			req->source_addr = buf->addr + start;
+		else
+			req->dest_addr = buf->addr + start;
+	}
 
 	return 0;
 }
@@ -229,17 +381,14 @@ static int tegra_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
 		prtd->dma_pos = 0;
-		prtd->dma_pos_end = frames_to_bytes(runtime, runtime->periods * runtime->period_size);
 		prtd->period_index = 0;
-		prtd->dma_req_idx = 0;
 		/* Fall-through */
 	case SNDRV_PCM_TRIGGER_RESUME:
 	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
 		spin_lock_irqsave(&prtd->lock, flags);
 		prtd->running = 1;
+		tegra_pcm_start_dma(prtd);
 		spin_unlock_irqrestore(&prtd->lock, flags);
-		tegra_pcm_queue_dma(prtd);
-		tegra_pcm_queue_dma(prtd);
 		break;
 	case SNDRV_PCM_TRIGGER_STOP:
 	case SNDRV_PCM_TRIGGER_SUSPEND:
@@ -247,8 +396,7 @@ static int tegra_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 		spin_lock_irqsave(&prtd->lock, flags);
 		prtd->running = 0;
 		spin_unlock_irqrestore(&prtd->lock, flags);
-		tegra_dma_dequeue_req(prtd->dma_chan, &prtd->dma_req[0]);
-		tegra_dma_dequeue_req(prtd->dma_chan, &prtd->dma_req[1]);
+		tegra_pcm_stop_dma(prtd);
 		break;
 	default:
 		return -EINVAL;
@@ -262,7 +410,7 @@ static snd_pcm_uframes_t tegra_pcm_pointer(struct snd_pcm_substream *substream)
 	struct snd_pcm_runtime *runtime = substream->runtime;
 	struct tegra_runtime_data *prtd = runtime->private_data;
 
-	return prtd->period_index * runtime->period_size;
+	return bytes_to_frames(runtime, tegra_pcm_dma_pos(prtd));
 }
 
 
@@ -33,6 +33,11 @@
 
 #include <mach/dma.h>
 
+/* the buffer is covered by requests of two periods each, and starting
+ * again part way in takes up to two lead-ins on top */
+#define TEGRA_PCM_MAX_SEGS	4
+#define TEGRA_PCM_NUM_REQS	(TEGRA_PCM_MAX_SEGS + 2)
+
 struct tegra_pcm_dma_params {
 	unsigned long addr;
 	unsigned long wrap;
@@ -44,11 +49,20 @@ struct tegra_runtime_data {
 	struct snd_pcm_substream *substream;
 	spinlock_t lock;
 	int running;
+	/* where the DMA stopped, and starts again */
 	int dma_pos;
-	int dma_pos_end;
 	int period_index;
-	int dma_req_idx;
-	struct tegra_dma_req dma_req[2];
+	int buffer_bytes;
+	/* the segments of the ring, each requeued at the tail as it
+	 * completes, followed by the lead-ins from dma_pos to the end of
+	 * its segment, split at the period boundary */
+	struct tegra_dma_req dma_req[TEGRA_PCM_NUM_REQS];
+	int req_start[TEGRA_PCM_NUM_REQS];
+	int num_segs;
+	/* the requests queued on the channel, in order */
+	struct tegra_dma_req *queue[TEGRA_PCM_NUM_REQS];
+	int queue_head;
+	int queue_len;
 	struct tegra_dma_channel *dma_chan;
 };
 